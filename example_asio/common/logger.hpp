@@ -0,0 +1,476 @@
+#ifndef EXAMPLE_COMMON_LOGGER_HPP
+#define EXAMPLE_COMMON_LOGGER_HPP
+
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/*
+    Асинхронный журнал для серверов и клиентов примеров.
+
+    Поток, который пишет в журнал, только форматирует сообщение в запись
+    фиксированного размера и кладет ее в свой кольцевой буфер (один писатель,
+    один читатель - без блокировок). Фоновый поток забирает записи из всех
+    буферов и пишет их в stderr или файл. Если буфер потока полон, сообщение
+    отбрасывается и увеличивается счетчик - io-поток никогда не ждет диск.
+
+    Уровни ниже LOG_COMPILE_LEVEL вырезаются при компиляции вместе с
+    вычислением аргументов:
+        -DLOG_COMPILE_LEVEL=2   // в бинарнике останутся только Info и выше
+
+    Использование:
+        LOG_INFO("file ", name, " size ", size);
+        LOG_ERROR("handshake: ", ec.message());
+*/
+
+// 0 - Trace, 1 - Debug, 2 - Info, 3 - Warn, 4 - Error, 5 - Off
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 1
+#endif
+
+enum class LogLevel : int
+{
+    Trace = 0,
+    Debug,
+    Info,
+    Warn,
+    Error,
+    Off
+};
+
+class Logger
+{
+public:
+    /**
+     * @brief Формат вывода.
+     * @details Binary - записи как есть: заголовок Record (16 байт) и length байт текста.
+     */
+    enum class Format
+    {
+        Text,
+        Binary
+    };
+
+    /**
+     * @brief Одна запись журнала. Длинные сообщения обрезаются.
+     */
+    struct Record
+    {
+        std::int64_t time;      // наносекунды от эпохи (CLOCK_REALTIME)
+        std::uint32_t thread;   // порядковый номер потока-писателя
+        std::uint8_t level;
+        std::uint8_t truncated;
+        std::uint16_t length;
+        char text[240];
+    };
+
+    static Logger& Instance()
+    {
+        static Logger logger;
+        return logger;
+    }
+
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    ~Logger()
+    {
+        stopping.store(true, std::memory_order_release);
+        if(worker.joinable())
+        {
+            worker.join();
+        }
+        DrainAll();
+        std::lock_guard<std::mutex> lock(outMutex);
+        std::fflush(out);
+        if(out != stderr)
+        {
+            std::fclose(out);
+        }
+    }
+
+    /**
+     * @brief Уровень, начиная с которого сообщения пишутся (в пределах LOG_COMPILE_LEVEL).
+     */
+    void SetLevel(LogLevel value)
+    {
+        level.store(static_cast<int>(value), std::memory_order_relaxed);
+    }
+
+    bool Enabled(LogLevel value) const
+    {
+        return static_cast<int>(value) >= level.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Перенаправляет журнал в файл.
+     * @param path Путь к файлу (дописывается в конец).
+     * @param fmt Текст или двоичные записи.
+     * @return false, если файл не открылся - тогда пишем в stderr как раньше.
+     */
+    bool Open(const std::string& path, Format fmt)
+    {
+        FILE* file = std::fopen(path.c_str(), fmt == Format::Binary ? "ab" : "a");
+        if(!file)
+        {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(outMutex);
+        std::fflush(out);
+        if(out != stderr)
+        {
+            std::fclose(out);
+        }
+        out = file;
+        format = fmt;
+        return true;
+    }
+
+    /**
+     * @brief Форматирует сообщение и кладет его в буфер текущего потока.
+     * @details Числа и строки форматируются без выделения памяти; прочие
+     * типы (error_code, json::value) выводятся через operator<<.
+     */
+    template<class... Args>
+    void Write(LogLevel value, const Args&... args)
+    {
+        Ring& ring = LocalRing();
+        std::size_t head = ring.head.load(std::memory_order_relaxed);
+        std::size_t tail = ring.tail.load(std::memory_order_acquire);
+        if(head - tail >= Ring::capacity)
+        {
+            ring.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        Record& rec = ring.records[head % Ring::capacity];
+        timespec ts{};
+        ::clock_gettime(CLOCK_REALTIME, &ts);
+        rec.time = static_cast<std::int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+        rec.thread = ring.thread;
+        rec.level = static_cast<std::uint8_t>(value);
+
+        Cursor cursor{rec.text, rec.text + sizeof(rec.text), false};
+        (Append(cursor, args), ...);
+        rec.length = static_cast<std::uint16_t>(cursor.p - rec.text);
+        rec.truncated = cursor.truncated ? 1 : 0;
+
+        ring.head.store(head + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Ждет, пока фоновый поток запишет все, что уже в буферах.
+     */
+    void Flush()
+    {
+        for(int i = 0; i < 1000 && Pending(); ++i)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        std::lock_guard<std::mutex> lock(outMutex);
+        std::fflush(out);
+    }
+
+    /**
+     * @brief Сколько сообщений отброшено из-за переполненных буферов.
+     */
+    std::uint64_t Dropped() const
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        return droppedTotal + DroppedLive();
+    }
+private:
+    struct Ring
+    {
+        static constexpr std::size_t capacity = 1024;
+
+        std::array<Record, capacity> records;
+        alignas(64) std::atomic<std::size_t> head{0};
+        alignas(64) std::atomic<std::size_t> tail{0};
+        std::atomic<std::uint64_t> dropped{0};
+        std::atomic<bool> closed{false};
+        std::uint32_t thread = 0;
+        // Сколько отброшенных уже попало в droppedTotal/отчет (трогает только читатель).
+        std::uint64_t reported = 0;
+    };
+
+    /**
+     * @brief Отмечает буфер закрытым, когда поток завершается; память освободит читатель.
+     */
+    struct RingHolder
+    {
+        std::shared_ptr<Ring> ring;
+
+        ~RingHolder()
+        {
+            if(ring)
+            {
+                ring->closed.store(true, std::memory_order_release);
+            }
+        }
+    };
+
+    struct Cursor
+    {
+        char* p;
+        char* end;
+        bool truncated;
+    };
+
+    Logger()
+        : worker(&Logger::Work, this)
+    {
+
+    }
+
+    Ring& LocalRing()
+    {
+        thread_local RingHolder holder;
+        if(!holder.ring)
+        {
+            holder.ring = std::make_shared<Ring>();
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            holder.ring->thread = nextThread++;
+            rings.push_back(holder.ring);
+        }
+        return *holder.ring;
+    }
+
+    static void AppendText(Cursor& c, std::string_view text)
+    {
+        std::size_t room = static_cast<std::size_t>(c.end - c.p);
+        if(text.size() > room)
+        {
+            text = text.substr(0, room);
+            c.truncated = true;
+        }
+        std::memcpy(c.p, text.data(), text.size());
+        c.p += text.size();
+    }
+
+    template<class T>
+    static void Append(Cursor& c, const T& value)
+    {
+        if constexpr(std::is_same_v<T, bool>)
+        {
+            AppendText(c, value ? "true" : "false");
+        }
+        else if constexpr(std::is_same_v<T, char>)
+        {
+            AppendText(c, std::string_view(&value, 1));
+        }
+        else if constexpr(std::is_arithmetic_v<T>)
+        {
+            auto [ptr, ec] = std::to_chars(c.p, c.end, value);
+            if(ec == std::errc())
+            {
+                c.p = ptr;
+            }
+            else
+            {
+                c.truncated = true;
+            }
+        }
+        else if constexpr(std::is_convertible_v<const T&, const char*>)
+        {
+            const char* str = value;
+            AppendText(c, str ? std::string_view(str) : std::string_view("(null)"));
+        }
+        else if constexpr(std::is_convertible_v<const T&, std::string_view>)
+        {
+            AppendText(c, std::string_view(value));
+        }
+        else if constexpr(HasDataSize<T>::value)
+        {
+            // boost::string_view, beast::string_view и прочие строковые представления.
+            AppendText(c, std::string_view(value.data(), value.size()));
+        }
+        else
+        {
+            thread_local std::ostringstream os;
+            os.str({});
+            os.clear();
+            os << value;
+            AppendText(c, os.str());
+        }
+    }
+
+    template<class T, class = void>
+    struct HasDataSize : std::false_type
+    {
+    };
+
+    template<class T>
+    struct HasDataSize<T, std::void_t<
+        decltype(std::string_view(std::declval<const T&>().data(), std::declval<const T&>().size()))>>
+        : std::true_type
+    {
+    };
+
+    bool Pending() const
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        for(const auto& ring : rings)
+        {
+            if(ring->head.load(std::memory_order_acquire) != ring->tail.load(std::memory_order_relaxed))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::uint64_t DroppedLive() const
+    {
+        std::uint64_t total = 0;
+        for(const auto& ring : rings)
+        {
+            total += ring->dropped.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    void Work()
+    {
+        while(!stopping.load(std::memory_order_acquire))
+        {
+            if(!DrainAll())
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            }
+        }
+    }
+
+    /**
+     * @brief Забирает записи из всех буферов.
+     * @return true, если что-то было записано.
+     */
+    bool DrainAll()
+    {
+        std::vector<std::shared_ptr<Ring>> snapshot;
+        {
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            snapshot = rings;
+        }
+
+        bool wrote = false;
+        std::uint64_t newlyDropped = 0;
+        std::lock_guard<std::mutex> outLock(outMutex);
+        for(const auto& ring : snapshot)
+        {
+            std::size_t tail = ring->tail.load(std::memory_order_relaxed);
+            std::size_t head = ring->head.load(std::memory_order_acquire);
+            for(; tail != head; ++tail)
+            {
+                Emit(ring->records[tail % Ring::capacity]);
+                wrote = true;
+            }
+            ring->tail.store(tail, std::memory_order_release);
+
+            std::uint64_t dropped = ring->dropped.load(std::memory_order_relaxed);
+            newlyDropped += dropped - ring->reported;
+            ring->reported = dropped;
+        }
+
+        if(newlyDropped != 0)
+        {
+            std::fprintf(out, "logger: %llu messages dropped\n", static_cast<unsigned long long>(newlyDropped));
+            wrote = true;
+        }
+        if(wrote)
+        {
+            std::fflush(out);
+        }
+
+        // Буферы завершившихся потоков, из которых все прочитано, больше не нужны.
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        for(auto it = rings.begin(); it != rings.end();)
+        {
+            Ring& ring = **it;
+            if(ring.closed.load(std::memory_order_acquire)
+                && ring.head.load(std::memory_order_acquire) == ring.tail.load(std::memory_order_relaxed))
+            {
+                droppedTotal += ring.dropped.load(std::memory_order_relaxed);
+                it = rings.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        return wrote;
+    }
+
+    void Emit(const Record& rec)
+    {
+        if(format == Format::Binary)
+        {
+            std::fwrite(&rec, offsetof(Record, text), 1, out);
+            std::fwrite(rec.text, 1, rec.length, out);
+            return;
+        }
+
+        static const char* const names[] = {"TRACE", "DEBUG", "INFO ", "WARN ", "ERROR", "OFF  "};
+        std::time_t sec = static_cast<std::time_t>(rec.time / 1000000000);
+        std::tm tm{};
+        gmtime_r(&sec, &tm);
+        char stamp[32];
+        std::strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+        std::fprintf(out, "%s.%06lld %s [%u] %.*s%s\n",
+            stamp,
+            static_cast<long long>(rec.time % 1000000000 / 1000),
+            names[rec.level < 6 ? rec.level : 5],
+            rec.thread,
+            static_cast<int>(rec.length), rec.text,
+            rec.truncated ? "..." : "");
+    }
+
+    std::atomic<int> level{LOG_COMPILE_LEVEL};
+    std::atomic<bool> stopping{false};
+
+    mutable std::mutex ringsMutex;
+    std::vector<std::shared_ptr<Ring>> rings;
+    std::uint32_t nextThread = 0;
+    std::uint64_t droppedTotal = 0;
+
+    std::mutex outMutex;
+    FILE* out = stderr;
+    Format format = Format::Text;
+
+    std::thread worker;
+};
+
+#define LOG_AT(lvl, ...) \
+    do \
+    { \
+        if constexpr(static_cast<int>(lvl) >= LOG_COMPILE_LEVEL) \
+        { \
+            auto& logger_ = ::Logger::Instance(); \
+            if(logger_.Enabled(lvl)) \
+            { \
+                logger_.Write(lvl, __VA_ARGS__); \
+            } \
+        } \
+    } while(false)
+
+#define LOG_TRACE(...) LOG_AT(LogLevel::Trace, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LogLevel::Debug, __VA_ARGS__)
+#define LOG_INFO(...)  LOG_AT(LogLevel::Info, __VA_ARGS__)
+#define LOG_WARN(...)  LOG_AT(LogLevel::Warn, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LogLevel::Error, __VA_ARGS__)
+
+#endif//EXAMPLE_COMMON_LOGGER_HPP
@@ -0,0 +1,85 @@
+#ifndef EXAMPLE_COMMON_TLS_CLIENT_SESSION_HPP
+#define EXAMPLE_COMMON_TLS_CLIENT_SESSION_HPP
+
+#include <openssl/ssl.h>
+#include <memory>
+#include <mutex>
+
+/*
+    TLS-сессия последнего подключения клиента.
+
+    Перед рукопожатием сессия подставляется в новый SSL-объект, и сервер,
+    если еще помнит ее (кеш по session ID или билет), пропускает обмен
+    ключами и проверку сертификата - это сокращенное рукопожатие.
+
+    Использование:
+        session.Apply(stream.native_handle());
+        stream.handshake(boost::asio::ssl::stream_base::client, error);
+        if(!error) session.Save(stream.native_handle());
+*/
+
+class TlsClientSession
+{
+public:
+    /**
+     * @brief Предлагает серверу сохраненную сессию. Вызывается до рукопожатия.
+     */
+    void Apply(SSL* ssl)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(session)
+        {
+            SSL_set_session(ssl, session.get());
+        }
+    }
+
+    /**
+     * @brief Запоминает сессию после успешного рукопожатия.
+     */
+    void Save(SSL* ssl)
+    {
+        // Копия: клиенты закрывают сокет без close_notify, и SSL_free пометил бы
+        // общий с соединением объект сессии как непригодный для возобновления.
+        SSL_SESSION* current = SSL_get_session(ssl);
+        if(!current || !SSL_SESSION_is_resumable(current))
+        {
+            return;
+        }
+        std::unique_ptr<SSL_SESSION, Free> copy(SSL_SESSION_dup(current));
+        if(copy)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            session = std::move(copy);
+        }
+    }
+
+    /**
+     * @brief Забывает сессию, например после ошибки рукопожатия.
+     */
+    void Reset()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        session.reset();
+    }
+
+    /**
+     * @brief Было ли рукопожатие сокращенным.
+     */
+    static bool Reused(SSL* ssl)
+    {
+        return SSL_session_reused(ssl) == 1;
+    }
+private:
+    struct Free
+    {
+        void operator()(SSL_SESSION* value) const
+        {
+            SSL_SESSION_free(value);
+        }
+    };
+
+    std::mutex mutex;
+    std::unique_ptr<SSL_SESSION, Free> session;
+};
+
+#endif//EXAMPLE_COMMON_TLS_CLIENT_SESSION_HPP
@@ -6,14 +6,14 @@ HttpsClient::HttpsClient(boost::asio::io_context& context, const Config& config_
     , resolver(context)
     , config(config_)
 {
-    std::cout << "start constructor " << std::endl;
+    LOG_DEBUG("start constructor ");
     boost::system::error_code error;
     ssl_context.set_verify_mode(boost::asio::ssl::verify_peer, error);
     //ssl_context.set_default_verify_paths();
 
     if(error.failed())
     {
-        std::cout << "error veryfy mode " << std::endl;
+        LOG_ERROR("error veryfy mode ");
         exit(23);
     }
     
@@ -21,25 +21,25 @@ HttpsClient::HttpsClient(boost::asio::io_context& context, const Config& config_
     
     if(!std::filesystem::exists(config.rootCACertificate))
     {
-        std::cout << "cert_not_exits " << std::endl;
+        LOG_ERROR("cert_not_exits ");
         exit(33);
     } 
 
     ssl_context.load_verify_file(config.rootCACertificate, error);
     if(error.failed())
     {
-        std::cout << config.rootCACertificate << std::endl;
-        std::cout << "load file error " << std::endl;
+        LOG_DEBUG(config.rootCACertificate);
+        LOG_ERROR("load file error ");
         exit(43);
     }
     
     results = resolver.resolve(config.serverHost, config.serverPort, error);
     if(error.failed())
     {
-        std::cout << "resolver bad" << std::endl;
+        LOG_ERROR("resolver bad");
         exit(53);
     }
-    std::cout << "Https Client construcotr done" << std::endl;
+    LOG_DEBUG("Https Client construcotr done");
 }
 
 std::string HttpsClient::PostRequest(const std::string& task, bool& bad)
@@ -62,13 +62,16 @@ std::string HttpsClient::PostRequest(const std::string& task, bool& bad)
         return error.message();
     }
 
+    session.Apply(stream.native_handle());
     stream.handshake(boost::asio::ssl::stream_base::client, error);
     if(error.failed())
     {
         bad = true;
+        session.Reset();
         boost::beast::get_lowest_layer(stream).close();
         return error.message();
     }
+    session.Save(stream.native_handle());
 
     boost::beast::http::request<boost::beast::http::string_body> req(boost::beast::http::verb::post, "find", 11);
     req.set(boost::beast::http::field::host, config.serverHost);
@@ -114,7 +117,7 @@ std::string HttpsClient::GetRequest()
     stream.set_verify_callback([](bool preverified,
         boost::asio::ssl::verify_context& ctx)
         {
-            std::cout <<  "preverified - " << preverified << std::endl;
+            LOG_DEBUG("preverified - ", preverified);
             return preverified;
         });
 
@@ -126,13 +129,16 @@ std::string HttpsClient::GetRequest()
         return error.message();
     }
 
+    session.Apply(stream.native_handle());
     stream.handshake(boost::asio::ssl::stream_base::client, error);
     if(error.failed())
     {
         bad = true;
+        session.Reset();
         boost::beast::get_lowest_layer(stream).close();
         return error.message();
     }
+    session.Save(stream.native_handle());
 
     boost::beast::http::request<boost::beast::http::string_body> req(boost::beast::http::verb::get, "/", 11);
     req.set(boost::beast::http::field::host, config.serverHost);
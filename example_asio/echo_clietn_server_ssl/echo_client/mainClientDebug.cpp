@@ -12,7 +12,7 @@ int main()
 {
 
 
-    std::cout << "start " << std::endl;
+    LOG_DEBUG("start");
     boost::asio::io_context ioContext;
     Config config;
     config.rootCACertificate = "./cert/cert.pem";
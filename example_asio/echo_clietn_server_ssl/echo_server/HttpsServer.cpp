@@ -24,24 +24,18 @@ HttpsSession::HttpsSession(boost::asio::ip::tcp::socket&& socket, const std::str
 
 void HttpsSession::Run()
 {
-    #ifdef DEBUG_PRINT//  
-         std::cout << "20 HttpsSession RUN !" << std::endl;  
-    #endif
+    LOG_TRACE("20 HttpsSession RUN !");
     boost::asio::dispatch(
             stream.get_executor(),
             boost::beast::bind_front_handler(
                 &HttpsSession::OnRun,
                 this->shared_from_this()));
-    #ifdef DEBUG_PRINT//  
-         std::cout << "20 HttpsSession END !" << std::endl;  
-    #endif
+    LOG_TRACE("20 HttpsSession END !");
 }
 
 void HttpsSession::OnRun()
 {
-    #ifdef DEBUG_PRINT//  
-         std::cout << "30 Https Session ON RUN !" << std::endl;  
-    #endif
+    LOG_TRACE("30 Https Session ON RUN !");
     // 
     boost::beast::get_lowest_layer(stream).expires_after(
             std::chrono::seconds(30));
@@ -51,34 +45,25 @@ void HttpsSession::OnRun()
             &HttpsSession::OnPerformingSsl,
        
             this->shared_from_this()));
-    #ifdef DEBUG_PRINT//
-         std::cout << "30 Https Session ON RUN END !" << std::endl;  
-    #endif
+    LOG_TRACE("30 Https Session ON RUN END !");
 }
 
 void HttpsSession::OnPerformingSsl(boost::system::error_code error)
 {
-    #ifdef DEBUG_PRINT//  
-         std::cout << " 50  HttpsSession::OnPerformingSsl" << std::endl;  
-    #endif
+    LOG_TRACE(" 50  HttpsSession::OnPerformingSsl");
     if(error)
     {
-        // spdlog::warn("Error handshake");
-        std::cout << "ERROR HANDSHAKE " << std::endl;
+        LOG_ERROR("ERROR HANDSHAKE ");
     } else {
-        std::cout << "Handshake OK !!!" << std::endl;
+        LOG_DEBUG("Handshake OK !!!");
     }
     DoRead();
-    #ifdef DEBUG_PRINT//   
-         std::cout << " 50 HttpsSession::OnPerformingSsl END" << std::endl;  
-    #endif
+    LOG_TRACE(" 50 HttpsSession::OnPerformingSsl END");
 }
 
 void HttpsSession::DoRead()
 {
-    #ifdef DEBUG_PRINT//   
-         std::cout << "60 HttpsSession::DoRead" << std::endl;  
-    #endif
+    LOG_TRACE("60 HttpsSession::DoRead");
     req = {};
     boost::beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(30));
 
@@ -87,16 +72,12 @@ void HttpsSession::DoRead()
         boost::beast::bind_front_handler(
             &HttpsSession::OnRead,
             this->shared_from_this()));
-    #ifdef DEBUG_PRINT//   
-         std::cout << "60 HttpsSession::DoRead END" << std::endl;  
-    #endif
+    LOG_TRACE("60 HttpsSession::DoRead END");
 }
 
 void HttpsSession::OnRead(boost::system::error_code error, std::size_t bytes_transferred)
 {
-    #ifdef DEBUG_PRINT//   
-         std::cout << "70 HttpsSession:: On Read" << std::endl;  
-    #endif
+    LOG_TRACE("70 HttpsSession:: On Read");
     boost::ignore_unused(bytes_transferred);
     if(error == boost::beast::http::error::end_of_stream)
     {
@@ -104,15 +85,11 @@ void HttpsSession::OnRead(boost::system::error_code error, std::size_t bytes_tra
     }
     if(error)
     {
-        //spdlog::warn("Error on read");
+        LOG_WARN("Error on read: ", error.message());
     }
-    #ifdef DEBUG_PRINT//   
-         std::cout << "HandleRequest Calles run Executable" << std::endl;  
-    #endif
+    LOG_TRACE("HandleRequest Calles run Executable");
     HandleRequest(this->filePath, std::move(req), exec);
-    #ifdef DEBUG_PRINT//   
-         std::cout << " 70 HttpsSession:: On Read END" << std::endl;  
-    #endif
+    LOG_TRACE(" 70 HttpsSession:: On Read END");
 }
 
 void HttpsSession::OnWrite(bool close, boost::beast::error_code ec, std::size_t bytes_transferred)
@@ -121,7 +98,7 @@ void HttpsSession::OnWrite(bool close, boost::beast::error_code ec, std::size_t
 
     if(ec)
     {
-        // spdlog::warn(ec.message());
+        LOG_WARN("Error on write: ", ec.message());
     }
 
     if(close)
@@ -152,7 +129,7 @@ void HttpsSession::OnShutdown(boost::beast::error_code error)
 {
     if(error)
     {
-        // spdlog::warn("Error on shutdown");
+        LOG_WARN("Error on shutdown");
     }
 }
 
@@ -165,38 +142,38 @@ HttpsServer::HttpsServer(const Config& config_,
     , fileDir(fileDir)
     , config(config_)
 {
-    std::cout << "HTTP concstructor " << std::endl;
+    LOG_DEBUG("HTTP concstructor ");
     port = std::stoul(config.port);
     LoadServerCertificate();
     boost::asio::ip::tcp::endpoint end(boost::asio::ip::make_address(InetIp), port);
     boost::system::error_code error;
-    std::cout << "load parameters " << std::endl;
+    LOG_DEBUG("load parameters ");
 
     acc.open(end.protocol(), error);
     if(error)
     {
-       // spdlog::critical("Error on open acceptor");
+        LOG_ERROR("Error on open acceptor");
         return;
     }
     acc.set_option(boost::asio::socket_base::reuse_address(true), error);
     if(error)
     {
-        // spdlog::critical("Error on set options in acceptor");
+        LOG_ERROR("Error on set options in acceptor");
         return;
     }
     acc.bind(end, error);
     if(error)
     {
-        // spdlog::critical("Error on bind acceptor's port");
+        LOG_ERROR("Error on bind acceptor's port");
         return;
     }
     acc.listen(boost::asio::socket_base::max_listen_connections, error);
     if(error)
     {
-        // spdlog::critical("Error on listen");
+        LOG_ERROR("Error on listen");
         return;
     }
-    std::cout << "HTTP constructor END" << std::endl;
+    LOG_DEBUG("HTTP constructor END");
 }
 
 HttpsServer::~HttpsServer()
@@ -211,7 +188,7 @@ void HttpsServer::Run()
 
 void HttpsServer::LoadServerCertificate()
 {
-    std::cout << "start Load Sert" << std::endl;
+    LOG_DEBUG("start Load Sert");
     ctx.set_options(
 			boost::asio::ssl::context::default_workarounds
 			| boost::asio::ssl::context::no_sslv2
@@ -220,7 +197,7 @@ void HttpsServer::LoadServerCertificate()
 		ctx.use_certificate_chain_file("./server01.crt");
 		ctx.use_private_key_file("./server01.key", boost::asio::ssl::context::pem);
 		ctx.use_tmp_dh_file("./dh2048.pem");
-    std::cout << "end load sert" << std::endl;
+    LOG_DEBUG("end load sert");
 }
 
 std::string HttpsServer::GetPassword()const
@@ -230,9 +207,7 @@ std::string HttpsServer::GetPassword()const
 
 void HttpsServer::DoAccept()
 {
-    #ifdef DEBUG_PRINT
-        std::cout << "Https Do Accent " << std::endl;
-    #endif
+    LOG_TRACE("Https Do Accent ");
 
     acc.async_accept(
         boost::asio::make_strand(context),
@@ -240,22 +215,17 @@ void HttpsServer::DoAccept()
             &HttpsServer::OnAccept,
             this->shared_from_this()));
 
-    #ifdef DEBUG_PRINT
-        std::cout << "Https Do Accent END" << std::endl;
-    #endif
+    LOG_TRACE("Https Do Accent END");
 
 }
 
 void HttpsServer::OnAccept(boost::beast::error_code error, boost::asio::ip::tcp::socket sock)
 {
-    #ifdef DEBUG_PRINT   
-        std::cout << "10 On Accep START !" << std::endl;  
-        std::cout << "Connection start! " << std::endl;
-    #endif
+    LOG_TRACE("10 On Accep START !");
+    LOG_TRACE("Connection start! ");
     if(error)
     {
-        //spdlog::warn("Error on accept");
-        std::cout << "error On Accept" << std::endl; 
+        LOG_ERROR("error On Accept");
         std::this_thread::sleep_for(std::chrono::milliseconds(404));
     }
     else
@@ -268,17 +238,15 @@ void HttpsServer::OnAccept(boost::beast::error_code error, boost::asio::ip::tcp:
     }
  
     DoAccept();
-    #ifdef DEBUG_PRINT//   
-         std::cout << "10 On Accep EDN !" << std::endl;  
-    #endif
+    LOG_TRACE("10 On Accep EDN !");
 }
 
 boost::json::value HttpsSession::ProcessRequest(boost::json::value task)
 {
     auto task_obj = task.as_object();
    
-   std::cout << "!!HttpsSession::ProcessRequest" << std::endl;
-   std::cout << task_obj << std::endl;
+   LOG_DEBUG("!!HttpsSession::ProcessRequest");
+   LOG_DEBUG(task_obj);
    /*
     if (task_obj.empty()) {
         spdlog::warn("Error, empty params");
@@ -19,6 +19,8 @@
 #include <variant>
 #include <iostream>
 
+#include "../../common/logger.hpp"
+
 
 
 struct Config {
@@ -157,10 +159,8 @@ private:
     template<class Body, class Allocator, class Send>
     void HandleRequest(std::string docRoot, boost::beast::http::request<Body, boost::beast::http::basic_fields<Allocator>>&& req, Send&& send)
     {
-        #ifdef DEBUG_PRINT//   
-            std::cout << " ?80 HandleRequest RUN" << std::endl;  
-            std::cout << "->" << req.body() << "<-" << std::endl;
-        #endif
+        LOG_TRACE(" ?80 HandleRequest RUN");
+        LOG_TRACE("->", req.body(), "<-");
 
 
 
@@ -192,7 +192,7 @@ private:
 
         if( req.method() != boost::beast::http::verb::get )
         {
-            // spdlog::warn("Unknown HTTP-method");
+            LOG_WARN("Unknown HTTP-method");
             send(BadRequest("Unknown HTTP-method <-"));
             return;
         }
@@ -200,7 +200,7 @@ private:
         if(req.method() == boost::beast::http::verb::get)
         {
 
-            std::cout << "Get method " << std::endl;
+            LOG_DEBUG("Get method ");
             send(HandleGet());
             return;
         }
@@ -0,0 +1,69 @@
+#include "BenchClient.hpp"
+
+#include <boost/beast/http.hpp>
+#include <boost/beast/version.hpp>
+
+BenchClient::BenchClient(const std::string& port, TlsClientSession* session)
+    : ssl(boost::asio::ssl::context::tlsv12_client)
+    , stream(context, ssl)
+    , chunk(256 * 1024)
+{
+    ssl.set_verify_mode(boost::asio::ssl::verify_none);
+
+    boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::make_address("127.0.0.1"),
+        static_cast<unsigned short>(std::stoul(port)));
+    boost::beast::get_lowest_layer(stream).connect(endpoint);
+    boost::beast::get_lowest_layer(stream).socket().set_option(boost::asio::ip::tcp::no_delay(true));
+    if(session)
+    {
+        session->Apply(stream.native_handle());
+    }
+    stream.handshake(boost::asio::ssl::stream_base::client);
+    if(session)
+    {
+        session->Save(stream.native_handle());
+    }
+}
+
+BenchClient::~BenchClient()
+{
+    boost::system::error_code ignored;
+    stream.shutdown(ignored);
+}
+
+std::uint64_t BenchClient::Get(const std::string& target)
+{
+    boost::beast::http::request<boost::beast::http::empty_body> req{boost::beast::http::verb::get, target, 11};
+    req.set(boost::beast::http::field::host, "127.0.0.1");
+    req.set(boost::beast::http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+    req.keep_alive(true);
+    boost::beast::http::write(stream, req);
+
+    boost::beast::http::response_parser<boost::beast::http::buffer_body> parser;
+    parser.body_limit(boost::none);
+    boost::beast::http::read_header(stream, buffer, parser);
+    if(parser.get().result() != boost::beast::http::status::ok)
+    {
+        throw boost::system::system_error(boost::beast::http::error::bad_status);
+    }
+
+    std::uint64_t total = 0;
+    while(!parser.is_done())
+    {
+        parser.get().body().data = chunk.data();
+        parser.get().body().size = chunk.size();
+        boost::system::error_code error;
+        boost::beast::http::read(stream, buffer, parser, error);
+        if(error && error != boost::beast::http::error::need_buffer)
+        {
+            throw boost::system::system_error(error);
+        }
+        total += chunk.size() - parser.get().body().size;
+    }
+    return total;
+}
+
+bool BenchClient::Resumed()
+{
+    return TlsClientSession::Reused(stream.native_handle());
+}
@@ -0,0 +1,51 @@
+#ifndef BENCH_CLIENT_HPP
+#define BENCH_CLIENT_HPP
+
+#include <boost/asio/io_context.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/ssl.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../../common/tls_client_session.hpp"
+
+/**
+ * @brief Синхронный TLS-клиент с одним keep-alive соединением - для бенчмарков.
+ * @details Сертификат сервера не проверяется. Тело ответа читается порциями
+ * в один и тот же буфер и отбрасывается, чтобы клиент сам не упирался в память.
+ */
+class BenchClient
+{
+public:
+    /**
+     * @brief Подключается к 127.0.0.1:port и проводит рукопожатие TLS 1.2.
+     * @param session Если задана, серверу предлагается сохраненная сессия,
+     * а после рукопожатия в нее сохраняется новая.
+     * @throw boost::system::system_error при ошибке подключения.
+     */
+    explicit BenchClient(const std::string& port, TlsClientSession* session = nullptr);
+    ~BenchClient();
+
+    BenchClient(const BenchClient&) = delete;
+    BenchClient& operator=(const BenchClient&) = delete;
+
+    /**
+     * @brief GET target по тому же соединению.
+     * @return Размер тела ответа.
+     * @throw boost::system::system_error при ошибке или ответе не 200.
+     */
+    std::uint64_t Get(const std::string& target);
+    /**
+     * @brief Было ли рукопожатие сокращенным.
+     */
+    bool Resumed();
+private:
+    boost::asio::io_context context;
+    boost::asio::ssl::context ssl;
+    boost::beast::ssl_stream<boost::beast::tcp_stream> stream;
+    boost::beast::flat_buffer buffer;
+    std::vector<char> chunk;
+};
+
+#endif//BENCH_CLIENT_HPP
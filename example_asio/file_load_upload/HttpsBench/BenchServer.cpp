@@ -0,0 +1,37 @@
+#include "BenchServer.hpp"
+
+#include <pthread.h>
+#include <time.h>
+
+BenchServer::BenchServer(const ConfigServer& config, std::function<void()> prepare)
+    : server(std::make_shared<HttpsServer>(config, "127.0.0.1", context))
+{
+    // Acceptor уже слушает, так что клиент может подключаться сразу после конструктора.
+    server->Run();
+    thread = std::thread([this, prepare = std::move(prepare)]
+    {
+        if(prepare)
+        {
+            prepare();
+        }
+        context.run();
+    });
+}
+
+BenchServer::~BenchServer()
+{
+    context.stop();
+    thread.join();
+    server.reset();
+}
+
+std::chrono::nanoseconds BenchServer::CpuTime()
+{
+    clockid_t clock;
+    timespec time{};
+    if(pthread_getcpuclockid(thread.native_handle(), &clock) != 0 || clock_gettime(clock, &time) != 0)
+    {
+        return std::chrono::nanoseconds::zero();
+    }
+    return std::chrono::seconds(time.tv_sec) + std::chrono::nanoseconds(time.tv_nsec);
+}
@@ -0,0 +1,41 @@
+#ifndef BENCH_SERVER_HPP
+#define BENCH_SERVER_HPP
+
+#include <boost/asio/io_context.hpp>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <thread>
+
+#include "../HttpsServer/HttpsServer.hpp"
+
+/**
+ * @brief HttpsServer на 127.0.0.1 со своим io_context в отдельном потоке - для бенчмарков.
+ * @details Сервер работает как в режиме Single у mainServer: один поток,
+ * один io_context. Останавливается в деструкторе; клиентов нужно закрыть раньше.
+ */
+class BenchServer
+{
+public:
+    /**
+     * @brief Создает сервер и запускает его поток.
+     * @param config Настройки сервера (порт - config.serverPort).
+     * @param prepare Вызывается в потоке сервера перед context.run().
+     */
+    explicit BenchServer(const ConfigServer& config, std::function<void()> prepare = {});
+    ~BenchServer();
+
+    BenchServer(const BenchServer&) = delete;
+    BenchServer& operator=(const BenchServer&) = delete;
+
+    /**
+     * @brief Процессорное время потока сервера (user + system, вместе с kTLS в ядре).
+     */
+    std::chrono::nanoseconds CpuTime();
+private:
+    boost::asio::io_context context{1};
+    std::shared_ptr<HttpsServer> server;
+    std::thread thread;
+};
+
+#endif//BENCH_SERVER_HPP
@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <string>
+#include <unistd.h>
+
+#include "BenchClient.hpp"
+#include "BenchServer.hpp"
+
+/**
+ * Сколько раз поток сервера вызывает operator new на один keep-alive запрос
+ * в HttpsSession (колбэки) и CoroutineSession (корутины), и сколько запросов
+ * в секунду проходит через одно соединение по loopback.
+ *
+ * Считаются только вызовы operator new из потока сервера: клиент работает в
+ * main и в счет не попадает. Выделения OpenSSL идут через malloc и не видны.
+ *
+ * Заодно это тест: после прогрева HttpsSession не должна выделять память
+ * на запрос совсем, иначе код возврата 1.
+ */
+
+namespace
+{
+    std::atomic<std::uint64_t> allocations{0};
+    // Ставится в потоке сервера (BenchServer prepare).
+    thread_local bool counting = false;
+}
+
+void* operator new(std::size_t size)
+{
+    if(counting)
+    {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    if(void* pointer = std::malloc(size ? size : 1))
+    {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+/**
+ * @brief Прогоняет запросы через сервер с выбранным типом сессий и печатает итог.
+ * @return Сколько раз поток сервера вызвал operator new за измеряемые запросы.
+ */
+static std::uint64_t Measure(ConfigServer config, bool coroutines, const std::string& target,
+    unsigned warmup, unsigned requests)
+{
+    config.coroutineSessions = coroutines;
+    BenchServer server(config, [] { counting = true; });
+    {
+        BenchClient client(config.serverPort);
+        // Прогрев: кеши файлов, память обработчиков, буферы сессии.
+        for(unsigned i = 0; i < warmup; ++i)
+        {
+            client.Get(target);
+        }
+
+        allocations.store(0, std::memory_order_relaxed);
+        auto start = std::chrono::steady_clock::now();
+        for(unsigned i = 0; i < requests; ++i)
+        {
+            client.Get(target);
+        }
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        auto count = allocations.load(std::memory_order_relaxed);
+
+        std::cout << (coroutines ? "CoroutineSession" : "HttpsSession    ")
+                  << "  requests " << requests
+                  << "  allocs/req " << static_cast<double>(count) / requests
+                  << "  req/s " << static_cast<std::uint64_t>(requests / seconds) << std::endl;
+        return count;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    ConfigServer config;
+    config.serverPort = "65510";
+    std::string certs = ".";
+    unsigned requests = 10000;
+    unsigned warmup = 100;
+    std::size_t size = 1024;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(arg == "--requests" && i + 1 < argc)
+        {
+            requests = std::max(1, std::atoi(argv[++i]));
+        }
+        else if(arg == "--size" && i + 1 < argc)
+        {
+            size = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if(arg == "--port" && i + 1 < argc)
+        {
+            config.serverPort = argv[++i];
+        }
+        else if(arg == "--certs" && i + 1 < argc)
+        {
+            certs = argv[++i];
+        }
+        else
+        {
+            std::cout << "usage: AllocBench [--requests N] [--size BYTES] [--port PORT] [--certs DIR]" << std::endl;
+            return 1;
+        }
+    }
+
+    config.currentServerCertificate = certs + "/server01.crt";
+    config.currentServerKey = certs + "/server01.key";
+    config.diffieHellman = certs + "/dh2048.pem";
+    Logger::Instance().SetLevel(LogLevel::Warn);
+
+    auto path = std::filesystem::temp_directory_path() / ("alloc-bench-" + std::to_string(getpid()));
+    {
+        std::ofstream file(path, std::ios::binary);
+        std::string data(size, 'a');
+        file.write(data.data(), static_cast<std::streamsize>(data.size()));
+    }
+    std::string target = "/v1/download" + path.string();
+
+    int status = 0;
+    try
+    {
+        auto callbacks = Measure(config, false, target, warmup, requests);
+        Measure(config, true, target, warmup, requests);
+        if(callbacks != 0)
+        {
+            std::cout << "FAILED: HttpsSession allocated " << callbacks
+                      << " times in steady state, expected 0" << std::endl;
+            status = 1;
+        }
+    }
+    catch(const std::exception& e)
+    {
+        std::cout << "Benchmark failed: " << e.what() << std::endl;
+        status = 1;
+    }
+
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+    return status;
+}
@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <time.h>
+
+#include "BenchClient.hpp"
+#include "BenchServer.hpp"
+
+/**
+ * Подключения с рукопожатием TLS 1.2 по loopback в трех режимах: полное
+ * рукопожатие, возобновление по session ID из кеша сервера и по билету
+ * (session ticket). Запросов нет - только подключение, рукопожатие и
+ * закрытие. Печатает число подключений в секунду, долю возобновленных и
+ * процессорное время на рукопожатие у сервера и у клиента.
+ */
+
+/**
+ * @brief Процессорное время текущего потока.
+ */
+static std::chrono::nanoseconds ThreadCpuTime()
+{
+    timespec time{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return std::chrono::seconds(time.tv_sec) + std::chrono::nanoseconds(time.tv_nsec);
+}
+
+enum class Mode
+{
+    Full,       // сессия не предлагается
+    SessionId,  // билеты выключены, сервер находит сессию в своем кеше
+    Ticket      // сессия целиком в билете у клиента
+};
+
+/**
+ * @brief Проводит connections рукопожатий в выбранном режиме и печатает итог.
+ */
+static void Measure(ConfigServer config, Mode mode, unsigned connections)
+{
+    config.tlsSessionTickets = mode == Mode::Ticket;
+    BenchServer server(config);
+
+    TlsClientSession session;
+    TlsClientSession* offer = mode == Mode::Full ? nullptr : &session;
+    // Первое подключение не считаем: оно всегда полное и заводит сессию.
+    BenchClient(config.serverPort, offer);
+
+    unsigned resumed = 0;
+    auto serverStart = server.CpuTime();
+    auto clientStart = ThreadCpuTime();
+    auto start = std::chrono::steady_clock::now();
+    for(unsigned i = 0; i < connections; ++i)
+    {
+        BenchClient client(config.serverPort, offer);
+        resumed += client.Resumed() ? 1 : 0;
+    }
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    auto serverCpu = std::chrono::duration<double, std::micro>(server.CpuTime() - serverStart).count();
+    auto clientCpu = std::chrono::duration<double, std::micro>(ThreadCpuTime() - clientStart).count();
+
+    const char* name = mode == Mode::Full ? "full      " : mode == Mode::SessionId ? "session id" : "ticket    ";
+    std::cout << name
+              << "  conn/s " << static_cast<std::uint64_t>(connections / seconds)
+              << "  resumed " << resumed << "/" << connections
+              << "  server cpu us/handshake " << serverCpu / connections
+              << "  client cpu us/handshake " << clientCpu / connections << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    ConfigServer config;
+    config.serverPort = "65530";
+    std::string certs = ".";
+    unsigned connections = 2000;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(arg == "--connections" && i + 1 < argc)
+        {
+            connections = std::max(1, std::atoi(argv[++i]));
+        }
+        else if(arg == "--port" && i + 1 < argc)
+        {
+            config.serverPort = argv[++i];
+        }
+        else if(arg == "--certs" && i + 1 < argc)
+        {
+            certs = argv[++i];
+        }
+        else
+        {
+            std::cout << "usage: HandshakeBench [--connections N] [--port PORT] [--certs DIR]" << std::endl;
+            return 1;
+        }
+    }
+
+    config.currentServerCertificate = certs + "/server01.crt";
+    config.currentServerKey = certs + "/server01.key";
+    config.diffieHellman = certs + "/dh2048.pem";
+    Logger::Instance().SetLevel(LogLevel::Warn);
+
+    try
+    {
+        Measure(config, Mode::Full, connections);
+        Measure(config, Mode::SessionId, connections);
+        Measure(config, Mode::Ticket, connections);
+    }
+    catch(const std::exception& e)
+    {
+        std::cout << "Benchmark failed: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
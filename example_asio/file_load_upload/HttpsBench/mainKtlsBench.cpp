@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <unistd.h>
+
+#include "BenchClient.hpp"
+#include "BenchServer.hpp"
+
+/**
+ * Скачивание большого файла по loopback в двух режимах сервера: kTLS +
+ * sendfile и шифрование в OpenSSL. Печатает скорость и процессорное время
+ * на гигабайт отдельно для потока сервера и для клиента (клиент в обоих
+ * режимах одинаковый, его время - для сравнения).
+ */
+
+/**
+ * @brief Процессорное время текущего потока.
+ */
+static std::chrono::nanoseconds ThreadCpuTime()
+{
+    timespec time{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return std::chrono::seconds(time.tv_sec) + std::chrono::nanoseconds(time.tv_nsec);
+}
+
+/**
+ * @brief Скачивает файл repeats раз через сервер в выбранном режиме и печатает итог.
+ */
+static void Measure(ConfigServer config, bool kernelTls, const std::string& target, unsigned repeats)
+{
+    config.kernelTls = kernelTls;
+    BenchServer server(config);
+    {
+        BenchClient client(config.serverPort);
+        // Первое скачивание не считаем: открытие файла, кеш страниц, окно TCP.
+        client.Get(target);
+
+        std::uint64_t bytes = 0;
+        auto serverStart = server.CpuTime();
+        auto clientStart = ThreadCpuTime();
+        auto start = std::chrono::steady_clock::now();
+        for(unsigned i = 0; i < repeats; ++i)
+        {
+            bytes += client.Get(target);
+        }
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        auto serverCpu = std::chrono::duration<double>(server.CpuTime() - serverStart).count();
+        auto clientCpu = std::chrono::duration<double>(ThreadCpuTime() - clientStart).count();
+
+        double gigabytes = static_cast<double>(bytes) / (1024.0 * 1024.0 * 1024.0);
+        std::cout << (kernelTls ? "kTLS + sendfile" : "OpenSSL        ")
+                  << "  MB/s " << static_cast<std::uint64_t>(bytes / seconds / (1024 * 1024))
+                  << "  server cpu s/GB " << serverCpu / gigabytes
+                  << "  client cpu s/GB " << clientCpu / gigabytes << std::endl;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    ConfigServer config;
+    config.serverPort = "65520";
+    std::string certs = ".";
+    std::uint64_t size = 256ull * 1024 * 1024;
+    unsigned repeats = 4;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(arg == "--size" && i + 1 < argc)
+        {
+            size = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if(arg == "--repeats" && i + 1 < argc)
+        {
+            repeats = std::max(1, std::atoi(argv[++i]));
+        }
+        else if(arg == "--port" && i + 1 < argc)
+        {
+            config.serverPort = argv[++i];
+        }
+        else if(arg == "--certs" && i + 1 < argc)
+        {
+            certs = argv[++i];
+        }
+        else
+        {
+            std::cout << "usage: KtlsBench [--size BYTES] [--repeats N] [--port PORT] [--certs DIR]" << std::endl;
+            return 1;
+        }
+    }
+
+    config.currentServerCertificate = certs + "/server01.crt";
+    config.currentServerKey = certs + "/server01.key";
+    config.diffieHellman = certs + "/dh2048.pem";
+    Logger::Instance().SetLevel(LogLevel::Warn);
+
+    if(!std::filesystem::exists("/sys/module/tls"))
+    {
+        // Без модуля tls сервер откатится на OpenSSL, и оба режима совпадут.
+        std::cout << "Kernel TLS module is not loaded (modprobe tls), kTLS mode will fall back to OpenSSL" << std::endl;
+    }
+
+    auto path = std::filesystem::temp_directory_path() / ("ktls-bench-" + std::to_string(getpid()));
+    {
+        // Случайные данные: так файл точно не сожмется и не попадет в кеш памяти.
+        std::ofstream file(path, std::ios::binary);
+        std::mt19937_64 random(42);
+        std::vector<std::uint64_t> block(64 * 1024);
+        for(std::uint64_t written = 0; written < size; written += block.size() * sizeof(block[0]))
+        {
+            std::generate(block.begin(), block.end(), random);
+            auto count = std::min<std::uint64_t>(block.size() * sizeof(block[0]), size - written);
+            file.write(reinterpret_cast<const char*>(block.data()), static_cast<std::streamsize>(count));
+        }
+    }
+    std::string target = "/v1/download" + path.string();
+
+    int status = 0;
+    try
+    {
+        Measure(config, true, target, repeats);
+        Measure(config, false, target, repeats);
+    }
+    catch(const std::exception& e)
+    {
+        std::cout << "Benchmark failed: " << e.what() << std::endl;
+        status = 1;
+    }
+
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+    return status;
+}
@@ -0,0 +1,329 @@
+#include "AsyncHttpsClient.hpp"
+
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/this_coro.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include "../../common/logger.hpp"
+
+namespace
+{
+
+/**
+ * @brief Пока жив, отмена корутины отменяет операции с сокетом соединения.
+ * @details Beast 1.77 не пробрасывает слот отмены в свои операции, поэтому
+ * обработчик ставится в слот корутины напрямую.
+ */
+class CancelOnSignal
+{
+public:
+    CancelOnSignal(boost::asio::cancellation_slot slot, ConnectionPool::Stream& stream)
+        : slot(slot)
+    {
+        if(slot.is_connected())
+        {
+            slot.assign([&stream](boost::asio::cancellation_type type)
+                {
+                    if(type != boost::asio::cancellation_type::none)
+                    {
+                        boost::beast::get_lowest_layer(stream).cancel();
+                    }
+                });
+        }
+    }
+
+    ~CancelOnSignal()
+    {
+        if(slot.is_connected())
+        {
+            slot.clear();
+        }
+    }
+
+    CancelOnSignal(const CancelOnSignal&) = delete;
+    CancelOnSignal& operator=(const CancelOnSignal&) = delete;
+private:
+    boost::asio::cancellation_slot slot;
+};
+
+/**
+ * @brief Возвращает соединение в пул, если корутина вышла по исключению.
+ */
+class Lease
+{
+public:
+    Lease(ConnectionPool& pool, std::unique_ptr<ConnectionPool::Connection> connection)
+        : pool(pool)
+        , connection(std::move(connection))
+    {
+
+    }
+
+    ~Lease()
+    {
+        if(connection)
+        {
+            pool.Release(std::move(connection), false);
+        }
+    }
+
+    Lease(const Lease&) = delete;
+    Lease& operator=(const Lease&) = delete;
+
+    ConnectionPool::Connection& operator*() const
+    {
+        return *connection;
+    }
+
+    void Release(bool reusable)
+    {
+        pool.Release(std::move(connection), reusable);
+    }
+
+    std::unique_ptr<ConnectionPool::Connection> Take()
+    {
+        return std::move(connection);
+    }
+private:
+    ConnectionPool& pool;
+    std::unique_ptr<ConnectionPool::Connection> connection;
+};
+
+}
+
+AsyncHttpsClient::AsyncHttpsClient(boost::asio::io_context& context, const Config& config)
+    : context(context)
+    , ssl_context(boost::asio::ssl::context::tlsv12_client)
+    , resolver(context)
+    , config(config)
+    , pool(context, ssl_context, ConnectionPool::Options{config.maxConnections, std::chrono::milliseconds(config.idleTimeoutMs)})
+{
+    ssl_context.set_verify_mode(boost::asio::ssl::verify_peer);
+
+    boost::system::error_code error;
+    ssl_context.load_verify_file(config.rootCACertificate, error);
+    if(error.failed())
+    {
+        LOG_ERROR("No verify path: ", config.rootCACertificate);
+        throw boost::system::system_error(error);
+    }
+}
+
+ConnectionPool& AsyncHttpsClient::Pool()
+{
+    return pool;
+}
+
+boost::asio::awaitable<AsyncHttpsClient::Response> AsyncHttpsClient::Get(std::string filePath, Sink sink,
+    std::chrono::milliseconds timeout)
+{
+    boost::beast::http::request<boost::beast::http::empty_body> req(boost::beast::http::verb::get, "/v1/download" + filePath, 11);
+    req.set(boost::beast::http::field::host, "some_host");
+    req.keep_alive(true);
+    req.prepare_payload();
+
+    co_return co_await Exchange(req, std::chrono::steady_clock::now() + timeout,
+        [&sink](ConnectionPool::Connection& connection, Response& response,
+            bool& started, boost::system::error_code& error) -> boost::asio::awaitable<void>
+        {
+            boost::beast::http::response_parser<boost::beast::http::buffer_body> parser;
+            // Скачиваем файлы любого размера.
+            parser.body_limit(boost::none);
+
+            co_await boost::beast::http::async_read_header(*connection.stream, connection.buffer, parser,
+                boost::asio::redirect_error(boost::asio::use_awaitable, error));
+            started = parser.got_some();
+            if(error)
+            {
+                co_return;
+            }
+            response.header = parser.get().base();
+            bool success = parser.get().result() == boost::beast::http::status::ok
+                || parser.get().result() == boost::beast::http::status::partial_content;
+
+            // Кадр корутины живет весь запрос - буфер в нем не требует отдельного выделения.
+            char chunk[16 * 1024];
+            while(!parser.is_done())
+            {
+                parser.get().body().data = chunk;
+                parser.get().body().size = sizeof(chunk);
+                co_await boost::beast::http::async_read(*connection.stream, connection.buffer, parser,
+                    boost::asio::redirect_error(boost::asio::use_awaitable, error));
+                if(error == boost::beast::http::error::need_buffer)
+                {
+                    error = {};
+                }
+                if(error)
+                {
+                    co_return;
+                }
+
+                std::size_t size = sizeof(chunk) - parser.get().body().size;
+                response.bytes += size;
+                if(size == 0)
+                {
+                    continue;
+                }
+                if(success && sink)
+                {
+                    sink(std::string_view(chunk, size));
+                }
+                else if(!success)
+                {
+                    response.body.append(chunk, size);
+                }
+            }
+            response.keepAlive = parser.get().keep_alive();
+        });
+}
+
+boost::asio::awaitable<AsyncHttpsClient::Response> AsyncHttpsClient::Post(std::string target, std::string body,
+    std::chrono::milliseconds timeout)
+{
+    boost::beast::http::request<boost::beast::http::string_body> req(boost::beast::http::verb::post, target, 11);
+    req.set(boost::beast::http::field::host, "some_host");
+    req.set(boost::beast::http::field::content_type, "application/json");
+    req.body() = std::move(body);
+    req.keep_alive(true);
+    req.prepare_payload();
+
+    co_return co_await Exchange(req, std::chrono::steady_clock::now() + timeout,
+        [](ConnectionPool::Connection& connection, Response& response,
+            bool& started, boost::system::error_code& error) -> boost::asio::awaitable<void>
+        {
+            boost::beast::http::response_parser<boost::beast::http::string_body> parser;
+            parser.body_limit(boost::none);
+            co_await boost::beast::http::async_read(*connection.stream, connection.buffer, parser,
+                boost::asio::redirect_error(boost::asio::use_awaitable, error));
+            started = parser.got_some();
+            if(error)
+            {
+                co_return;
+            }
+            auto res = parser.release();
+            response.keepAlive = res.keep_alive();
+            response.bytes = res.body().size();
+            response.body = std::move(res.body());
+            response.header = std::move(res.base());
+        });
+}
+
+template<class Request, class Read>
+boost::asio::awaitable<AsyncHttpsClient::Response> AsyncHttpsClient::Exchange(const Request& request,
+    Deadline deadline, Read read)
+{
+    boost::asio::cancellation_state state = co_await boost::asio::this_coro::cancellation_state;
+    auto slot = state.slot();
+
+    for(int attempt = 0; ; ++attempt)
+    {
+        Lease connection(pool, co_await Acquire(deadline));
+        // Соединение из пула сервер мог закрыть как раз сейчас - тогда один раз
+        // повторяем запрос на новом (до начала ответа это безопасно).
+        bool retry = (*connection).reused && attempt == 0;
+
+        Response response;
+        boost::system::error_code error;
+        bool gotResponse = false;
+        {
+            CancelOnSignal cancel(slot, *(*connection).stream);
+            auto& stream = *(*connection).stream;
+
+            boost::beast::get_lowest_layer(stream).expires_at(deadline);
+            co_await boost::beast::http::async_write(stream, request,
+                boost::asio::redirect_error(boost::asio::use_awaitable, error));
+            if(!error)
+            {
+                boost::beast::get_lowest_layer(stream).expires_at(deadline);
+                co_await read(*connection, response, gotResponse, error);
+            }
+            boost::beast::get_lowest_layer(stream).expires_never();
+        }
+
+        if(!error)
+        {
+            connection.Release(response.keepAlive);
+            co_return response;
+        }
+
+        connection.Release(false);
+        if(retry && !gotResponse && error != boost::asio::error::operation_aborted
+            && error != boost::beast::error::timeout)
+        {
+            LOG_DEBUG(request.target(), ": pooled connection is closed, retrying");
+            continue;
+        }
+        throw boost::system::system_error(error);
+    }
+}
+
+boost::asio::awaitable<std::unique_ptr<ConnectionPool::Connection>> AsyncHttpsClient::Acquire(Deadline deadline)
+{
+    if(results.empty())
+    {
+        results = co_await resolver.async_resolve(config.serverHost, config.serverPort, boost::asio::use_awaitable);
+    }
+
+    std::unique_ptr<ConnectionPool::Connection> connection;
+    auto slot = ConnectionPool::Slot::Busy;
+    bool again = false;
+    for(;;)
+    {
+        auto waiter = std::make_shared<ConnectionPool::Waiter>(context.get_executor());
+        waiter->again = again;
+        slot = pool.TryAcquire(config.serverHost, config.serverPort, connection, waiter);
+        if(slot != ConnectionPool::Slot::Busy)
+        {
+            break;
+        }
+
+        // Все соединения заняты другими корутинами - ждем, пока Release не разбудит.
+        if(std::chrono::steady_clock::now() >= deadline)
+        {
+            pool.CancelWait(config.serverHost, config.serverPort, waiter);
+            throw boost::system::system_error(boost::beast::error::timeout);
+        }
+        boost::system::error_code error;
+        waiter->timer.expires_at(deadline);
+        co_await waiter->timer.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, error));
+        if(waiter->woken)
+        {
+            again = true;
+            continue;
+        }
+        pool.CancelWait(config.serverHost, config.serverPort, waiter);
+        throw boost::system::system_error(error ? error : boost::beast::error::timeout);
+    }
+    if(slot == ConnectionPool::Slot::Idle)
+    {
+        co_return connection;
+    }
+
+    Lease lease(pool, std::move(connection));
+    auto& stream = *(*lease).stream;
+    boost::system::error_code error;
+    {
+        boost::asio::cancellation_state state = co_await boost::asio::this_coro::cancellation_state;
+        CancelOnSignal cancel(state.slot(), stream);
+
+        boost::beast::get_lowest_layer(stream).expires_at(deadline);
+        co_await boost::beast::get_lowest_layer(stream).async_connect(results,
+            boost::asio::redirect_error(boost::asio::use_awaitable, error));
+        if(!error)
+        {
+            pool.BeforeHandshake(*lease);
+            boost::beast::get_lowest_layer(stream).expires_at(deadline);
+            co_await stream.async_handshake(boost::asio::ssl::stream_base::client,
+                boost::asio::redirect_error(boost::asio::use_awaitable, error));
+            pool.AfterHandshake(*lease, error);
+        }
+        boost::beast::get_lowest_layer(stream).expires_never();
+    }
+    if(error)
+    {
+        throw boost::system::system_error(error);
+    }
+
+    co_return lease.Take();
+}
@@ -0,0 +1,117 @@
+#ifndef ASYNC_HTTPS_CLIENT_HPP
+#define ASYNC_HTTPS_CLIENT_HPP
+
+// awaitable.hpp из Boost 1.77 использует std::exchange, но сам <utility> не подключает.
+#include <utility>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/cancellation_signal.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/ssl.hpp>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "ConnectionPool.hpp"
+#include "HttpsClient.hpp"
+
+/**
+ * @brief Асинхронный клиент на корутинах C++20 (boost::asio::awaitable).
+ * @details Каждый запрос - корутина, которая не блокирует поток: один поток,
+ * выполняющий context.run(), обслуживает любое число одновременных запросов
+ * (соединений к серверу при этом не больше maxConnections, остальные запросы
+ * ждут свободного). Соединения берутся из собственного пула с keep-alive.
+ *
+ * У каждого запроса свой таймаут - общий срок на ожидание соединения,
+ * подключение, отправку и чтение ответа; по его истечении корутина завершается
+ * исключением с beast::error::timeout. Отмена - стандартная для asio: через
+ * слот отмены, с которым запущена корутина (co_spawn + bind_cancellation_slot,
+ * операторы || из awaitable_operators). Beast 1.77 сам слот отмены не
+ * поддерживает, поэтому отмена прерывает операции с сокетом текущего запроса
+ * (соединение в пул не возвращается), а корутина
+ * завершается исключением с operation_aborted.
+ *
+ * Ошибки сети бросаются как boost::system::system_error, ответы сервера с
+ * любым статусом возвращаются как есть. Все методы вызываются из потока,
+ * выполняющего context.run().
+ */
+class AsyncHttpsClient
+{
+public:
+    /**
+     * @brief Получатель тела ответа: вызывается для каждого прочитанного куска.
+     */
+    using Sink = std::function<void(std::string_view chunk)>;
+
+    /**
+     * @brief Ответ сервера.
+     */
+    struct Response
+    {
+        boost::beast::http::response_header<> header;
+        // Тело для Post; у Get тело уходит в Sink.
+        std::string body;
+        // Сколько байт тела получено.
+        std::uint64_t bytes = 0;
+        // Можно ли отправлять следующий запрос в это соединение.
+        bool keepAlive = false;
+    };
+
+    /**
+     * @brief Конструктор.
+     * @param context Объект для io-операций.
+     * @param config Конфиг программы (сервер, сертификат, размер пула).
+     * @details Бросает system_error, если не удалось загрузить корневой сертификат.
+     */
+    AsyncHttpsClient(boost::asio::io_context& context, const Config& config);
+
+    AsyncHttpsClient(const AsyncHttpsClient&) = delete;
+    AsyncHttpsClient& operator=(const AsyncHttpsClient&) = delete;
+
+    /**
+     * @brief Скачивает файл, отдавая тело по кускам.
+     * @param filePath Путь к файлу на сервере.
+     * @param sink Куда отдавать тело (только при статусе 200 и 206).
+     * @param timeout Срок на весь запрос.
+     */
+    boost::asio::awaitable<Response> Get(std::string filePath, Sink sink,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(60000));
+
+    /**
+     * @brief Отправляет POST и читает ответ целиком.
+     * @param target Цель запроса, например "/v1/unloading".
+     * @param body Тело запроса.
+     * @param timeout Срок на весь запрос.
+     */
+    boost::asio::awaitable<Response> Post(std::string target, std::string body,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(60000));
+
+    ConnectionPool& Pool();
+private:
+    using Deadline = std::chrono::steady_clock::time_point;
+
+    /**
+     * @brief Выдает соединение из пула, подключаясь при необходимости.
+     */
+    boost::asio::awaitable<std::unique_ptr<ConnectionPool::Connection>> Acquire(Deadline deadline);
+    /**
+     * @brief Отправляет запрос и читает ответ, один раз повторяя его на новом
+     * соединении, если соединение из пула оказалось закрыто сервером.
+     * @param read Читает ответ из соединения; started - начал ли приходить ответ.
+     */
+    template<class Request, class Read>
+    boost::asio::awaitable<Response> Exchange(const Request& request, Deadline deadline, Read read);
+
+    boost::asio::io_context& context;
+    boost::asio::ssl::context ssl_context;
+    boost::asio::ip::tcp::resolver resolver;
+    // Адреса сервера, заполняются при первом запросе.
+    ConnectionPool::Results results;
+    Config config;
+    ConnectionPool pool;
+};
+
+#endif//ASYNC_HTTPS_CLIENT_HPP
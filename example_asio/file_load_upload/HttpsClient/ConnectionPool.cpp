@@ -0,0 +1,349 @@
+#include "ConnectionPool.hpp"
+
+#include <boost/asio/post.hpp>
+#include <sys/socket.h>
+#include <cerrno>
+
+#include "../../common/logger.hpp"
+
+ConnectionPool::Waiter::Waiter(const boost::asio::any_io_executor& executor)
+    : timer(executor)
+{
+
+}
+
+ConnectionPool::ConnectionPool(boost::asio::io_context& context, boost::asio::ssl::context& ssl, Options options)
+    : context(context)
+    , ssl(ssl)
+    , options(options)
+{
+    if(this->options.maxConnections == 0)
+    {
+        this->options.maxConnections = 1;
+    }
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    Clear();
+}
+
+std::unique_ptr<ConnectionPool::Connection> ConnectionPool::Acquire(const std::string& host,
+    const std::string& port, const Results& results, boost::system::error_code& error)
+{
+    error = {};
+    std::string key = host + ":" + port;
+    auto deadline = std::chrono::steady_clock::now() + options.acquireTimeout;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    Endpoint& endpoint = endpoints[key];
+    for(;;)
+    {
+        bool reserved = false;
+        if(auto connection = TakeIdle(endpoint, key, reserved))
+        {
+            return connection;
+        }
+        if(reserved)
+        {
+            break;
+        }
+
+        if(released.wait_until(lock, deadline) == std::cv_status::timeout
+            && endpoint.idle.empty() && endpoint.total >= options.maxConnections)
+        {
+            error = boost::asio::error::timed_out;
+            return nullptr;
+        }
+    }
+
+    // Место уже занято, а подключаемся без блокировки.
+    lock.unlock();
+    return Connect(key, results, error);
+}
+
+ConnectionPool::Slot ConnectionPool::TryAcquire(const std::string& host, const std::string& port,
+    std::unique_ptr<Connection>& connection, const std::shared_ptr<Waiter>& waiter)
+{
+    std::string key = host + ":" + port;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    Endpoint& endpoint = endpoints[key];
+    bool reserved = false;
+    connection = TakeIdle(endpoint, key, reserved);
+    if(connection)
+    {
+        return Slot::Idle;
+    }
+    if(!reserved)
+    {
+        if(waiter)
+        {
+            if(waiter->again)
+            {
+                endpoint.waiters.push_front(waiter);
+            }
+            else
+            {
+                endpoint.waiters.push_back(waiter);
+            }
+        }
+        return Slot::Busy;
+    }
+    connection = Create(key);
+    return Slot::Reserved;
+}
+
+void ConnectionPool::CancelWait(const std::string& host, const std::string& port,
+    const std::shared_ptr<Waiter>& waiter)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Endpoint& endpoint = endpoints[host + ":" + port];
+    for(auto it = endpoint.waiters.begin(); it != endpoint.waiters.end(); ++it)
+    {
+        if(*it == waiter)
+        {
+            endpoint.waiters.erase(it);
+            return;
+        }
+    }
+    // Не в очереди - значит, Release уже снял его и разбудил; место достанется следующему.
+    if(waiter->woken)
+    {
+        Wake(endpoint, 1);
+    }
+}
+
+void ConnectionPool::BeforeHandshake(Connection& connection)
+{
+    // Запрос пишется сразу за последним сообщением рукопожатия - Nagle задержал бы
+    // его до подтверждения (delayed ACK, ~40 мс), а ответы мелких файлов - тем более.
+    boost::system::error_code ignored;
+    boost::beast::get_lowest_layer(*connection.stream).socket().set_option(boost::asio::ip::tcp::no_delay(true), ignored);
+
+    Endpoint* endpoint = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        endpoint = &endpoints[connection.endpoint];
+    }
+    endpoint->session.Apply(connection.stream->native_handle());
+}
+
+void ConnectionPool::AfterHandshake(Connection& connection, const boost::system::error_code& error)
+{
+    Endpoint* endpoint = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        endpoint = &endpoints[connection.endpoint];
+        if(!error)
+        {
+            ++created;
+        }
+    }
+
+    if(error)
+    {
+        LOG_ERROR("Error handshaking: ", error.message(), " (", error.category().name(), ")");
+        endpoint->session.Reset();
+        return;
+    }
+    LOG_DEBUG("Hnad Shake ok", TlsClientSession::Reused(connection.stream->native_handle()) ? " (resumed)" : "");
+    endpoint->session.Save(connection.stream->native_handle());
+    connection.lastUsed = std::chrono::steady_clock::now();
+}
+
+void ConnectionPool::Release(std::unique_ptr<Connection> connection, bool reusable)
+{
+    if(!connection)
+    {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = endpoints.find(connection->endpoint);
+    if(it == endpoints.end())
+    {
+        Close(*connection);
+        return;
+    }
+
+    Endpoint& endpoint = it->second;
+    // Непрочитанный остаток в буфере значит, что ответы рассинхронизировались с запросами.
+    if(reusable && connection->buffer.size() == 0)
+    {
+        connection->lastUsed = now;
+        endpoint.idle.push_back(std::move(connection));
+    }
+    else
+    {
+        Close(*connection);
+        --endpoint.total;
+    }
+    Evict(endpoint, now);
+    Wake(endpoint, 1);
+    released.notify_one();
+}
+
+void ConnectionPool::Clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for(auto& [key, endpoint] : endpoints)
+    {
+        for(auto& connection : endpoint.idle)
+        {
+            Close(*connection);
+        }
+        endpoint.total -= endpoint.idle.size();
+        endpoint.idle.clear();
+        Wake(endpoint, endpoint.waiters.size());
+    }
+    released.notify_all();
+}
+
+void ConnectionPool::Wake(Endpoint& endpoint, std::size_t count)
+{
+    for(; count > 0 && !endpoint.waiters.empty(); --count)
+    {
+        auto waiter = std::move(endpoint.waiters.front());
+        endpoint.waiters.pop_front();
+        waiter->woken = true;
+        // Таймер не потокобезопасен - отменяем на его executor, а не в потоке Release.
+        boost::asio::post(waiter->timer.get_executor(), [waiter]() { waiter->timer.cancel(); });
+    }
+}
+
+std::uint64_t ConnectionPool::Created() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return created;
+}
+
+std::uint64_t ConnectionPool::Reused() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return reused;
+}
+
+std::size_t ConnectionPool::Idle() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::size_t count = 0;
+    for(const auto& [key, endpoint] : endpoints)
+    {
+        count += endpoint.idle.size();
+    }
+    return count;
+}
+
+std::size_t ConnectionPool::MaxConnections() const
+{
+    return options.maxConnections;
+}
+
+std::unique_ptr<ConnectionPool::Connection> ConnectionPool::TakeIdle(Endpoint& endpoint, const std::string& key,
+    bool& reserved)
+{
+    auto now = std::chrono::steady_clock::now();
+    Evict(endpoint, now);
+
+    while(!endpoint.idle.empty())
+    {
+        auto connection = std::move(endpoint.idle.back());
+        endpoint.idle.pop_back();
+        if(Healthy(*connection, now))
+        {
+            connection->reused = true;
+            ++reused;
+            return connection;
+        }
+        LOG_DEBUG("Pooled connection to ", key, " is closed by server");
+        Close(*connection);
+        --endpoint.total;
+    }
+
+    reserved = endpoint.total < options.maxConnections;
+    if(reserved)
+    {
+        ++endpoint.total;
+    }
+    return nullptr;
+}
+
+std::unique_ptr<ConnectionPool::Connection> ConnectionPool::Create(const std::string& key)
+{
+    auto connection = std::make_unique<Connection>();
+    connection->endpoint = key;
+    connection->stream = std::make_unique<Stream>(context, ssl);
+
+    connection->stream->set_verify_callback([](bool preverified,
+        boost::asio::ssl::verify_context& ctx)
+        {
+            return preverified;
+        });
+    return connection;
+}
+
+std::unique_ptr<ConnectionPool::Connection> ConnectionPool::Connect(const std::string& key,
+    const Results& results, boost::system::error_code& error)
+{
+    auto connection = Create(key);
+    Stream& stream = *connection->stream;
+
+    boost::beast::get_lowest_layer(stream).connect(results, error);
+    if(error.failed())
+    {
+        LOG_ERROR("Error connnecting to ", key, ": ", error.message());
+        Release(std::move(connection), false);
+        return nullptr;
+    }
+
+    BeforeHandshake(*connection);
+    stream.handshake(boost::asio::ssl::stream_base::client, error);
+    AfterHandshake(*connection, error);
+    if(error.failed())
+    {
+        Release(std::move(connection), false);
+        return nullptr;
+    }
+    return connection;
+}
+
+bool ConnectionPool::Healthy(Connection& connection, std::chrono::steady_clock::time_point now) const
+{
+    if(now - connection.lastUsed >= options.idleTimeout)
+    {
+        return false;
+    }
+
+    auto& socket = boost::beast::get_lowest_layer(*connection.stream).socket();
+    if(!socket.is_open() || SSL_pending(connection.stream->native_handle()) > 0)
+    {
+        return false;
+    }
+
+    // Простаивающий сервер ничего не шлет: 0 - он закрыл соединение,
+    // данные - скорее всего close_notify. В обоих случаях соединение не годится.
+    char byte;
+    ssize_t n = ::recv(socket.native_handle(), &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+void ConnectionPool::Evict(Endpoint& endpoint, std::chrono::steady_clock::time_point now)
+{
+    // Самые старые - в начале.
+    auto it = endpoint.idle.begin();
+    while(it != endpoint.idle.end() && now - (*it)->lastUsed >= options.idleTimeout)
+    {
+        Close(**it);
+        ++it;
+    }
+    endpoint.total -= static_cast<std::size_t>(it - endpoint.idle.begin());
+    endpoint.idle.erase(endpoint.idle.begin(), it);
+}
+
+void ConnectionPool::Close(Connection& connection)
+{
+    boost::system::error_code error;
+    boost::beast::get_lowest_layer(*connection.stream).socket().close(error);
+}
@@ -0,0 +1,202 @@
+#ifndef CONNECTION_POOL_HPP
+#define CONNECTION_POOL_HPP
+
+#include <boost/asio/steady_timer.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/ssl.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../../common/tls_client_session.hpp"
+
+/**
+ * @brief Пул установленных TLS-соединений с keep-alive, отдельный для каждого адреса сервера.
+ * @details Соединение берется через Acquire и возвращается через Release.
+ * Перед выдачей простаивавшего соединения проверяется, что сервер его не
+ * закрыл и не прислал ничего лишнего; соединения, простоявшие дольше
+ * idleTimeout, закрываются. Число соединений к одному адресу (занятых и
+ * свободных) ограничено maxConnections - лишние Acquire ждут освобождения,
+ * асинхронные клиенты - в очереди Waiter, которую будит Release.
+ * Для новых соединений предлагается TLS-сессия прошлого подключения к этому адресу.
+ */
+class ConnectionPool
+{
+public:
+    using Stream = boost::beast::ssl_stream<boost::beast::tcp_stream>;
+    using Results = boost::asio::ip::basic_resolver_results<boost::asio::ip::tcp>;
+
+    /**
+     * @brief Одно соединение с сервером.
+     */
+    struct Connection
+    {
+        std::unique_ptr<Stream> stream;
+        // Данные, прочитанные из сокета, но еще не разобранные.
+        boost::beast::flat_buffer buffer;
+        std::string endpoint;
+        std::chrono::steady_clock::time_point lastUsed;
+        // Соединение взято из пула, а не только что установлено.
+        bool reused = false;
+    };
+
+    struct Options
+    {
+        // Сколько соединений (занятых и свободных) держать к одному адресу.
+        std::size_t maxConnections = 4;
+        // Свободное соединение закрывается после такого простоя
+        // (должно быть меньше таймаута сервера на keep-alive).
+        std::chrono::milliseconds idleTimeout{15000};
+        // Сколько ждать свободного места, если все соединения заняты.
+        std::chrono::milliseconds acquireTimeout{30000};
+    };
+
+    /**
+     * @brief Конструктор.
+     * @param context Объект для io-операций.
+     * @param ssl Клиентский TLS-контекст, должен пережить пул.
+     * @param options Ограничения пула.
+     */
+    ConnectionPool(boost::asio::io_context& context, boost::asio::ssl::context& ssl, Options options);
+    ~ConnectionPool();
+
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    /**
+     * @brief Выдает свободное соединение или устанавливает новое.
+     * @param host Имя сервера (ключ пула вместе с портом).
+     * @param port Порт сервера.
+     * @param results Адреса, к которым подключаться.
+     * @param error Ошибка подключения или рукопожатия.
+     * @return nullptr при ошибке.
+     */
+    std::unique_ptr<Connection> Acquire(const std::string& host, const std::string& port,
+        const Results& results, boost::system::error_code& error);
+    /**
+     * @brief Итог TryAcquire.
+     */
+    enum class Slot
+    {
+        Idle,       // выдано открытое соединение из пула
+        Reserved,   // место занято, выдано неподключенное соединение - подключаться вызывающему
+        Busy        // все соединения заняты
+    };
+    /**
+     * @brief Место асинхронного клиента в очереди ожидания соединения.
+     * @details Клиент ждет на timer (с дедлайном). Release снимает первого
+     * ожидающего из очереди адреса, ставит woken и отменяет ожидание через
+     * executor таймера. Разбуженный снова вызывает TryAcquire; отмена без
+     * woken значит, что отменили самого клиента. Объект одноразовый: на
+     * каждое ожидание - новый, чтобы запоздалая отмена не задела следующее.
+     */
+    struct Waiter
+    {
+        explicit Waiter(const boost::asio::any_io_executor& executor);
+
+        boost::asio::steady_timer timer;
+        bool woken = false;
+        // Клиента уже будили, но место перехватили - встает в начало очереди.
+        bool again = false;
+    };
+    /**
+     * @brief Неблокирующий Acquire для асинхронных клиентов.
+     * @param connection Сюда кладется соединение для Idle и Reserved.
+     * @param waiter Если задан, при Busy ставится в очередь ожидания (под той
+     * же блокировкой, так что освобождение между проверкой и постановкой не теряется).
+     * @details Для Reserved вызывающий сам подключается (async_connect), затем
+     * вызывает BeforeHandshake, async_handshake и AfterHandshake. При ошибке
+     * соединение возвращается через Release(..., false), это освобождает место.
+     */
+    Slot TryAcquire(const std::string& host, const std::string& port, std::unique_ptr<Connection>& connection,
+        const std::shared_ptr<Waiter>& waiter = nullptr);
+    /**
+     * @brief Убирает ожидающего из очереди (таймаут или отмена клиента).
+     * @details Если его уже разбудили, пробуждение передается следующему.
+     */
+    void CancelWait(const std::string& host, const std::string& port, const std::shared_ptr<Waiter>& waiter);
+    /**
+     * @brief Настраивает подключенный сокет и предлагает серверу прошлую TLS-сессию.
+     */
+    void BeforeHandshake(Connection& connection);
+    /**
+     * @brief Запоминает TLS-сессию после рукопожатия (или забывает ее при ошибке).
+     */
+    void AfterHandshake(Connection& connection, const boost::system::error_code& error);
+    /**
+     * @brief Возвращает соединение.
+     * @param connection Соединение из Acquire.
+     * @param reusable false - соединение закрывается (ошибка, Connection: close).
+     */
+    void Release(std::unique_ptr<Connection> connection, bool reusable);
+    /**
+     * @brief Закрывает все свободные соединения.
+     */
+    void Clear();
+
+    // Сколько соединений установлено и сколько раз выдано уже открытое.
+    std::uint64_t Created() const;
+    std::uint64_t Reused() const;
+    std::size_t Idle() const;
+    std::size_t MaxConnections() const;
+private:
+    struct Endpoint
+    {
+        // Свободные соединения, последнее возвращенное - в конце.
+        std::vector<std::unique_ptr<Connection>> idle;
+        // Занятые и свободные.
+        std::size_t total = 0;
+        TlsClientSession session;
+        // Асинхронные клиенты, ждущие места, в порядке очереди.
+        std::deque<std::shared_ptr<Waiter>> waiters;
+    };
+
+    /**
+     * @brief Выдает проверенное свободное соединение или занимает место под новое.
+     * Вызывается под mutex.
+     * @return Соединение из пула; nullptr и reserved = true, если место занято под новое.
+     */
+    std::unique_ptr<Connection> TakeIdle(Endpoint& endpoint, const std::string& key, bool& reserved);
+    /**
+     * @brief Новое неподключенное соединение.
+     */
+    std::unique_ptr<Connection> Create(const std::string& key);
+    /**
+     * @brief Устанавливает новое соединение. Вызывается без блокировки.
+     */
+    std::unique_ptr<Connection> Connect(const std::string& key, const Results& results,
+        boost::system::error_code& error);
+    /**
+     * @brief Можно ли отправить запрос в простаивавшее соединение.
+     */
+    bool Healthy(Connection& connection, std::chrono::steady_clock::time_point now) const;
+    /**
+     * @brief Закрывает соединения, простоявшие дольше idleTimeout. Вызывается под mutex.
+     */
+    void Evict(Endpoint& endpoint, std::chrono::steady_clock::time_point now);
+    /**
+     * @brief Будит до count первых ожидающих адреса. Вызывается под mutex.
+     */
+    static void Wake(Endpoint& endpoint, std::size_t count);
+    static void Close(Connection& connection);
+
+    boost::asio::io_context& context;
+    boost::asio::ssl::context& ssl;
+    Options options;
+
+    mutable std::mutex mutex;
+    std::condition_variable released;
+    // Элементы unordered_map не перемещаются, ссылки на Endpoint остаются действительными,
+    // а сами Endpoint не удаляются до разрушения пула.
+    std::unordered_map<std::string, Endpoint> endpoints;
+    std::uint64_t created = 0;
+    std::uint64_t reused = 0;
+};
+
+#endif//CONNECTION_POOL_HPP
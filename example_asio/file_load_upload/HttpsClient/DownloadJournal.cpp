@@ -0,0 +1,319 @@
+#include "DownloadJournal.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include <boost/json.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+
+DownloadJournal::DownloadJournal(std::string path)
+    : path(std::move(path))
+{
+
+}
+
+std::string DownloadJournal::PathFor(const std::string& saveFilePath)
+{
+    return saveFilePath + ".journal";
+}
+
+bool DownloadJournal::Load()
+{
+    std::ifstream file(path, std::ios::binary);
+    if(!file)
+    {
+        return false;
+    }
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    boost::json::error_code ec;
+    auto value = boost::json::parse(text, ec);
+    auto* object = ec ? nullptr : value.if_object();
+    if(!object)
+    {
+        return false;
+    }
+
+    try
+    {
+        remotePath = boost::json::value_to<std::string>(object->at("remote"));
+        etag = boost::json::value_to<std::string>(object->at("etag"));
+        lastModified = boost::json::value_to<std::string>(object->at("lastModified"));
+        size.reset();
+        if(!object->at("size").is_null())
+        {
+            size = object->at("size").to_number<std::uint64_t>();
+        }
+        ranges.clear();
+        for(const auto& range : object->at("ranges").as_array())
+        {
+            const auto& pair = range.as_array();
+            Add(pair.at(0).to_number<std::uint64_t>(), pair.at(1).to_number<std::uint64_t>());
+        }
+    }
+    catch(const std::exception&)
+    {
+        Reset({});
+        return false;
+    }
+
+    if(size && End() > *size)
+    {
+        Reset({});
+        return false;
+    }
+    return true;
+}
+
+bool DownloadJournal::Save(std::string& error) const
+{
+    boost::json::array list;
+    for(const auto& [first, end] : ranges)
+    {
+        list.push_back(boost::json::array{first, end});
+    }
+    boost::json::object object;
+    object["remote"] = remotePath;
+    object["size"] = size ? boost::json::value(*size) : boost::json::value(nullptr);
+    object["etag"] = etag;
+    object["lastModified"] = lastModified;
+    object["ranges"] = std::move(list);
+    std::string text = boost::json::serialize(object);
+
+    // Пишем рядом и переименовываем: после сбоя остается старая или новая версия, но не половина.
+    std::string temp = path + ".tmp";
+    int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0)
+    {
+        error = std::strerror(errno);
+        return false;
+    }
+    std::size_t done = 0;
+    while(done < text.size())
+    {
+        ssize_t n = ::write(fd, text.data() + done, text.size() - done);
+        if(n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(n < 0)
+        {
+            error = std::strerror(errno);
+            ::close(fd);
+            return false;
+        }
+        done += static_cast<std::size_t>(n);
+    }
+    bool synced = ::fdatasync(fd) == 0;
+    ::close(fd);
+    if(!synced || std::rename(temp.c_str(), path.c_str()) != 0)
+    {
+        error = std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+void DownloadJournal::Remove() const
+{
+    std::error_code ignored;
+    std::filesystem::remove(path, ignored);
+}
+
+void DownloadJournal::Reset(const std::string& remotePath_)
+{
+    remotePath = remotePath_;
+    size.reset();
+    etag.clear();
+    lastModified.clear();
+    ranges.clear();
+}
+
+void DownloadJournal::Begin(std::optional<std::uint64_t> size_, std::string etag_, std::string lastModified_)
+{
+    size = size_;
+    etag = std::move(etag_);
+    lastModified = std::move(lastModified_);
+}
+
+void DownloadJournal::Add(std::uint64_t first, std::uint64_t end)
+{
+    if(first >= end)
+    {
+        return;
+    }
+    auto it = std::lower_bound(ranges.begin(), ranges.end(), std::make_pair(first, end));
+    it = ranges.insert(it, {first, end});
+
+    // Склеиваем с соседями, чтобы отрезки не пересекались.
+    if(it != ranges.begin() && std::prev(it)->second >= it->first)
+    {
+        auto previous = std::prev(it);
+        previous->second = std::max(previous->second, it->second);
+        it = std::prev(ranges.erase(it));
+    }
+    while(std::next(it) != ranges.end() && std::next(it)->first <= it->second)
+    {
+        it->second = std::max(it->second, std::next(it)->second);
+        ranges.erase(std::next(it));
+    }
+}
+
+bool DownloadJournal::Known() const
+{
+    return size.has_value();
+}
+
+std::uint64_t DownloadJournal::Size() const
+{
+    return size.value_or(0);
+}
+
+std::uint64_t DownloadJournal::Done() const
+{
+    std::uint64_t done = 0;
+    for(const auto& [first, end] : ranges)
+    {
+        done += end - first;
+    }
+    return done;
+}
+
+std::uint64_t DownloadJournal::End() const
+{
+    return ranges.empty() ? 0 : ranges.back().second;
+}
+
+bool DownloadJournal::Complete() const
+{
+    return size && Done() == *size;
+}
+
+std::optional<std::pair<std::uint64_t, std::uint64_t>> DownloadJournal::NextGap() const
+{
+    if(!size || Complete())
+    {
+        return std::nullopt;
+    }
+    std::uint64_t first = 0;
+    for(const auto& range : ranges)
+    {
+        if(range.first > first)
+        {
+            break;
+        }
+        first = range.second;
+    }
+    auto next = std::upper_bound(ranges.begin(), ranges.end(), std::make_pair(first, first));
+    std::uint64_t end = next == ranges.end() ? *size : next->first;
+    return std::make_pair(first, end - 1);
+}
+
+std::string DownloadJournal::Validator() const
+{
+    // Слабый ETag в If-Range не годится (RFC 7233, 3.2).
+    if(!etag.empty() && etag.rfind("W/", 0) != 0)
+    {
+        return etag;
+    }
+    return lastModified;
+}
+
+const std::string& DownloadJournal::RemotePath() const
+{
+    return remotePath;
+}
+
+const std::string& DownloadJournal::ETag() const
+{
+    return etag;
+}
+
+bool DownloadJournal::Verify(const std::string& dataPath, std::string& error) const
+{
+    std::error_code ec;
+    auto actual = std::filesystem::file_size(dataPath, ec);
+    if(ec)
+    {
+        error = ec.message();
+        return false;
+    }
+    if(!Complete() || actual != *size)
+    {
+        error = "Downloaded " + std::to_string(actual) + " bytes of " + std::to_string(Size());
+        return false;
+    }
+
+    // Сервер с хешированием содержимого отдает ETag из 32 hex-символов.
+    static const char hex[] = "0123456789abcdef";
+    bool contentHash = etag.size() == 34 && etag.front() == '"' && etag.back() == '"'
+        && etag.find_first_not_of(hex, 1) == etag.size() - 1;
+    if(!contentHash)
+    {
+        return true;
+    }
+
+    int fd = ::open(dataPath.c_str(), O_RDONLY | O_CLOEXEC);
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(EVP_MD_CTX_new(), &EVP_MD_CTX_free);
+    if(fd < 0 || !ctx || EVP_DigestInit_ex(ctx.get(), EVP_sha256(), nullptr) != 1)
+    {
+        error = fd < 0 ? std::strerror(errno) : "Can't hash file";
+        if(fd >= 0)
+        {
+            ::close(fd);
+        }
+        return false;
+    }
+
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    char buf[64 * 1024];
+    for(;;)
+    {
+        ssize_t n = ::read(fd, buf, sizeof(buf));
+        if(n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(n < 0)
+        {
+            error = std::strerror(errno);
+            ::close(fd);
+            return false;
+        }
+        if(n == 0)
+        {
+            break;
+        }
+        EVP_DigestUpdate(ctx.get(), buf, static_cast<std::size_t>(n));
+    }
+    ::close(fd);
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    if(EVP_DigestFinal_ex(ctx.get(), digest, &length) != 1)
+    {
+        error = "Can't hash file";
+        return false;
+    }
+    std::string expected = "\"";
+    for(unsigned int i = 0; i < 16 && i < length; ++i)
+    {
+        expected += hex[digest[i] >> 4];
+        expected += hex[digest[i] & 0xf];
+    }
+    expected += '"';
+
+    if(expected != etag)
+    {
+        error = "Content hash " + expected + " does not match ETag " + etag;
+        return false;
+    }
+    return true;
+}
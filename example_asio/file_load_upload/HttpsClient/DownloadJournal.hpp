@@ -0,0 +1,104 @@
+#ifndef DOWNLOAD_JOURNAL_HPP
+#define DOWNLOAD_JOURNAL_HPP
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Журнал недокачанного файла, который лежит рядом с ним (<файл>.journal).
+ * @details Хранит, какой файл качается, его размер и валидаторы (ETag,
+ * Last-Modified), а также уже записанные отрезки. По нему после обрыва
+ * запрашиваются только недостающие байты - с If-Range, чтобы не склеить
+ * куски разных версий файла. Журнал записывается во временный файл и
+ * переименовывается, так что на диске всегда лежит целая версия. Отрезки
+ * попадают в журнал только после fdatasync данных.
+ */
+class DownloadJournal
+{
+public:
+    /**
+     * @brief Конструктор.
+     * @param path Путь к файлу журнала.
+     */
+    explicit DownloadJournal(std::string path);
+
+    /**
+     * @brief Путь к журналу для сохраняемого файла.
+     */
+    static std::string PathFor(const std::string& saveFilePath);
+
+    /**
+     * @brief Читает журнал с диска.
+     * @return false, если журнала нет или он испорчен.
+     */
+    bool Load();
+    /**
+     * @brief Записывает журнал на диск.
+     */
+    bool Save(std::string& error) const;
+    /**
+     * @brief Удаляет журнал с диска.
+     */
+    void Remove() const;
+
+    /**
+     * @brief Начинает журнал заново: о файле ничего не известно, ничего не скачано.
+     */
+    void Reset(const std::string& remotePath);
+    /**
+     * @brief Запоминает, что сервер сообщил о файле (ответ на GET без Range).
+     * @param size Размер, если сервер прислал Content-Length.
+     */
+    void Begin(std::optional<std::uint64_t> size, std::string etag, std::string lastModified);
+    /**
+     * @brief Отмечает записанный отрезок [first, end).
+     */
+    void Add(std::uint64_t first, std::uint64_t end);
+
+    // Известен ли размер файла.
+    bool Known() const;
+    // Размер файла, если он известен.
+    std::uint64_t Size() const;
+    // Сколько байт уже записано.
+    std::uint64_t Done() const;
+    // Самый дальний записанный байт + 1.
+    std::uint64_t End() const;
+    // Размер известен и все байты записаны.
+    bool Complete() const;
+    /**
+     * @brief Первый недостающий отрезок [first, last].
+     * @return Пусто, если размер неизвестен или файл скачан.
+     */
+    std::optional<std::pair<std::uint64_t, std::uint64_t>> NextGap() const;
+    /**
+     * @brief Значение для If-Range: сильный ETag или Last-Modified.
+     * @return Пустая строка, если докачивать нечем проверить.
+     */
+    std::string Validator() const;
+
+    const std::string& RemotePath() const;
+    const std::string& ETag() const;
+
+    /**
+     * @brief Проверяет скачанный файл.
+     * @details Размер сверяется с журналом; если ETag - это хеш содержимого
+     * (первые 128 бит SHA-256, как его считает сервер), то сверяется и хеш.
+     * @param dataPath Путь к скачанным данным.
+     * @param error Причина, если проверка не прошла.
+     */
+    bool Verify(const std::string& dataPath, std::string& error) const;
+private:
+    std::string path;
+
+    std::string remotePath;
+    std::optional<std::uint64_t> size;
+    std::string etag;
+    std::string lastModified;
+    // Записанные отрезки [first, end), упорядочены и не пересекаются.
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> ranges;
+};
+
+#endif//DOWNLOAD_JOURNAL_HPP
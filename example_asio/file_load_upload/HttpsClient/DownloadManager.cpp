@@ -0,0 +1,402 @@
+#include "DownloadManager.hpp"
+
+#include <boost/asio/connect.hpp>
+#include <boost/asio/post.hpp>
+#include <algorithm>
+#include <filesystem>
+#include <vector>
+
+#include "../../common/logger.hpp"
+
+DownloadManager::DownloadManager(boost::asio::io_context& context, ConnectionPool& pool, std::string host,
+                                 std::string port, const ConnectionPool::Results& results, Options options)
+    : context(context)
+    , pool(pool)
+    , host(std::move(host))
+    , port(std::move(port))
+    , results(results)
+    , options(options)
+    , limit(std::clamp(options.initialConcurrency, 1.0, static_cast<double>(pool.MaxConnections())))
+    , roundStart(std::chrono::steady_clock::now())
+{
+
+}
+
+DownloadManager::~DownloadManager()
+{
+    if(waiter)
+    {
+        // Иначе ожидание без срока держало бы context.run(), а обработчик обратился бы к нам.
+        pool.CancelWait(host, port, waiter);
+        waiter->woken = false;
+        waiter->timer.cancel();
+    }
+}
+
+std::future<DownloadResult> DownloadManager::Enqueue(const std::string& remotePath, const std::string& localPath,
+    DownloadCallback callback)
+{
+    auto task = std::make_shared<Task>();
+    task->result.remotePath = remotePath;
+    task->result.localPath = localPath;
+    task->callback = std::move(callback);
+
+    task->request = {boost::beast::http::verb::get, "/v1/download" + remotePath, 11};
+    task->request.set(boost::beast::http::field::host, "some_host");
+    task->request.keep_alive(true);
+    task->request.prepare_payload();
+
+    auto future = task->promise.get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(queue.empty() && active == 0)
+        {
+            // Менеджер простаивал - скорость прошлого раунда уже ни о чем не говорит.
+            roundDone = 0;
+            roundBytes = 0;
+            roundStart = std::chrono::steady_clock::now();
+            lastRoundRate = 0;
+            decreasedThisRound = false;
+        }
+        queue.push_back(std::move(task));
+    }
+
+    boost::asio::post(context, [this]{ Pump(); });
+    return future;
+}
+
+double DownloadManager::Concurrency() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return limit;
+}
+
+std::size_t DownloadManager::Pending() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return queue.size() + active;
+}
+
+void DownloadManager::Pump()
+{
+    std::vector<std::shared_ptr<Task>> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        while(!queue.empty() && active < static_cast<std::size_t>(limit))
+        {
+            ready.push_back(std::move(queue.front()));
+            queue.pop_front();
+            ++active;
+        }
+    }
+
+    for(auto& task : ready)
+    {
+        if(task->started == std::chrono::steady_clock::time_point{})
+        {
+            task->started = std::chrono::steady_clock::now();
+        }
+        Start(std::move(task));
+    }
+}
+
+void DownloadManager::Start(std::shared_ptr<Task> task)
+{
+    // Один Waiter на менеджер: пока он в очереди пула, остальные файлы ждут у нас.
+    std::shared_ptr<ConnectionPool::Waiter> wait;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!waiter)
+        {
+            wait = std::make_shared<ConnectionPool::Waiter>(context.get_executor());
+            wait->again = wokenBefore;
+        }
+    }
+    auto slot = pool.TryAcquire(host, port, task->connection, wait);
+
+    if(slot == ConnectionPool::Slot::Busy)
+    {
+        // Все соединения пула заняты чужими запросами - вернем файл в очередь
+        // и подождем, пока пул не освободит соединение.
+        std::lock_guard<std::mutex> lock(mutex);
+        --active;
+        queue.push_front(std::move(task));
+        if(wait)
+        {
+            waiter = wait;
+            wait->timer.expires_at(std::chrono::steady_clock::time_point::max());
+            wait->timer.async_wait([this, wait](boost::system::error_code)
+                {
+                    OnPoolReleased(wait);
+                });
+        }
+        return;
+    }
+
+    if(wait)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        wokenBefore = false;
+    }
+
+    if(slot == ConnectionPool::Slot::Idle)
+    {
+        return DoWrite(std::move(task));
+    }
+
+    auto& stream = *task->connection->stream;
+    boost::beast::get_lowest_layer(stream).expires_after(options.timeout);
+    boost::beast::get_lowest_layer(stream).async_connect(
+        results,
+        boost::beast::bind_front_handler(
+            &DownloadManager::OnConnect,
+            this,
+            std::move(task)));
+}
+
+void DownloadManager::OnPoolReleased(const std::shared_ptr<ConnectionPool::Waiter>& wait)
+{
+    if(!wait->woken)
+    {
+        // Отменено деструктором.
+        return;
+    }
+
+    bool idle = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        waiter.reset();
+        wokenBefore = true;
+        idle = queue.empty();
+    }
+    if(idle)
+    {
+        // Файлы уже ушли на другие соединения - освобожденное место отдаем следующему.
+        pool.CancelWait(host, port, wait);
+        return;
+    }
+    Pump();
+}
+
+void DownloadManager::OnConnect(std::shared_ptr<Task> task, boost::beast::error_code error,
+    const boost::asio::ip::tcp::endpoint& endpoint)
+{
+    boost::ignore_unused(endpoint);
+
+    if(error)
+    {
+        return Fail(std::move(task), "Error connnecting: " + error.message(), true);
+    }
+
+    pool.BeforeHandshake(*task->connection);
+
+    auto& stream = *task->connection->stream;
+    boost::beast::get_lowest_layer(stream).expires_after(options.timeout);
+    stream.async_handshake(
+        boost::asio::ssl::stream_base::client,
+        boost::beast::bind_front_handler(
+            &DownloadManager::OnHandshake,
+            this,
+            std::move(task)));
+}
+
+void DownloadManager::OnHandshake(std::shared_ptr<Task> task, boost::beast::error_code error)
+{
+    pool.AfterHandshake(*task->connection, error);
+    if(error)
+    {
+        return Fail(std::move(task), "Error handshaking: " + error.message(), true);
+    }
+
+    DoWrite(std::move(task));
+}
+
+void DownloadManager::DoWrite(std::shared_ptr<Task> task)
+{
+    task->parser.emplace();
+    // Скачиваем файлы любого размера.
+    task->parser->body_limit(boost::none);
+
+    boost::beast::error_code error;
+    task->parser->get().body().open(task->result.localPath.c_str(), boost::beast::file_mode::write_new, error);
+    if(error)
+    {
+        task->parser.reset();
+        // Запрос еще не отправлен - соединение можно отдать следующему.
+        pool.Release(std::move(task->connection), true);
+        return Fail(std::move(task), "Can't create file: " + error.message(), false);
+    }
+
+    // Ссылки берем до того, как task переедет в обработчик.
+    auto& stream = *task->connection->stream;
+    auto& request = task->request;
+    boost::beast::get_lowest_layer(stream).expires_after(options.timeout);
+    boost::beast::http::async_write(stream, request,
+        boost::beast::bind_front_handler(
+            &DownloadManager::OnWrite,
+            this,
+            std::move(task)));
+}
+
+void DownloadManager::OnWrite(std::shared_ptr<Task> task, boost::beast::error_code error, std::size_t bytes)
+{
+    boost::ignore_unused(bytes);
+
+    if(error)
+    {
+        if(Retry(task, false))
+        {
+            return;
+        }
+        return Fail(std::move(task), "Error writing data to the socket: " + error.message(), true);
+    }
+
+    auto& connection = *task->connection;
+    auto& parser = *task->parser;
+    boost::beast::get_lowest_layer(*connection.stream).expires_after(options.timeout);
+    boost::beast::http::async_read(*connection.stream, connection.buffer, parser,
+        boost::beast::bind_front_handler(
+            &DownloadManager::OnRead,
+            this,
+            std::move(task)));
+}
+
+void DownloadManager::OnRead(std::shared_ptr<Task> task, boost::beast::error_code error, std::size_t bytes)
+{
+    boost::ignore_unused(bytes);
+
+    if(error)
+    {
+        if(Retry(task, task->parser->got_some()))
+        {
+            return;
+        }
+        return Fail(std::move(task), "Error reading from socket: " + error.message(), true);
+    }
+
+    auto res = task->parser->release();
+    task->parser.reset();
+    pool.Release(std::move(task->connection), res.keep_alive());
+
+    task->result.status = res.result_int();
+    // size() у file_body знает только размер файлов, открытых на чтение.
+    boost::beast::error_code sizeError;
+    task->result.bytes = res.body().file().size(sizeError);
+    res.body().close();
+
+    if(res.result() != boost::beast::http::status::ok)
+    {
+        task->result.bad = true;
+        task->result.error = "Server response is " + std::to_string(task->result.status);
+        std::filesystem::remove(task->result.localPath);
+        LOG_ERROR(task->result.remotePath, ": ", task->result.error);
+    }
+
+    bool serverError = task->result.status >= 500;
+    Finish(std::move(task), serverError);
+}
+
+bool DownloadManager::Retry(const std::shared_ptr<Task>& task, bool gotResponse)
+{
+    // Повторяем только если закрыто было соединение из пула и ответ еще не начался.
+    if(task->retried || gotResponse || !task->connection->reused)
+    {
+        return false;
+    }
+    task->retried = true;
+
+    if(task->parser)
+    {
+        task->parser->get().body().close();
+        task->parser.reset();
+        std::filesystem::remove(task->result.localPath);
+    }
+    pool.Release(std::move(task->connection), false);
+
+    LOG_DEBUG(task->result.remotePath, ": pooled connection is closed, retrying");
+    Start(task);
+    return true;
+}
+
+void DownloadManager::Fail(std::shared_ptr<Task> task, const std::string& what, bool networkError)
+{
+    if(task->parser)
+    {
+        task->parser->get().body().close();
+        task->parser.reset();
+        std::filesystem::remove(task->result.localPath);
+    }
+    pool.Release(std::move(task->connection), false);
+
+    task->result.bad = true;
+    task->result.error = what;
+    LOG_ERROR(task->result.remotePath, ": ", what);
+
+    Finish(std::move(task), networkError);
+}
+
+void DownloadManager::Finish(std::shared_ptr<Task> task, bool networkError)
+{
+    task->result.elapsed = std::chrono::steady_clock::now() - task->started;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        --active;
+        Adjust(task->result, networkError);
+    }
+
+    if(task->callback)
+    {
+        task->callback(task->result);
+    }
+    task->promise.set_value(std::move(task->result));
+
+    Pump();
+}
+
+void DownloadManager::Adjust(const DownloadResult& result, bool networkError)
+{
+    auto maxLimit = static_cast<double>(pool.MaxConnections());
+
+    if(networkError)
+    {
+        if(!decreasedThisRound)
+        {
+            limit = std::max(1.0, limit * options.errorBackoff);
+            decreasedThisRound = true;
+            LOG_DEBUG("Download concurrency ", limit, " after error");
+        }
+    }
+    else
+    {
+        roundBytes += result.bytes;
+    }
+
+    if(++roundDone < std::max<std::size_t>(1, static_cast<std::size_t>(limit)))
+    {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - roundStart).count();
+    double rate = seconds > 0 ? static_cast<double>(roundBytes) / seconds : 0;
+
+    if(!decreasedThisRound)
+    {
+        if(lastRoundRate > 0 && rate < lastRoundRate * (1 - options.dropTolerance))
+        {
+            // Больше параллельных загрузок стало только мешать друг другу.
+            limit = std::max(1.0, limit * options.throughputBackoff);
+        }
+        else
+        {
+            limit = std::min(maxLimit, limit + 1);
+        }
+        LOG_DEBUG("Download concurrency ", limit, " (", rate / 1e6, " MB/s)");
+    }
+
+    lastRoundRate = rate;
+    roundDone = 0;
+    roundBytes = 0;
+    roundStart = now;
+    decreasedThisRound = false;
+}
@@ -0,0 +1,161 @@
+#ifndef DOWNLOAD_MANAGER_HPP
+#define DOWNLOAD_MANAGER_HPP
+
+#include <boost/asio/steady_timer.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/ssl.hpp>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+#include "ConnectionPool.hpp"
+
+/**
+ * @brief Итог скачивания одного файла.
+ */
+struct DownloadResult
+{
+    std::string remotePath;
+    std::string localPath;
+    // true, если файл не скачан (локальный файл тогда удаляется).
+    bool bad = false;
+    // Текст ошибки, если bad.
+    std::string error;
+    // HTTP-статус ответа, 0 - ответа не было.
+    unsigned status = 0;
+    std::uint64_t bytes = 0;
+    std::chrono::steady_clock::duration elapsed{};
+};
+
+using DownloadCallback = std::function<void(const DownloadResult&)>;
+
+/**
+ * @brief Параллельное асинхронное скачивание файлов через пул соединений.
+ * @details Все операции идут на io_context клиента - результаты появляются,
+ * пока кто-то выполняет context.run(). Одновременно скачивается не больше
+ * limit файлов, и limit подстраивается по AIMD:
+ *  - после каждого "раунда" (limit завершенных файлов) сравнивается скорость
+ *    раунда с прошлой: если она не упала, limit += 1;
+ *  - если скорость упала больше чем на dropTolerance, limit *= throughputBackoff;
+ *  - ошибка соединения или ответ 5xx - limit *= errorBackoff, не чаще раза за раунд.
+ * limit не превышает maxConnections пула.
+ */
+class DownloadManager
+{
+public:
+    struct Options
+    {
+        // С какого числа параллельных скачиваний начинать.
+        double initialConcurrency = 2;
+        // Таймаут на каждую сетевую операцию.
+        std::chrono::milliseconds timeout{60000};
+        double errorBackoff = 0.5;
+        double throughputBackoff = 0.75;
+        double dropTolerance = 0.2;
+    };
+
+    /**
+     * @brief Конструктор.
+     * @param context Объект для io-операций (тот же, что у пула).
+     * @param pool Пул соединений, должен пережить менеджер.
+     * @param host Имя сервера.
+     * @param port Порт сервера.
+     * @param results Адреса сервера, должны пережить менеджер.
+     * @param options Настройки.
+     */
+    DownloadManager(boost::asio::io_context& context, ConnectionPool& pool, std::string host, std::string port,
+        const ConnectionPool::Results& results, Options options);
+
+    ~DownloadManager();
+
+    DownloadManager(const DownloadManager&) = delete;
+    DownloadManager& operator=(const DownloadManager&) = delete;
+
+    /**
+     * @brief Ставит файл в очередь на скачивание.
+     * @param remotePath Путь к файлу на сервере.
+     * @param localPath Куда сохранить (файл не должен существовать).
+     * @param callback Вызывается из io-потока по завершении, до готовности future.
+     * @return future с результатом.
+     */
+    std::future<DownloadResult> Enqueue(const std::string& remotePath, const std::string& localPath,
+        DownloadCallback callback);
+
+    // Текущий предел параллельности.
+    double Concurrency() const;
+    // Файлы в очереди и в работе.
+    std::size_t Pending() const;
+private:
+    struct Task
+    {
+        DownloadResult result;
+        DownloadCallback callback;
+        std::promise<DownloadResult> promise;
+        std::unique_ptr<ConnectionPool::Connection> connection;
+        boost::beast::http::request<boost::beast::http::empty_body> request;
+        std::optional<boost::beast::http::response_parser<boost::beast::http::file_body>> parser;
+        std::chrono::steady_clock::time_point started;
+        // Запрос уже повторялся на новом соединении.
+        bool retried = false;
+    };
+
+    /**
+     * @brief Запускает файлы из очереди, пока active < limit.
+     */
+    void Pump();
+    void Start(std::shared_ptr<Task> task);
+    /**
+     * @brief Пул разбудил ожидание свободного соединения (или ожидание отменено).
+     */
+    void OnPoolReleased(const std::shared_ptr<ConnectionPool::Waiter>& waiter);
+    void OnConnect(std::shared_ptr<Task> task, boost::beast::error_code error,
+        const boost::asio::ip::tcp::endpoint& endpoint);
+    void OnHandshake(std::shared_ptr<Task> task, boost::beast::error_code error);
+    void DoWrite(std::shared_ptr<Task> task);
+    void OnWrite(std::shared_ptr<Task> task, boost::beast::error_code error, std::size_t bytes);
+    void OnRead(std::shared_ptr<Task> task, boost::beast::error_code error, std::size_t bytes);
+    /**
+     * @brief Повторяет запрос на новом соединении, если старое закрыли из-под нас.
+     * @return true, если повтор запущен.
+     */
+    bool Retry(const std::shared_ptr<Task>& task, bool gotResponse);
+    void Fail(std::shared_ptr<Task> task, const std::string& what, bool networkError);
+    void Finish(std::shared_ptr<Task> task, bool networkError);
+    /**
+     * @brief Пересчитывает limit после завершения файла. Вызывается под mutex.
+     */
+    void Adjust(const DownloadResult& result, bool networkError);
+
+    boost::asio::io_context& context;
+    ConnectionPool& pool;
+    std::string host;
+    std::string port;
+    const ConnectionPool::Results& results;
+    Options options;
+
+    mutable std::mutex mutex;
+    std::deque<std::shared_ptr<Task>> queue;
+    std::size_t active = 0;
+    // Место в очереди пула, пока все его соединения заняты чужими запросами:
+    // Release будит, и файлы из очереди стартуют снова.
+    std::shared_ptr<ConnectionPool::Waiter> waiter;
+    // Нас уже будили, но место перехватили - ждем в начале очереди пула.
+    bool wokenBefore = false;
+
+    double limit;
+    // Текущий раунд AIMD.
+    std::size_t roundDone = 0;
+    std::uint64_t roundBytes = 0;
+    std::chrono::steady_clock::time_point roundStart;
+    double lastRoundRate = 0;
+    bool decreasedThisRound = false;
+};
+
+#endif//DOWNLOAD_MANAGER_HPP
@@ -1,11 +1,25 @@
 #include "HttpsClient.hpp"
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <mutex>
+
 // https://www.boost.org/doc/libs/1_73_0/doc/html/boost_asio/reference/ssl__context.html
 
 HttpsClient::HttpsClient(boost::asio::io_context& context, Config conf)
     : context(context)
     , ssl_context(boost::asio::ssl::context::tlsv12_client)
     , resolver(context)
+    , config(conf)
+    , pool(context, ssl_context, ConnectionPool::Options{conf.maxConnections, std::chrono::milliseconds(conf.idleTimeoutMs)})
+    , downloads(context, pool, conf.serverHost, conf.serverPort, results,
+                DownloadManager::Options{conf.initialConcurrency, std::chrono::milliseconds(conf.downloadTimeoutMs)})
 {
     boost::system::error_code error;
    
@@ -15,13 +29,13 @@ HttpsClient::HttpsClient(boost::asio::io_context& context, Config conf)
    
     if(error.failed())
     {
-        std::cout << "verify mode error"  << std::endl;
+        LOG_ERROR("verify mode error");
         exit(23);
     }
 
     if(!std::filesystem::exists(conf.rootCACertificate))
     {
-        std::cout << "No filepath" <<  std::endl;
+        LOG_ERROR("No filepath");
         exit(33);
     }
 
@@ -32,17 +46,14 @@ HttpsClient::HttpsClient(boost::asio::io_context& context, Config conf)
 
     if(error.failed())
     {
-        std::cout << "No verify path" << std::endl;
+        LOG_ERROR("No verify path");
         exit(43);
     }
     
     results = resolver.resolve(conf.serverHost, conf.serverPort, error);
     if(error.failed())
     {
-        std::cout << "Error resolving dns name" << std::endl;
-         std::cout << error.what() << std::endl;
-        std::cout << error.message() << std::endl;
-        std::cout << error.category().name()  << std::endl;
+        LOG_ERROR("Error resolving dns name: ", error.message(), " (", error.category().name(), ")");
         exit(53);
     }
 }
@@ -65,7 +76,7 @@ std::string HttpsClient::PostRequest(const std::string& task, bool& bad)
     if(error.failed())
     {
         bad = true;
-        std::cout << "Error connnecting" << std::endl;
+        LOG_ERROR("Error connnecting");
         boost::beast::get_lowest_layer(stream).close();
         return error.message();
     }
@@ -73,7 +84,7 @@ std::string HttpsClient::PostRequest(const std::string& task, bool& bad)
     if(error.failed())
     {
         bad = true;
-        std::cout << "Error handshaking" << std::endl;
+        LOG_ERROR("Error handshaking");
         boost::beast::get_lowest_layer(stream).close();
         return error.message();
     }
@@ -90,7 +101,7 @@ std::string HttpsClient::PostRequest(const std::string& task, bool& bad)
     if(error.failed())
     {
         bad = true;
-        std::cout << "Error writing data to the socket" << std::endl;
+        LOG_ERROR("Error writing data to the socket");
         boost::beast::get_lowest_layer(stream).close();
         return error.message();
     }
@@ -101,7 +112,7 @@ std::string HttpsClient::PostRequest(const std::string& task, bool& bad)
     if(error.failed())
     {
         bad = true;
-        std::cout << "Error reading from socket" << std::endl;
+        LOG_ERROR("Error reading from socket");
         boost::beast::get_lowest_layer(stream).close();
         return error.message();
     }
@@ -110,7 +121,7 @@ std::string HttpsClient::PostRequest(const std::string& task, bool& bad)
 
     if(res.result() != boost::beast::http::status::ok)
     {
-        std::cout << "Beast response is not ok" << std::endl;
+        LOG_ERROR("Beast response is not ok");
         bad = true;
     }
 
@@ -120,106 +131,561 @@ std::string HttpsClient::PostRequest(const std::string& task, bool& bad)
 
 std::string HttpsClient::GetRequest(const std::string& filePath, const std::string& saveFilePath, bool& bad)
 {
-    std::cout << "Clinet GetRequest start" << std::endl; 
+    LOG_DEBUG("Clinet GetRequest start");
     bad = false;
-    boost::system::error_code error;
 
-    boost::beast::ssl_stream<boost::beast::tcp_stream> stream(context, ssl_context);
+    // Данные качаются в <файл>.part, а в журнал пишется, что уже скачано.
+    std::string partPath = saveFilePath + ".part";
+    DownloadJournal journal(DownloadJournal::PathFor(saveFilePath));
 
-    stream.set_verify_callback([](bool preverified,
-        boost::asio::ssl::verify_context& ctx)
+    std::error_code ignored;
+    bool resume = journal.Load() && journal.RemotePath() == filePath
+        && std::filesystem::file_size(partPath, ignored) >= journal.End() && !ignored;
+    if(!resume)
+    {
+        if(std::filesystem::exists(saveFilePath))
         {
-            return preverified;
-        });
+            bad = true;
+            LOG_ERROR(" error request !");
+            return std::make_error_code(std::errc::file_exists).message();
+        }
+        journal.Reset(filePath);
+    }
+    else
+    {
+        LOG_INFO("Resuming ", filePath, " from ", journal.Done(), " of ", journal.Size(), " bytes");
+    }
 
-    boost::beast::get_lowest_layer(stream).connect(results, error);
-    if(error.failed())
+    int fd = ::open(partPath.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (resume ? 0 : O_TRUNC), 0644);
+    if(fd < 0)
     {
         bad = true;
-        std::cout << "Error connnecting" << std::endl;
-        boost::beast::get_lowest_layer(stream).close();
-        return error.message();
+        LOG_ERROR(" error request !");
+        return std::strerror(errno);
     }
 
-    stream.handshake(boost::asio::ssl::stream_base::client, error);
-    
-    if(error.failed())
+    std::string error;
+    for(unsigned attempt = 1; ; ++attempt)
+    {
+        auto status = FetchMissing(filePath, fd, journal, error);
+        if(status == FetchStatus::Done)
+        {
+            break;
+        }
+        if(status == FetchStatus::Fatal)
+        {
+            // Ответ сервера, а не обрыв - докачивать нечего.
+            ::close(fd);
+            std::filesystem::remove(partPath, ignored);
+            journal.Remove();
+            bad = true;
+            LOG_ERROR(filePath, ": ", error);
+            return error;
+        }
+        if(attempt >= std::max(1u, config.resumeAttempts))
+        {
+            ::close(fd);
+            bad = true;
+            LOG_ERROR(filePath, ": ", error, ", ", journal.Done(), " bytes kept for resume");
+            return error;
+        }
+        LOG_WARN(filePath, ": ", error, ", resuming from ", journal.Done(), " bytes");
+    }
+    error.clear();
+
+    if(journal.Known() && ::ftruncate(fd, static_cast<off_t>(journal.Size())) != 0)
     {
+        error = std::strerror(errno);
+    }
+    ::close(fd);
 
+    if(!error.empty() || !journal.Verify(partPath, error))
+    {
+        // Проверку не прошла смесь версий или испорченные данные - начинать заново.
+        std::filesystem::remove(partPath, ignored);
+        journal.Remove();
         bad = true;
-        std::cout <<  "Error handshaking" << std::endl;
-        boost::beast::get_lowest_layer(stream).close();
-        
-        std::cout << error.what() << std::endl;
-        std::cout << error.message() << std::endl;
-        std::cout << error.category().name() << std::endl;
+        LOG_ERROR(filePath, ": ", error);
+        return error;
+    }
 
+    std::filesystem::rename(partPath, saveFilePath, ignored);
+    if(ignored)
+    {
+        bad = true;
+        LOG_ERROR(filePath, ": ", ignored.message());
+        return ignored.message();
+    }
+    journal.Remove();
+    return std::string();
+}
 
-        return error.message();
+HttpsClient::FetchStatus HttpsClient::FetchMissing(const std::string& filePath, int fd, DownloadJournal& journal,
+    std::string& error)
+{
+    while(!journal.Complete())
+    {
+        // Пока о файле ничего не известно - обычный GET, потом только недостающие куски.
+        auto gap = journal.NextGap();
+
+        boost::beast::http::request<boost::beast::http::empty_body> req(boost::beast::http::verb::get, "/v1/download" + filePath, 11);
+        req.set(boost::beast::http::field::host, "some_host");
+        if(gap)
+        {
+            req.set(boost::beast::http::field::range,
+                "bytes=" + std::to_string(gap->first) + "-" + std::to_string(gap->second));
+            auto validator = journal.Validator();
+            if(!validator.empty())
+            {
+                req.set(boost::beast::http::field::if_range, validator);
+            }
+        }
+        req.keep_alive(true);
+        req.prepare_payload();
+
+        LOG_DEBUG("request created  with target : ", req.target());
+
+        std::unique_ptr<ConnectionPool::Connection> connection;
+        std::optional<boost::beast::http::response_parser<SegmentBody>> reading;
+
+        for(int attempt = 0; ; ++attempt)
+        {
+            reading.emplace();
+            // Скачиваем файлы любого размера.
+            reading->body_limit(boost::none);
+
+            boost::system::error_code ec;
+            connection = pool.Acquire(config.serverHost, config.serverPort, results, ec);
+            if(!connection)
+            {
+                error = ec.message();
+                return FetchStatus::Retry;
+            }
+            // Соединение из пула сервер мог закрыть как раз сейчас - тогда один раз
+            // повторяем запрос на новом (GET можно безопасно отправить повторно).
+            bool retry = connection->reused && attempt == 0;
+
+            boost::beast::http::write(*connection->stream, req, ec);
+            LOG_DEBUG("request has ben sended ! ");
+            if(!ec.failed())
+            {
+                boost::beast::http::read_header(*connection->stream, connection->buffer, *reading, ec);
+            }
+            if(!ec.failed())
+            {
+                break;
+            }
+
+            bool gotSome = reading->got_some();
+            pool.Release(std::move(connection), false);
+            if(retry && !gotSome)
+            {
+                continue;
+            }
+            LOG_ERROR("Error reading from socket");
+            error = ec.message();
+            return FetchStatus::Retry;
+        }
+
+        auto& parser = *reading;
+        const auto& res = parser.get();
+        std::uint64_t first = 0;
+        std::uint64_t length = std::numeric_limits<std::uint64_t>::max();
+
+        if(res.result() == boost::beast::http::status::partial_content && gap)
+        {
+            std::string expected = "bytes " + std::to_string(gap->first) + "-" + std::to_string(gap->second)
+                + "/" + std::to_string(journal.Size());
+            if(res[boost::beast::http::field::content_range] != expected)
+            {
+                pool.Release(std::move(connection), false);
+                error = "Unexpected Content-Range " + std::string(res[boost::beast::http::field::content_range]);
+                return FetchStatus::Fatal;
+            }
+            first = gap->first;
+            length = gap->second - gap->first + 1;
+        }
+        else if(res.result() == boost::beast::http::status::ok)
+        {
+            if(gap)
+            {
+                // Файл на сервере изменился (If-Range не совпал) - пришел целиком.
+                LOG_WARN(filePath, " changed on server, downloading from scratch");
+            }
+            journal.Reset(filePath);
+            std::optional<std::uint64_t> size;
+            if(auto contentLength = parser.content_length())
+            {
+                size = *contentLength;
+                length = *contentLength;
+            }
+            journal.Begin(size, std::string(res[boost::beast::http::field::etag]),
+                std::string(res[boost::beast::http::field::last_modified]));
+            if(::ftruncate(fd, 0) != 0)
+            {
+                pool.Release(std::move(connection), false);
+                error = std::strerror(errno);
+                return FetchStatus::Fatal;
+            }
+        }
+        else if(res.result() == boost::beast::http::status::range_not_satisfiable && gap)
+        {
+            // Файл стал короче - начинаем сначала.
+            pool.Release(std::move(connection), false);
+            journal.Reset(filePath);
+            error = "File is changed on server";
+            return FetchStatus::Retry;
+        }
+        else
+        {
+            LOG_ERROR("api-screen-recorder-server response is not ok");
+            pool.Release(std::move(connection), false);
+            error = "api-screen-recorder-server response is not ok";
+            return FetchStatus::Fatal;
+        }
+
+        // Читатель тела (и проверка длины в init) создается, когда начинается тело, -
+        // уже после read_header, так что задать тело можно сейчас.
+        auto& body = parser.get().body();
+        body = SegmentBody::value_type{fd, first, length, 0};
+
+        std::uint64_t saved = 0;
+        auto checkpoint = [&]
+        {
+            // Сначала данные на диск, потом запись о них в журнал.
+            if(body.written == saved || !journal.Known())
+            {
+                return;
+            }
+            std::string ignored;
+            if(::fdatasync(fd) == 0)
+            {
+                journal.Add(first + saved, first + body.written);
+                journal.Save(ignored);
+            }
+            saved = body.written;
+        };
+
+        boost::system::error_code ec;
+        while(!parser.is_done())
+        {
+            boost::beast::http::read_some(*connection->stream, connection->buffer, parser, ec);
+            if(ec.failed())
+            {
+                break;
+            }
+            if(body.written - saved >= config.journalInterval)
+            {
+                checkpoint();
+            }
+        }
+
+        if(ec.failed())
+        {
+            pool.Release(std::move(connection), false);
+            checkpoint();
+            LOG_ERROR("Error reading from socket");
+            error = ec.message();
+            return FetchStatus::Retry;
+        }
+
+        pool.Release(std::move(connection), parser.get().keep_alive());
+        if(!journal.Known())
+        {
+            // Ответ без Content-Length: размер узнали, только дочитав.
+            journal.Begin(body.written, journal.ETag(), std::string(res[boost::beast::http::field::last_modified]));
+        }
+        journal.Add(first, first + body.written);
     }
-    std::cout << "Hnad Shake ok" << std::endl;
+    return FetchStatus::Done;
+}
 
-    // requests a file by path on the server
-//    boost::beast::http::request<boost::beast::http::empty_body> req(boost::beast::http::verb::get, "/v1/download" + filePath, 11);
-    boost::beast::http::request<boost::beast::http::empty_body> req(boost::beast::http::verb::get, "/v1/download" + filePath, 11);
+std::future<DownloadResult> HttpsClient::AsyncGetRequest(const std::string& filePath, const std::string& saveFilePath,
+    DownloadCallback callback)
+{
+    return downloads.Enqueue(filePath, saveFilePath, std::move(callback));
+}
 
+std::vector<std::future<DownloadResult>> HttpsClient::GetBatch(
+    const std::vector<std::pair<std::string, std::string>>& files, DownloadCallback callback)
+{
+    std::vector<std::future<DownloadResult>> futures;
+    futures.reserve(files.size());
+    for(const auto& [filePath, saveFilePath] : files)
+    {
+        futures.push_back(downloads.Enqueue(filePath, saveFilePath, callback));
+    }
+    return futures;
+}
 
-    std::cout << "request created  with target : " << req.target() << std::endl;
-   
+std::string HttpsClient::HeadRequest(const std::string& filePath, RemoteFileInfo& info, bool& bad)
+{
+    bad = false;
+
+    boost::beast::http::request<boost::beast::http::empty_body> req(boost::beast::http::verb::head, "/v1/download" + filePath, 11);
     req.set(boost::beast::http::field::host, "some_host");
-    req.keep_alive(false);
+    req.keep_alive(true);
     req.prepare_payload();
 
-     std::cout << " req.body() "   << std::endl;
-    boost::beast::http::write(stream, req, error);
-    std::cout << "request has ben sended ! " << std::endl;
-    if(error.failed())
+    for(int attempt = 0; ; ++attempt)
     {
-        bad = true;
-        std::cout << "Error writing data to the socket" << std::endl;
-        boost::beast::get_lowest_layer(stream).close();
-        return error.message();
+        boost::system::error_code error;
+        auto connection = pool.Acquire(config.serverHost, config.serverPort, results, error);
+        if(!connection)
+        {
+            bad = true;
+            return error.message();
+        }
+        bool retry = connection->reused && attempt == 0;
+
+        boost::beast::http::write(*connection->stream, req, error);
+        if(error.failed())
+        {
+            pool.Release(std::move(connection), false);
+            if(retry)
+            {
+                continue;
+            }
+            bad = true;
+            LOG_ERROR("Error writing data to the socket");
+            return error.message();
+        }
+
+        // У ответа на HEAD тела нет, хотя Content-Length есть.
+        boost::beast::http::response_parser<boost::beast::http::empty_body> parser;
+        parser.skip(true);
+        boost::beast::http::read(*connection->stream, connection->buffer, parser, error);
+        if(error.failed())
+        {
+            bool gotSome = parser.got_some();
+            pool.Release(std::move(connection), false);
+            if(retry && !gotSome)
+            {
+                continue;
+            }
+            bad = true;
+            LOG_ERROR("Error reading from socket");
+            return error.message();
+        }
+
+        const auto& res = parser.get();
+        pool.Release(std::move(connection), res.keep_alive());
+
+        if(res.result() != boost::beast::http::status::ok)
+        {
+            bad = true;
+            return "HEAD response is " + std::to_string(res.result_int());
+        }
+
+        auto length = res[boost::beast::http::field::content_length];
+        auto [ptr, ec] = std::from_chars(length.data(), length.data() + length.size(), info.size);
+        if(ec != std::errc() || ptr != length.data() + length.size())
+        {
+            bad = true;
+            return "HEAD response has no Content-Length";
+        }
+        info.etag = std::string(res[boost::beast::http::field::etag]);
+        info.lastModified = std::string(res[boost::beast::http::field::last_modified]);
+        info.acceptRanges = res[boost::beast::http::field::accept_ranges] == "bytes";
+        return std::string();
     }
+}
 
-    boost::beast::flat_buffer buffer;
-    boost::beast::http::response<boost::beast::http::file_body> res;
-    
-    // open file to write data
-    res.body().open(saveFilePath.c_str(), boost::beast::file_mode::write_new, error);
-    
-    if(error.failed())
+bool HttpsClient::FetchSegment(const std::string& filePath, int fd, const RemoteFileInfo& info, Segment& segment,
+    bool& changed, std::string& error)
+{
+    changed = false;
+    std::uint64_t first = segment.first + segment.done;
+    std::string range = "bytes=" + std::to_string(first) + "-" + std::to_string(segment.last);
+
+    boost::beast::http::request<boost::beast::http::empty_body> req(boost::beast::http::verb::get, "/v1/download" + filePath, 11);
+    req.set(boost::beast::http::field::host, "some_host");
+    req.set(boost::beast::http::field::range, range);
+    // Если файл изменился, сервер вернет его целиком (200) вместо куска другой версии.
+    if(!info.etag.empty())
     {
-        bad = true;
-        std::cout << " error request !" << std::endl;
-        return error.message();
+        req.set(boost::beast::http::field::if_range, info.etag);
     }
+    req.keep_alive(true);
+    req.prepare_payload();
 
-    boost::beast::http::read(stream, buffer, res, error);
-    if(error.failed())
+    for(int attempt = 0; ; ++attempt)
     {
-        bad = true;
-        std::cout << "Error reading from socket" << std::endl;
-        boost::beast::get_lowest_layer(stream).close();
-        res.body().close();
+        boost::system::error_code ec;
+        auto connection = pool.Acquire(config.serverHost, config.serverPort, results, ec);
+        if(!connection)
+        {
+            error = ec.message();
+            return false;
+        }
+        bool retry = connection->reused && attempt == 0;
 
-        // femove file if error 
-        std::filesystem::remove(saveFilePath);
-        return error.message();
+        boost::beast::http::write(*connection->stream, req, ec);
+        if(ec.failed())
+        {
+            pool.Release(std::move(connection), false);
+            if(retry)
+            {
+                continue;
+            }
+            error = ec.message();
+            return false;
+        }
+
+        boost::beast::http::response_parser<SegmentBody> parser;
+        parser.body_limit(boost::none);
+        // Читатель тела создается только после read_header, с началом тела; границы
+        // сегмента от заголовка не зависят, поэтому задаем их сразу.
+        parser.get().body() = SegmentBody::value_type{fd, first, segment.last - first + 1, 0};
+
+        boost::beast::http::read_header(*connection->stream, connection->buffer, parser, ec);
+        if(ec.failed())
+        {
+            bool gotSome = parser.got_some();
+            pool.Release(std::move(connection), false);
+            if(retry && !gotSome)
+            {
+                continue;
+            }
+            error = ec.message();
+            return false;
+        }
+
+        const auto& res = parser.get();
+        std::string expected = "bytes " + std::to_string(first) + "-" + std::to_string(segment.last)
+            + "/" + std::to_string(info.size);
+        if(res.result() != boost::beast::http::status::partial_content
+            || res[boost::beast::http::field::content_range] != expected)
+        {
+            changed = res.result() == boost::beast::http::status::ok;
+            error = changed ? "File is changed on server" : "Unexpected response " + std::to_string(res.result_int());
+            // Тело не читали - соединение дальше не годится.
+            pool.Release(std::move(connection), false);
+            return false;
+        }
+
+        boost::beast::http::read(*connection->stream, connection->buffer, parser, ec);
+        segment.done += parser.get().body().written;
+        if(ec.failed())
+        {
+            pool.Release(std::move(connection), false);
+            error = ec.message();
+            return false;
+        }
+
+        pool.Release(std::move(connection), parser.get().keep_alive());
+        return segment.first + segment.done == segment.last + 1;
     }
+}
 
-    boost::beast::get_lowest_layer(stream).close();
+std::string HttpsClient::GetRequestSegmented(const std::string& filePath, const std::string& saveFilePath, bool& bad)
+{
+    RemoteFileInfo info;
+    auto message = HeadRequest(filePath, info, bad);
+    if(bad)
+    {
+        return message;
+    }
 
-    if(res.result() != boost::beast::http::status::ok)
+    if(!info.acceptRanges || config.segmentSize == 0 || info.size <= config.segmentSize)
+    {
+        return GetRequest(filePath, saveFilePath, bad);
+    }
+
+    int fd = ::open(saveFilePath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if(fd < 0)
     {
-        std::cout << "api-screen-recorder-server response is not ok" << std::endl ;
         bad = true;
-        res.body().close();
+        return std::strerror(errno);
+    }
 
-        //remove file if error 
+    // Место под файл целиком сразу: ENOSPC всплывет до скачивания, и файл не фрагментируется.
+    int rc = ::posix_fallocate(fd, 0, static_cast<off_t>(info.size));
+    if(rc == EOPNOTSUPP || rc == EINVAL)
+    {
+        rc = ::ftruncate(fd, static_cast<off_t>(info.size)) == 0 ? 0 : errno;
+    }
+    if(rc != 0)
+    {
+        ::close(fd);
         std::filesystem::remove(saveFilePath);
-        return "api-screen-recorder-server response is not ok";
+        bad = true;
+        return std::strerror(rc);
     }
 
-    res.body().close();
+    std::deque<Segment> queue;
+    for(std::uint64_t first = 0; first < info.size; first += config.segmentSize)
+    {
+        queue.push_back(Segment{first, std::min(first + config.segmentSize, info.size) - 1});
+    }
+
+    std::mutex mutex;
+    std::condition_variable changedQueue;
+    std::size_t inFlight = 0;
+    bool aborted = false;
+    std::string failure;
+
+    auto worker = [&]
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for(;;)
+        {
+            // Пустая очередь еще не конец: упавшую часть другой поток вернет обратно.
+            changedQueue.wait(lock, [&]{ return aborted || !queue.empty() || inFlight == 0; });
+            if(aborted || queue.empty())
+            {
+                return;
+            }
+            Segment segment = queue.front();
+            queue.pop_front();
+            ++inFlight;
+            lock.unlock();
+
+            bool changed = false;
+            std::string error;
+            bool ok = FetchSegment(filePath, fd, info, segment, changed, error);
+
+            lock.lock();
+            --inFlight;
+            if(!ok)
+            {
+                if(changed || ++segment.attempts >= std::max(1u, config.segmentAttempts))
+                {
+                    aborted = true;
+                    failure = error;
+                }
+                else
+                {
+                    LOG_WARN("Segment ", segment.first, "-", segment.last, " of ", filePath, " failed: ", error,
+                        ", retrying from ", segment.first + segment.done);
+                    queue.push_back(segment);
+                }
+            }
+            changedQueue.notify_all();
+        }
+    };
+
+    std::size_t threads = std::min({std::max<std::size_t>(1, config.segmentConnections), queue.size(),
+        pool.MaxConnections()});
+    // Расшифровка TLS - основная работа, поэтому каждое соединение обслуживает свой поток.
+    std::vector<std::thread> workers;
+    for(std::size_t i = 1; i < threads; ++i)
+    {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for(auto& thread : workers)
+    {
+        thread.join();
+    }
+
+    ::close(fd);
+    if(aborted)
+    {
+        LOG_ERROR("Segmented download of ", filePath, " failed: ", failure);
+        std::filesystem::remove(saveFilePath);
+        bad = true;
+        return failure;
+    }
     return std::string();
-}
\ No newline at end of file
+}
@@ -14,14 +14,50 @@
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <optional>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include "../../common/logger.hpp"
+#include "ConnectionPool.hpp"
+#include "DownloadJournal.hpp"
+#include "DownloadManager.hpp"
+#include "SegmentBody.hpp"
+
 struct Config {
   std::string rootCACertificate;
   std::string serverHost;
   std::string serverPort;
+  // Сколько keep-alive соединений держать к серверу (и предел параллельных скачиваний).
+  std::size_t maxConnections = 8;
+  // Через сколько мс простоя закрывать соединение (сервер ждет 30 с).
+  unsigned idleTimeoutMs = 15000;
+  // С какого числа параллельных скачиваний начинать GetBatch.
+  double initialConcurrency = 2;
+  // Таймаут на сетевую операцию при асинхронном скачивании, мс.
+  unsigned downloadTimeoutMs = 60000;
+  // Сколько соединений использовать для скачивания одного файла по частям.
+  std::size_t segmentConnections = 4;
+  // Размер части, байт. Файлы не больше одной части качаются обычным GET.
+  std::uint64_t segmentSize = 16 * 1024 * 1024;
+  // Сколько раз пробовать скачать часть, прежде чем сдаться.
+  unsigned segmentAttempts = 3;
+  // Сколько раз GetRequest переподключается и докачивает после обрыва.
+  unsigned resumeAttempts = 3;
+  // Как часто (в байтах) сохранять журнал докачки.
+  std::uint64_t journalInterval = 8 * 1024 * 1024;
+};
+
+/**
+ * @brief Что сервер сообщил о файле в ответ на HEAD.
+ */
+struct RemoteFileInfo {
+  std::uint64_t size = 0;
+  std::string etag;
+  std::string lastModified;
+  // Сервер отдает диапазоны (Accept-Ranges: bytes).
+  bool acceptRanges = false;
 };
 
 class HttpsClient {
@@ -46,11 +82,104 @@ class HttpsClient {
    * @param fileData информация о файле на локальном устройстве и на сервере
    * @param bad false, если прием прошел нормально
    * @param
+   * @details Соединение берется из пула и после ответа возвращается в него.
+   * Данные пишутся в saveFilePath.part, а скачанные отрезки и валидаторы файла -
+   * в журнал saveFilePath.journal. После обрыва запрашиваются только недостающие
+   * байты (до resumeAttempts раз, а затем - при следующем вызове с теми же
+   * путями). В конце сверяется размер и, если ETag - хеш содержимого, SHA-256;
+   * только после этого .part переименовывается в saveFilePath.
    */
   std::string GetRequest(const std::string& filePath,
                          const std::string& saveFilePath, bool& bad);
 
+  /**
+   * @brief Асинхронно скачивает файл
+   *
+   * @param filePath путь к файлу на сервере
+   * @param saveFilePath куда сохранить
+   * @param callback вызывается по завершении (из потока, выполняющего context.run())
+   * @details Работает на io_context клиента: пока context.run() не вызван, ничего не скачивается.
+   * Клиент должен жить до завершения всех скачиваний.
+   */
+  std::future<DownloadResult> AsyncGetRequest(const std::string& filePath,
+                                              const std::string& saveFilePath,
+                                              DownloadCallback callback = {});
+
+  /**
+   * @brief Скачивает список файлов параллельно
+   *
+   * @param files пары (путь на сервере, куда сохранить)
+   * @param callback вызывается для каждого файла по завершении
+   * @return future для каждого файла, в том же порядке
+   * @details Число одновременных скачиваний подстраивается под скорость и ошибки.
+   */
+  std::vector<std::future<DownloadResult>> GetBatch(
+      const std::vector<std::pair<std::string, std::string>>& files,
+      DownloadCallback callback = {});
+
+  /**
+   * @brief Узнает размер файла и его валидаторы запросом HEAD
+   *
+   * @param filePath путь к файлу на сервере
+   * @param info сюда пишется ответ сервера
+   * @param bad true, если файл недоступен
+   */
+  std::string HeadRequest(const std::string& filePath, RemoteFileInfo& info,
+                          bool& bad);
+
+  /**
+   * @brief Скачивает большой файл по частям через несколько соединений
+   *
+   * @param filePath путь к файлу на сервере
+   * @param saveFilePath куда сохранить (файл не должен существовать)
+   * @param bad true, если скачать не удалось (файл тогда удаляется)
+   * @details Размер узнается через HEAD, файл сразу создается нужного размера,
+   * части запрашиваются с Range и If-Range параллельно из segmentConnections
+   * потоков и пишутся на свое место через pwrite. Упавшая часть докачивается
+   * с места обрыва. Если сервер не отдает диапазоны - обычный GetRequest.
+   */
+  std::string GetRequestSegmented(const std::string& filePath,
+                                  const std::string& saveFilePath, bool& bad);
+
  private:
+  /**
+   * @brief Чем закончилась докачка.
+   */
+  enum class FetchStatus {
+    Done,   // файл скачан целиком
+    Retry,  // обрыв, можно докачать
+    Fatal   // сервер отказал, докачивать нечего
+  };
+
+  /**
+   * @brief Докачивает недостающие по журналу байты в fd
+   *
+   * @param journal журнал; в него записывается, что скачано
+   * @param error причина, если не Done
+   */
+  FetchStatus FetchMissing(const std::string& filePath, int fd,
+                           DownloadJournal& journal, std::string& error);
+
+  /**
+   * @brief Отрезок файла [first, last] и сколько из него уже скачано.
+   */
+  struct Segment {
+    std::uint64_t first = 0;
+    std::uint64_t last = 0;
+    std::uint64_t done = 0;
+    unsigned attempts = 0;
+  };
+
+  /**
+   * @brief Докачивает часть файла одним Range-запросом
+   *
+   * @param changed true, если файл на сервере изменился после HEAD
+   * @return true, если часть скачана целиком
+   */
+  bool FetchSegment(const std::string& filePath, int fd,
+                    const RemoteFileInfo& info, Segment& segment,
+                    bool& changed, std::string& error);
+
   //Для работы с https
   boost::asio::ssl::context ssl_context;
   //Для работы с IO
@@ -59,6 +188,11 @@ class HttpsClient {
   boost::asio::ip::tcp::resolver resolver;
   //Точка подключения к серверу
   boost::asio::ip::basic_resolver_results<boost::asio::ip::tcp> results;
+  Config config;
+  //Установленные соединения с keep-alive
+  ConnectionPool pool;
+  //Асинхронные скачивания
+  DownloadManager downloads;
 };
 
 #endif  // SOURCE_HTTPS_CLIENT
\ No newline at end of file
@@ -0,0 +1,52 @@
+#include "SegmentBody.hpp"
+
+#include <unistd.h>
+#include <cerrno>
+
+void SegmentBody::reader::init(const boost::optional<std::uint64_t>& contentLength, boost::beast::error_code& ec)
+{
+    if(body.fd < 0)
+    {
+        ec = boost::beast::errc::make_error_code(boost::beast::errc::bad_file_descriptor);
+        return;
+    }
+    if(contentLength && *contentLength > body.length - body.written)
+    {
+        ec = boost::beast::http::error::body_limit;
+        return;
+    }
+    ec = {};
+}
+
+std::size_t SegmentBody::reader::Write(const char* data, std::size_t size, boost::beast::error_code& ec)
+{
+    if(size > body.length - body.written)
+    {
+        ec = boost::beast::http::error::body_limit;
+        return 0;
+    }
+
+    std::size_t done = 0;
+    while(done < size)
+    {
+        ssize_t n = ::pwrite(body.fd, data + done, size - done, static_cast<off_t>(body.offset + body.written));
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            ec.assign(errno, boost::system::system_category());
+            return done;
+        }
+        done += static_cast<std::size_t>(n);
+        body.written += static_cast<std::uint64_t>(n);
+    }
+    ec = {};
+    return done;
+}
+
+void SegmentBody::reader::finish(boost::beast::error_code& ec)
+{
+    ec = {};
+}
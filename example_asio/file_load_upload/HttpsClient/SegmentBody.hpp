@@ -0,0 +1,70 @@
+#ifndef SEGMENT_BODY_HPP
+#define SEGMENT_BODY_HPP
+
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/optional.hpp>
+#include <cstdint>
+
+/**
+ * @brief Тело ответа, которое пишется в уже открытый файл с заданного смещения.
+ * @details В отличие от file_body, данные пишутся через pwrite, поэтому
+ * несколько потоков могут одновременно заполнять разные отрезки одного файла.
+ * Больше length байт тело не принимает (ошибка body_limit).
+ */
+struct SegmentBody
+{
+    struct value_type
+    {
+        // Дескриптор файла, открытого на запись. Тело его не закрывает.
+        int fd = -1;
+        // Куда в файле писать первый байт.
+        std::uint64_t offset = 0;
+        // Сколько байт ожидается.
+        std::uint64_t length = 0;
+        // Сколько уже записано.
+        std::uint64_t written = 0;
+    };
+
+    class reader
+    {
+    public:
+        template<bool isRequest, class Fields>
+        reader(boost::beast::http::header<isRequest, Fields>& h, value_type& b)
+            : body(b)
+        {
+            boost::ignore_unused(h);
+        }
+
+        void init(const boost::optional<std::uint64_t>& contentLength, boost::beast::error_code& ec);
+
+        template<class ConstBufferSequence>
+        std::size_t put(const ConstBufferSequence& buffers, boost::beast::error_code& ec)
+        {
+            std::size_t total = 0;
+            for(auto it = boost::asio::buffer_sequence_begin(buffers);
+                it != boost::asio::buffer_sequence_end(buffers); ++it)
+            {
+                boost::asio::const_buffer buffer = *it;
+                total += Write(static_cast<const char*>(buffer.data()), buffer.size(), ec);
+                if(ec)
+                {
+                    return total;
+                }
+            }
+            return total;
+        }
+
+        void finish(boost::beast::error_code& ec);
+    private:
+        /**
+         * @brief Пишет кусок тела в файл.
+         * @return Сколько байт записано.
+         */
+        std::size_t Write(const char* data, std::size_t size, boost::beast::error_code& ec);
+
+        value_type& body;
+    };
+};
+
+#endif//SEGMENT_BODY_HPP
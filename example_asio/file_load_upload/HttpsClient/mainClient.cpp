@@ -3,11 +3,15 @@
 #include <chrono>
 #include <iostream>
 #include <thread>
+#include <utility>
 
+#include <boost/asio/co_spawn.hpp>
+
+#include "./AsyncHttpsClient.hpp"
 #include "./HttpsClient.hpp"
 
 
-int main() {
+int main(int argc, char* argv[]) {
   boost::asio::io_context ioContext {1};
   Config config;
 
@@ -26,10 +30,78 @@ int main() {
   // show json
   // std::cout << "i send ->" << boost::json::serialize(message) << std::endl;
 
+  if (argc > 2 && std::string(argv[1]) == "--async") {
+    // HttpsClient --async /remote/a.txt /remote/b.txt ... - все файлы
+    // одновременно корутинами в одном потоке.
+    AsyncHttpsClient asyncClient(ioContext, config);
+    int failed = 0;
+    for (int i = 2; i < argc; ++i) {
+      boost::asio::co_spawn(
+          ioContext,
+          [&asyncClient, &failed, path = std::string(argv[i])]()
+              -> boost::asio::awaitable<void> {
+            std::ofstream file(std::filesystem::path(path).filename(),
+                               std::ios::binary);
+            auto response = co_await asyncClient.Get(
+                path, [&file](std::string_view chunk) {
+                  file.write(chunk.data(), chunk.size());
+                });
+            if (response.header.result() != boost::beast::http::status::ok) {
+              ++failed;
+            }
+            LOG_INFO(path, " ", response.header.result_int(), " ",
+                     response.bytes);
+          },
+          [&failed](std::exception_ptr error) {
+            if (error) {
+              ++failed;
+              try {
+                std::rethrow_exception(error);
+              } catch (const std::exception& e) {
+                LOG_ERROR(e.what());
+              }
+            }
+          });
+    }
+    ioContext.run();
+    return failed == 0 ? 0 : 1;
+  }
+
   HttpsClient client(ioContext, config);
 
   bool isBad = true;
 
+  if (argc == 3 && std::string(argv[1]) == "--segmented") {
+    // HttpsClient --segmented /remote/big.bin - один большой файл
+    // кусками по нескольким соединениям.
+    client.GetRequestSegmented(
+        argv[2], std::filesystem::path(argv[2]).filename().string(), isBad);
+    return isBad ? 1 : 0;
+  }
+
+  if (argc > 1) {
+    // HttpsClient /remote/a.txt /remote/b.txt ... - скачать все параллельно
+    // в текущий каталог.
+    std::vector<std::pair<std::string, std::string>> files;
+    for (int i = 1; i < argc; ++i) {
+      files.emplace_back(argv[i],
+                         std::filesystem::path(argv[i]).filename().string());
+    }
+
+    auto results = client.GetBatch(files, [](const DownloadResult& result) {
+      LOG_INFO(result.remotePath, result.bad ? " failed: " : " ok ",
+               result.bad ? result.error : std::to_string(result.bytes));
+    });
+
+    ioContext.run();
+
+    int failed = 0;
+    for (auto& result : results) {
+      failed += result.get().bad ? 1 : 0;
+    }
+    return failed == 0 ? 0 : 1;
+  }
+
   ioContext.run();
 
   // send message in Post reauest
@@ -0,0 +1,68 @@
+#include "AdmissionControl.hpp"
+
+#include <utility>
+
+AdmissionControl::Slot::Slot(AdmissionControl* owner)
+    : owner(owner)
+{
+
+}
+
+AdmissionControl::Slot::Slot(Slot&& other) noexcept
+    : owner(std::exchange(other.owner, nullptr))
+{
+
+}
+
+AdmissionControl::Slot& AdmissionControl::Slot::operator=(Slot&& other) noexcept
+{
+    if(this != &other)
+    {
+        if(owner)
+        {
+            owner->active.fetch_sub(1, std::memory_order_relaxed);
+        }
+        owner = std::exchange(other.owner, nullptr);
+    }
+    return *this;
+}
+
+AdmissionControl::Slot::~Slot()
+{
+    if(owner)
+    {
+        owner->active.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+AdmissionControl::Slot::operator bool() const
+{
+    return owner != nullptr;
+}
+
+AdmissionControl::AdmissionControl(std::size_t limit)
+    : limit(limit)
+{
+
+}
+
+AdmissionControl::Slot AdmissionControl::TryAdmit()
+{
+    std::size_t previous = active.fetch_add(1, std::memory_order_relaxed);
+    if(limit != 0 && previous >= limit)
+    {
+        active.fetch_sub(1, std::memory_order_relaxed);
+        return Slot();
+    }
+    return Slot(this);
+}
+
+std::size_t AdmissionControl::Active() const
+{
+    return active.load(std::memory_order_relaxed);
+}
+
+std::size_t AdmissionControl::Limit() const
+{
+    return limit;
+}
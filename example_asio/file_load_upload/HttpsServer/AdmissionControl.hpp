@@ -0,0 +1,66 @@
+#ifndef ADMISSION_CONTROL_HPP
+#define ADMISSION_CONTROL_HPP
+
+#include <atomic>
+#include <cstddef>
+
+/**
+ * @brief Ограничение числа одновременно обслуживаемых сессий.
+ * @details Место под сессию занимается при accept и освобождается, когда
+ * сессия завершается (Slot живет в сессии). Подключение сверх предела
+ * закрывается сразу, до TLS-рукопожатия, - так наплыв подключений не
+ * отнимает память и процессор у уже открытых сессий. Один объект
+ * разделяют все потоки и шарды сервера.
+ */
+class AdmissionControl
+{
+public:
+    /**
+     * @brief Занятое место; освобождает его при разрушении.
+     */
+    class Slot
+    {
+    public:
+        Slot() = default;
+        Slot(Slot&& other) noexcept;
+        Slot& operator=(Slot&& other) noexcept;
+        ~Slot();
+
+        Slot(const Slot&) = delete;
+        Slot& operator=(const Slot&) = delete;
+
+        /**
+         * @brief Занято ли место.
+         */
+        explicit operator bool() const;
+    private:
+        friend class AdmissionControl;
+
+        explicit Slot(AdmissionControl* owner);
+
+        AdmissionControl* owner = nullptr;
+    };
+
+    /**
+     * @brief Конструктор.
+     * @param limit Сколько сессий обслуживать одновременно (0 - без ограничения).
+     */
+    explicit AdmissionControl(std::size_t limit);
+
+    AdmissionControl(const AdmissionControl&) = delete;
+    AdmissionControl& operator=(const AdmissionControl&) = delete;
+
+    /**
+     * @brief Занимает место под новую сессию.
+     * @return Пустой Slot, если предел уже достигнут.
+     */
+    Slot TryAdmit();
+
+    std::size_t Active() const;
+    std::size_t Limit() const;
+private:
+    const std::size_t limit;
+    std::atomic<std::size_t> active{0};
+};
+
+#endif//ADMISSION_CONTROL_HPP
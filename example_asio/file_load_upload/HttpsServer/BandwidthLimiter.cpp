@@ -0,0 +1,179 @@
+#include "BandwidthLimiter.hpp"
+
+#include <algorithm>
+
+namespace
+{
+    // Границы порции, байт: мельче - лишние записи, крупнее - рывки на медленных корзинах.
+    constexpr std::size_t minChunk = 4 * 1024;
+    constexpr std::size_t maxChunk = 64 * 1024;
+}
+
+TokenBucket::TokenBucket(std::uint64_t rate, std::uint64_t burst)
+    : rate(static_cast<double>(rate))
+    , burst(static_cast<double>(burst))
+    , tokens(static_cast<double>(burst))
+    , last(Clock::now())
+{
+
+}
+
+void TokenBucket::Refill(Clock::time_point now)
+{
+    if(now <= last)
+    {
+        return;
+    }
+    double seconds = std::chrono::duration<double>(now - last).count();
+    tokens = std::min(burst, tokens + seconds * rate);
+    last = now;
+}
+
+void TokenBucket::Consume(std::uint64_t bytes, Clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Refill(now);
+    tokens -= static_cast<double>(bytes);
+}
+
+TokenBucket::Clock::duration TokenBucket::Wait(Clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Refill(now);
+    if(tokens >= 0)
+    {
+        return Clock::duration::zero();
+    }
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(-tokens / rate));
+}
+
+bool TokenBucket::Full(Clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Refill(now);
+    return tokens >= burst;
+}
+
+std::uint64_t TokenBucket::Rate() const
+{
+    return static_cast<std::uint64_t>(rate);
+}
+
+bool BandwidthShare::Limited() const
+{
+    return count > 0;
+}
+
+BandwidthShare::Clock::duration BandwidthShare::Wait(Clock::time_point now) const
+{
+    auto wait = Clock::duration::zero();
+    for(std::size_t i = 0; i < count; ++i)
+    {
+        wait = std::max(wait, buckets[i]->Wait(now));
+    }
+    return wait;
+}
+
+void BandwidthShare::Consume(std::uint64_t bytes, Clock::time_point now) const
+{
+    for(std::size_t i = 0; i < count; ++i)
+    {
+        buckets[i]->Consume(bytes, now);
+    }
+}
+
+std::size_t BandwidthShare::Chunk() const
+{
+    return chunk;
+}
+
+void BandwidthShare::Add(std::shared_ptr<TokenBucket> bucket)
+{
+    if(!bucket)
+    {
+        return;
+    }
+    auto size = static_cast<std::size_t>(std::clamp<std::uint64_t>(bucket->Rate() / 8, minChunk, maxChunk));
+    chunk = count == 0 ? size : std::min(chunk, size);
+    buckets[count++] = std::move(bucket);
+}
+
+BandwidthLimiter::BandwidthLimiter(std::uint64_t globalRate, std::vector<BandwidthRule> rules,
+    std::chrono::milliseconds burst)
+    : burst(burst)
+{
+    if(globalRate > 0)
+    {
+        global = MakeBucket(globalRate);
+    }
+
+    routes.reserve(rules.size());
+    for(auto& rule : rules)
+    {
+        auto bucket = rule.routeRate > 0 ? MakeBucket(rule.routeRate) : nullptr;
+        routes.push_back({std::move(rule), std::move(bucket)});
+    }
+}
+
+std::shared_ptr<TokenBucket> BandwidthLimiter::MakeBucket(std::uint64_t rate) const
+{
+    // Запас не меньше самой крупной порции, иначе каждая порция уходила бы в долг.
+    auto size = std::max<std::uint64_t>(rate * static_cast<std::uint64_t>(burst.count()) / 1000, maxChunk);
+    return std::make_shared<TokenBucket>(rate, size);
+}
+
+BandwidthShare BandwidthLimiter::Acquire(std::string_view target, const boost::asio::ip::address& client)
+{
+    BandwidthShare share;
+    share.Add(global);
+
+    for(std::size_t r = 0; r < routes.size(); ++r)
+    {
+        const auto& route = routes[r];
+        if(target.substr(0, route.rule.prefix.size()) != route.rule.prefix)
+        {
+            continue;
+        }
+
+        share.Add(route.bucket);
+        if(route.rule.clientRate > 0)
+        {
+            auto now = TokenBucket::Clock::now();
+            std::lock_guard<std::mutex> lock(mutex);
+            auto& bucket = clients[{r, client}];
+            if(!bucket)
+            {
+                bucket = MakeBucket(route.rule.clientRate);
+            }
+            share.Add(bucket);
+            if(clients.size() >= sweepAt)
+            {
+                Sweep(now);
+            }
+        }
+        break;
+    }
+    return share;
+}
+
+void BandwidthLimiter::Sweep(TokenBucket::Clock::time_point now)
+{
+    for(auto it = clients.begin(); it != clients.end();)
+    {
+        if(it->second.use_count() == 1 && it->second->Full(now))
+        {
+            it = clients.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    sweepAt = std::max<std::size_t>(1024, clients.size() * 2);
+}
+
+std::size_t BandwidthLimiter::Clients() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return clients.size();
+}
@@ -0,0 +1,169 @@
+#ifndef BANDWIDTH_LIMITER_HPP
+#define BANDWIDTH_LIMITER_HPP
+
+#include <boost/asio/ip/address.hpp>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Ограничение скорости отдачи для маршрута.
+ */
+struct BandwidthRule
+{
+    // Префикс target, к которому относится правило (например "/v1/download").
+    std::string prefix;
+    // Предел для одного IP клиента, байт/с (0 - без ограничения).
+    std::uint64_t clientRate = 0;
+    // Предел на весь маршрут, байт/с (0 - без ограничения).
+    std::uint64_t routeRate = 0;
+};
+
+/**
+ * @brief Корзина токенов, в которой можно уйти в долг.
+ * @details Сессия пишет порцию, а потом списывает отправленные байты, и
+ * баланс может стать отрицательным. Следующая порция ждет, пока долг не
+ * погасится. Так не нужно знать заранее, сколько возьмет сокет, а средняя
+ * скорость все равно не выше rate. Одну корзину делят сессии из разных
+ * потоков, поэтому методы потокобезопасны.
+ */
+class TokenBucket
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief Конструктор. Корзина создается полной.
+     * @param rate Скорость, байт/с.
+     * @param burst Сколько байт можно отправить подряд после простоя.
+     */
+    TokenBucket(std::uint64_t rate, std::uint64_t burst);
+
+    TokenBucket(const TokenBucket&) = delete;
+    TokenBucket& operator=(const TokenBucket&) = delete;
+
+    /**
+     * @brief Списывает отправленные байты.
+     */
+    void Consume(std::uint64_t bytes, Clock::time_point now);
+    /**
+     * @brief Сколько ждать, пока баланс не станет неотрицательным (0 - можно писать).
+     */
+    Clock::duration Wait(Clock::time_point now);
+    /**
+     * @brief Полна ли корзина (новая корзина вела бы себя так же).
+     */
+    bool Full(Clock::time_point now);
+
+    std::uint64_t Rate() const;
+private:
+    /**
+     * @brief Начисляет токены за время с прошлого обращения. Вызывается под mutex.
+     */
+    void Refill(Clock::time_point now);
+
+    const double rate;
+    const double burst;
+
+    std::mutex mutex;
+    double tokens;
+    Clock::time_point last;
+};
+
+/**
+ * @brief Корзины, через которые идет один ответ: клиента, маршрута и общая.
+ * @details Пустой объект (Limited() == false) ничего не ограничивает.
+ */
+class BandwidthShare
+{
+public:
+    using Clock = TokenBucket::Clock;
+
+    bool Limited() const;
+    /**
+     * @brief Сколько ждать перед следующей порцией: наибольшее ожидание среди корзин.
+     */
+    Clock::duration Wait(Clock::time_point now) const;
+    /**
+     * @brief Списывает отправленные байты со всех корзин.
+     */
+    void Consume(std::uint64_t bytes, Clock::time_point now) const;
+    /**
+     * @brief Сколько байт писать за раз: около 1/8 секунды самой медленной корзины.
+     */
+    std::size_t Chunk() const;
+private:
+    friend class BandwidthLimiter;
+
+    void Add(std::shared_ptr<TokenBucket> bucket);
+
+    std::array<std::shared_ptr<TokenBucket>, 3> buckets;
+    std::size_t count = 0;
+    std::size_t chunk = 0;
+};
+
+/**
+ * @brief Ограничение скорости отдачи файлов: общее, по маршрутам и по IP клиента.
+ * @details Правило маршрута выбирается по первому совпавшему префиксу target.
+ * Корзины клиентов живут в таблице по (правило, адрес), так что все
+ * соединения одного клиента делят одну скорость. Корзина удаляется из
+ * таблицы, когда ее никто не держит и она снова полна - новая на ее месте
+ * вела бы себя так же. Объект разделяют все потоки и шарды сервера.
+ */
+class BandwidthLimiter
+{
+public:
+    /**
+     * @brief Конструктор.
+     * @param globalRate Общий предел для всех ответов с файлами, байт/с (0 - без ограничения).
+     * @param rules Правила маршрутов.
+     * @param burst Сколько времени простоя копит корзина.
+     */
+    BandwidthLimiter(std::uint64_t globalRate, std::vector<BandwidthRule> rules, std::chrono::milliseconds burst);
+
+    BandwidthLimiter(const BandwidthLimiter&) = delete;
+    BandwidthLimiter& operator=(const BandwidthLimiter&) = delete;
+
+    /**
+     * @brief Корзины для ответа на запрос.
+     * @param target target запроса.
+     * @param client Адрес клиента.
+     */
+    BandwidthShare Acquire(std::string_view target, const boost::asio::ip::address& client);
+    /**
+     * @brief Сколько корзин клиентов сейчас в таблице.
+     */
+    std::size_t Clients() const;
+private:
+    struct Route
+    {
+        BandwidthRule rule;
+        std::shared_ptr<TokenBucket> bucket;
+    };
+
+    /**
+     * @brief Корзина из rate байт/с с запасом на burst.
+     */
+    std::shared_ptr<TokenBucket> MakeBucket(std::uint64_t rate) const;
+    /**
+     * @brief Убирает корзины, которые никто не держит и которые снова полны. Вызывается под mutex.
+     */
+    void Sweep(TokenBucket::Clock::time_point now);
+
+    std::chrono::milliseconds burst;
+    std::shared_ptr<TokenBucket> global;
+    std::vector<Route> routes;
+
+    mutable std::mutex mutex;
+    std::map<std::pair<std::size_t, boost::asio::ip::address>, std::shared_ptr<TokenBucket>> clients;
+    std::size_t sweepAt = 1024;
+};
+
+#endif//BANDWIDTH_LIMITER_HPP
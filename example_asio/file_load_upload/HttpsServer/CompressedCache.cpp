@@ -0,0 +1,442 @@
+#include "CompressedCache.hpp"
+
+#include <boost/beast/zlib/deflate_stream.hpp>
+#include <unistd.h>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+    std::array<std::uint32_t, 256> MakeCrcTable()
+    {
+        std::array<std::uint32_t, 256> table{};
+        for(std::uint32_t i = 0; i < 256; ++i)
+        {
+            std::uint32_t c = i;
+            for(int k = 0; k < 8; ++k)
+            {
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        return table;
+    }
+
+    std::uint32_t Crc32(const char* data, std::size_t size)
+    {
+        static const auto table = MakeCrcTable();
+        std::uint32_t crc = 0xffffffffu;
+        for(std::size_t i = 0; i < size; ++i)
+        {
+            crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xff] ^ (crc >> 8);
+        }
+        return crc ^ 0xffffffffu;
+    }
+
+    std::uint32_t Adler32(const char* data, std::size_t size)
+    {
+        // 5552 - наибольший блок, при котором сумма не переполняет 32 бита.
+        std::uint32_t a = 1;
+        std::uint32_t b = 0;
+        while(size > 0)
+        {
+            std::size_t block = size < 5552 ? size : 5552;
+            size -= block;
+            while(block-- > 0)
+            {
+                a += static_cast<unsigned char>(*data++);
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+        }
+        return (b << 16) | a;
+    }
+
+    std::uint64_t Mix(std::uint64_t x)
+    {
+        // splitmix64
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    bool ReadAll(int fd, char* data, std::size_t size)
+    {
+        std::size_t done = 0;
+        while(done < size)
+        {
+            ssize_t n = ::pread(fd, data + done, size - done, static_cast<off_t>(done));
+            if(n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if(n <= 0)
+            {
+                return false;
+            }
+            done += static_cast<std::size_t>(n);
+        }
+        return true;
+    }
+}
+
+ContentCoding ContentEncoder::Negotiate(boost::beast::string_view acceptEncoding)
+{
+    std::string_view header(acceptEncoding.data(), acceptEncoding.size());
+
+    auto trim = [](std::string_view v)
+    {
+        while(!v.empty() && (v.front() == ' ' || v.front() == '\t'))
+        {
+            v.remove_prefix(1);
+        }
+        while(!v.empty() && (v.back() == ' ' || v.back() == '\t'))
+        {
+            v.remove_suffix(1);
+        }
+        return v;
+    };
+
+    // q хранится в тысячных, -1 - кодирование не упомянуто.
+    int gzip = -1;
+    int deflate = -1;
+    int any = -1;
+
+    while(!header.empty())
+    {
+        auto comma = header.find(',');
+        std::string_view item = trim(header.substr(0, comma));
+        header = comma == std::string_view::npos ? std::string_view{} : header.substr(comma + 1);
+
+        auto semicolon = item.find(';');
+        std::string_view name = trim(item.substr(0, semicolon));
+        int q = 1000;
+        if(semicolon != std::string_view::npos)
+        {
+            std::string_view param = trim(item.substr(semicolon + 1));
+            if(param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=')
+            {
+                param.remove_prefix(2);
+                // q-value: "0", "1", "0.5", "0.125"
+                q = 0;
+                if(!param.empty() && param[0] == '1')
+                {
+                    q = 1000;
+                }
+                else if(param.size() > 2 && param[0] == '0' && param[1] == '.')
+                {
+                    int scale = 100;
+                    for(std::size_t i = 2; i < param.size() && i < 5 && param[i] >= '0' && param[i] <= '9'; ++i)
+                    {
+                        q += (param[i] - '0') * scale;
+                        scale /= 10;
+                    }
+                }
+            }
+        }
+
+        if(boost::beast::iequals(boost::beast::string_view(name.data(), name.size()), "gzip")
+            || boost::beast::iequals(boost::beast::string_view(name.data(), name.size()), "x-gzip"))
+        {
+            gzip = q;
+        }
+        else if(boost::beast::iequals(boost::beast::string_view(name.data(), name.size()), "deflate"))
+        {
+            deflate = q;
+        }
+        else if(name == "*")
+        {
+            any = q;
+        }
+    }
+
+    if(gzip < 0)
+    {
+        gzip = any;
+    }
+    if(deflate < 0)
+    {
+        deflate = any;
+    }
+
+    // При равном весе предпочитаем gzip - его понимают все клиенты.
+    if(gzip > 0 && gzip >= deflate)
+    {
+        return ContentCoding::Gzip;
+    }
+    if(deflate > 0)
+    {
+        return ContentCoding::Deflate;
+    }
+    return ContentCoding::Identity;
+}
+
+const char* ContentEncoder::Name(ContentCoding coding)
+{
+    switch(coding)
+    {
+    case ContentCoding::Gzip:
+        return "gzip";
+    case ContentCoding::Deflate:
+        return "deflate";
+    default:
+        return "identity";
+    }
+}
+
+std::shared_ptr<MemoryBlob> ContentEncoder::Encode(ContentCoding coding, const char* data, std::size_t size, int level)
+{
+    if(coding == ContentCoding::Identity)
+    {
+        return nullptr;
+    }
+
+    boost::beast::zlib::deflate_stream ds;
+    ds.reset(level, 15, 8, boost::beast::zlib::Strategy::normal);
+
+    std::size_t head = coding == ContentCoding::Gzip ? 10 : 2;
+    std::size_t trail = coding == ContentCoding::Gzip ? 8 : 4;
+    std::vector<unsigned char> out(head + ds.upper_bound(size) + trail);
+
+    if(coding == ContentCoding::Gzip)
+    {
+        // ID1 ID2 CM=deflate FLG=0 MTIME=0 XFL=0 OS=unix
+        const unsigned char header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+        std::memcpy(out.data(), header, sizeof(header));
+    }
+    else
+    {
+        // CMF: deflate с окном 32 КБ, FLG подобран так, чтобы CMF*256+FLG делилось на 31.
+        out[0] = 0x78;
+        out[1] = 0x9c;
+    }
+
+    boost::beast::zlib::z_params zs;
+    zs.next_in = data;
+    zs.avail_in = size;
+    zs.next_out = out.data() + head;
+    zs.avail_out = out.size() - head - trail;
+
+    boost::beast::error_code ec;
+    ds.write(zs, boost::beast::zlib::Flush::finish, ec);
+    if(ec != boost::beast::zlib::error::end_of_stream || zs.avail_in != 0)
+    {
+        return nullptr;
+    }
+
+    std::size_t length = head + zs.total_out;
+    unsigned char* p = out.data() + length;
+    if(coding == ContentCoding::Gzip)
+    {
+        std::uint32_t crc = Crc32(data, size);
+        std::uint32_t isize = static_cast<std::uint32_t>(size);
+        for(int i = 0; i < 4; ++i)
+        {
+            p[i] = static_cast<unsigned char>(crc >> (8 * i));
+            p[4 + i] = static_cast<unsigned char>(isize >> (8 * i));
+        }
+    }
+    else
+    {
+        std::uint32_t adler = Adler32(data, size);
+        for(int i = 0; i < 4; ++i)
+        {
+            p[i] = static_cast<unsigned char>(adler >> (24 - 8 * i));
+        }
+    }
+    length += trail;
+
+    auto blob = std::make_shared<MemoryBlob>();
+    blob->size = length;
+    blob->data.reset(new char[length]);
+    std::memcpy(blob->data.get(), out.data(), length);
+    return blob;
+}
+
+// ###############################  CACHE
+
+std::size_t CompressedCache::KeyHash::operator()(const Key& key) const
+{
+    return static_cast<std::size_t>(Mix(static_cast<std::uint64_t>(key.inode)
+        ^ Mix(static_cast<std::uint64_t>(key.device) + static_cast<std::uint64_t>(key.coding))));
+}
+
+CompressedCache::CompressedCache(std::size_t budget, std::size_t maxFileSize, int level)
+    : budget(budget)
+    , maxFileSize(maxFileSize)
+    , level(level < 1 ? 1 : (level > 9 ? 9 : level))
+{
+
+}
+
+void CompressedCache::Erase(std::list<Node>::iterator node)
+{
+    used -= node->blob->size;
+    index.erase(node->key);
+    lru.erase(node);
+}
+
+void CompressedCache::Remember(const Key& key, const CachedFile& file, bool worth)
+{
+    if(verdicts.size() >= verdictCapacity && verdicts.find(key) == verdicts.end())
+    {
+        verdicts.clear();
+    }
+    verdicts[key] = VerdictNode{file.Size(), file.ModifiedTimeSpec(), worth};
+}
+
+CompressedCache::Verdict CompressedCache::Check(const CachedFile& file, ContentCoding coding) const
+{
+    if(coding == ContentCoding::Identity || file.Size() > maxFileSize)
+    {
+        return Verdict::NotWorth;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = verdicts.find(Key{file.Device(), file.Inode(), coding});
+    if(it == verdicts.end()
+        || it->second.sourceSize != file.Size()
+        || it->second.modified.tv_sec != file.ModifiedTimeSpec().tv_sec
+        || it->second.modified.tv_nsec != file.ModifiedTimeSpec().tv_nsec)
+    {
+        return Verdict::Unknown;
+    }
+    return it->second.worth ? Verdict::Worth : Verdict::NotWorth;
+}
+
+std::shared_ptr<const MemoryBlob> CompressedCache::Get(const CachedFile& file, const MemoryBlob* source, ContentCoding coding)
+{
+    if(Check(file, coding) == Verdict::NotWorth)
+    {
+        return nullptr;
+    }
+
+    Key key{file.Device(), file.Inode(), coding};
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if(it != index.end())
+        {
+            auto node = it->second;
+            const auto& blob = *node->blob;
+            if(node->sourceSize == file.Size()
+                && blob.modified.tv_sec == file.ModifiedTimeSpec().tv_sec
+                && blob.modified.tv_nsec == file.ModifiedTimeSpec().tv_nsec)
+            {
+                ++hits;
+                lru.splice(lru.begin(), lru, node);
+                return node->blob;
+            }
+            Erase(node);
+        }
+        ++misses;
+    }
+
+    std::unique_ptr<char[]> own;
+    const char* data = nullptr;
+    std::size_t size = static_cast<std::size_t>(file.Size());
+    if(source && source->size == size)
+    {
+        data = source->data.get();
+    }
+    else
+    {
+        own.reset(new char[size == 0 ? 1 : size]);
+        if(!ReadAll(file.NativeHandle(), own.get(), size))
+        {
+            return nullptr;
+        }
+        data = own.get();
+    }
+
+    std::shared_ptr<MemoryBlob> blob = ContentEncoder::Encode(coding, data, size, level);
+    if(!blob)
+    {
+        return nullptr;
+    }
+    blob->device = file.Device();
+    blob->inode = file.Inode();
+    blob->modified = file.ModifiedTimeSpec();
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Сжатие ничего не дало - отдаем как есть, чтобы не тратить на это CPU у клиента.
+    // Не влезающий в бюджет вариант пришлось бы сжимать на каждый запрос - тоже как есть.
+    if(blob->size >= size || blob->size > budget)
+    {
+        Remember(key, file, false);
+        return nullptr;
+    }
+    Remember(key, file, true);
+
+    auto it = index.find(key);
+    if(it != index.end())
+    {
+        return it->second->blob;
+    }
+
+    while(used + blob->size > budget && !lru.empty())
+    {
+        Erase(std::prev(lru.end()));
+    }
+
+    used += blob->size;
+    lru.push_front(Node{key, file.Size(), blob});
+    index.emplace(key, lru.begin());
+
+    return blob;
+}
+
+void CompressedCache::Invalidate(dev_t device, ino_t inode)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for(auto coding : {ContentCoding::Gzip, ContentCoding::Deflate})
+    {
+        auto it = index.find(Key{device, inode, coding});
+        if(it != index.end())
+        {
+            Erase(it->second);
+        }
+        verdicts.erase(Key{device, inode, coding});
+    }
+}
+
+void CompressedCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    index.clear();
+    lru.clear();
+    verdicts.clear();
+    used = 0;
+}
+
+std::uint64_t CompressedCache::Hits() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return hits;
+}
+
+std::uint64_t CompressedCache::Misses() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return misses;
+}
+
+std::size_t CompressedCache::UsedBytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return used;
+}
+
+std::size_t CompressedCache::Count() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return lru.size();
+}
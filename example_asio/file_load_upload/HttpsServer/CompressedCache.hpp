@@ -0,0 +1,173 @@
+#ifndef COMPRESSED_CACHE_HPP
+#define COMPRESSED_CACHE_HPP
+
+#include <boost/beast/core/string.hpp>
+#include <sys/types.h>
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "FileCache.hpp"
+#include "MemoryCache.hpp"
+
+/**
+ * @brief Кодирование тела ответа (Content-Encoding).
+ */
+enum class ContentCoding
+{
+    Identity,
+    Gzip,
+    Deflate
+};
+
+/**
+ * @brief Сжатие тела в формате gzip (RFC 1952) или zlib (RFC 1950, "deflate" в HTTP).
+ * @details Сам deflate делает beast::zlib::deflate_stream - он выдает "голый"
+ * поток без обертки, поэтому заголовок и контрольную сумму дописываем сами.
+ */
+class ContentEncoder
+{
+public:
+    /**
+     * @brief Выбирает кодирование по заголовку Accept-Encoding.
+     * @param acceptEncoding Значение заголовка (пустое - только identity).
+     * @return Gzip или Deflate, если клиент их принимает, иначе Identity.
+     */
+    static ContentCoding Negotiate(boost::beast::string_view acceptEncoding);
+    /**
+     * @brief Имя кодирования для заголовка Content-Encoding.
+     */
+    static const char* Name(ContentCoding coding);
+    /**
+     * @brief Сжимает буфер.
+     * @param coding Gzip или Deflate.
+     * @param data Исходные данные.
+     * @param size Их размер.
+     * @param level Уровень сжатия 1..9.
+     * @return Сжатые данные или nullptr при ошибке.
+     */
+    static std::shared_ptr<MemoryBlob> Encode(ContentCoding coding, const char* data, std::size_t size, int level);
+};
+
+/**
+ * @brief Ограниченный по памяти LRU-кеш сжатых вариантов файлов.
+ * @details Ключ - устройство, inode и кодирование; запись сверяется с файлом
+ * по размеру и mtime, так что измененный файл сжимается заново. Сжатие
+ * выполняется вне блокировки: если два потока одновременно сжали один файл,
+ * в кеше остается первый результат. Кроме самих данных кеш помнит, стоит
+ * ли файл сжимать: файл, который не сжался или не влез в бюджет, больше не
+ * читается и не сжимается, пока не изменится.
+ */
+class CompressedCache
+{
+public:
+    /**
+     * @brief Что известно о пользе сжатия версии файла.
+     */
+    enum class Verdict
+    {
+        Unknown,    // файл еще не сжимали
+        Worth,      // сжатый вариант меньше исходного и помещается в бюджет
+        NotWorth    // отдается как есть
+    };
+
+    /**
+     * @brief Конструктор.
+     * @param budget Сколько байт сжатых данных держать (0 - на лету не сжимаем, только .gz рядом с файлом).
+     * @param maxFileSize Файлы больше этого размера на лету не сжимаются.
+     * @param level Уровень сжатия 1..9.
+     */
+    CompressedCache(std::size_t budget, std::size_t maxFileSize, int level);
+    /**
+     * @brief Возвращает сжатый вариант файла, при необходимости сжимая его.
+     * @param file Открытый и уже сверенный с диском файл.
+     * @param source Содержимое файла, если оно уже в памяти (иначе читаем сами).
+     * @param coding Gzip или Deflate.
+     * @return Сжатые данные или nullptr, если файл отдается как есть.
+     */
+    std::shared_ptr<const MemoryBlob> Get(const CachedFile& file, const MemoryBlob* source, ContentCoding coding);
+    /**
+     * @brief Стоит ли сжимать файл, не читая и не сжимая его.
+     * @param file Открытый и уже сверенный с диском файл.
+     * @param coding Gzip или Deflate.
+     */
+    Verdict Check(const CachedFile& file, ContentCoding coding) const;
+    /**
+     * @brief Убирает сжатые варианты файла.
+     */
+    void Invalidate(dev_t device, ino_t inode);
+    /**
+     * @brief Убирает все записи.
+     */
+    void Clear();
+
+    std::uint64_t Hits() const;
+    std::uint64_t Misses() const;
+    std::size_t UsedBytes() const;
+    std::size_t Count() const;
+private:
+    struct Key
+    {
+        dev_t device;
+        ino_t inode;
+        ContentCoding coding;
+
+        bool operator==(const Key& other) const
+        {
+            return device == other.device && inode == other.inode && coding == other.coding;
+        }
+    };
+
+    struct KeyHash
+    {
+        std::size_t operator()(const Key& key) const;
+    };
+
+    struct Node
+    {
+        Key key;
+        std::uint64_t sourceSize;
+        std::shared_ptr<const MemoryBlob> blob;
+    };
+
+    /**
+     * @brief Итог сжатия версии файла (размер и mtime), переживает вытеснение данных.
+     */
+    struct VerdictNode
+    {
+        std::uint64_t sourceSize;
+        timespec modified;
+        bool worth;
+    };
+
+    /**
+     * @brief Удаляет запись из кеша.
+     */
+    void Erase(std::list<Node>::iterator node);
+    /**
+     * @brief Запоминает, стоит ли сжимать файл. Вызывается под mutex.
+     */
+    void Remember(const Key& key, const CachedFile& file, bool worth);
+
+    // Больше итогов не помним: таблица очищается целиком.
+    static constexpr std::size_t verdictCapacity = 65536;
+
+    std::size_t budget;
+    std::size_t maxFileSize;
+    int level;
+    std::size_t used = 0;
+
+    mutable std::mutex mutex;
+
+    std::list<Node> lru;
+    std::unordered_map<Key, std::list<Node>::iterator, KeyHash> index;
+    std::unordered_map<Key, VerdictNode, KeyHash> verdicts;
+
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+};
+
+#endif//COMPRESSED_CACHE_HPP
@@ -0,0 +1,157 @@
+#include "ContentHasher.hpp"
+
+#include <openssl/evp.h>
+#include <unistd.h>
+#include <cerrno>
+
+std::size_t ContentHasher::KeyHash::operator()(const Key& key) const
+{
+    return std::hash<std::uint64_t>{}(static_cast<std::uint64_t>(key.inode) * 0x9e3779b97f4a7c15ULL
+        ^ static_cast<std::uint64_t>(key.device));
+}
+
+ContentHasher::ContentHasher(std::size_t capacity)
+    : capacity(capacity == 0 ? 1 : capacity)
+    , worker(&ContentHasher::Work, this)
+{
+
+}
+
+ContentHasher::~ContentHasher()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+std::optional<EntityTag> ContentHasher::Find(const std::shared_ptr<const CachedFile>& file)
+{
+    Key key{file->Device(), file->Inode()};
+    const auto& modified = file->ModifiedTimeSpec();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(key);
+    if(it != entries.end())
+    {
+        const auto& entry = it->second;
+        if(entry.size == file->Size()
+            && entry.modified.tv_sec == modified.tv_sec
+            && entry.modified.tv_nsec == modified.tv_nsec)
+        {
+            if(entry.etag.empty())
+            {
+                return std::nullopt;
+            }
+            return EntityTag(entry.etag.data(), entry.etag.size());
+        }
+        entries.erase(it);
+    }
+
+    if(queue.size() >= maxQueue)
+    {
+        return std::nullopt;
+    }
+
+    // Простое ограничение: при переполнении забываем все и начинаем заново.
+    if(entries.size() >= capacity)
+    {
+        entries.clear();
+    }
+
+    entries.emplace(key, Entry{file->Size(), modified, {}});
+    queue.push_back(file);
+    wake.notify_one();
+
+    return std::nullopt;
+}
+
+std::uint64_t ContentHasher::Computed() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return computed;
+}
+
+void ContentHasher::Work()
+{
+    for(;;)
+    {
+        std::shared_ptr<const CachedFile> file;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]{ return stopping || !queue.empty(); });
+            if(stopping)
+            {
+                return;
+            }
+            file = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        std::string etag = Hash(*file);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(Key{file->Device(), file->Inode()});
+        // Пока считали, файл успели изменить - запись уже о другой версии.
+        if(it == entries.end()
+            || it->second.size != file->Size()
+            || it->second.modified.tv_sec != file->ModifiedTimeSpec().tv_sec
+            || it->second.modified.tv_nsec != file->ModifiedTimeSpec().tv_nsec)
+        {
+            continue;
+        }
+        if(etag.empty())
+        {
+            entries.erase(it);
+            continue;
+        }
+        it->second.etag = std::move(etag);
+        ++computed;
+    }
+}
+
+std::string ContentHasher::Hash(const CachedFile& file)
+{
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(EVP_MD_CTX_new(), &EVP_MD_CTX_free);
+    if(!ctx || EVP_DigestInit_ex(ctx.get(), EVP_sha256(), nullptr) != 1)
+    {
+        return {};
+    }
+
+    char buf[64 * 1024];
+    std::uint64_t offset = 0;
+    while(offset < file.Size())
+    {
+        ssize_t n = ::pread(file.NativeHandle(), buf, sizeof(buf), static_cast<off_t>(offset));
+        if(n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(n <= 0)
+        {
+            return {};
+        }
+        EVP_DigestUpdate(ctx.get(), buf, static_cast<std::size_t>(n));
+        offset += static_cast<std::uint64_t>(n);
+    }
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    if(EVP_DigestFinal_ex(ctx.get(), digest, &length) != 1)
+    {
+        return {};
+    }
+
+    // Для ETag хватает первых 128 бит.
+    static const char hex[] = "0123456789abcdef";
+    std::string etag = "\"";
+    for(unsigned int i = 0; i < 16 && i < length; ++i)
+    {
+        etag += hex[digest[i] >> 4];
+        etag += hex[digest[i] & 0xf];
+    }
+    etag += '"';
+    return etag;
+}
@@ -0,0 +1,97 @@
+#ifndef CONTENT_HASHER_HPP
+#define CONTENT_HASHER_HPP
+
+#include <sys/types.h>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "FileCache.hpp"
+
+/**
+ * @brief ETag по содержимому файла (SHA-256), который считается в фоновом потоке.
+ * @details Пока хеш не готов, Find возвращает пустое значение и ставит файл в
+ * очередь - сервер в это время отдает ETag по метаданным. Готовый хеш привязан
+ * к размеру и mtime файла, при их изменении считается заново. Такой ETag
+ * переживает копирование файла на другой сервер и touch без изменения данных.
+ */
+class ContentHasher
+{
+public:
+    /**
+     * @brief Конструктор. Запускает фоновый поток.
+     * @param capacity Сколько хешей помнить.
+     */
+    explicit ContentHasher(std::size_t capacity);
+    ~ContentHasher();
+
+    ContentHasher(const ContentHasher&) = delete;
+    ContentHasher& operator=(const ContentHasher&) = delete;
+
+    /**
+     * @brief Возвращает ETag по содержимому или ставит файл в очередь на хеширование.
+     * @param file Открытый и уже сверенный с диском файл.
+     * @return ETag в кавычках, если хеш уже посчитан.
+     */
+    std::optional<EntityTag> Find(const std::shared_ptr<const CachedFile>& file);
+
+    std::uint64_t Computed() const;
+private:
+    struct Key
+    {
+        dev_t device;
+        ino_t inode;
+
+        bool operator==(const Key& other) const
+        {
+            return device == other.device && inode == other.inode;
+        }
+    };
+
+    struct KeyHash
+    {
+        std::size_t operator()(const Key& key) const;
+    };
+
+    struct Entry
+    {
+        std::uint64_t size = 0;
+        timespec modified{};
+        // Пустой, пока хеш считается.
+        std::string etag;
+    };
+
+    /**
+     * @brief Цикл фонового потока.
+     */
+    void Work();
+    /**
+     * @brief Считает SHA-256 файла.
+     * @return ETag в кавычках или пустая строка при ошибке чтения.
+     */
+    static std::string Hash(const CachedFile& file);
+
+    // Больше файлов в очереди не держим - остальные получат хеш при следующем запросе.
+    static constexpr std::size_t maxQueue = 1024;
+
+    std::size_t capacity;
+
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    std::deque<std::shared_ptr<const CachedFile>> queue;
+    std::unordered_map<Key, Entry, KeyHash> entries;
+    std::uint64_t computed = 0;
+
+    std::thread worker;
+};
+
+#endif//CONTENT_HASHER_HPP
@@ -0,0 +1,589 @@
+#include "CoroutineSession.hpp"
+
+#include <sys/sendfile.h>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/experimental/deferred.hpp>
+#include <boost/asio/experimental/parallel_group.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/write.hpp>
+#include <cstdio>
+
+void CoroutineSession::Start(boost::asio::ip::tcp::socket&& socket, boost::asio::ssl::context& context,
+    std::weak_ptr<HttpsServer> host, AdmissionControl::Slot slot)
+{
+    auto executor = socket.get_executor();
+    boost::asio::co_spawn(executor, Run(std::move(socket), context, std::move(host), std::move(slot)),
+        [](std::exception_ptr error)
+        {
+            if(!error)
+            {
+                return;
+            }
+            try
+            {
+                std::rethrow_exception(error);
+            }
+            catch(const std::exception& e)
+            {
+                LOG_ERROR("Session failed: ", e.what());
+            }
+        });
+}
+
+CoroutineSession::CoroutineSession(boost::asio::ip::tcp::socket&& socket, boost::asio::ssl::context& context,
+    std::weak_ptr<HttpsServer> host, AdmissionControl::Slot slot)
+    : stream(std::move(socket), context)
+    , host(host)
+    , slot(std::move(slot))
+    , created(Clock::now())
+{
+    if(auto server = host.lock())
+    {
+        shared = server->shared;
+        shared->metrics.SessionOpened();
+    }
+
+    boost::system::error_code ec;
+    client = boost::beast::get_lowest_layer(stream).socket().remote_endpoint(ec).address();
+}
+
+CoroutineSession::~CoroutineSession()
+{
+    if(shared)
+    {
+        shared->metrics.Record(Stage::Session, Clock::now() - created);
+        shared->metrics.SessionClosed();
+    }
+}
+
+boost::asio::awaitable<void> CoroutineSession::Run(boost::asio::ip::tcp::socket socket,
+    boost::asio::ssl::context& context, std::weak_ptr<HttpsServer> host, AdmissionControl::Slot slot)
+{
+    CoroutineSession session(std::move(socket), context, std::move(host), std::move(slot));
+    if(session.shared)
+    {
+        co_await session.Loop();
+    }
+}
+
+boost::asio::awaitable<void> CoroutineSession::Loop()
+{
+    shared->metrics.Record(Stage::Accept, Clock::now() - created);
+
+    if(!co_await Handshake())
+    {
+        co_return;
+    }
+
+    for(;;)
+    {
+        boost::beast::error_code error;
+        boost::beast::http::request_parser<boost::beast::http::empty_body, RecyclingAllocator<char>> header;
+        // Ограничение на тело проверяется уже при разборе Content-Length,
+        // а нужное значение зависит от маршрута - выставим его позже.
+        header.body_limit(boost::none);
+
+        boost::beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(30));
+        co_await boost::beast::http::async_read_header(stream, buffer, header,
+            boost::asio::redirect_error(boost::asio::use_awaitable, error));
+        if(error == boost::beast::http::error::end_of_stream)
+        {
+            co_return co_await Close();
+        }
+        if(error)
+        {
+            LOG_ERROR("Error on read: ", error.message());
+            shared->metrics.Add(error == boost::beast::error::timeout ? Counter::Timeouts : Counter::ReadErrors);
+            co_return;
+        }
+
+        auto readStart = Clock::now();
+        auto server = host.lock();
+        if(!server)
+        {
+            co_return;
+        }
+
+        const auto& head = header.get();
+        if((head.method() == boost::beast::http::verb::put || head.method() == boost::beast::http::verb::post)
+            && head.target().starts_with("/v1/upload/"))
+        {
+            if(!co_await Upload(*server, header, readStart))
+            {
+                co_return;
+            }
+            continue;
+        }
+
+        // Content-Length парсер сверяет с лимитом только при разборе заголовка,
+        // поэтому для уже прочитанного заголовка проверяем сами.
+        auto contentLength = header.content_length();
+        if(contentLength && *contentLength > requestBodyLimit)
+        {
+            auto res = server->Error(boost::beast::http::status::payload_too_large, "Request body is too large",
+                head.version());
+            co_await Write(res);
+            co_return;
+        }
+
+        boost::beast::http::request_parser<boost::beast::http::string_body, RecyclingAllocator<char>> parser(std::move(header));
+        parser.body_limit(requestBodyLimit);
+        co_await boost::beast::http::async_read(stream, buffer, parser,
+            boost::asio::redirect_error(boost::asio::use_awaitable, error));
+        if(error == boost::beast::http::error::end_of_stream)
+        {
+            co_return co_await Close();
+        }
+        if(error)
+        {
+            LOG_ERROR("Error on read: ", error.message());
+            shared->metrics.Add(error == boost::beast::error::timeout ? Counter::Timeouts : Counter::ReadErrors);
+            co_return;
+        }
+
+        auto handleStart = Clock::now();
+        shared->metrics.Record(Stage::Read, handleStart - readStart);
+
+        const auto& target = parser.get().target();
+        share = shared->bandwidth.Acquire(std::string_view(target.data(), target.size()), client);
+
+        auto res = server->Route(parser.release());
+        shared->metrics.Record(Stage::Handle, Clock::now() - handleStart);
+        server.reset();
+
+        bool next = co_await std::visit([this](auto& msg)
+            {
+                return Write(msg);
+            }, res);
+        if(!next)
+        {
+            co_return;
+        }
+    }
+}
+
+boost::asio::awaitable<bool> CoroutineSession::Handshake()
+{
+    auto start = Clock::now();
+    boost::beast::error_code error;
+
+    boost::beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(30));
+    co_await stream.async_handshake(boost::asio::ssl::stream_base::server,
+        boost::asio::redirect_error(boost::asio::use_awaitable, error));
+    shared->metrics.Record(Stage::Handshake, Clock::now() - start);
+
+    if(error)
+    {
+        shared->metrics.Add(Counter::HandshakeFailures);
+        if(error == boost::beast::error::timeout)
+        {
+            shared->metrics.Add(Counter::Timeouts);
+        }
+        LOG_ERROR("Error handshake: ", error.message(), " (", error.category().name(), ")");
+        co_return false;
+    }
+
+    if(SSL_session_reused(stream.native_handle()))
+    {
+        shared->metrics.Add(Counter::ResumedHandshakes);
+    }
+
+    auto server = host.lock();
+    if(server && server->config.kernelTls)
+    {
+        auto& sock = boost::beast::get_lowest_layer(stream).socket();
+        kernelTls = KernelTls::EnableTx(stream.native_handle(), sock.native_handle());
+        if(kernelTls)
+        {
+            // sendfile должен возвращать EAGAIN, а не блокировать io-поток.
+            boost::system::error_code ec;
+            sock.native_non_blocking(true, ec);
+        }
+        else
+        {
+            LOG_WARN("kTLS is not available, using OpenSSL for writes");
+        }
+    }
+    co_return true;
+}
+
+boost::asio::awaitable<bool> CoroutineSession::Upload(HttpsServer& server,
+    boost::beast::http::request_parser<boost::beast::http::empty_body, RecyclingAllocator<char>>& header, Clock::time_point readStart)
+{
+    unsigned version = header.get().version();
+
+    std::string uploadPath = server.UploadPath(std::string(header.get().target()));
+    if(uploadPath.empty())
+    {
+        auto res = server.Error(boost::beast::http::status::bad_request, "Bad upload path", version);
+        co_return co_await Write(res);
+    }
+
+    auto contentLength = header.content_length();
+    if(contentLength && *contentLength > server.config.uploadBodyLimit)
+    {
+        auto res = server.Error(boost::beast::http::status::payload_too_large, "File is too large", version);
+        co_return co_await Write(res);
+    }
+
+    boost::system::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(uploadPath).parent_path(), ec);
+
+    // Временный файл в той же директории, чтобы rename был атомарным.
+    std::string uploadTemp = uploadPath + ".upload-XXXXXX";
+    int fd = ::mkstemp(uploadTemp.data());
+    if(fd < 0)
+    {
+        auto res = server.Error(boost::beast::http::status::internal_server_error, "Can't create file", version);
+        co_return co_await Write(res);
+    }
+
+    bool expectContinue = version >= 11
+        && boost::beast::iequals(header.get()[boost::beast::http::field::expect], "100-continue");
+
+    boost::beast::http::request_parser<boost::beast::http::file_body, RecyclingAllocator<char>> parser(std::move(header));
+    parser.body_limit(server.config.uploadBodyLimit);
+
+    boost::beast::file file;
+    file.native_handle(fd);
+    parser.get().body().reset(std::move(file), ec);
+
+    auto abort = [&parser, &uploadTemp]
+    {
+        parser.get().body().close();
+        std::remove(uploadTemp.c_str());
+    };
+
+    if(ec)
+    {
+        abort();
+        auto res = server.Error(boost::beast::http::status::internal_server_error, "Can't open file", version);
+        co_return co_await Write(res);
+    }
+
+    boost::beast::error_code error;
+    if(expectContinue)
+    {
+        boost::beast::http::response<boost::beast::http::empty_body, HttpFields> continueRes{boost::beast::http::status::continue_, version};
+        boost::beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(30));
+        if(kernelTls)
+        {
+            co_await boost::beast::http::async_write(boost::beast::get_lowest_layer(stream), continueRes,
+                boost::asio::redirect_error(boost::asio::use_awaitable, error));
+        }
+        else
+        {
+            co_await boost::beast::http::async_write(stream, continueRes,
+                boost::asio::redirect_error(boost::asio::use_awaitable, error));
+        }
+        if(error)
+        {
+            LOG_ERROR("Error on write 100-continue: ", error.message());
+            abort();
+            co_return false;
+        }
+    }
+
+    while(!parser.is_done())
+    {
+        // Таймаут на каждую порцию, а не на весь файл: большой файл может идти долго.
+        boost::beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(30));
+        co_await boost::beast::http::async_read_some(stream, buffer, parser,
+            boost::asio::redirect_error(boost::asio::use_awaitable, error));
+
+        if(error == boost::beast::http::error::body_limit)
+        {
+            abort();
+            auto res = server.Error(boost::beast::http::status::payload_too_large, "File is too large", version);
+            co_return co_await Write(res);
+        }
+        if(error)
+        {
+            LOG_ERROR("Error on upload read: ", error.message());
+            shared->metrics.Add(error == boost::beast::error::timeout ? Counter::Timeouts : Counter::ReadErrors);
+            abort();
+            co_return false;
+        }
+    }
+
+    shared->metrics.Record(Stage::Read, Clock::now() - readStart);
+
+    auto& request = parser.get();
+    bool keepAlive = request.keep_alive();
+    request.body().close();
+
+    if(std::rename(uploadTemp.c_str(), uploadPath.c_str()) != 0)
+    {
+        abort();
+        auto res = server.Error(boost::beast::http::status::internal_server_error, "Can't save file", version);
+        co_return co_await Write(res);
+    }
+
+    LOG_INFO("file uploaded to ", uploadPath);
+
+    boost::beast::http::response<boost::beast::http::string_body, HttpFields> res{boost::beast::http::status::created, version};
+    res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(boost::beast::http::field::content_type, "text/plain");
+    res.keep_alive(keepAlive);
+    res.body() = uploadPath;
+    res.prepare_payload();
+    co_return co_await Write(res);
+}
+
+template<class Body>
+boost::asio::awaitable<bool> CoroutineSession::Write(boost::beast::http::response<Body, HttpFields>& msg)
+{
+    auto writeStart = Clock::now();
+    boost::beast::error_code error;
+    std::size_t bytes = 0;
+
+    boost::beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(30));
+    if constexpr(std::is_same_v<Body, FileRangeBody>)
+    {
+        // Из памяти sendfile не нужен - буфер уходит одним write.
+        if(kernelTls && !msg.body().IsMemory())
+        {
+            co_await SendFile(msg, error, bytes);
+        }
+        else if(share.Limited())
+        {
+            co_await WritePartial(msg, error, bytes);
+        }
+        else if(kernelTls)
+        {
+            bytes = co_await boost::beast::http::async_write(boost::beast::get_lowest_layer(stream), msg,
+                boost::asio::redirect_error(boost::asio::use_awaitable, error));
+        }
+        else
+        {
+            bytes = co_await boost::beast::http::async_write(stream, msg,
+                boost::asio::redirect_error(boost::asio::use_awaitable, error));
+        }
+    }
+    else if constexpr(std::is_same_v<Body, TarBody>)
+    {
+        // Архив может идти дольше таймаута записи - срок ставится на каждую порцию.
+        co_await WritePartial(msg, error, bytes);
+    }
+    else if(kernelTls)
+    {
+        // При kTLS шифрует ядро, поэтому пишем прямо в tcp-сокет.
+        bytes = co_await boost::beast::http::async_write(boost::beast::get_lowest_layer(stream), msg,
+            boost::asio::redirect_error(boost::asio::use_awaitable, error));
+    }
+    else
+    {
+        bytes = co_await boost::beast::http::async_write(stream, msg,
+            boost::asio::redirect_error(boost::asio::use_awaitable, error));
+    }
+
+    auto& metrics = shared->metrics;
+    metrics.Record(Stage::Write, Clock::now() - writeStart);
+    metrics.Add(Counter::BytesSent, bytes);
+    metrics.Add(Counter::Requests);
+    if(throttled > Clock::duration::zero())
+    {
+        metrics.Record(Stage::Throttle, throttled);
+        throttled = {};
+    }
+    share = {};
+
+    if(error)
+    {
+        LOG_ERROR("Error on write: ", error.message());
+        metrics.Add(error == boost::beast::error::timeout ? Counter::Timeouts : Counter::WriteErrors);
+        co_return false;
+    }
+
+    if(msg.need_eof())
+    {
+        co_await Close();
+        co_return false;
+    }
+    co_return true;
+}
+
+template<class Body>
+boost::asio::awaitable<void> CoroutineSession::WritePartial(boost::beast::http::response<Body, HttpFields>& msg,
+    boost::beast::error_code& error, std::size_t& bytes)
+{
+    boost::beast::http::response_serializer<Body, HttpFields> sr(msg);
+    if(share.Limited())
+    {
+        sr.limit(share.Chunk());
+    }
+
+    do
+    {
+        co_await Pace(error);
+        if(error)
+        {
+            co_return;
+        }
+
+        boost::beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(30));
+        std::size_t n = 0;
+        if(kernelTls)
+        {
+            n = co_await boost::beast::http::async_write_some(boost::beast::get_lowest_layer(stream), sr,
+                boost::asio::redirect_error(boost::asio::use_awaitable, error));
+        }
+        else
+        {
+            n = co_await boost::beast::http::async_write_some(stream, sr,
+                boost::asio::redirect_error(boost::asio::use_awaitable, error));
+        }
+        bytes += n;
+        if(share.Limited() && n > 0)
+        {
+            share.Consume(n, Clock::now());
+        }
+    }
+    while(!error && !sr.is_done());
+}
+
+boost::asio::awaitable<void> CoroutineSession::Pace(boost::beast::error_code& error)
+{
+    if(!share.Limited())
+    {
+        co_return;
+    }
+
+    auto wait = share.Wait(Clock::now());
+    if(wait <= Clock::duration::zero())
+    {
+        co_return;
+    }
+
+    throttled += wait;
+    shared->metrics.Add(Counter::ThrottleWaits);
+    boost::asio::steady_timer timer(stream.get_executor());
+    timer.expires_after(wait);
+    co_await timer.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, error));
+}
+
+boost::asio::awaitable<void> CoroutineSession::SendFile(boost::beast::http::response<FileRangeBody, HttpFields>& msg,
+    boost::beast::error_code& error, std::size_t& bytes)
+{
+    auto& lowest = boost::beast::get_lowest_layer(stream);
+    auto& sock = lowest.socket();
+    const auto& body = msg.body();
+
+    // async_wait на сокете таймер tcp_stream не видит - ожидание ограничиваем своим.
+    boost::asio::steady_timer timer(sock.get_executor());
+    auto deadline = Clock::now() + std::chrono::seconds(30);
+
+    boost::beast::http::response_serializer<FileRangeBody, HttpFields> sr(msg);
+    sr.split(true);
+    bytes += co_await boost::beast::http::async_write_header(lowest, sr,
+        boost::asio::redirect_error(boost::asio::use_awaitable, error));
+    if(error)
+    {
+        co_return;
+    }
+
+    for(const auto& part : body.Parts())
+    {
+        if(!part.head.empty())
+        {
+            lowest.expires_after(std::chrono::seconds(30));
+            bytes += co_await boost::asio::async_write(lowest, boost::asio::buffer(part.head),
+                boost::asio::redirect_error(boost::asio::use_awaitable, error));
+            if(error)
+            {
+                co_return;
+            }
+        }
+
+        std::uint64_t sent = 0;
+        while(sent < part.length)
+        {
+            co_await Pace(error);
+            if(error)
+            {
+                co_return;
+            }
+
+            off_t offset = static_cast<off_t>(part.offset + sent);
+            std::size_t chunk = static_cast<std::size_t>(
+                std::min<std::uint64_t>(part.length - sent, share.Limited() ? share.Chunk() : 16 * 1024 * 1024));
+
+            ssize_t n = ::sendfile(sock.native_handle(), body.NativeHandle(), &offset, chunk);
+            if(n > 0)
+            {
+                sent += static_cast<std::uint64_t>(n);
+                bytes += static_cast<std::size_t>(n);
+                auto now = Clock::now();
+                share.Consume(static_cast<std::uint64_t>(n), now);
+                deadline = now + std::chrono::seconds(30);
+                continue;
+            }
+            if(n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                // Срок отсчитывается от последней отправки: медленный, но читающий клиент не обрывается.
+                timer.expires_at(deadline);
+                auto [order, waitError, timerError] = co_await boost::asio::experimental::make_parallel_group(
+                        sock.async_wait(boost::asio::socket_base::wait_write, boost::asio::experimental::deferred),
+                        timer.async_wait(boost::asio::experimental::deferred))
+                    .async_wait(boost::asio::experimental::wait_for_one(), boost::asio::use_awaitable);
+                if(order[0] == 1)
+                {
+                    error = boost::beast::error::timeout;
+                    co_return;
+                }
+                if(waitError)
+                {
+                    error = waitError;
+                    co_return;
+                }
+                continue;
+            }
+
+            // n == 0 - файл укоротили после того, как ушел Content-Length.
+            error = n == 0
+                ? boost::beast::error_code(boost::beast::http::error::short_read)
+                : boost::beast::error_code(errno, boost::system::generic_category());
+            co_return;
+        }
+    }
+
+    if(!body.Tail().empty())
+    {
+        lowest.expires_after(std::chrono::seconds(30));
+        bytes += co_await boost::asio::async_write(lowest, boost::asio::buffer(body.Tail()),
+            boost::asio::redirect_error(boost::asio::use_awaitable, error));
+    }
+}
+
+boost::asio::awaitable<void> CoroutineSession::Close()
+{
+    auto start = Clock::now();
+
+    if(kernelTls)
+    {
+        // OpenSSL уже не знает номер следующей записи, поэтому
+        // close_notify отправляем через ядро и закрываем сокет сами.
+        auto& sock = boost::beast::get_lowest_layer(stream).socket();
+        KernelTls::SendCloseNotify(sock.native_handle());
+        boost::system::error_code ec;
+        sock.shutdown(boost::asio::ip::tcp::socket::shutdown_send, ec);
+        sock.close(ec);
+        shared->metrics.Record(Stage::Shutdown, Clock::now() - start);
+        co_return;
+    }
+
+    boost::beast::error_code error;
+    boost::beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(30));
+    co_await stream.async_shutdown(boost::asio::redirect_error(boost::asio::use_awaitable, error));
+    shared->metrics.Record(Stage::Shutdown, Clock::now() - start);
+
+    if(error)
+    {
+        LOG_ERROR("Error on shutdown");
+    }
+}
@@ -0,0 +1,120 @@
+#ifndef COROUTINE_SESSION_HPP
+#define COROUTINE_SESSION_HPP
+
+#include <utility>
+#include <boost/asio/awaitable.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/ssl.hpp>
+#include <chrono>
+#include <memory>
+
+#include "HttpsServer.hpp"
+
+/**
+ * @brief Обработка одного клиента одной корутиной C++20 - альтернатива HttpsSession.
+ * @details Рукопожатие, чтение, обработка и запись идут в одном цикле, а все
+ * состояние соединения (поток, буфер, парсеры, текущий ответ) лежит в кадре
+ * корутины, поэтому код читается сверху вниз, без цепочки обработчиков.
+ * Выделений памяти на запрос это не убирает: AllocBench показывает у
+ * HttpsSession ноль, у корутины - одно (состояние async_write под use_awaitable).
+ * Поведение то же, что у HttpsSession: маршруты (HttpsServer::Route), загрузка
+ * файлов, kTLS с sendfile, ограничение скорости, таймауты и метрики. Включается флагом
+ * coroutineSessions в ConfigServer.
+ */
+class CoroutineSession
+{
+public:
+    /**
+     * @brief Запускает корутину клиента на executor'е сокета.
+     * @param socket Подключенный сокет.
+     * @param context ssl-context сервера, должен пережить сессию.
+     * @param host Сервер, который принял подключение.
+     * @param slot Место, занятое под сессию в AdmissionControl.
+     */
+    static void Start(boost::asio::ip::tcp::socket&& socket, boost::asio::ssl::context& context,
+        std::weak_ptr<HttpsServer> host, AdmissionControl::Slot slot = {});
+
+    ~CoroutineSession();
+
+    CoroutineSession(const CoroutineSession&) = delete;
+    CoroutineSession& operator=(const CoroutineSession&) = delete;
+private:
+    using Stream = boost::beast::ssl_stream<boost::beast::tcp_stream>;
+    using Clock = std::chrono::steady_clock;
+
+    CoroutineSession(boost::asio::ip::tcp::socket&& socket, boost::asio::ssl::context& context,
+        std::weak_ptr<HttpsServer> host, AdmissionControl::Slot slot);
+
+    /**
+     * @brief Тело корутины: сессия живет в ее кадре.
+     */
+    static boost::asio::awaitable<void> Run(boost::asio::ip::tcp::socket socket, boost::asio::ssl::context& context,
+        std::weak_ptr<HttpsServer> host, AdmissionControl::Slot slot);
+    /**
+     * @brief Цикл рукопожатие -> (чтение -> обработка -> запись)* -> shutdown.
+     */
+    boost::asio::awaitable<void> Loop();
+    /**
+     * @brief TLS-рукопожатие и включение kTLS.
+     * @return false, если рукопожатие не удалось.
+     */
+    boost::asio::awaitable<bool> Handshake();
+    /**
+     * @brief Принимает файл в uploadDirectory и отвечает клиенту.
+     * @param header Прочитанный заголовок запроса.
+     * @param readStart Когда начал приходить запрос.
+     * @return true, если соединение можно использовать дальше.
+     */
+    boost::asio::awaitable<bool> Upload(HttpsServer& server,
+        boost::beast::http::request_parser<boost::beast::http::empty_body, RecyclingAllocator<char>>& header, Clock::time_point readStart);
+    /**
+     * @brief Отправляет ответ и закрывает соединение, если этого требует ответ.
+     * @return true, если можно читать следующий запрос.
+     */
+    template<class Body>
+    boost::asio::awaitable<bool> Write(boost::beast::http::response<Body, HttpFields>& msg);
+    /**
+     * @brief Отправляет ответ по порциям: архив или файл с ограничением скорости.
+     * @details Срок записи ставится на каждую порцию, а не на весь ответ.
+     * @param bytes Сколько байт ушло.
+     */
+    template<class Body>
+    boost::asio::awaitable<void> WritePartial(boost::beast::http::response<Body, HttpFields>& msg,
+        boost::beast::error_code& error, std::size_t& bytes);
+    /**
+     * @brief Ждет токенов для следующей порции текущего ответа, если их нет.
+     */
+    boost::asio::awaitable<void> Pace(boost::beast::error_code& error);
+    /**
+     * @brief Отправляет файл через sendfile (только при kTLS).
+     * @param bytes Сколько байт ушло.
+     */
+    boost::asio::awaitable<void> SendFile(boost::beast::http::response<FileRangeBody, HttpFields>& msg,
+        boost::beast::error_code& error, std::size_t& bytes);
+    /**
+     * @brief Отключает клиента (close_notify и закрытие сокета).
+     */
+    boost::asio::awaitable<void> Close();
+
+    // Ограничение на тело обычного запроса (читается в память).
+    static constexpr std::uint64_t requestBodyLimit = 1024 * 1024;
+
+    Stream stream;
+    boost::beast::flat_buffer buffer;
+    std::weak_ptr<HttpsServer> host;
+    // Держим общие данные, чтобы метрики пережили сервер, если сессия завершается позже.
+    std::shared_ptr<ServerShared> shared;
+    // Освобождается раньше shared, в котором живет AdmissionControl.
+    AdmissionControl::Slot slot;
+    // Исходящие данные шифрует ядро (kTLS TX включен после рукопожатия).
+    bool kernelTls = false;
+    Clock::time_point created;
+    boost::asio::ip::address client;
+    // Корзины токенов текущего ответа (пустые - без ограничения скорости).
+    BandwidthShare share;
+    // Сколько текущий ответ ждал токенов.
+    Clock::duration throttled{};
+};
+
+#endif//COROUTINE_SESSION_HPP
@@ -0,0 +1,291 @@
+#include "FileCache.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <filesystem>
+
+std::shared_ptr<CachedFile> CachedFile::Open(const std::string& path, boost::beast::error_code& ec)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        ec = boost::beast::error_code(errno, boost::system::generic_category());
+        return nullptr;
+    }
+
+    struct stat st{};
+    if(::fstat(fd, &st) != 0)
+    {
+        ec = boost::beast::error_code(errno, boost::system::generic_category());
+        ::close(fd);
+        return nullptr;
+    }
+
+    if(!S_ISREG(st.st_mode))
+    {
+        ec = boost::beast::errc::make_error_code(boost::beast::errc::no_such_file_or_directory);
+        ::close(fd);
+        return nullptr;
+    }
+
+    ec = {};
+    return std::shared_ptr<CachedFile>(new CachedFile(fd, st));
+}
+
+CachedFile::CachedFile(int fd, const struct stat& st)
+    : fd(fd)
+    , info(st)
+{
+    char buf[64];
+    auto mtime = static_cast<unsigned long long>(st.st_mtim.tv_sec) * 1000000000ull
+        + static_cast<unsigned long long>(st.st_mtim.tv_nsec);
+    int len = std::snprintf(buf, sizeof(buf), "\"%llx-%llx-%llx\"",
+        static_cast<unsigned long long>(st.st_ino),
+        static_cast<unsigned long long>(st.st_size),
+        mtime);
+    etag.assign(buf, static_cast<std::size_t>(len));
+}
+
+CachedFile::~CachedFile()
+{
+    if(fd >= 0)
+    {
+        ::close(fd);
+    }
+}
+
+int CachedFile::NativeHandle() const
+{
+    return fd;
+}
+
+std::uint64_t CachedFile::Size() const
+{
+    return static_cast<std::uint64_t>(info.st_size);
+}
+
+std::time_t CachedFile::ModifiedTime() const
+{
+    return info.st_mtim.tv_sec;
+}
+
+const timespec& CachedFile::ModifiedTimeSpec() const
+{
+    return info.st_mtim;
+}
+
+ino_t CachedFile::Inode() const
+{
+    return info.st_ino;
+}
+
+dev_t CachedFile::Device() const
+{
+    return info.st_dev;
+}
+
+const std::string& CachedFile::ETag() const
+{
+    return etag;
+}
+
+bool CachedFile::Same(const struct stat& st) const
+{
+    return st.st_ino == info.st_ino
+        && st.st_dev == info.st_dev
+        && st.st_size == info.st_size
+        && st.st_mtim.tv_sec == info.st_mtim.tv_sec
+        && st.st_mtim.tv_nsec == info.st_mtim.tv_nsec;
+}
+
+// ###############################  CACHE
+
+FileCache::FileCache(std::size_t capacity, std::chrono::milliseconds revalidate)
+    : capacity(capacity == 0 ? 1 : capacity)
+    , revalidate(revalidate)
+{
+    std::error_code ec;
+    workDir = std::filesystem::current_path(ec).string();
+}
+
+void FileCache::Resolve(std::string_view path, std::string& key) const
+{
+    key.clear();
+    if(path.empty() || path.front() != '/')
+    {
+        key = workDir;
+    }
+    // Корень - пустая строка, чтобы компоненты дописывались как "/имя".
+    if(key == "/")
+    {
+        key.clear();
+    }
+
+    while(!path.empty())
+    {
+        auto slash = path.find('/');
+        std::string_view part = path.substr(0, slash);
+        path = slash == std::string_view::npos ? std::string_view{} : path.substr(slash + 1);
+
+        if(part.empty() || part == ".")
+        {
+            continue;
+        }
+        if(part == "..")
+        {
+            // Выше корня не поднимаемся.
+            auto last = key.rfind('/');
+            key.resize(last == std::string::npos ? 0 : last);
+            continue;
+        }
+        key += '/';
+        key += part;
+    }
+
+    if(key.empty())
+    {
+        key = "/";
+    }
+}
+
+std::shared_ptr<const CachedFile> FileCache::Open(std::string_view path, boost::beast::error_code& ec)
+{
+    // Буфер потока: его емкость переживает запросы.
+    thread_local std::string key;
+    Resolve(path, key);
+    auto now = std::chrono::steady_clock::now();
+
+    // stat и open идут вне блокировки: иначе в --shared/--sharded обращения
+    // к диску всех потоков выстраивались бы в очередь за одним mutex.
+    std::shared_ptr<const CachedFile> cached;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if(it != index.end())
+        {
+            auto node = it->second;
+            if(now - node->checked < revalidate)
+            {
+                ++hits;
+                lru.splice(lru.begin(), lru, node);
+                ec = {};
+                return node->file;
+            }
+            cached = node->file;
+        }
+    }
+
+    if(cached)
+    {
+        struct stat st{};
+        bool same = ::stat(key.c_str(), &st) == 0 && cached->Same(st);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        // Пока проверяли, запись могли заменить или вытеснить - трогаем только свою.
+        bool ours = it != index.end() && it->second->file == cached;
+        if(same)
+        {
+            ++hits;
+            if(ours)
+            {
+                it->second->checked = now;
+                lru.splice(lru.begin(), lru, it->second);
+            }
+            ec = {};
+            return cached;
+        }
+
+        // Файл заменили или изменили - закрываем у себя, у сессий старая версия доживет.
+        ++stale;
+        if(ours)
+        {
+            lru.erase(it->second);
+            index.erase(it);
+        }
+    }
+
+    auto file = CachedFile::Open(key, ec);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    ++misses;
+    if(!file)
+    {
+        return nullptr;
+    }
+
+    auto it = index.find(key);
+    if(it != index.end())
+    {
+        // Другой поток открыл тот же файл раньше - берем его запись, свой дескриптор закроется.
+        const auto& other = it->second->file;
+        if(other->Inode() == file->Inode() && other->Device() == file->Device()
+            && other->Size() == file->Size()
+            && other->ModifiedTimeSpec().tv_sec == file->ModifiedTimeSpec().tv_sec
+            && other->ModifiedTimeSpec().tv_nsec == file->ModifiedTimeSpec().tv_nsec)
+        {
+            lru.splice(lru.begin(), lru, it->second);
+            return other;
+        }
+        lru.erase(it->second);
+        index.erase(it);
+    }
+
+    lru.push_front(Node{key, file, now});
+    index.emplace(key, lru.begin());
+
+    while(lru.size() > capacity)
+    {
+        index.erase(lru.back().key);
+        lru.pop_back();
+    }
+
+    return file;
+}
+
+void FileCache::Invalidate(const std::string& path)
+{
+    std::string key;
+    Resolve(path, key);
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(key);
+    if(it == index.end())
+    {
+        return;
+    }
+    lru.erase(it->second);
+    index.erase(it);
+}
+
+void FileCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    index.clear();
+    lru.clear();
+}
+
+std::uint64_t FileCache::Hits() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return hits;
+}
+
+std::uint64_t FileCache::Misses() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return misses;
+}
+
+std::uint64_t FileCache::Stale() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stale;
+}
+
+std::size_t FileCache::Count() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return lru.size();
+}
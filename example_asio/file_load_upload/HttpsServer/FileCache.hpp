@@ -0,0 +1,139 @@
+#ifndef FILE_CACHE_HPP
+#define FILE_CACHE_HPP
+
+#include <boost/beast/core/error.hpp>
+#include <boost/beast/core/static_string.hpp>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * @brief Открытый на чтение файл вместе с результатом fstat.
+ * @details Один объект разделяют все сессии, которые отдают этот файл,
+ * поэтому читать из него нужно только через pread. Дескриптор закрывается,
+ * когда уходит последняя ссылка.
+ */
+class CachedFile
+{
+public:
+    /**
+     * @brief Открывает обычный файл на чтение.
+     * @param path Путь к файлу.
+     * @param ec Объект для хранения ошибки.
+     * @return Открытый файл или nullptr.
+     */
+    static std::shared_ptr<CachedFile> Open(const std::string& path, boost::beast::error_code& ec);
+
+    CachedFile(const CachedFile&) = delete;
+    CachedFile& operator=(const CachedFile&) = delete;
+    ~CachedFile();
+
+    int NativeHandle() const;
+    std::uint64_t Size() const;
+    std::time_t ModifiedTime() const;
+    /**
+     * @brief Время изменения с наносекундами.
+     */
+    const timespec& ModifiedTimeSpec() const;
+    ino_t Inode() const;
+    dev_t Device() const;
+    /**
+     * @brief Тот же ли это файл, что описан в st (inode, размер, mtime).
+     */
+    bool Same(const struct stat& st) const;
+    /**
+     * @brief Сильный ETag по inode, размеру и mtime (в кавычках).
+     * @details Считается один раз при открытии и живет вместе с записью в кеше.
+     */
+    const std::string& ETag() const;
+private:
+    CachedFile(int fd, const struct stat& st);
+
+    int fd = -1;
+    struct stat info{};
+    std::string etag;
+};
+
+/**
+ * @brief ETag в кавычках. Самый длинный - по метаданным, с суффиксом
+ * кодирования - все равно короткий, поэтому хранится без кучи.
+ */
+using EntityTag = boost::beast::static_string<64>;
+
+/**
+ * @brief Ограниченный LRU-кеш открытых файлов и их метаданных.
+ * @details Ключ - путь, приведенный к абсолютному виду без обращения к диску.
+ * Запись считается свежей revalidate-интервал после последней проверки,
+ * затем сверяется с stat() по inode, размеру и mtime. Вытесненные записи
+ * живут, пока их держат сессии. Все методы потокобезопасны - один кеш
+ * разделяют все потоки и шарды сервера; stat и open выполняются вне
+ * блокировки, под ней только поиск и правка LRU.
+ */
+class FileCache
+{
+public:
+    /**
+     * @brief Конструктор.
+     * @param capacity Сколько файлов держать открытыми (должно быть заметно меньше RLIMIT_NOFILE).
+     * @param revalidate Как часто сверять запись с файлом на диске.
+     */
+    FileCache(std::size_t capacity, std::chrono::milliseconds revalidate);
+    /**
+     * @brief Возвращает открытый файл из кеша или открывает его.
+     * @param path Путь к файлу.
+     * @param ec Объект для хранения ошибки.
+     * @return Открытый файл или nullptr.
+     */
+    std::shared_ptr<const CachedFile> Open(std::string_view path, boost::beast::error_code& ec);
+    /**
+     * @brief Убирает запись о файле (файл изменен или удален).
+     * @param path Путь к файлу.
+     */
+    void Invalidate(const std::string& path);
+    /**
+     * @brief Убирает все записи.
+     */
+    void Clear();
+
+    std::uint64_t Hits() const;
+    std::uint64_t Misses() const;
+    std::uint64_t Stale() const;
+    std::size_t Count() const;
+private:
+    struct Node
+    {
+        std::string key;
+        std::shared_ptr<const CachedFile> file;
+        std::chrono::steady_clock::time_point checked;
+    };
+
+    /**
+     * @brief Приводит путь к ключу кеша: абсолютный, без ".", ".." и лишних '/'.
+     * @details То же, что lexically_normal, но без filesystem::path - ключ
+     * собирается в key, и при попадании в кеш память не выделяется.
+     */
+    void Resolve(std::string_view path, std::string& key) const;
+
+    std::size_t capacity;
+    std::chrono::milliseconds revalidate;
+    std::string workDir;
+
+    mutable std::mutex mutex;
+
+    std::list<Node> lru;
+    std::unordered_map<std::string, std::list<Node>::iterator> index;
+
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t stale = 0;
+};
+
+#endif//FILE_CACHE_HPP
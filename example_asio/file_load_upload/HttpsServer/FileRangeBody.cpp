@@ -0,0 +1,183 @@
+#include "FileRangeBody.hpp"
+
+#include <unistd.h>
+#include <cerrno>
+
+void FileRangeBody::value_type::Open(const char* path, boost::beast::error_code& ec)
+{
+    file = CachedFile::Open(path, ec);
+}
+
+void FileRangeBody::value_type::Open(std::shared_ptr<const CachedFile> file_)
+{
+    file = std::move(file_);
+}
+
+void FileRangeBody::value_type::Open(std::shared_ptr<const MemoryBlob> blob)
+{
+    memory = std::move(blob);
+}
+
+bool FileRangeBody::value_type::IsMemory() const
+{
+    return memory != nullptr;
+}
+
+bool FileRangeBody::value_type::IsOpen() const
+{
+    return file != nullptr || memory != nullptr;
+}
+
+std::uint64_t FileRangeBody::value_type::FileSize() const
+{
+    if(memory)
+    {
+        return memory->size;
+    }
+    return file ? file->Size() : 0;
+}
+
+int FileRangeBody::value_type::NativeHandle() const
+{
+    return file ? file->NativeHandle() : -1;
+}
+
+void FileRangeBody::value_type::AddPart(std::string head, std::uint64_t offset, std::uint64_t length)
+{
+    parts.push_back(Part{std::move(head), offset, length});
+}
+
+void FileRangeBody::value_type::SetTail(std::string tail_)
+{
+    tail = std::move(tail_);
+}
+
+std::uint64_t FileRangeBody::value_type::Size() const
+{
+    std::uint64_t size = tail.size();
+    for(const auto& p : parts)
+    {
+        size += p.head.size() + p.length;
+    }
+    return size;
+}
+
+const FileRangeBody::PartList& FileRangeBody::value_type::Parts() const
+{
+    return parts;
+}
+
+const std::string& FileRangeBody::value_type::Tail() const
+{
+    return tail;
+}
+
+std::uint64_t FileRangeBody::size(const value_type& body)
+{
+    return body.Size();
+}
+
+void FileRangeBody::writer::init(boost::beast::error_code& ec)
+{
+    if(!body.parts.empty() && !body.IsOpen())
+    {
+        ec = boost::beast::errc::make_error_code(boost::beast::errc::bad_file_descriptor);
+        return;
+    }
+    ec = {};
+}
+
+bool FileRangeBody::writer::HasMore() const
+{
+    if(part < body.parts.size())
+    {
+        const auto& p = body.parts[part];
+        if(!headSent && !p.head.empty())
+        {
+            return true;
+        }
+        if(sent < p.length)
+        {
+            return true;
+        }
+        for(std::size_t i = part + 1; i < body.parts.size(); ++i)
+        {
+            if(!body.parts[i].head.empty() || body.parts[i].length != 0)
+            {
+                return true;
+            }
+        }
+    }
+    return !tailSent && !body.tail.empty();
+}
+
+boost::optional<std::pair<FileRangeBody::writer::const_buffers_type, bool>>
+    FileRangeBody::writer::get(boost::beast::error_code& ec)
+{
+    ec = {};
+
+    while(part < body.parts.size())
+    {
+        const auto& p = body.parts[part];
+
+        if(!headSent)
+        {
+            headSent = true;
+            if(!p.head.empty())
+            {
+                return {{const_buffers_type{p.head.data(), p.head.size()}, HasMore()}};
+            }
+        }
+
+        if(sent < p.length && body.memory)
+        {
+            if(p.offset + p.length > body.memory->size)
+            {
+                ec = boost::beast::http::error::short_read;
+                return boost::none;
+            }
+            const char* data = body.memory->data.get() + p.offset + sent;
+            std::size_t amount = static_cast<std::size_t>(p.length - sent);
+            sent = p.length;
+            return {{const_buffers_type{data, amount}, HasMore()}};
+        }
+
+        if(sent < p.length)
+        {
+            std::uint64_t remain = p.length - sent;
+            std::size_t amount = remain > sizeof(buf) ? sizeof(buf) : static_cast<std::size_t>(remain);
+
+            ssize_t nread = ::pread(body.file->NativeHandle(), buf, amount, static_cast<off_t>(p.offset + sent));
+            if(nread < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+                ec = boost::beast::error_code(errno, boost::system::generic_category());
+                return boost::none;
+            }
+            if(nread == 0)
+            {
+                // Файл укоротили после того, как мы отправили Content-Length.
+                ec = boost::beast::http::error::short_read;
+                return boost::none;
+            }
+
+            sent += static_cast<std::uint64_t>(nread);
+            return {{const_buffers_type{buf, static_cast<std::size_t>(nread)}, HasMore()}};
+        }
+
+        ++part;
+        headSent = false;
+        sent = 0;
+    }
+
+    if(!tailSent && !body.tail.empty())
+    {
+        tailSent = true;
+        return {{const_buffers_type{body.tail.data(), body.tail.size()}, false}};
+    }
+
+    return boost::none;
+}
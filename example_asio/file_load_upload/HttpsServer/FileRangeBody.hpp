@@ -0,0 +1,145 @@
+#ifndef FILE_RANGE_BODY_HPP
+#define FILE_RANGE_BODY_HPP
+
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/container/small_vector.hpp>
+#include <boost/optional.hpp>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "FileCache.hpp"
+#include "MemoryCache.hpp"
+
+/**
+ * @brief Тело ответа для отдачи файла целиком или его диапазонов (RFC 7233).
+ * @details Тело состоит из набора частей. Каждая часть - это заголовок
+ * (пустой для 200 и одиночного 206, граница multipart для multipart/byteranges)
+ * и отрезок файла [offset, offset + length). В конце может идти хвост
+ * (закрывающая граница multipart). Чтение идет через pread, поэтому
+ * один CachedFile могут одновременно отдавать несколько сессий.
+ * Если файл лежит в MemoryCache, части отдаются прямо из памяти одним
+ * буфером, без чтения с диска.
+ */
+struct FileRangeBody
+{
+    /**
+     * @brief Часть тела: заголовок и отрезок файла.
+     */
+    struct Part
+    {
+        std::string head;
+        std::uint64_t offset = 0;
+        std::uint64_t length = 0;
+    };
+    /**
+     * @brief Части тела. Обычно часть одна (файл целиком или один диапазон) -
+     * она лежит в самом теле, без отдельного выделения памяти.
+     */
+    using PartList = boost::container::small_vector<Part, 1>;
+
+    class value_type
+    {
+        friend struct FileRangeBody;
+    public:
+        /**
+         * @brief Открывает файл на чтение и запоминает его размер.
+         * @param path Путь к файлу.
+         * @param ec Объект для хранения ошибки.
+         */
+        void Open(const char* path, boost::beast::error_code& ec);
+        /**
+         * @brief Использует уже открытый файл (например, из FileCache).
+         * @param file Открытый файл.
+         */
+        void Open(std::shared_ptr<const CachedFile> file);
+        /**
+         * @brief Отдавать данные из памяти, а не из файла.
+         * @param blob Содержимое файла из MemoryCache.
+         */
+        void Open(std::shared_ptr<const MemoryBlob> blob);
+        /**
+         * @brief Данные отдаются из памяти.
+         */
+        bool IsMemory() const;
+        /**
+         * @brief Открыт ли файл.
+         */
+        bool IsOpen() const;
+        /**
+         * @brief Размер всего файла.
+         */
+        std::uint64_t FileSize() const;
+        /**
+         * @brief Дескриптор открытого файла (для fstat).
+         */
+        int NativeHandle() const;
+        /**
+         * @brief Добавляет часть в тело.
+         * @param head Текст, который уходит перед отрезком файла.
+         * @param offset Смещение отрезка в файле.
+         * @param length Длина отрезка.
+         */
+        void AddPart(std::string head, std::uint64_t offset, std::uint64_t length);
+        /**
+         * @brief Задает хвост, уходящий после всех частей.
+         */
+        void SetTail(std::string tail);
+        /**
+         * @brief Сколько байт уйдет в теле.
+         */
+        std::uint64_t Size() const;
+        /**
+         * @brief Части тела (для отправки мимо сериализатора, через sendfile).
+         */
+        const PartList& Parts() const;
+        /**
+         * @brief Хвост тела.
+         */
+        const std::string& Tail() const;
+    private:
+        std::shared_ptr<const CachedFile> file;
+        std::shared_ptr<const MemoryBlob> memory;
+        PartList parts;
+        std::string tail;
+    };
+
+    /**
+     * @brief Размер тела для Content-Length.
+     */
+    static std::uint64_t size(const value_type& body);
+
+    class writer
+    {
+    public:
+        using const_buffers_type = boost::asio::const_buffer;
+
+        template<bool isRequest, class Fields>
+        writer(boost::beast::http::header<isRequest, Fields>& h, value_type& b)
+            : body(b)
+        {
+            boost::ignore_unused(h);
+        }
+
+        void init(boost::beast::error_code& ec);
+
+        boost::optional<std::pair<const_buffers_type, bool>>
+            get(boost::beast::error_code& ec);
+    private:
+        /**
+         * @brief Остались ли еще данные после текущей позиции.
+         */
+        bool HasMore() const;
+
+        value_type& body;
+        std::size_t part = 0;
+        bool headSent = false;
+        std::uint64_t sent = 0;
+        bool tailSent = false;
+        char buf[64 * 1024];
+    };
+};
+
+#endif//FILE_RANGE_BODY_HPP
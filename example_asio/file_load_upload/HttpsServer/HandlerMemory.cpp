@@ -0,0 +1,68 @@
+#include "HandlerMemory.hpp"
+
+#include <new>
+
+HandlerMemory::HandlerMemory(Metrics* metrics)
+    : metrics(metrics)
+{
+
+}
+
+HandlerMemory::~HandlerMemory()
+{
+    for(std::size_t i = 0; i < freeCount; ++i)
+    {
+        ::operator delete(static_cast<std::max_align_t*>(free[i].data) - 1);
+    }
+}
+
+void* HandlerMemory::Allocate(std::size_t size)
+{
+    if(metrics)
+    {
+        metrics->Add(Counter::HandlerAllocations);
+    }
+
+    // Самый маленький подходящий блок - большие остаются для больших операций.
+    std::size_t best = freeCount;
+    for(std::size_t i = 0; i < freeCount; ++i)
+    {
+        if(free[i].capacity >= size && (best == freeCount || free[i].capacity < free[best].capacity))
+        {
+            best = i;
+        }
+    }
+    if(best != freeCount)
+    {
+        void* data = free[best].data;
+        free[best] = free[--freeCount];
+        return data;
+    }
+
+    if(metrics)
+    {
+        metrics->Add(Counter::HandlerHeapAllocations);
+    }
+    std::size_t capacity = minBlock;
+    while(capacity < size)
+    {
+        capacity *= 2;
+    }
+    // Размер блока храним перед данными, чтобы при возврате знать его емкость.
+    auto* block = static_cast<std::max_align_t*>(::operator new(capacity + sizeof(std::max_align_t)));
+    *reinterpret_cast<std::size_t*>(block) = capacity;
+    return block + 1;
+}
+
+void HandlerMemory::Deallocate(void* pointer, std::size_t)
+{
+    auto* block = static_cast<std::max_align_t*>(pointer) - 1;
+    std::size_t capacity = *reinterpret_cast<std::size_t*>(block);
+
+    if(freeCount < maxFree)
+    {
+        free[freeCount++] = Block{pointer, capacity};
+        return;
+    }
+    ::operator delete(block);
+}
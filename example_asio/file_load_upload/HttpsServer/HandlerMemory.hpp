@@ -0,0 +1,142 @@
+#ifndef HANDLER_MEMORY_HPP
+#define HANDLER_MEMORY_HPP
+
+#include <array>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+#include "Metrics.hpp"
+
+/**
+ * @brief Память одной цепочки асинхронных операций сессии.
+ * @details Освобожденные блоки не возвращаются в кучу, а ждут следующей
+ * операции: рукопожатие и первый запрос заполняют запас, а дальше запросы
+ * по keep-alive обходятся без malloc/free. Блоков в запасе не больше
+ * maxFree, размер блока округляется до степени двойки, чтобы блок от
+ * одной операции подходил похожим. Запас - простой список без блокировок:
+ * объект обслуживает одну цепочку, где следующая операция начинается
+ * только после того, как asio освободил память предыдущей. Операции,
+ * которые идут одновременно (чтение и запись), берут разные объекты.
+ */
+class HandlerMemory
+{
+public:
+    /**
+     * @brief Конструктор.
+     * @param metrics Куда считать выделения (может быть nullptr).
+     */
+    explicit HandlerMemory(Metrics* metrics);
+    ~HandlerMemory();
+
+    HandlerMemory(const HandlerMemory&) = delete;
+    HandlerMemory& operator=(const HandlerMemory&) = delete;
+
+    void* Allocate(std::size_t size);
+    void Deallocate(void* pointer, std::size_t size);
+private:
+    struct Block
+    {
+        void* data = nullptr;
+        std::size_t capacity = 0;
+    };
+
+    static constexpr std::size_t maxFree = 8;
+    static constexpr std::size_t minBlock = 64;
+
+    std::array<Block, maxFree> free{};
+    std::size_t freeCount = 0;
+    Metrics* metrics;
+};
+
+/**
+ * @brief Аллокатор поверх HandlerMemory для associated_allocator.
+ */
+template<class T>
+class HandlerAllocator
+{
+public:
+    using value_type = T;
+
+    explicit HandlerAllocator(HandlerMemory& memory) noexcept
+        : memory(&memory)
+    {
+
+    }
+
+    template<class U>
+    HandlerAllocator(const HandlerAllocator<U>& other) noexcept
+        : memory(other.memory)
+    {
+
+    }
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(memory->Allocate(sizeof(T) * n));
+    }
+
+    void deallocate(T* pointer, std::size_t n)
+    {
+        memory->Deallocate(pointer, sizeof(T) * n);
+    }
+
+    template<class U>
+    bool operator==(const HandlerAllocator<U>& other) const noexcept
+    {
+        return memory == other.memory;
+    }
+
+    template<class U>
+    bool operator!=(const HandlerAllocator<U>& other) const noexcept
+    {
+        return memory != other.memory;
+    }
+private:
+    template<class> friend class HandlerAllocator;
+
+    HandlerMemory* memory;
+};
+
+/**
+ * @brief Обработчик, который сообщает asio и beast свой аллокатор.
+ * @details Через get_allocator() (associated_allocator) из HandlerMemory
+ * берется память и под операции сокета, и под состояние составных
+ * операций beast (сериализатор в http::async_write и т.п.). В Boost 1.77
+ * нет bind_allocator, поэтому обертка своя.
+ */
+template<class Handler>
+class AllocatingHandler
+{
+public:
+    using allocator_type = HandlerAllocator<char>;
+
+    AllocatingHandler(HandlerMemory& memory, Handler handler)
+        : memory(&memory)
+        , handler(std::move(handler))
+    {
+
+    }
+
+    allocator_type get_allocator() const noexcept
+    {
+        return allocator_type(*memory);
+    }
+
+    template<class... Args>
+    void operator()(Args&&... args)
+    {
+        handler(std::forward<Args>(args)...);
+    }
+private:
+    HandlerMemory* memory;
+    Handler handler;
+};
+
+template<class Handler>
+AllocatingHandler<std::decay_t<Handler>> MakeAllocatingHandler(HandlerMemory& memory, Handler&& handler)
+{
+    return AllocatingHandler<std::decay_t<Handler>>(memory, std::forward<Handler>(handler));
+}
+
+#endif//HANDLER_MEMORY_HPP
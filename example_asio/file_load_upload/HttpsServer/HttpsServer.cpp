@@ -1,223 +1,1972 @@
 #include "HttpsServer.hpp"
+#include "CoroutineSession.hpp"
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#include <cctype>
+#include <charconv>
+#include <cstdio>
+#include <random>
+
+std::string_view HttpsServer::GetContentType(std::string_view target)
+{
+    if(target.find(".mp4") != std::string_view::npos){
+        return "video/mp4";
+    }
+
+    if(target.find(".mp3") != std::string_view::npos){
+        return "audio/mpeg";
+    }
+
+    return "application/text";
+}
+
+bool HttpsServer::IsCompressible(std::string_view target, std::string_view contentType) const
+{
+    if(contentType.starts_with("video/") || contentType.starts_with("audio/")
+        || contentType.starts_with("image/"))
+    {
+        return false;
+    }
+
+    // Форматы, которые уже сжаты - повторное сжатие только тратит CPU.
+    static const char* const compressed[] = {
+        ".gz", ".tgz", ".zip", ".bz2", ".xz", ".zst", ".7z", ".rar",
+        ".jpg", ".jpeg", ".png", ".gif", ".webp", ".mkv", ".avi", ".webm", ".ogg", ".flac"
+    };
+    // Расширение, как у filesystem::path::extension: от последней точки имени,
+    // если имя с нее не начинается.
+    std::string_view name = target.substr(target.rfind('/') + 1);
+    auto dot = name.rfind('.');
+    if(dot == std::string_view::npos || dot == 0 || name == "..")
+    {
+        return true;
+    }
+    std::string_view ext = name.substr(dot);
+    for(const char* e : compressed)
+    {
+        if(boost::beast::iequals(boost::beast::string_view(ext.data(), ext.size()), e))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+HttpsSession::HttpsSession(
+                            boost::asio::ip::tcp::socket&& socket, 
+                            boost::asio::ssl::context& context, 
+                            std::weak_ptr<HttpsServer> host,
+                            AdmissionControl::Slot slot)
+                                        : stream(std::move(socket), context)
+                                        , paceTimer(stream.get_executor())
+                                        , idleTimer(stream.get_executor())
+                                        , exec(*this)
+                                        , host(host)
+                                        , sendFileTimer(stream.get_executor())
+                                        , shared([&host]
+                                            {
+                                                auto server = host.lock();
+                                                return server ? server->shared : nullptr;
+                                            }())
+                                        , slot(std::move(slot))
+                                        , readMemory(shared ? &shared->metrics : nullptr)
+                                        , writeMemory(shared ? &shared->metrics : nullptr)
+                                        , created(std::chrono::steady_clock::now())
+{
+    if(shared)
+    {
+        shared->metrics.SessionOpened();
+    }
+
+    boost::system::error_code ec;
+    client = boost::beast::get_lowest_layer(stream).socket().remote_endpoint(ec).address();
+}
+
+HttpsSession::~HttpsSession()
+{
+    if(shared)
+    {
+        shared->metrics.Record(Stage::Session, std::chrono::steady_clock::now() - created);
+        shared->metrics.SessionClosed();
+    }
+}
+
+boost::beast::http::response<boost::beast::http::string_body, HttpFields> 
+        HttpsServer::Error(boost::beast::http::status status, const std::string& what,unsigned version)
+{
+    boost::beast::http::response<boost::beast::http::string_body, HttpFields> res{status, version};
+    res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(boost::beast::http::field::content_type, "text/html");
+    res.keep_alive(false);
+    res.body() = "An error occurred: '" + what + "'";
+    res.prepare_payload();
+
+    return res;
+}
+
+
+
+HttpsServer::HttpDate HttpsServer::FormatHttpDate(std::time_t time)
+{
+    std::tm tm{};
+    gmtime_r(&time, &tm);
+    char buf[64];
+    auto len = std::strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return HttpDate(buf, len);
+}
+
+HttpsServer::RangeResult HttpsServer::ParseRange(boost::beast::string_view value, std::uint64_t size,
+        std::vector<std::pair<std::uint64_t, std::uint64_t>>& ranges) const
+{
+    std::string_view header(value.data(), value.size());
+    ranges.clear();
+
+    auto trim = [](std::string_view v)
+    {
+        while(!v.empty() && (v.front() == ' ' || v.front() == '\t'))
+        {
+            v.remove_prefix(1);
+        }
+        while(!v.empty() && (v.back() == ' ' || v.back() == '\t'))
+        {
+            v.remove_suffix(1);
+        }
+        return v;
+    };
+
+    auto toNumber = [](std::string_view v, std::uint64_t& out)
+    {
+        if(v.empty())
+        {
+            return false;
+        }
+        auto [ptr, ec] = std::from_chars(v.data(), v.data() + v.size(), out);
+        return ec == std::errc() && ptr == v.data() + v.size();
+    };
+
+    header = trim(header);
+    const std::string_view unit = "bytes=";
+    if(header.size() < unit.size() || !boost::beast::iequals(boost::beast::string_view(header.data(), unit.size()), "bytes="))
+    {
+        return RangeResult::None;
+    }
+    header.remove_prefix(unit.size());
+
+    bool anySpec = false;
+    while(!header.empty())
+    {
+        auto comma = header.find(',');
+        std::string_view spec = trim(header.substr(0, comma));
+        header = comma == std::string_view::npos ? std::string_view{} : header.substr(comma + 1);
+
+        if(spec.empty())
+        {
+            continue;
+        }
+        anySpec = true;
+
+        auto dash = spec.find('-');
+        if(dash == std::string_view::npos)
+        {
+            return RangeResult::None;
+        }
+        std::string_view firstStr = trim(spec.substr(0, dash));
+        std::string_view lastStr = trim(spec.substr(dash + 1));
+
+        std::uint64_t first = 0;
+        std::uint64_t last = 0;
+        if(firstStr.empty())
+        {
+            // suffix-byte-range-spec: последние N байт
+            std::uint64_t suffix = 0;
+            if(!toNumber(lastStr, suffix))
+            {
+                return RangeResult::None;
+            }
+            if(suffix == 0 || size == 0)
+            {
+                continue;
+            }
+            first = suffix >= size ? 0 : size - suffix;
+            last = size - 1;
+        }
+        else
+        {
+            if(!toNumber(firstStr, first))
+            {
+                return RangeResult::None;
+            }
+            if(lastStr.empty())
+            {
+                last = size == 0 ? 0 : size - 1;
+            }
+            else if(!toNumber(lastStr, last) || last < first)
+            {
+                return RangeResult::None;
+            }
+            if(first >= size)
+            {
+                continue;
+            }
+            last = std::min(last, size - 1);
+        }
+
+        ranges.emplace_back(first, last);
+    }
+
+    if(!anySpec)
+    {
+        return RangeResult::None;
+    }
+
+    if(ranges.empty())
+    {
+        return RangeResult::Unsatisfiable;
+    }
+
+    // Перекрывающиеся и соседние диапазоны сливаем, чтобы один запрос
+    // не мог заставить нас отдать файл многократно.
+    std::sort(ranges.begin(), ranges.end());
+    std::size_t out = 0;
+    for(std::size_t i = 1; i < ranges.size(); ++i)
+    {
+        if(ranges[i].first <= ranges[out].second + 1)
+        {
+            ranges[out].second = std::max(ranges[out].second, ranges[i].second);
+        }
+        else
+        {
+            ranges[++out] = ranges[i];
+        }
+    }
+    ranges.resize(out + 1);
+
+    if(ranges.size() > maxRanges)
+    {
+        ranges.clear();
+        return RangeResult::None;
+    }
+
+    return RangeResult::Satisfiable;
+}
+
+bool HttpsServer::ParseHttpDate(boost::beast::string_view value, std::time_t& time)
+{
+    // Принимаем только IMF-fixdate - его шлют все современные клиенты.
+    std::string str(value.data(), value.size());
+    std::tm tm{};
+    const char* end = strptime(str.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if(end == nullptr || *end != '\0')
+    {
+        return false;
+    }
+    time = timegm(&tm);
+    return true;
+}
+
+bool HttpsServer::ETagMatches(boost::beast::string_view list, const EntityTag& etag, bool strong)
+{
+    std::string_view header(list.data(), list.size());
+    std::string_view current(etag.data(), etag.size());
+    if(!strong && current.substr(0, 2) == "W/")
+    {
+        current.remove_prefix(2);
+    }
+
+    while(!header.empty())
+    {
+        auto comma = header.find(',');
+        std::string_view tag = header.substr(0, comma);
+        header = comma == std::string_view::npos ? std::string_view{} : header.substr(comma + 1);
+
+        while(!tag.empty() && (tag.front() == ' ' || tag.front() == '\t'))
+        {
+            tag.remove_prefix(1);
+        }
+        while(!tag.empty() && (tag.back() == ' ' || tag.back() == '\t'))
+        {
+            tag.remove_suffix(1);
+        }
+
+        if(tag == "*")
+        {
+            return true;
+        }
+        if(tag.substr(0, 2) == "W/")
+        {
+            // Слабый тег никогда не совпадает при сильном сравнении.
+            if(strong)
+            {
+                continue;
+            }
+            tag.remove_prefix(2);
+        }
+        if(tag == current)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool HttpsServer::NotModified(const boost::beast::http::request<boost::beast::http::string_body, HttpFields>& req,
+        const TagList& etags, std::time_t modified, std::size_t& matched) const
+{
+    matched = std::string::npos;
+    // If-None-Match главнее: If-Modified-Since при нем не смотрим (RFC 7232, 6).
+    auto noneMatch = req.find(boost::beast::http::field::if_none_match);
+    if(noneMatch != req.end())
+    {
+        for(std::size_t i = 0; i < etags.size(); ++i)
+        {
+            if(ETagMatches(noneMatch->value(), etags[i], false))
+            {
+                matched = i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    auto modifiedSince = req.find(boost::beast::http::field::if_modified_since);
+    std::time_t since = 0;
+    if(modifiedSince != req.end() && ParseHttpDate(modifiedSince->value(), since))
+    {
+        return modified <= since;
+    }
+
+    return false;
+}
+
+bool HttpsServer::IfRangeMatches(const boost::beast::http::request<boost::beast::http::string_body, HttpFields>& req,
+        const TagList& etags, const HttpDate& lastModified) const
+{
+    auto it = req.find(boost::beast::http::field::if_range);
+    if(it == req.end())
+    {
+        return true;
+    }
+
+    std::string_view value(it->value().data(), it->value().size());
+    // If-Range требует сильного сравнения, слабый тег всегда устаревший.
+    if(!value.empty() && (value.front() == '"' || value.substr(0, 2) == "W/"))
+    {
+        for(const auto& etag : etags)
+        {
+            if(ETagMatches(it->value(), etag, true))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    return value == std::string_view(lastModified.data(), lastModified.size());
+}
+
+void HttpsServer::EntityTags(const std::shared_ptr<const CachedFile>& file, const char* coding, TagList& etags)
+{
+    auto add = [&etags, coding](std::string_view etag)
+        {
+            // У сжатого на лету варианта свои байты, значит и свой сильный ETag.
+            auto& tag = etags.emplace_back(etag.data(), etag.size() - 1);
+            if(coding)
+            {
+                tag += '-';
+                tag += coding;
+            }
+            tag += '"';
+        };
+
+    if(shared->contentHasher)
+    {
+        if(auto etag = shared->contentHasher->Find(file))
+        {
+            add(std::string_view(etag->data(), etag->size()));
+        }
+    }
+    // Тег по метаданным остается верным для той же версии файла: иначе после
+    // хеширования клиент с ним получал бы 200 вместо 304, а If-Range не совпадал бы.
+    add(file->ETag());
+}
+
+std::string HttpsServer::UploadPath(const std::string& target) const
+{
+    std::string uploadTarget {"/v1/upload/"};
+    std::filesystem::path name = target.substr(uploadTarget.size());
+
+    if(name.empty() || name.is_absolute())
+    {
+        return {};
+    }
+
+    // Не даем выйти за пределы uploadDirectory.
+    for(const auto& part : name)
+    {
+        if(part == ".." || part == ".")
+        {
+            return {};
+        }
+    }
+
+    return (std::filesystem::path(config.uploadDirectory) / name).lexically_normal().string();
+}
+
+std::string HttpsServer::RecordingPath(const std::string& path, std::string& name) const
+{
+    if(path.empty())
+    {
+        return {};
+    }
+
+    // Сравниваем нормализованные пути, иначе "/records/../etc" сошел бы за путь внутри.
+    auto root = std::filesystem::path(config.recordingsDirectory).lexically_normal();
+    auto full = (root / path).lexically_normal();
+    auto relative = full.lexically_relative(root);
+    if(relative.empty() || relative == "." || *relative.begin() == "..")
+    {
+        return {};
+    }
+
+    name = relative.string();
+    return full.string();
+}
+
+boost::beast::http::response<boost::beast::http::string_body, HttpFields>
+    HttpsServer::HandleMetrics(const boost::beast::http::request<boost::beast::http::string_body, HttpFields>& req)
+{
+    std::string body = shared->metrics.Render();
+
+    // Очередь listen-сокета этого сервера (в режиме шардов - только своего шарда).
+    struct tcp_info info{};
+    socklen_t infoLength = sizeof(info);
+    if(::getsockopt(acc.native_handle(), IPPROTO_TCP, TCP_INFO, &info, &infoLength) != 0)
+    {
+        info = {};
+    }
+
+    char line[2048];
+    std::snprintf(line, sizeof(line),
+        "# TYPE https_file_cache_hits_total counter\nhttps_file_cache_hits_total %llu\n"
+        "# TYPE https_file_cache_misses_total counter\nhttps_file_cache_misses_total %llu\n"
+        "# TYPE https_file_cache_open_files gauge\nhttps_file_cache_open_files %zu\n"
+        "# TYPE https_memory_cache_hits_total counter\nhttps_memory_cache_hits_total %llu\n"
+        "# TYPE https_memory_cache_misses_total counter\nhttps_memory_cache_misses_total %llu\n"
+        "# TYPE https_memory_cache_bytes gauge\nhttps_memory_cache_bytes %zu\n"
+        "# TYPE https_compressed_cache_hits_total counter\nhttps_compressed_cache_hits_total %llu\n"
+        "# TYPE https_compressed_cache_bytes gauge\nhttps_compressed_cache_bytes %zu\n"
+        "# TYPE https_tls_session_cache_hits_total counter\nhttps_tls_session_cache_hits_total %llu\n"
+        "# TYPE https_tls_session_cache_misses_total counter\nhttps_tls_session_cache_misses_total %llu\n"
+        "# TYPE https_tls_session_cache_sessions gauge\nhttps_tls_session_cache_sessions %zu\n"
+        "# TYPE https_tls_ticket_key_rotations_total counter\nhttps_tls_ticket_key_rotations_total %llu\n"
+        "# TYPE https_log_dropped_total counter\nhttps_log_dropped_total %llu\n"
+        "# TYPE https_recordings_indexed gauge\nhttps_recordings_indexed %zu\n"
+        "# TYPE https_bandwidth_clients gauge\nhttps_bandwidth_clients %zu\n"
+        "# TYPE https_admitted_sessions gauge\nhttps_admitted_sessions %zu\n"
+        "# TYPE https_max_sessions gauge\nhttps_max_sessions %zu\n"
+        "# TYPE https_accept_queue_length gauge\nhttps_accept_queue_length %u\n"
+        "# TYPE https_accept_queue_limit gauge\nhttps_accept_queue_limit %u\n",
+        static_cast<unsigned long long>(shared->fileCache.Hits()),
+        static_cast<unsigned long long>(shared->fileCache.Misses()),
+        shared->fileCache.Count(),
+        static_cast<unsigned long long>(shared->memoryCache.Hits()),
+        static_cast<unsigned long long>(shared->memoryCache.Misses()),
+        shared->memoryCache.UsedBytes(),
+        static_cast<unsigned long long>(shared->compressedCache.Hits()),
+        shared->compressedCache.UsedBytes(),
+        static_cast<unsigned long long>(shared->tlsSessions.Hits()),
+        static_cast<unsigned long long>(shared->tlsSessions.Misses()),
+        shared->tlsSessions.Count(),
+        static_cast<unsigned long long>(shared->tlsSessions.TicketKeyRotations()),
+        static_cast<unsigned long long>(Logger::Instance().Dropped()),
+        shared->recordings ? shared->recordings->Size() : std::size_t{0},
+        shared->bandwidth.Clients(),
+        shared->admission.Active(),
+        shared->admission.Limit(),
+        // Для listen-сокета ядро кладет сюда текущую и наибольшую длину очереди accept.
+        static_cast<unsigned>(info.tcpi_unacked),
+        static_cast<unsigned>(info.tcpi_sacked));
+    body += line;
+
+    boost::beast::http::response<boost::beast::http::string_body, HttpFields> res{boost::beast::http::status::ok, req.version()};
+    res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(boost::beast::http::field::content_type, "text/plain; version=0.0.4");
+    res.keep_alive(req.keep_alive());
+    res.body() = std::move(body);
+    res.prepare_payload();
+    return res;
+}
+
+bool HttpsServer::ParseFindQuery(const boost::json::object& task, RecordingIndex::Query& query, std::string& error) const
+{
+    query.limit = config.findLimit;
+
+    // constructing a query by json fields in request
+    for(const auto& val : task)
+    {
+        std::string key(val.key());
+        const auto& value = val.value();
+
+        if(key == "date_from" || key == "date_to")
+        {
+            auto& bound = key == "date_from" ? query.from : query.to;
+            if(!value.is_string()
+                || !RecordingIndex::ParseTime(std::string_view(value.as_string().data(), value.as_string().size()), bound))
+            {
+                error = key + " - must be string 'YYYY-MM-DD hh:mm:ss'";
+                return false;
+            }
+            continue;
+        }
+
+        if(key == "limit")
+        {
+            if(!value.is_int64() || value.as_int64() <= 0)
+            {
+                error = "limit - must be positive number";
+                return false;
+            }
+            query.limit = std::min<std::size_t>(query.limit, static_cast<std::size_t>(value.as_int64()));
+            continue;
+        }
+
+        std::size_t field = 0;
+        while(field < RecordingIndex::fieldCount
+            && key != RecordingIndex::FieldName(static_cast<RecordingIndex::Field>(field)))
+        {
+            ++field;
+        }
+        if(field == RecordingIndex::fieldCount)
+        {
+            error = "Unknown field " + key;
+            return false;
+        }
+
+        // Одно значение или список допустимых: "project_id" : ["10", "11"].
+        auto& values = query.values[field];
+        auto add = [&values](const boost::json::value& item)
+            {
+                if(item.is_string())
+                {
+                    values.emplace_back(item.as_string().c_str());
+                    return true;
+                }
+                if(item.is_int64() || item.is_uint64())
+                {
+                    values.push_back(boost::json::serialize(item));
+                    return true;
+                }
+                return false;
+            };
+        bool valid = true;
+        if(value.is_array())
+        {
+            valid = !value.as_array().empty();
+            for(const auto& item : value.as_array())
+            {
+                valid = valid && add(item);
+            }
+        }
+        else
+        {
+            valid = add(value);
+        }
+        if(!valid)
+        {
+            error = key + " - must be string or array of strings";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+boost::beast::http::response<boost::beast::http::string_body, HttpFields>
+    HttpsServer::HandlePostFindWithMeta(boost::beast::http::request<boost::beast::http::string_body, HttpFields>&& req)
+{
+    auto index = shared->recordings;
+    if(!index)
+    {
+        return Error(boost::beast::http::status::not_found, "Search is not configured", req.version());
+    }
+
+    boost::json::error_code error;
+    auto task = boost::json::parse(req.body(), error);
+    if(error || !task.is_object())
+    {
+        return Error(boost::beast::http::status::bad_request, "Body must be json object", req.version());
+    }
+
+    RecordingIndex::Query query;
+    std::string what;
+    if(!ParseFindQuery(task.as_object(), query, what))
+    {
+        return Error(boost::beast::http::status::bad_request, what, req.version());
+    }
+
+    bool truncated = false;
+    auto found = index->Find(query, truncated);
+
+    boost::json::array files;
+    files.reserve(found.size());
+    for(const auto& recording : found)
+    {
+        boost::json::object file;
+        file["path"] = recording.path;
+        file["size"] = recording.size;
+        file["created"] = RecordingIndex::FormatTime(recording.created);
+        for(std::size_t f = 0; f < RecordingIndex::fieldCount; ++f)
+        {
+            file[RecordingIndex::FieldName(static_cast<RecordingIndex::Field>(f))] = recording.fields[f];
+        }
+        files.push_back(std::move(file));
+    }
+
+    boost::json::object result;
+    result["count"] = files.size();
+    result["truncated"] = truncated;
+    result["files"] = std::move(files);
+
+    boost::beast::http::response<boost::beast::http::string_body, HttpFields> res{boost::beast::http::status::ok, req.version()};
+    res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(boost::beast::http::field::content_type, "application/json");
+    res.keep_alive(req.keep_alive());
+    res.body() = boost::json::serialize(result);
+    res.prepare_payload();
+    return res;
+}
+
+std::variant<boost::beast::http::response<TarBody, HttpFields>,
+                boost::beast::http::response<boost::beast::http::string_body, HttpFields>>
+    HttpsServer::HandlePostUnloading(boost::beast::http::request<boost::beast::http::string_body, HttpFields>&& req)
+{
+    boost::json::error_code error;
+    auto task = boost::json::parse(req.body(), error);
+    if(error || !task.is_object())
+    {
+        return Error(boost::beast::http::status::bad_request, "Body must be json object", req.version());
+    }
+
+    TarBody::value_type body;
+    bool truncated = false;
+
+    if(auto files = task.as_object().if_contains("files"))
+    {
+        if(task.as_object().size() != 1 || !files->is_array() || files->as_array().empty())
+        {
+            return Error(boost::beast::http::status::bad_request,
+                "files - must be the only field and a non-empty array of paths", req.version());
+        }
+        if(files->as_array().size() > config.findLimit)
+        {
+            return Error(boost::beast::http::status::bad_request,
+                "Too many files, at most " + std::to_string(config.findLimit), req.version());
+        }
+        if(config.recordingsDirectory.empty())
+        {
+            // Без корня записей не от чего отсчитывать допустимые пути.
+            return Error(boost::beast::http::status::not_found, "Unloading is not configured", req.version());
+        }
+
+        for(const auto& item : files->as_array())
+        {
+            if(!item.is_string())
+            {
+                return Error(boost::beast::http::status::bad_request, "files - must be array of strings", req.version());
+            }
+            // Отдаем только записи, а не любой файл, доступный серверу.
+            std::string name;
+            std::string path = RecordingPath(item.as_string().c_str(), name);
+            if(path.empty())
+            {
+                return Error(boost::beast::http::status::bad_request,
+                    "files - paths must be inside the recordings directory", req.version());
+            }
+            // Отсутствие файла видно только сейчас - после заголовка ответа его уже не сообщить.
+            std::error_code ec;
+            if(!std::filesystem::is_regular_file(path, ec))
+            {
+                return Error(boost::beast::http::status::not_found, "File not found: " + path, req.version());
+            }
+            body.Add(std::move(path), std::move(name));
+        }
+    }
+    else
+    {
+        auto index = shared->recordings;
+        if(!index)
+        {
+            return Error(boost::beast::http::status::not_found, "Search is not configured", req.version());
+        }
+
+        RecordingIndex::Query query;
+        std::string what;
+        if(!ParseFindQuery(task.as_object(), query, what))
+        {
+            return Error(boost::beast::http::status::bad_request, what, req.version());
+        }
+
+        auto found = index->Find(query, truncated);
+        if(found.empty())
+        {
+            return Error(boost::beast::http::status::not_found, "No recordings match", req.version());
+        }
+        for(auto& recording : found)
+        {
+            // Имена в архиве - от директории записей.
+            std::string name = std::filesystem::path(recording.path)
+                .lexically_relative(config.recordingsDirectory).string();
+            body.Add(std::move(recording.path), std::move(name));
+        }
+    }
+
+    boost::beast::http::response<TarBody, HttpFields> res{
+        std::piecewise_construct,
+        std::make_tuple(std::move(body)),
+        std::make_tuple(boost::beast::http::status::ok, req.version())};
+    res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(boost::beast::http::field::content_type, "application/x-tar");
+    res.set(boost::beast::http::field::content_disposition, "attachment; filename=\"unloading.tar\"");
+    if(truncated)
+    {
+        // Под фильтры подходит больше записей, чем limit.
+        res.set("X-Truncated", "true");
+    }
+    res.keep_alive(req.keep_alive());
+    // Размер заранее не известен: HTTP/1.1 - chunked, HTTP/1.0 - до закрытия соединения.
+    res.prepare_payload();
+    return res;
+}
+
+std::variant<boost::beast::http::response<FileRangeBody, HttpFields>,
+                boost::beast::http::response<boost::beast::http::string_body, HttpFields>>
+    HttpsServer::HandleGetLoad(boost::beast::http::request<boost::beast::http::string_body, HttpFields>&& req)
+{
+    LOG_DEBUG("hendl get has ben started ");
+    std::string_view target(req.target().data(), req.target().size());
+    LOG_DEBUG("target is ", target);
+
+    std::string_view loadTarget {"/v1/download"};
+
+    std::string_view fileName = target.substr(loadTarget.size());
+
+    LOG_DEBUG("file name is ", fileName);
+
+    boost::system::error_code ec;
+
+    auto file = shared->fileCache.Open(fileName, ec);
+    if(ec == boost::system::errc::no_such_file_or_directory || ec == boost::system::errc::not_a_directory)
+    {
+        LOG_WARN("file ", target, " not found");
+        return Error(boost::beast::http::status::not_found, std::string(target), req.version());
+    }
+    if(ec.failed())
+    {
+        return Error(boost::beast::http::status::internal_server_error, "Can't open file: '" + std::string(fileName) + "'", req.version());
+    }
+
+    std::string_view contentType = GetContentType(fileName);
+
+    auto source = file;
+
+    // Сжимаем только то, что еще не сжато, и только если клиент это принимает.
+    bool compressible = config.compression && IsCompressible(fileName, contentType);
+    ContentCoding coding = ContentCoding::Identity;
+    auto acceptEncoding = req.find(boost::beast::http::field::accept_encoding);
+    if(compressible && acceptEncoding != req.end() && file->Size() >= config.compressionMinFile)
+    {
+        coding = ContentEncoder::Negotiate(acceptEncoding->value());
+    }
+
+    // Заранее сжатый файл рядом с исходным, если он не старее исходного.
+    bool sidecar = false;
+    if(coding == ContentCoding::Gzip)
+    {
+        boost::system::error_code gzEc;
+        thread_local std::string gzName;
+        gzName.assign(fileName);
+        gzName += ".gz";
+        auto gz = shared->fileCache.Open(gzName, gzEc);
+        if(gz && gz->ModifiedTime() >= file->ModifiedTime())
+        {
+            source = gz;
+            sidecar = true;
+        }
+    }
+
+    // Кодирование выбираем до ETag и проверки условий: иначе клиент получил бы
+    // ETag сжатого варианта, а тело и следующий ETag - исходные, и 304 не совпал бы никогда.
+    std::shared_ptr<const MemoryBlob> compressed;
+    // Польза сжатия еще не известна - годится и ETag сжатого, и ETag исходного варианта.
+    bool undecided = false;
+    if(coding != ContentCoding::Identity && !sidecar)
+    {
+        switch(shared->compressedCache.Check(*file, coding))
+        {
+        case CompressedCache::Verdict::NotWorth:
+            coding = ContentCoding::Identity;
+            break;
+        case CompressedCache::Verdict::Unknown:
+            // Пользу сжатия узнаем, только сжав файл; дальше она запомнена.
+            // Сжимаем ниже, когда ясно, что ответ будет с телом.
+            undecided = true;
+            break;
+        case CompressedCache::Verdict::Worth:
+            // Сжимаем (или берем из кеша), только если дойдет до тела.
+            break;
+        }
+    }
+
+    // Первым идет тег, который уйдет в ответе с телом.
+    TagList etags;
+    bool onTheFly = coding != ContentCoding::Identity && !sidecar;
+    EntityTags(source, onTheFly ? ContentEncoder::Name(coding) : nullptr, etags);
+    std::size_t codedTags = etags.size();
+    if(undecided)
+    {
+        EntityTags(file, nullptr, etags);
+    }
+    HttpDate lastModified = FormatHttpDate(file->ModifiedTime());
+
+    // Условный запрос проверяем до того, как трогать содержимое файла.
+    std::size_t matched = std::string::npos;
+    if(NotModified(req, etags, file->ModifiedTime(), matched))
+    {
+        boost::beast::http::response<boost::beast::http::string_body, HttpFields> res{
+            boost::beast::http::status::not_modified, req.version()};
+        res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
+        // Совпала только дата, а сжимать ли, еще не известно - ETag не обещаем.
+        if(matched != std::string::npos || !undecided)
+        {
+            res.set(boost::beast::http::field::etag, etags[matched != std::string::npos ? matched : 0]);
+        }
+        res.set(boost::beast::http::field::last_modified, lastModified);
+        if(compressible)
+        {
+            res.set(boost::beast::http::field::vary, "Accept-Encoding");
+        }
+        res.keep_alive(req.keep_alive());
+        return res;
+    }
+
+    // HEAD и чтение небольшой части файла не повод читать весь файл в память.
+    bool admit = req.method() != boost::beast::http::verb::head;
+    auto rangeField = req.find(boost::beast::http::field::range);
+    if(admit && rangeField != req.end() && coding == ContentCoding::Identity)
+    {
+        std::vector<std::pair<std::uint64_t, std::uint64_t>> wanted;
+        if(ParseRange(rangeField->value(), source->Size(), wanted) == RangeResult::Satisfiable)
+        {
+            std::uint64_t covered = 0;
+            for(const auto& [first, last] : wanted)
+            {
+                covered += last - first + 1;
+            }
+            admit = covered >= source->Size() / 2;
+        }
+    }
+    auto memory = shared->memoryCache.Get(*source, admit);
+    if(coding != ContentCoding::Identity && !sidecar)
+    {
+        if(!compressed)
+        {
+            compressed = shared->compressedCache.Get(*file, memory.get(), coding);
+        }
+        if(compressed)
+        {
+            memory = std::move(compressed);
+        }
+        else
+        {
+            // Файл не прочитался или сжатие не окупилось.
+            coding = ContentCoding::Identity;
+            etags.clear();
+            EntityTags(file, nullptr, etags);
+        }
+    }
+    if(undecided && coding != ContentCoding::Identity)
+    {
+        // Теги исходного варианта к сжатому телу не относятся.
+        etags.resize(codedTags);
+    }
+    const EntityTag& etag = etags.front();
+
+    FileRangeBody::value_type body;
+    if(memory)
+    {
+        body.Open(memory);
+    }
+    else
+    {
+        body.Open(source);
+    }
+
+    // Диапазоны относятся к тому представлению, которое отдаем (сжатому, если сжимаем).
+    auto size = body.FileSize();
+    LOG_DEBUG("body.size() = ", size);
+
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> ranges;
+    RangeResult range = RangeResult::None;
+    if(rangeField != req.end() && IfRangeMatches(req, etags, lastModified))
+    {
+        range = ParseRange(rangeField->value(), size, ranges);
+    }
+
+    if(range == RangeResult::Unsatisfiable)
+    {
+        boost::beast::http::response<boost::beast::http::string_body, HttpFields> res{
+            boost::beast::http::status::range_not_satisfiable, req.version()};
+        res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(boost::beast::http::field::accept_ranges, "bytes");
+        res.set(boost::beast::http::field::content_range, "bytes */" + std::to_string(size));
+        res.set(boost::beast::http::field::etag, etag);
+        res.set(boost::beast::http::field::last_modified, lastModified);
+        if(compressible)
+        {
+            res.set(boost::beast::http::field::vary, "Accept-Encoding");
+        }
+        res.keep_alive(req.keep_alive());
+        res.prepare_payload();
+        return res;
+    }
+
+    auto status = boost::beast::http::status::ok;
+    std::string_view responseType = contentType;
+    std::string multipartType;
+
+    if(range == RangeResult::Satisfiable && ranges.size() == 1)
+    {
+        status = boost::beast::http::status::partial_content;
+        body.AddPart({}, ranges.front().first, ranges.front().second - ranges.front().first + 1);
+    }
+    else if(range == RangeResult::Satisfiable)
+    {
+        static thread_local std::mt19937_64 gen{std::random_device{}()};
+        char boundary[17];
+        std::snprintf(boundary, sizeof(boundary), "%016llx", static_cast<unsigned long long>(gen()));
+
+        status = boost::beast::http::status::partial_content;
+        multipartType = std::string("multipart/byteranges; boundary=") + boundary;
+        responseType = multipartType;
+
+        bool firstPart = true;
+        for(const auto& [first, last] : ranges)
+        {
+            std::string head = firstPart ? "" : "\r\n";
+            head += std::string("--") + boundary + "\r\n";
+            head += "Content-Type: ";
+            head += contentType;
+            head += "\r\n";
+            head += "Content-Range: bytes " + std::to_string(first) + "-" + std::to_string(last)
+                + "/" + std::to_string(size) + "\r\n\r\n";
+            body.AddPart(std::move(head), first, last - first + 1);
+            firstPart = false;
+        }
+        body.SetTail(std::string("\r\n--") + boundary + "--\r\n");
+    }
+    else
+    {
+        body.AddPart({}, 0, size);
+    }
+
+    boost::beast::http::response<FileRangeBody, HttpFields> res{
+    std::piecewise_construct,
+    std::make_tuple(std::move(body)),
+    std::make_tuple(status, req.version())};
+    res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(boost::beast::http::field::content_type, boost::beast::string_view(responseType.data(), responseType.size()));
+    res.set(boost::beast::http::field::accept_ranges, "bytes");
+    res.set(boost::beast::http::field::etag, etag);
+    res.set(boost::beast::http::field::last_modified, lastModified);
+    if(coding != ContentCoding::Identity)
+    {
+        res.set(boost::beast::http::field::content_encoding, ContentEncoder::Name(coding));
+    }
+    if(compressible)
+    {
+        res.set(boost::beast::http::field::vary, "Accept-Encoding");
+    }
+    if(range == RangeResult::Satisfiable && ranges.size() == 1)
+    {
+        res.set(boost::beast::http::field::content_range, "bytes " + std::to_string(ranges.front().first)
+            + "-" + std::to_string(ranges.front().second) + "/" + std::to_string(size));
+    }
+    res.prepare_payload();
+    res.keep_alive(req.keep_alive());
+
+    return res;
+}
 
-std::string HttpsServer::GetContentType(const std::string& target)
+
+
+void HttpsSession::Run()
 {
-    if(target.find(".mp4") != std::string::npos){
-        return "video/mp4";
+    boost::asio::dispatch(
+            stream.get_executor(),
+            Bind(readMemory,
+                &HttpsSession::OnRun,
+                this->shared_from_this()));
+}
+// run call -> on run 
+
+
+void HttpsSession::OnRun()
+{
+    stageStart = std::chrono::steady_clock::now();
+    shared->metrics.Record(Stage::Accept, stageStart - created);
+
+    boost::beast::get_lowest_layer(stream).expires_after(
+            std::chrono::seconds(30));
+
+    stream.async_handshake(
+        boost::asio::ssl::stream_base::server,
+        Bind(readMemory,
+            &HttpsSession::OnPerformingSsl,
+            this->shared_from_this()));
+}
+// OnRun -> OnPerformingSsl
+
+
+void HttpsSession::OnPerformingSsl(boost::system::error_code error)
+{
+    shared->metrics.Record(Stage::Handshake, std::chrono::steady_clock::now() - stageStart);
+
+    if(error)
+    {
+        shared->metrics.Add(Counter::HandshakeFailures);
+        if(error == boost::beast::error::timeout)
+        {
+            shared->metrics.Add(Counter::Timeouts);
+        }
+        LOG_ERROR("Error handshake: ", error.message(), " (", error.category().name(), ")");
+        return;
+    }
+
+    if(SSL_session_reused(stream.native_handle()))
+    {
+        shared->metrics.Add(Counter::ResumedHandshakes);
+    }
+
+    auto server = host.lock();
+    if(server && server->config.kernelTls)
+    {
+        auto& sock = boost::beast::get_lowest_layer(stream).socket();
+        kernelTls = KernelTls::EnableTx(stream.native_handle(), sock.native_handle());
+        if(kernelTls)
+        {
+            // sendfile должен возвращать EAGAIN, а не блокировать io-поток.
+            boost::system::error_code ec;
+            sock.native_non_blocking(true, ec);
+        }
+        else
+        {
+            LOG_WARN("kTLS is not available, using OpenSSL for writes");
+        }
+    }
+
+    DoRead();
+}
+// OnPerformingSsl -> DoRead
+
+void HttpsSession::DoRead()
+{
+    reading = true;
+    req = {};
+    stringParser.reset();
+    uploadParser.reset();
+    headerParser.emplace();
+    // Ограничение на тело проверяется уже при разборе Content-Length,
+    // а нужное значение зависит от маршрута - выставим его позже.
+    headerParser->body_limit(boost::none);
+    if(writing)
+    {
+        // Пока идет запись, клиент занят приемом ответа, и таймаут чтения
+        // оборвал бы долгую отдачу файла. Ожидание ограничит idleTimer,
+        // когда очередь опустеет.
+        boost::beast::get_lowest_layer(stream).expires_never();
+    }
+    else
+    {
+        boost::beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(30));
+    }
+
+    // Read a request header
+    boost::beast::http::async_read_header(stream, buff, *headerParser,
+        Bind(readMemory,
+            &HttpsSession::OnReadHeader,
+            this->shared_from_this()));
+}
+// DoRead -> OnReadHeader
+
+void HttpsSession::OnReadHeader(boost::system::error_code error, std::size_t bytes_transferred)
+{
+    boost::ignore_unused(bytes_transferred);
+    idleTimer.cancel();
+
+    if(error)
+    {
+        reading = false;
+        return StopReading(error);
+    }
+
+    stageStart = std::chrono::steady_clock::now();
+
+    const auto& header = headerParser->get();
+    if((header.method() == boost::beast::http::verb::put || header.method() == boost::beast::http::verb::post)
+        && header.target().starts_with("/v1/upload/"))
+    {
+        reading = false;
+        DoWrite();
+        if(writing)
+        {
+            // 100-continue и ответ пишутся в тот же поток, а тело читается
+            // отдельно - ждем, пока уйдут ответы на предыдущие запросы.
+            uploadPending = true;
+            return;
+        }
+        return StartUpload();
+    }
+
+    // Content-Length парсер сверяет с лимитом только при разборе заголовка,
+    // поэтому для уже прочитанного заголовка проверяем сами.
+    auto contentLength = headerParser->content_length();
+    if(contentLength && *contentLength > requestBodyLimit)
+    {
+        reading = false;
+        return exec(Error(boost::beast::http::status::payload_too_large, "Request body is too large", header.version()));
+    }
+
+    stringParser.emplace(std::move(*headerParser));
+    headerParser.reset();
+    stringParser->body_limit(requestBodyLimit);
+    if(!stringParser->is_done())
+    {
+        // Тело может ждать сети - отложенные ответы не задерживаем.
+        DoWrite();
+    }
+
+    boost::beast::http::async_read(stream, buff, *stringParser,
+        Bind(readMemory,
+            &HttpsSession::OnRead,
+            this->shared_from_this()));
+}
+// OnReadHeader -> OnRead | StartUpload
+
+void HttpsSession::OnRead(boost::system::error_code error, std::size_t bytes_transferred)
+{
+    boost::ignore_unused(bytes_transferred);
+    reading = false;
+
+    if(error)
+    {
+        return StopReading(error);
+    }
+
+    auto handleStart = std::chrono::steady_clock::now();
+    shared->metrics.Record(Stage::Read, handleStart - stageStart);
+
+    req = stringParser->release();
+    HandleRequest(std::move(req), exec);
+
+    shared->metrics.Record(Stage::Handle, std::chrono::steady_clock::now() - handleStart);
+}
+// OnRead -> HandleRequest
+
+void HttpsSession::StopReading(boost::system::error_code error)
+{
+    readStopped = true;
+    // Ответы, отложенные до разбора этого запроса.
+    DoWrite();
+
+    if(error == boost::beast::http::error::end_of_stream)
+    {
+        // Ответы на уже прочитанные запросы сначала уходят клиенту.
+        closeAfterWrites = true;
+        if(!writing && queueSize == 0)
+        {
+            DoClose();
+        }
+        return;
+    }
+
+    LOG_ERROR("Error on read: ", error.message());
+    shared->metrics.Add(error == boost::beast::error::timeout || idleExpired ? Counter::Timeouts : Counter::ReadErrors);
+}
+
+void HttpsSession::StartUpload()
+{
+    auto server = host.lock();
+    const auto& header = headerParser->get();
+    unsigned version = header.version();
+
+    uploadPath = server->UploadPath(std::string(header.target()));
+    if(uploadPath.empty())
+    {
+        return exec(Error(boost::beast::http::status::bad_request, "Bad upload path", version));
+    }
+
+    auto contentLength = headerParser->content_length();
+    if(contentLength && *contentLength > server->config.uploadBodyLimit)
+    {
+        return exec(Error(boost::beast::http::status::payload_too_large, "File is too large", version));
+    }
+
+    boost::system::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(uploadPath).parent_path(), ec);
+
+    // Временный файл в той же директории, чтобы rename был атомарным.
+    uploadTemp = uploadPath + ".upload-XXXXXX";
+    int fd = ::mkstemp(uploadTemp.data());
+    if(fd < 0)
+    {
+        uploadTemp.clear();
+        return exec(Error(boost::beast::http::status::internal_server_error, "Can't create file", version));
+    }
+
+    bool expectContinue = version >= 11
+        && boost::beast::iequals(header[boost::beast::http::field::expect], "100-continue");
+
+    uploadParser.emplace(std::move(*headerParser));
+    headerParser.reset();
+    uploadParser->body_limit(server->config.uploadBodyLimit);
+
+    boost::beast::file file;
+    file.native_handle(fd);
+    uploadParser->get().body().reset(std::move(file), ec);
+    if(ec)
+    {
+        AbortUpload();
+        return exec(Error(boost::beast::http::status::internal_server_error, "Can't open file", version));
+    }
+
+    if(expectContinue)
+    {
+        continueRes = {boost::beast::http::status::continue_, version};
+        boost::beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(30));
+        if(kernelTls)
+        {
+            boost::beast::http::async_write(boost::beast::get_lowest_layer(stream), continueRes,
+                Bind(readMemory,
+                    &HttpsSession::OnWriteContinue,
+                    this->shared_from_this()));
+        }
+        else
+        {
+            boost::beast::http::async_write(stream, continueRes,
+                Bind(readMemory,
+                    &HttpsSession::OnWriteContinue,
+                    this->shared_from_this()));
+        }
+        return;
+    }
+
+    DoReadUpload();
+}
+// StartUpload -> OnWriteContinue | DoReadUpload
+
+void HttpsSession::OnWriteContinue(boost::beast::error_code error, std::size_t bytes_transferred)
+{
+    boost::ignore_unused(bytes_transferred);
+
+    if(error)
+    {
+        LOG_ERROR("Error on write 100-continue: ", error.message());
+        return AbortUpload();
+    }
+
+    DoReadUpload();
+}
+
+void HttpsSession::DoReadUpload()
+{
+    // Таймаут на каждую порцию, а не на весь файл: большой файл может идти долго.
+    boost::beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(30));
+
+    boost::beast::http::async_read_some(stream, buff, *uploadParser,
+        Bind(readMemory,
+            &HttpsSession::OnReadUpload,
+            this->shared_from_this()));
+}
+
+void HttpsSession::OnReadUpload(boost::system::error_code error, std::size_t bytes_transferred)
+{
+    boost::ignore_unused(bytes_transferred);
+
+    if(error == boost::beast::http::error::body_limit)
+    {
+        unsigned version = uploadParser->get().version();
+        AbortUpload();
+        return exec(Error(boost::beast::http::status::payload_too_large, "File is too large", version));
+    }
+
+    if(error)
+    {
+        LOG_ERROR("Error on upload read: ", error.message());
+        shared->metrics.Add(error == boost::beast::error::timeout ? Counter::Timeouts : Counter::ReadErrors);
+        return AbortUpload();
+    }
+
+    if(!uploadParser->is_done())
+    {
+        return DoReadUpload();
+    }
+
+    FinishUpload();
+}
+// OnReadUpload -> DoReadUpload | FinishUpload
+
+void HttpsSession::FinishUpload()
+{
+    shared->metrics.Record(Stage::Read, std::chrono::steady_clock::now() - stageStart);
+
+    auto& request = uploadParser->get();
+    unsigned version = request.version();
+    bool keepAlive = request.keep_alive();
+
+    request.body().close();
+
+    if(std::rename(uploadTemp.c_str(), uploadPath.c_str()) != 0)
+    {
+        AbortUpload();
+        return exec(Error(boost::beast::http::status::internal_server_error, "Can't save file", version));
+    }
+    uploadTemp.clear();
+
+    LOG_INFO("file uploaded to ", uploadPath);
+
+    boost::beast::http::response<boost::beast::http::string_body, HttpFields> res{boost::beast::http::status::created, version};
+    res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(boost::beast::http::field::content_type, "text/plain");
+    res.keep_alive(keepAlive);
+    res.body() = uploadPath;
+    res.prepare_payload();
+
+    uploadParser.reset();
+    exec(std::move(res));
+}
+
+void HttpsSession::AbortUpload()
+{
+    if(uploadParser)
+    {
+        uploadParser->get().body().close();
+    }
+    if(!uploadTemp.empty())
+    {
+        std::remove(uploadTemp.c_str());
+        uploadTemp.clear();
+    }
+}
+
+void HttpsSession::HandleRequest(boost::beast::http::request<boost::beast::http::string_body, HttpFields>&& req, Executable& send)
+{
+    // Корзины выбираются до Route: после него target запроса уже не доступен.
+    shares[(queueHead + queueSize) % pipelineDepth] = shared->bandwidth.Acquire(
+        std::string_view(req.target().data(), req.target().size()), client);
+
+    std::visit([&send](auto&& res)
+        {
+            send(std::move(res));
+        }, host.lock()->Route(std::move(req)));
+}
+
+HttpsServer::Response HttpsServer::Route(boost::beast::http::request<boost::beast::http::string_body, HttpFields>&& req)
+{
+    if(req.method() == boost::beast::http::verb::get && req.target() == "/metrics")
+    {
+        return HandleMetrics(req);
+    }
+
+    if(req.method() == boost::beast::http::verb::post && req.target() == "/v1/find")
+    {
+        return HandlePostFindWithMeta(std::move(req));
+    }
+
+    if(req.method() == boost::beast::http::verb::post && req.target() == "/v1/unloading")
+    {
+        auto res = HandlePostUnloading(std::move(req));
+        return std::visit([](auto&& full) -> Response
+            {
+                return std::move(full);
+            }, std::move(res));
+    }
+
+    if(req.method() == boost::beast::http::verb::get)
+    {
+        auto res = HandleGetLoad(std::move(req));
+        return std::visit([](auto&& full) -> Response
+            {
+                return std::move(full);
+            }, std::move(res));
     }
 
-    if(target.find(".mp3") != std::string::npos){
-        return "audio/mpeg";
+    if(req.method() == boost::beast::http::verb::head)
+    {
+        // Те же заголовки, что и у GET (Content-Length, ETag, Accept-Ranges), но без тела.
+        auto res = HandleGetLoad(std::move(req));
+        return std::visit([](auto&& full) -> Response
+            {
+                return boost::beast::http::response<boost::beast::http::empty_body, HttpFields>{std::move(full.base())};
+            }, std::move(res));
     }
 
-    return "application/text";
+    LOG_WARN("Unknown HTTP-method");
+    return Error(boost::beast::http::status::bad_request, "Unknown HTTP-method", req.version());
 }
 
-HttpsSession::HttpsSession(
-                            boost::asio::ip::tcp::socket&& socket, 
-                            boost::asio::ssl::context& context, 
-                            std::weak_ptr<HttpsServer> host)
-                                        : stream(std::move(socket), context)
-                                        , exec(*this)
-                                        , host(host)
+
+namespace
 {
 
+bool Coalesce(std::monostate&, std::string&, std::size_t)
+{
+    return false;
 }
 
-boost::beast::http::response<boost::beast::http::string_body> 
-        HttpsServer::Error(boost::beast::http::status status, const std::string& what,unsigned version)
+/**
+ * @brief Дописывает ответ в out целиком, как его отправил бы http::async_write.
+ * @param limit Больший ответ (или ответ без известной длины) не склеивается.
+ * @return false, если ответ уйдет отдельной записью.
+ */
+template<class Body>
+bool Coalesce(boost::beast::http::response<Body, HttpFields>& msg, std::string& out, std::size_t limit)
 {
-    boost::beast::http::response<boost::beast::http::string_body> res{status, version};
-    res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
-    res.set(boost::beast::http::field::content_type, "text/html");
-    res.keep_alive(false);
-    res.body() = "An error occurred: '" + what + "'";
-    res.prepare_payload();
+    auto size = msg.payload_size();
+    if(!size || *size > limit)
+    {
+        return false;
+    }
 
-    return res;
+    std::size_t mark = out.size();
+    boost::beast::http::response_serializer<Body, HttpFields> sr(msg);
+    boost::beast::error_code ec;
+    do
+    {
+        sr.next(ec, [&sr, &out](boost::beast::error_code&, const auto& buffers)
+            {
+                for(auto buffer : boost::beast::buffers_range_ref(buffers))
+                {
+                    out.append(static_cast<const char*>(buffer.data()), buffer.size());
+                }
+                sr.consume(boost::beast::buffer_bytes(buffers));
+            });
+    }
+    while(!ec && !sr.is_done());
+
+    if(ec)
+    {
+        // Ошибку (например, чтения файла) покажет обычная запись.
+        out.resize(mark);
+        return false;
+    }
+    return true;
 }
 
+}
 
+HttpsSession::Outgoing& HttpsSession::NextResponse()
+{
+    return responses[(queueHead + queueSize) % pipelineDepth];
+}
 
-std::variant<boost::beast::http::response<boost::beast::http::file_body>,
-                boost::beast::http::response<boost::beast::http::string_body>>
-    HttpsServer::HandleGetLoad(boost::beast::http::request<boost::beast::http::string_body>&& req)
+void HttpsSession::OnQueued(bool close)
 {
-    std::cout << "hendl get has ben started " << std::endl;
-    std::string target = std::string(req.target().begin(), req.target().end());
-    std::cout << "target is " << target << std::endl;
+    ++queueSize;
+    if(close)
+    {
+        readStopped = true;
+        closeAfterWrites = true;
+    }
 
-    std::string loadTarget {"/v1/download"};
+    // Не ждем конца записи: конвейерный запрос, возможно, уже пришел.
+    if(!readStopped && queueSize < pipelineDepth)
+    {
+        // Следующий запрос уже в буфере и разберется без ожидания сети -
+        // пишем после него, чтобы ответы ушли одной записью.
+        bool buffered = HeaderBuffered();
+        DoRead();
+        if(buffered)
+        {
+            return;
+        }
+    }
 
-    std::string fileName = target.substr(loadTarget.size());
+    DoWrite();
+}
 
-    std::cout << "file name is " << fileName << std::endl;
+bool HttpsSession::HeaderBuffered() const
+{
+    auto data = buff.data();
+    std::string_view view(static_cast<const char*>(data.data()), data.size());
+    return view.find("\r\n\r\n") != std::string_view::npos;
+}
 
-    if(!std::filesystem::exists(fileName) )
+void HttpsSession::DoWrite()
+{
+    if(writing || queueSize == 0)
     {
-        std::cout << "file " << target << "error !" << std::endl;
-        return Error(boost::beast::http::status::not_found, target, req.version());
+        return;
     }
 
-    boost::system::error_code ec;
+    writing = true;
+    writeStart = std::chrono::steady_clock::now();
+    boost::beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(30));
 
-    boost::beast::http::file_body::value_type body;
-    body.open(fileName.c_str(), boost::beast::file_mode::scan, ec);
-    if(ec.failed())
+    writeBuffer.clear();
+    writeCount = 0;
+    while(writeCount < queueSize && writeBuffer.size() < coalesceLimit
+        && std::visit([this](auto& res)
+            {
+                using Message = std::decay_t<decltype(res)>;
+                // Файл с ограничением скорости уходит сам, по порциям.
+                if constexpr(std::is_same_v<Message, boost::beast::http::response<FileRangeBody, HttpFields>>)
+                {
+                    if(shares[(queueHead + writeCount) % pipelineDepth].Limited())
+                    {
+                        return false;
+                    }
+                }
+                return Coalesce(res, writeBuffer, coalesceLimit);
+            }, responses[(queueHead + writeCount) % pipelineDepth]))
     {
-        return Error(boost::beast::http::status::internal_server_error, "Can't open file: '" + fileName + "'", req.version());
+        ++writeCount;
     }
 
-    auto size = body.size();
-    std::cout << "body.size() = " << size << std::endl; 
+    if(writeCount > 0)
+    {
+        // При kTLS шифрует ядро, поэтому пишем прямо в tcp-сокет.
+        if(kernelTls)
+        {
+            boost::asio::async_write(
+                boost::beast::get_lowest_layer(stream),
+                boost::asio::buffer(writeBuffer),
+                Bind(writeMemory,
+                    &HttpsSession::OnWrite,
+                    this->shared_from_this()));
+            return;
+        }
 
-    boost::beast::http::response<boost::beast::http::file_body> res{
-    std::piecewise_construct,
-    std::make_tuple(std::move(body)),
-    std::make_tuple(boost::beast::http::status::ok, req.version())};
-    res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
-    res.set(boost::beast::http::field::content_type, GetContentType(fileName)); // ? 
-    res.content_length(size);
-    res.keep_alive(req.keep_alive());
+        boost::asio::async_write(
+            stream,
+            boost::asio::buffer(writeBuffer),
+            Bind(writeMemory,
+                &HttpsSession::OnWrite,
+                this->shared_from_this()));
+        return;
+    }
 
-    return res;
+    writeCount = 1;
+    std::visit([this](auto& res)
+        {
+            using Message = std::decay_t<decltype(res)>;
+            if constexpr(!std::is_same_v<Message, std::monostate>)
+            {
+                if constexpr(std::is_same_v<Message, boost::beast::http::response<FileRangeBody, HttpFields>>)
+                {
+                    // Из памяти sendfile не нужен - буфер уходит одним write.
+                    if(kernelTls && !res.body().IsMemory())
+                    {
+                        return StartSendFile(std::move(res));
+                    }
+                    if(shares[queueHead].Limited())
+                    {
+                        partialWriter.emplace<boost::beast::http::response_serializer<FileRangeBody, HttpFields>>(res);
+                        partialBytes = 0;
+                        return DoPartialWrite();
+                    }
+                }
+                if constexpr(std::is_same_v<Message, boost::beast::http::response<TarBody, HttpFields>>)
+                {
+                    partialWriter.emplace<boost::beast::http::response_serializer<TarBody, HttpFields>>(res);
+                    partialBytes = 0;
+                    return DoPartialWrite();
+                }
+
+                if(kernelTls)
+                {
+                    boost::beast::http::async_write(
+                        boost::beast::get_lowest_layer(stream),
+                        res,
+                        Bind(writeMemory,
+                            &HttpsSession::OnWrite,
+                            this->shared_from_this()));
+                    return;
+                }
+
+                // Write the response
+                boost::beast::http::async_write(
+                    stream,
+                    res,
+                    Bind(writeMemory,
+                        &HttpsSession::OnWrite,
+                        this->shared_from_this()));
+            }
+        }, responses[queueHead]);
 }
 
+void HttpsSession::OnWrite(boost::beast::error_code ec, std::size_t bytes_transferred)
+{
+    auto& metrics = shared->metrics;
+    metrics.Record(Stage::Write, std::chrono::steady_clock::now() - writeStart);
+    metrics.Add(Counter::BytesSent, bytes_transferred);
+    metrics.Add(Counter::Requests, writeCount);
+    if(throttled > std::chrono::steady_clock::duration::zero())
+    {
+        metrics.Record(Stage::Throttle, throttled);
+        throttled = {};
+    }
+    writing = false;
 
+    if(ec)
+    {
+        LOG_ERROR("Error on write: ", ec.message());
+        metrics.Add(ec == boost::beast::error::timeout ? Counter::Timeouts : Counter::WriteErrors);
+        // Остальные ответы уже не дойдут - закрываем сокет вместе с ожидающим чтением.
+        readStopped = true;
+        boost::beast::get_lowest_layer(stream).close();
+        return;
+    }
 
-void HttpsSession::Run()
-{
-    boost::asio::dispatch(
-            stream.get_executor(),
-            boost::beast::bind_front_handler(
-                &HttpsSession::OnRun,
-                this->shared_from_this()));
-}
-// run call -> on run 
+    for(; writeCount > 0; --writeCount)
+    {
+        responses[queueHead].emplace<std::monostate>();
+        shares[queueHead] = {};
+        queueHead = (queueHead + 1) % pipelineDepth;
+        --queueSize;
+    }
 
+    // Чтение, начатое во время записи, идет без таймаута.
+    bool waitingRequest = reading;
 
-void HttpsSession::OnRun()
-{
-    boost::beast::get_lowest_layer(stream).expires_after(
-            std::chrono::seconds(30));
+    DoWrite();
+    // Очередь была полна - освободилось место.
+    if(!reading && !readStopped && !uploadPending && queueSize < pipelineDepth)
+    {
+        DoRead();
+    }
+    if(writing)
+    {
+        return;
+    }
 
-    stream.async_handshake(
-        boost::asio::ssl::stream_base::server,
-        boost::beast::bind_front_handler(
-            &HttpsSession::OnPerformingSsl,
-            this->shared_from_this()));
-}
-// OnRun -> OnPerformingSsl
+    if(uploadPending)
+    {
+        uploadPending = false;
+        return StartUpload();
+    }
 
+    if(closeAfterWrites)
+    {
+        return DoClose();
+    }
 
-void HttpsSession::OnPerformingSsl(boost::system::error_code error)
+    if(waitingRequest)
+    {
+        idleExpired = false;
+        idleTimer.expires_after(std::chrono::seconds(30));
+        idleTimer.async_wait(
+            boost::beast::bind_front_handler(
+                &HttpsSession::OnIdle,
+                this->shared_from_this()));
+    }
+}
+
+void HttpsSession::OnIdle(boost::system::error_code error)
 {
-    if(error)
+    if(error || !reading || writing)
     {
-        std::cout << "Error handshake" << std::endl;
-        std::cout << error.what() << std::endl;
-        std::cout << error.message() << std::endl;
-        std::cout << error.category().name() << std::endl;
         return;
     }
-    DoRead();
+
+    idleExpired = true;
+    boost::beast::get_lowest_layer(stream).close();
 }
-// OnPerformingSsl -> DoRead
 
-void HttpsSession::DoRead()
+HttpsSession::Executable::Executable(HttpsSession& rf)
+    : self(rf)
 {
-    req = {};
-    boost::beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(30));
 
-    // Read a request
-    boost::beast::http::async_read(stream, buff, req,
-        boost::beast::bind_front_handler(
-            &HttpsSession::OnRead,
+}
+
+void HttpsSession::StartSendFile(boost::beast::http::response<FileRangeBody, HttpFields>&& msg)
+{
+    writeStart = std::chrono::steady_clock::now();
+    sendFileState.emplace(std::move(msg));
+    sendFileState->sr.split(true);
+    sendFileState->deadline = writeStart + std::chrono::seconds(30);
+
+    boost::beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(30));
+    boost::beast::http::async_write_header(
+        boost::beast::get_lowest_layer(stream),
+        sendFileState->sr,
+        Bind(writeMemory,
+            &HttpsSession::OnSendFileWrite,
             this->shared_from_this()));
 }
-// DoRead -> OnRead
 
-void HttpsSession::OnRead(boost::system::error_code error, std::size_t bytes_transferred)
+void HttpsSession::OnSendFileWrite(boost::beast::error_code error, std::size_t bytes_transferred)
 {
-    boost::ignore_unused(bytes_transferred);
+    if(error)
+    {
+        sendFileState.reset();
+        return OnWrite(error, bytes_transferred);
+    }
 
-    if(error == boost::beast::http::error::end_of_stream)
+    sendFileState->bytes += bytes_transferred;
+    DoSendFile();
+}
+
+void HttpsSession::OnSendFileWait(boost::beast::error_code error)
+{
+    if(sendFileState->waiting)
     {
-        return DoClose();
+        sendFileState->waiting = false;
+        sendFileTimer.cancel();
+    }
+    if(sendFileState->timedOut)
+    {
+        error = boost::beast::error::timeout;
     }
 
     if(error)
     {
-        std::cout << "Error on read" << std::endl;
+        std::size_t bytes = sendFileState->bytes;
+        sendFileState.reset();
+        return OnWrite(error, bytes);
     }
 
-    HandleRequest(std::move(req), exec);
+    DoSendFile();
 }
-// OnRead -> HandleRequest
 
-void HttpsSession::HandleRequest(boost::beast::http::request<boost::beast::http::string_body>&& req, Executable& send)
+void HttpsSession::OnSendFileTimeout(boost::system::error_code error)
 {
-    if(req.method() == boost::beast::http::verb::get)
+    // Срабатывание от прошлого ожидания: с тех пор файл отправлялся и срок сдвинулся.
+    if(error || !sendFileState || !sendFileState->waiting
+        || std::chrono::steady_clock::now() < sendFileState->deadline)
+    {
+        return;
+    }
+
+    sendFileState->timedOut = true;
+    boost::system::error_code ec;
+    boost::beast::get_lowest_layer(stream).socket().cancel(ec);
+}
+
+void HttpsSession::DoSendFile()
+{
+    auto& state = *sendFileState;
+    const auto& body = state.msg.body();
+    auto& sock = boost::beast::get_lowest_layer(stream).socket();
+
+    while(state.part < body.Parts().size())
     {
-        auto res = host.lock()->HandleGetLoad(std::move(req));
+        const auto& part = body.Parts()[state.part];
 
-        if(res.index() == 0)
+        if(!state.headSent)
         {
-            send(std::move(std::get<boost::beast::http::response<boost::beast::http::file_body>>(std::move(res))));
+            state.headSent = true;
+            if(!part.head.empty())
+            {
+                boost::beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(30));
+                boost::asio::async_write(
+                    boost::beast::get_lowest_layer(stream),
+                    boost::asio::buffer(part.head),
+                    Bind(writeMemory,
+                        &HttpsSession::OnSendFileWrite,
+                        this->shared_from_this()));
+                return;
+            }
         }
-        else
+
+        while(state.sent < part.length)
         {
-            send(std::move(std::get<boost::beast::http::response<boost::beast::http::string_body>>(std::move(res))));
+            if(Throttle(Bind(writeMemory, &HttpsSession::OnSendFileWait, this->shared_from_this())))
+            {
+                return;
+            }
+
+            const auto& share = shares[queueHead];
+            off_t offset = static_cast<off_t>(part.offset + state.sent);
+            std::size_t chunk = static_cast<std::size_t>(
+                std::min<std::uint64_t>(part.length - state.sent, share.Limited() ? share.Chunk() : 16 * 1024 * 1024));
+
+            ssize_t n = ::sendfile(sock.native_handle(), body.NativeHandle(), &offset, chunk);
+            if(n > 0)
+            {
+                state.sent += static_cast<std::uint64_t>(n);
+                state.bytes += static_cast<std::size_t>(n);
+                auto now = std::chrono::steady_clock::now();
+                share.Consume(static_cast<std::uint64_t>(n), now);
+                state.deadline = now + std::chrono::seconds(30);
+                continue;
+            }
+            if(n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                state.waiting = true;
+                sendFileTimer.expires_at(state.deadline);
+                sendFileTimer.async_wait(
+                    boost::beast::bind_front_handler(
+                        &HttpsSession::OnSendFileTimeout,
+                        this->shared_from_this()));
+                sock.async_wait(
+                    boost::asio::socket_base::wait_write,
+                    Bind(writeMemory,
+                        &HttpsSession::OnSendFileWait,
+                        this->shared_from_this()));
+                return;
+            }
+
+            // n == 0 - файл укоротили после того, как ушел Content-Length.
+            boost::beast::error_code ec = n == 0
+                ? boost::beast::error_code(boost::beast::http::error::short_read)
+                : boost::beast::error_code(errno, boost::system::generic_category());
+            std::size_t bytes = state.bytes;
+            sendFileState.reset();
+            return OnWrite(ec, bytes);
         }
 
+        ++state.part;
+        state.headSent = false;
+        state.sent = 0;
+    }
+
+    if(!state.tailSent && !body.Tail().empty())
+    {
+        state.tailSent = true;
+        boost::beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(30));
+        boost::asio::async_write(
+            boost::beast::get_lowest_layer(stream),
+            boost::asio::buffer(body.Tail()),
+            Bind(writeMemory,
+                &HttpsSession::OnSendFileWrite,
+                this->shared_from_this()));
         return;
     }
 
-    std::cout << "Unknown HTTP-method" << std::endl;
-    send(std::move(Error(boost::beast::http::status::bad_request,"Unknown HTTP-method", req.version())));
+    std::size_t bytes = state.bytes;
+    sendFileState.reset();
+    OnWrite({}, bytes);
 }
 
-
-void HttpsSession::OnWrite(bool close, boost::beast::error_code ec, std::size_t bytes_transferred)
+void HttpsSession::DoPartialWrite()
 {
-    boost::ignore_unused(bytes_transferred);
-
-    if(ec)
+    if(Throttle(Bind(writeMemory, &HttpsSession::OnPaceWait, this->shared_from_this())))
     {
-        std::cout << ec.message()  << std::endl;
+        return;
     }
 
-    if(close)
+    const auto& share = shares[queueHead];
+    boost::beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(30));
+    std::visit([this, &share](auto& sr)
+        {
+            using Serializer = std::decay_t<decltype(sr)>;
+            if constexpr(!std::is_same_v<Serializer, std::monostate>)
+            {
+                if(share.Limited())
+                {
+                    sr.limit(share.Chunk());
+                }
+
+                if(kernelTls)
+                {
+                    boost::beast::http::async_write_some(
+                        boost::beast::get_lowest_layer(stream),
+                        sr,
+                        Bind(writeMemory,
+                            &HttpsSession::OnPartialWrite,
+                            this->shared_from_this()));
+                    return;
+                }
+
+                boost::beast::http::async_write_some(
+                    stream,
+                    sr,
+                    Bind(writeMemory,
+                        &HttpsSession::OnPartialWrite,
+                        this->shared_from_this()));
+            }
+        }, partialWriter);
+}
+
+void HttpsSession::OnPartialWrite(boost::beast::error_code error, std::size_t bytes_transferred)
+{
+    partialBytes += bytes_transferred;
+    if(bytes_transferred > 0)
     {
-        return DoClose();
+        shares[queueHead].Consume(bytes_transferred, std::chrono::steady_clock::now());
     }
 
-    mg = nullptr;
+    bool done = std::visit([](auto& sr)
+        {
+            using Serializer = std::decay_t<decltype(sr)>;
+            if constexpr(std::is_same_v<Serializer, std::monostate>)
+            {
+                return true;
+            }
+            else
+            {
+                return sr.is_done();
+            }
+        }, partialWriter);
+    if(!error && !done)
+    {
+        return DoPartialWrite();
+    }
 
-    DoRead();
+    partialWriter.emplace<std::monostate>();
+    OnWrite(error, partialBytes);
 }
 
-HttpsSession::Executable::Executable(HttpsSession& rf)
-    : self(rf)
+void HttpsSession::OnPaceWait(boost::system::error_code error)
 {
+    if(error)
+    {
+        return OnPartialWrite(error, 0);
+    }
 
+    DoPartialWrite();
 }
 
 void HttpsSession::DoClose()
 {
+    stageStart = std::chrono::steady_clock::now();
+
+    if(kernelTls)
+    {
+        // OpenSSL уже не знает номер следующей записи, поэтому
+        // close_notify отправляем через ядро и закрываем сокет сами.
+        auto& sock = boost::beast::get_lowest_layer(stream).socket();
+        KernelTls::SendCloseNotify(sock.native_handle());
+        boost::system::error_code ec;
+        sock.shutdown(boost::asio::ip::tcp::socket::shutdown_send, ec);
+        sock.close(ec);
+        shared->metrics.Record(Stage::Shutdown, std::chrono::steady_clock::now() - stageStart);
+        return;
+    }
+
     boost::beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(30));
 
     stream.async_shutdown(
-        boost::beast::bind_front_handler(
+        Bind(writeMemory,
             &HttpsSession::OnShutdown,
             this->shared_from_this()));
 }
 
 void HttpsSession::OnShutdown(boost::beast::error_code error)
 {
+    shared->metrics.Record(Stage::Shutdown, std::chrono::steady_clock::now() - stageStart);
+
     if(error)
     {
-        std::cout << "Error on shutdown" << std::endl;
+        LOG_ERROR("Error on shutdown");
     }
 }
 
@@ -225,11 +1974,37 @@ void HttpsSession::OnShutdown(boost::beast::error_code error)
 
 
 
-HttpsServer::HttpsServer(const ConfigServer& conf,  const std::string InetIp, boost::asio::io_context& context)
+ServerShared::ServerShared(const ConfigServer& conf)
+    : fileCache(conf.openFileCacheSize, std::chrono::milliseconds(conf.openFileRevalidateMs))
+    , memoryCache(conf.memoryCacheBudget, conf.memoryCacheMaxFile)
+    , compressedCache(conf.compressionCacheBudget, conf.compressionMaxFile, conf.compressionLevel)
+    , tlsSessions(conf.tlsSessionCacheSize, std::chrono::seconds(conf.tlsSessionLifetimeSec),
+                  std::chrono::seconds(conf.tlsTicketKeyRotationSec))
+    , bandwidth(conf.bandwidthLimit, conf.bandwidthRules, std::chrono::milliseconds(conf.bandwidthBurstMs))
+    , admission(conf.maxSessions)
+{
+    if(conf.etagContentHash)
+    {
+        contentHasher = std::make_unique<ContentHasher>(conf.etagContentHashCapacity);
+    }
+
+    if(!conf.recordingsDirectory.empty())
+    {
+        // Заполняет RecordingWatcher.
+        recordings = std::make_shared<RecordingIndex>();
+    }
+
+}
+
+HttpsServer::HttpsServer(const ConfigServer& conf,  const std::string InetIp, boost::asio::io_context& context,
+                         std::shared_ptr<ServerShared> shared_)
     : ctx(boost::asio::ssl::context::tlsv12)
     , context(context)
     , acc(context)
     , config(conf)
+    , shared(shared_ ? std::move(shared_) : std::make_shared<ServerShared>(conf))
+    , acceptTimer(context)
+    , acceptBackoff(conf.acceptBackoffMinMs)
 {
     LoadServerCertificate();
     boost::asio::ip::tcp::endpoint end(boost::asio::ip::make_address(InetIp), std::stoul(config.serverPort));
@@ -238,35 +2013,64 @@ HttpsServer::HttpsServer(const ConfigServer& conf,  const std::string InetIp, bo
     acc.open(end.protocol(), error);
     if(error)
     {
-        std::cout << "Error on open acceptor" << std::endl;
+        LOG_ERROR("Error on open acceptor");
         exit(1);
     }
 
     acc.set_option(boost::asio::socket_base::reuse_address(true), error);
     if(error)
     {
-        std::cout << "Error on set options in acceptor" <<  std::endl;
+        LOG_ERROR("Error on set options in acceptor");
         exit(1);
     }
 
+    if(config.reusePort)
+    {
+        // Каждый шард держит свой acceptor на том же порту, ядро само раздает им подключения.
+        acc.set_option(boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true), error);
+        if(error)
+        {
+            LOG_ERROR("Error on set SO_REUSEPORT in acceptor");
+            exit(1);
+        }
+    }
+
     acc.bind(end, error);
     if(error)
     {
-        std::cout << "Error on bind acceptor's port" << std::endl;
+        LOG_ERROR("Error on bind acceptor's port");
         exit(1);
     }
 
     acc.listen(boost::asio::socket_base::max_listen_connections, error);
     if(error)
     {
-        std::cout << "Error on listen" << std::endl;
+        LOG_ERROR("Error on listen");
+        exit(1);
+    }
+
+    // Синхронный accept в ShedConnections не должен ждать, если очередь пуста.
+    acc.non_blocking(true, error);
+    if(error)
+    {
+        LOG_ERROR("Error on set non-blocking acceptor");
         exit(1);
     }
+
+    reserveFd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if(reserveFd < 0)
+    {
+        LOG_WARN("Can't open reserve descriptor, connections won't be shed on EMFILE");
+    }
 }
 
 HttpsServer::~HttpsServer()
 {
     acc.close();
+    if(reserveFd >= 0)
+    {
+        ::close(reserveFd);
+    }
 }
 
 void HttpsServer::Run()
@@ -287,19 +2091,19 @@ void HttpsServer::LoadServerCertificate()
 
     if(!std::filesystem::exists(config.currentServerCertificate))
     {
-        std::cout << "No " <<  config.currentServerCertificate << std::endl;
+        LOG_ERROR("No ", config.currentServerCertificate);
         bad = true;
     }
 
     if(!std::filesystem::exists(config.currentServerKey))
     {
-        std::cout << "No " + config.currentServerKey << std::endl;
+        LOG_ERROR("No ", config.currentServerKey);
         bad = true;
     }
 
     if(!std::filesystem::exists(config.diffieHellman))
     {
-        std::cout << "No " + config.diffieHellman << std::endl;
+        LOG_ERROR("No ", config.diffieHellman);
         bad = true;
     }
 
@@ -315,21 +2119,38 @@ void HttpsServer::LoadServerCertificate()
     ctx.use_certificate_chain_file(config.currentServerCertificate, error);
     if(error.failed())
     {
-        std::cout << "Certificate: " + error.message() << std::endl;
+        LOG_ERROR("Certificate: ", error.message());
         exit(1);
     }
 
     ctx.use_private_key_file(config.currentServerKey, boost::asio::ssl::context::pem, error);
     if(error.failed())
     {
-        std::cout << "Private key: " + error.message() << std::endl;
+        LOG_ERROR("Private key: ", error.message());
         exit(1);
     }
 
     ctx.use_tmp_dh_file(config.diffieHellman, error);
     if(error.failed())
     {
-        std::cout << "Diffie-Hellman: " + error.message() << std::endl;
+        LOG_ERROR("Diffie-Hellman: ", error.message());
+        exit(1);
+    }
+
+    if(config.kernelTls)
+    {
+        // kTLS умеет только AES-GCM, а пересогласование сбило бы счетчик записей.
+        if(SSL_CTX_set_cipher_list(ctx.native_handle(), KernelTls::CipherList()) != 1)
+        {
+            LOG_ERROR("Can't set kTLS cipher list");
+            exit(1);
+        }
+        SSL_CTX_set_options(ctx.native_handle(), SSL_OP_NO_RENEGOTIATION);
+    }
+
+    if(!shared->tlsSessions.Attach(ctx.native_handle(), config.tlsSessionTickets))
+    {
+        LOG_ERROR("Can't set up TLS session cache");
         exit(1);
     }
 }
@@ -350,28 +2171,116 @@ void HttpsServer::DoAccept()
 
 void HttpsServer::OnAccept(boost::beast::error_code error, boost::asio::ip::tcp::socket sock)
 {
+    if(error == boost::asio::error::operation_aborted)
+    {
+        // acceptor закрыт
+        return;
+    }
+
     if(error)
     {
-        std::cout << "Error on accept" << std::endl;
-        std::this_thread::sleep_for(std::chrono::milliseconds(404));
+        LOG_ERROR("Error on accept: ", error.message());
+        shared->metrics.Add(Counter::AcceptErrors);
+        if(error == boost::asio::error::no_descriptors
+            || error == boost::system::errc::too_many_files_open_in_system)
+        {
+            ShedConnections();
+        }
+
+        // Поток io не усыпляем - на нем идут все открытые сессии.
+        acceptTimer.expires_after(acceptBackoff);
+        acceptTimer.async_wait(
+            boost::beast::bind_front_handler(
+                &HttpsServer::OnAcceptBackoff,
+                this->shared_from_this()));
+        acceptBackoff = std::min(acceptBackoff * 2, std::chrono::milliseconds(config.acceptBackoffMaxMs));
+        return;
+    }
+
+    acceptBackoff = std::chrono::milliseconds(config.acceptBackoffMinMs);
+
+    auto slot = shared->admission.TryAdmit();
+    if(!slot)
+    {
+        Reject(std::move(sock));
+        return DoAccept();
+    }
+
+    // Ответ крупнее coalesceLimit уходит несколькими записями, и Nagle
+    // придержал бы хвост до ACK (delayed ACK, ~40 мс) - на каждом ответе.
+    boost::system::error_code ec;
+    sock.set_option(boost::asio::ip::tcp::no_delay(true), ec);
+
+    if(config.coroutineSessions)
+    {
+        CoroutineSession::Start(std::move(sock), ctx, this->weak_from_this(), std::move(slot));
     }
     else
     {
         std::make_shared<HttpsSession>(
         std::move(sock),
         ctx,
-        this->weak_from_this())->Run();
+        this->weak_from_this(),
+        std::move(slot))->Run();
+    }
+    DoAccept();
+}
+
+void HttpsServer::OnAcceptBackoff(boost::system::error_code error)
+{
+    if(error)
+    {
+        return;
     }
+
     DoAccept();
 }
 
+void HttpsServer::ShedConnections()
+{
+    if(reserveFd < 0)
+    {
+        return;
+    }
+
+    ::close(reserveFd);
+    reserveFd = -1;
+
+    for(std::size_t i = 0; i < shedBatch; ++i)
+    {
+        boost::system::error_code ec;
+        auto sock = acc.accept(ec);
+        if(ec)
+        {
+            break;
+        }
+        shared->metrics.Add(Counter::AcceptShed);
+        sock.close(ec);
+    }
+
+    reserveFd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if(reserveFd < 0)
+    {
+        LOG_WARN("Can't reopen reserve descriptor");
+    }
+}
+
+void HttpsServer::Reject(boost::asio::ip::tcp::socket&& sock)
+{
+    shared->metrics.Add(Counter::AdmissionRejected);
+
+    // FIN без рукопожатия: клиент сразу видит закрытие, а не ждет таймаута.
+    boost::system::error_code ec;
+    sock.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+    sock.close(ec);
+}
 
 
 
 
-boost::beast::http::response<boost::beast::http::string_body> HttpsSession::Error(boost::beast::http::status status, const std::string& what, unsigned version)
+boost::beast::http::response<boost::beast::http::string_body, HttpFields> HttpsSession::Error(boost::beast::http::status status, const std::string& what, unsigned version)
 {
-    boost::beast::http::response<boost::beast::http::string_body> res{status, version};
+    boost::beast::http::response<boost::beast::http::string_body, HttpFields> res{status, version};
     res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
     res.set(boost::beast::http::field::content_type, "text/html");
     res.keep_alive(false);
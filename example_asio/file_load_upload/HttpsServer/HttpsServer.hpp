@@ -6,8 +6,10 @@
 #include <boost/beast/ssl.hpp>
 #include <boost/beast/version.hpp>
 #include <boost/asio/dispatch.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/asio/strand.hpp>
 #include <boost/config.hpp>
+#include <boost/container/static_vector.hpp>
 #include <boost/json.hpp>
 #include <functional>
 #include <utility>
@@ -15,11 +17,31 @@
 #include <string_view>
 #include <thread>
 #include <algorithm>
+#include <array>
 #include <filesystem>
+#include <optional>
 #include <variant>
+#include <vector>
+#include <ctime>
 
 #include <iostream>
 
+#include "../../common/logger.hpp"
+#include "AdmissionControl.hpp"
+#include "BandwidthLimiter.hpp"
+#include "CompressedCache.hpp"
+#include "ContentHasher.hpp"
+#include "FileCache.hpp"
+#include "FileRangeBody.hpp"
+#include "HandlerMemory.hpp"
+#include "KernelTls.hpp"
+#include "MemoryCache.hpp"
+#include "Metrics.hpp"
+#include "RecordingIndex.hpp"
+#include "RecyclingAllocator.hpp"
+#include "TarBody.hpp"
+#include "TlsSessionStore.hpp"
+
 struct ConfigServer {
   std::string rootCACertificate;
   std::string serverHost;
@@ -27,21 +49,102 @@ struct ConfigServer {
   std::string currentServerCertificate;
   std::string currentServerKey; 
   std::string diffieHellman;
+  // Шифровать исходящие данные в ядре (kTLS) и отдавать файлы через sendfile.
+  bool kernelTls = false;
+  // Сколько файлов держать открытыми в кеше (меньше RLIMIT_NOFILE).
+  std::size_t openFileCacheSize = 512;
+  // Как часто сверять открытый файл с диском, мс.
+  unsigned openFileRevalidateMs = 1000;
+  // Сколько памяти отдать под горячие файлы, байт (0 - не кешировать в памяти).
+  std::size_t memoryCacheBudget = 256 * 1024 * 1024;
+  // Файлы больше этого размера в памяти не держим.
+  std::size_t memoryCacheMaxFile = 8 * 1024 * 1024;
+  // Открывать acceptor с SO_REUSEPORT (несколько шардов на одном порту).
+  bool reusePort = false;
+  // Куда складываются файлы, принятые через /v1/upload.
+  std::string uploadDirectory = "./upload";
+  // Максимальный размер загружаемого файла, байт.
+  std::uint64_t uploadBodyLimit = 4ull * 1024 * 1024 * 1024;
+  // Сжимать ответы gzip/deflate, если клиент это принимает.
+  bool compression = true;
+  // Сколько памяти отдать под сжатые варианты файлов, байт.
+  std::size_t compressionCacheBudget = 64 * 1024 * 1024;
+  // Файлы больше этого размера на лету не сжимаются (.gz рядом используется всегда).
+  std::size_t compressionMaxFile = 4 * 1024 * 1024;
+  // Файлы меньше этого размера сжимать невыгодно.
+  std::size_t compressionMinFile = 1024;
+  // Уровень сжатия 1..9.
+  int compressionLevel = 6;
+  // ETag по SHA-256 содержимого (считается в фоне) вместо inode/размера/mtime.
+  bool etagContentHash = false;
+  // Сколько хешей содержимого помнить.
+  std::size_t etagContentHashCapacity = 65536;
+  // Сколько TLS-сессий помнить для возобновления по session ID.
+  std::size_t tlsSessionCacheSize = 20480;
+  // Время жизни TLS-сессии и билета, с.
+  unsigned tlsSessionLifetimeSec = 3600;
+  // Выдавать билеты сессий (RFC 5077).
+  bool tlsSessionTickets = true;
+  // Как часто менять ключ билетов, с.
+  unsigned tlsTicketKeyRotationSec = 3600;
+  // Обслуживать клиентов корутинами (CoroutineSession) вместо цепочки колбэков (HttpsSession).
+  bool coroutineSessions = false;
+  // Где лежат записи с метаданными <запись>.json для POST /v1/find (пусто - поиск выключен).
+  std::string recordingsDirectory;
+  // Больше записей в одном ответе /v1/find не отдаем.
+  std::size_t findLimit = 10000;
+  // Общий предел скорости отдачи файлов, байт/с (0 - без ограничения).
+  std::uint64_t bandwidthLimit = 0;
+  // Пределы скорости по маршрутам: на IP клиента и на весь маршрут.
+  std::vector<BandwidthRule> bandwidthRules;
+  // Сколько времени простоя копит корзина токенов (всплеск после паузы), мс.
+  unsigned bandwidthBurstMs = 1000;
+  // Больше стольких сессий одновременно не обслуживаем, лишние подключения закрываются сразу (0 - без ограничения).
+  std::size_t maxSessions = 0;
+  // Пауза перед повтором accept после ошибки, мс: начинается с Min и удваивается до Max.
+  unsigned acceptBackoffMinMs = 10;
+  unsigned acceptBackoffMaxMs = 1000;
+};
+
+/**
+ * @brief То, что разделяют между собой все потоки и шарды сервера.
+ */
+struct ServerShared
+{
+    explicit ServerShared(const ConfigServer& conf);
+
+    FileCache fileCache;
+    MemoryCache memoryCache;
+    CompressedCache compressedCache;
+    // nullptr, если ETag считается по метаданным.
+    std::unique_ptr<ContentHasher> contentHasher;
+    // Общие для всех SSL_CTX кеш сессий и ключи билетов.
+    TlsSessionStore tlsSessions;
+    // Индекс записей для /v1/find; nullptr, если recordingsDirectory не задан.
+    std::shared_ptr<RecordingIndex> recordings;
+    // Ограничение скорости отдачи файлов.
+    BandwidthLimiter bandwidth;
+    // Предел одновременных сессий всех шардов.
+    AdmissionControl admission;
+    Metrics metrics;
 };
 
 
 class HttpsServer : public std::enable_shared_from_this<HttpsServer>
 {
     friend class HttpsSession;
+    friend class CoroutineSession;
 public:
     /**
      * @brief Создает объект Https сервера,
      * @param config  структура с настройками.
      * @param InetIp Ip, на котором будет HttpServer
      * @param context Объект управления io.
+     * @param shared Общие для шардов кеши. Если не передать - сервер заведет свои.
      * @details Передается структура c настроками, в тч для RequestHandler
      */
-    HttpsServer(const ConfigServer& conf , const std::string InetIp, boost::asio::io_context& context);
+    HttpsServer(const ConfigServer& conf , const std::string InetIp, boost::asio::io_context& context,
+                std::shared_ptr<ServerShared> shared = nullptr);
     ~HttpsServer();
     /**
      * @brief Запускает сервер.
@@ -53,7 +156,14 @@ private:
      * @param target Путь к файлу, который запрашивается.
      * @return Строку типа контента.
      */
-    std::string GetContentType(const std::string& target);
+    std::string_view GetContentType(std::string_view target);
+    /**
+     * @brief Имеет ли смысл сжимать файл при отдаче.
+     * @param target Путь к файлу.
+     * @param contentType Тип контента файла.
+     * @return false для уже сжатых форматов (видео, аудио, картинки, архивы).
+     */
+    bool IsCompressible(std::string_view target, std::string_view contentType) const;
     /**
      * @brief Начинает прием клиентов.
      */
@@ -65,6 +175,23 @@ private:
      * @param sock tcp-сокет клиента.
      */
     void OnAccept(boost::beast::error_code error, boost::asio::ip::tcp::socket sock);
+    /**
+     * @brief Повторяет accept после паузы, начатой ошибкой accept.
+     * @param error Объект проверки ошибки.
+     */
+    void OnAcceptBackoff(boost::system::error_code error);
+    /**
+     * @brief Закрывает подключения из очереди acceptor'а, когда кончились дескрипторы.
+     * @details Освобождает запасной дескриптор, принимает на него подключения
+     * и сразу закрывает их, затем занимает запасной дескриптор снова. Без
+     * этого клиенты висели бы в очереди, пока не истечет их таймаут.
+     */
+    void ShedConnections();
+    /**
+     * @brief Закрывает подключение сверх maxSessions, не начиная рукопожатия.
+     * @param sock tcp-сокет клиента.
+     */
+    void Reject(boost::asio::ip::tcp::socket&& sock);
     /**
     * @brief Обработка запроса на выдачу файлов по json
     * @param task тело запроса
@@ -84,33 +211,175 @@ private:
      */
     std::string GetPassword()const;
 
-    boost::beast::http::response<boost::beast::http::string_body> 
+    /**
+     * @brief Результат разбора заголовка Range.
+     */
+    enum class RangeResult
+    {
+        None,           // заголовка нет или он не разобран - отдаем файл целиком
+        Satisfiable,    // есть хотя бы один диапазон внутри файла
+        Unsatisfiable   // все диапазоны за концом файла - 416
+    };
+    /**
+     * @brief Разбирает заголовок Range вида "bytes=0-99,200-,-500".
+     * @param header Значение заголовка.
+     * @param size Размер файла.
+     * @param ranges Сюда пишутся диапазоны [first, last] (включительно), отсортированные и слитые.
+     * @return Результат разбора.
+     */
+    RangeResult ParseRange(boost::beast::string_view value, std::uint64_t size,
+        std::vector<std::pair<std::uint64_t, std::uint64_t>>& ranges) const;
+    /**
+     * @brief ETag одной версии файла во всех формах, которые мог получить клиент.
+     */
+    using TagList = boost::container::static_vector<EntityTag, 4>;
+    /**
+     * @brief Значение Last-Modified.
+     */
+    using HttpDate = boost::beast::static_string<32>;
+    /**
+     * @brief Проверяет условие If-Range.
+     * @param req Запрос клиента.
+     * @param etags ETag текущей версии файла (см. EntityTags).
+     * @param lastModified Значение Last-Modified текущей версии файла.
+     * @return true, если Range можно применять.
+     */
+    bool IfRangeMatches(const boost::beast::http::request<boost::beast::http::string_body, HttpFields>& req,
+        const TagList& etags, const HttpDate& lastModified) const;
+    /**
+     * @brief Проверяет If-None-Match / If-Modified-Since.
+     * @param req Запрос клиента.
+     * @param etags ETag текущей версии файла (см. EntityTags).
+     * @param modified Время изменения файла.
+     * @param matched Сюда пишется индекс совпавшего тега или npos, если совпала дата.
+     * @return true, если клиенту можно ответить 304.
+     */
+    bool NotModified(const boost::beast::http::request<boost::beast::http::string_body, HttpFields>& req,
+        const TagList& etags, std::time_t modified, std::size_t& matched) const;
+    /**
+     * @brief Есть ли etag в списке тегов из заголовка.
+     * @param list Значение If-None-Match или If-Range.
+     * @param etag Текущий ETag.
+     * @param strong Сильное сравнение (слабые теги не совпадают ни с чем).
+     */
+    static bool ETagMatches(boost::beast::string_view list, const EntityTag& etag, bool strong);
+    /**
+     * @brief Добавляет ETag файла: первым - по содержимому, если хеш уже посчитан,
+     * и по метаданным, который клиент мог получить до того, как хеш был готов.
+     * @param coding Суффикс кодирования ("gzip") для сжатого на лету варианта или nullptr.
+     */
+    void EntityTags(const std::shared_ptr<const CachedFile>& file, const char* coding, TagList& etags);
+    /**
+     * @brief Разбирает HTTP-date (IMF-fixdate).
+     * @return false, если формат не распознан.
+     */
+    static bool ParseHttpDate(boost::beast::string_view value, std::time_t& time);
+    /**
+     * @brief Форматирует время в виде HTTP-date (RFC 7231).
+     */
+    static HttpDate FormatHttpDate(std::time_t time);
+
+    boost::beast::http::response<boost::beast::http::string_body, HttpFields> 
         Error(boost::beast::http::status status, const std::string& what,unsigned version);
 
-    boost::beast::http::response<boost::beast::http::string_body> 
-        HandlePostFindWithMeta(boost::beast::http::request<boost::beast::http::string_body>&& req);
+    /**
+     * @brief Ответ на POST /v1/find: записи, подходящие под фильтры из тела.
+     * @param req Запрос с json: date_from, date_to, login, theme, pin,
+     * project_id, agent_id (строка или список строк), limit.
+     */
+    boost::beast::http::response<boost::beast::http::string_body, HttpFields> 
+        HandlePostFindWithMeta(boost::beast::http::request<boost::beast::http::string_body, HttpFields>&& req);
+    /**
+     * @brief Ответ на POST /v1/unloading: tar-архив с файлами, который
+     * собирается во время отправки (chunked).
+     * @param req Запрос с json: {"files": [путь, ...]} или те же фильтры, что у /v1/find.
+     * Пути из files - только внутри recordingsDirectory; без него files не принимается.
+     */
+    std::variant<boost::beast::http::response<TarBody, HttpFields>,
+                boost::beast::http::response<boost::beast::http::string_body, HttpFields>>
+        HandlePostUnloading(boost::beast::http::request<boost::beast::http::string_body, HttpFields>&& req);
+    /**
+     * @brief Собирает запрос к индексу записей из полей json.
+     * @param error Что не так с полем, если вернули false.
+     */
+    bool ParseFindQuery(const boost::json::object& task, RecordingIndex::Query& query, std::string& error) const;
 
 
+    /**
+     * @brief Путь, куда сохранить загружаемый файл.
+     * @param target target запроса вида /v1/upload/<имя>.
+     * @return Путь внутри uploadDirectory или пустая строка, если имя недопустимо.
+     */
+    std::string UploadPath(const std::string& target) const;
+    /**
+     * @brief Путь файла из /v1/unloading внутри recordingsDirectory.
+     * @param path Абсолютный путь или путь от recordingsDirectory.
+     * @param name Сюда кладется путь от recordingsDirectory (имя в архиве).
+     * @return Нормализованный путь или пустая строка, если он ведет наружу.
+     */
+    std::string RecordingPath(const std::string& path, std::string& name) const;
+
+    /**
+     * @brief Ответ на GET /metrics: метрики сессий и кешей в формате Prometheus.
+     * @param req Запрос клиента.
+     */
+    boost::beast::http::response<boost::beast::http::string_body, HttpFields>
+        HandleMetrics(const boost::beast::http::request<boost::beast::http::string_body, HttpFields>& req);
 
     //Взять URL файлов по параметрам
-    std::variant<boost::beast::http::response<boost::beast::http::file_body>,
-                boost::beast::http::response<boost::beast::http::string_body>>
-        HandleGetLoad(boost::beast::http::request<boost::beast::http::string_body>&& req);
+    std::variant<boost::beast::http::response<FileRangeBody, HttpFields>,
+                boost::beast::http::response<boost::beast::http::string_body, HttpFields>>
+        HandleGetLoad(boost::beast::http::request<boost::beast::http::string_body, HttpFields>&& req);
+
+    /**
+     * @brief Любой ответ на запрос, тело которого прочитано в память.
+     */
+    using Response = std::variant<boost::beast::http::response<FileRangeBody, HttpFields>,
+                                  boost::beast::http::response<boost::beast::http::string_body, HttpFields>,
+                                  boost::beast::http::response<boost::beast::http::empty_body, HttpFields>,
+                                  boost::beast::http::response<TarBody, HttpFields>>;
+    /**
+     * @brief Выбирает обработчик по методу и target.
+     * @param req Запрос клиента.
+     * @details Общая часть HttpsSession и CoroutineSession: сессии только читают и пишут.
+     */
+    Response Route(boost::beast::http::request<boost::beast::http::string_body, HttpFields>&& req);
 private:
+    // Больше диапазонов в одном запросе не обслуживаем - отдаем файл целиком.
+    static constexpr std::size_t maxRanges = 32;
+    // Сколько подключений закрыть за раз через запасной дескриптор.
+    static constexpr std::size_t shedBatch = 64;
     
     ConfigServer config;
 
     boost::asio::io_context& context;
     boost::asio::ssl::context ctx;
     boost::asio::ip::tcp::acceptor acc;
+    std::shared_ptr<ServerShared> shared;
+    // Пауза перед повтором accept после ошибки.
+    boost::asio::steady_timer acceptTimer;
+    std::chrono::milliseconds acceptBackoff;
+    // Запасной дескриптор (/dev/null) на случай EMFILE, -1 - не удалось открыть.
+    int reserveFd = -1;
 };
 
 /**
  * @brief Класс для обработки одного клиента.
+ * @details Поддерживает конвейер HTTP/1.1: следующий запрос читается, пока
+ * отправляются ответы на предыдущие, ответы ждут в очереди (до pipelineDepth)
+ * и уходят по порядку.
  */
 class HttpsSession : public std::enable_shared_from_this<HttpsSession>
 {
 private:
+    /**
+     * @brief Место под ответ в очереди на отправку.
+     */
+    using Outgoing = std::variant<std::monostate,
+                                  boost::beast::http::response<FileRangeBody, HttpFields>,
+                                  boost::beast::http::response<boost::beast::http::string_body, HttpFields>,
+                                  boost::beast::http::response<boost::beast::http::empty_body, HttpFields>,
+                                  boost::beast::http::response<TarBody, HttpFields>>;
     /**
      * @brief Шаблонный класс для отправки сообщения в stream
      */
@@ -126,20 +395,13 @@ private:
          * @brief Оператор для отправки ответа клиенту.
          * @param msg response, отправляемвый клиенту.
          */
-        template<bool isRequest, class Body, class Fields>
-        void operator()(boost::beast::http::message<isRequest, Body, Fields>&& msg)const
+        template<class Body>
+        void operator()(boost::beast::http::response<Body, HttpFields>&& msg)const
         {
-            auto sp = std::make_shared<boost::beast::http::message<isRequest, Body, Fields>>(std::move(msg));
-            self.mg = sp;
-
-            // Write the response
-            boost::beast::http::async_write(
-                self.stream,
-                *sp,
-                boost::beast::bind_front_handler(
-                    &HttpsSession::OnWrite,
-                    self.shared_from_this(),
-                    sp->need_eof()));
+            // Ответ ждет в очереди сессии до OnWrite, отдельный объект в куче не нужен.
+            auto& res = self.NextResponse().template emplace<boost::beast::http::response<Body, HttpFields>>(std::move(msg));
+            bool close = res.need_eof();
+            self.OnQueued(close);
         }
     private:
         HttpsSession& self;
@@ -151,11 +413,14 @@ public:
      * @param filePath Путь к директории, где лежат медиафайлы.
      * @param context ssl-context для зашифрованного обмена данными.
      * @param host Указатель на HttpsServer. Необходим чтобы сделать запрос в бд.
+     * @param slot Место, занятое под сессию в AdmissionControl.
      */
     explicit HttpsSession(
         boost::asio::ip::tcp::socket&& socket,  
         boost::asio::ssl::context& context, 
-        std::weak_ptr<HttpsServer> host);
+        std::weak_ptr<HttpsServer> host,
+        AdmissionControl::Slot slot = {});
+    ~HttpsSession();
     /**
      * @brief Запустить обработку клиента.
      */
@@ -167,14 +432,14 @@ private:
      */
     void OnPerformingSsl(boost::system::error_code error);
 
-    boost::beast::http::response<boost::beast::http::string_body> 
+    boost::beast::http::response<boost::beast::http::string_body, HttpFields> 
         Error(boost::beast::http::status status, const std::string& what,unsigned version);
     /**
      * @brief Метод для обработки запроса от пользователя.
      * @param req Сообщение-запрос от клиента.
      * @param send Объект, с перегруженным оператором operator().
      */
-    void HandleRequest(boost::beast::http::request<boost::beast::http::string_body>&& req, Executable& send);
+    void HandleRequest(boost::beast::http::request<boost::beast::http::string_body, HttpFields>&& req, Executable& send);
 
 
 
@@ -185,9 +450,15 @@ private:
      */
     void OnRun();
     /**
-     * @brief Метод для чтения запроса клиента.
+     * @brief Метод для чтения заголовка запроса клиента.
      */
     void DoRead();
+    /**
+     * @brief Выбирает, куда читать тело: в память или (для загрузки) в файл.
+     * @param error Объект для хранения ошибки.
+     * @param bytes_transferred Сколько байт пришло.
+     */
+    void OnReadHeader(boost::system::error_code error, std::size_t bytes_transferred);
     /**
      * @brief Метод для проверки успешности чтения от клиента.
      * @param error Объект для хранения ошибки.
@@ -195,12 +466,137 @@ private:
      */
     void OnRead(boost::system::error_code error, std::size_t bytes_transferred);
     /**
-     * @brief Метод для проверки успешности отсылки ответа клиенту.
-     * @param close Отключаем ли клиента.
+     * @brief Больше не читает запросы: клиент закрыл соединение или ошибка.
+     * @details При закрытии клиентом соединение закрывается после отправки
+     * ответов на уже прочитанные запросы.
+     * @param error Объект для хранения ошибки.
+     */
+    void StopReading(boost::system::error_code error);
+    /**
+     * @brief Начинает прием файла: временный файл рядом с целевым, 100-continue.
+     */
+    void StartUpload();
+    /**
+     * @brief Вызывается после отправки 100 Continue.
+     * @param error Объект для хранения ошибки.
+     * @param bytes_transferred Сколько байт ушло.
+     */
+    void OnWriteContinue(boost::beast::error_code error, std::size_t bytes_transferred);
+    /**
+     * @brief Читает очередную порцию тела загружаемого файла.
+     */
+    void DoReadUpload();
+    /**
+     * @brief Пишет прочитанную порцию в файл (это делает парсер) и читает дальше.
+     * @param error Объект для хранения ошибки.
+     * @param bytes_transferred Сколько байт пришло.
+     */
+    void OnReadUpload(boost::system::error_code error, std::size_t bytes_transferred);
+    /**
+     * @brief Переименовывает временный файл в целевой и отвечает клиенту.
+     */
+    void FinishUpload();
+    /**
+     * @brief Удаляет временный файл неудавшейся загрузки.
+     */
+    void AbortUpload();
+    /**
+     * @brief Свободное место в конце очереди ответов.
+     */
+    Outgoing& NextResponse();
+    /**
+     * @brief Ответ встал в очередь: запускает запись и чтение следующего запроса.
+     * @param close Последний ли это ответ в соединении.
+     */
+    void OnQueued(bool close);
+    /**
+     * @brief Есть ли в буфере чтения полный заголовок следующего запроса.
+     */
+    bool HeaderBuffered() const;
+    /**
+     * @brief Отправляет ответы из очереди, если запись сейчас не идет.
+     * @details Маленькие ответы подряд сериализуются в один буфер и уходят
+     * одной записью (одной TLS-записью), большие - по одному.
+     */
+    void DoWrite();
+    /**
+     * @brief Метод для проверки успешности отсылки ответов клиенту.
      * @param ec Объект для хранения ошибки.
      * @param bytes_transferred Сколько байт ушло.
      */
-    void OnWrite(bool close, boost::beast::error_code ec, std::size_t bytes_transferred);
+    void OnWrite(boost::beast::error_code ec, std::size_t bytes_transferred);
+    /**
+     * @brief Ограничивает ожидание запроса, начатого без таймаута во время записи.
+     * @param error Объект для хранения ошибки.
+     */
+    void OnIdle(boost::system::error_code error);
+    /**
+     * @brief Начинает отправку файла через sendfile (только при kTLS).
+     * @param msg response с файлом.
+     */
+    void StartSendFile(boost::beast::http::response<FileRangeBody, HttpFields>&& msg);
+    /**
+     * @brief Отправляет очередную часть файла, пока сокет принимает данные.
+     */
+    void DoSendFile();
+    /**
+     * @brief Продолжение отправки после записи заголовка или границы multipart.
+     * @param error Объект для хранения ошибки.
+     * @param bytes_transferred Сколько байт ушло.
+     */
+    void OnSendFileWrite(boost::beast::error_code error, std::size_t bytes_transferred);
+    /**
+     * @brief Продолжение отправки после того, как сокет снова готов к записи.
+     * @param error Объект для хранения ошибки.
+     */
+    void OnSendFileWait(boost::beast::error_code error);
+    /**
+     * @brief Прерывает ожидание сокета, если с последней отправки прошло больше таймаута записи.
+     * @param error Объект для хранения ошибки.
+     */
+    void OnSendFileTimeout(boost::system::error_code error);
+    /**
+     * @brief Отправляет очередную порцию архива или файла с ограничением скорости.
+     * @details Такой ответ может идти дольше таймаута записи, поэтому срок
+     * ставится на каждую порцию, а не на весь ответ. Если у ответа нет
+     * токенов, порция ждет на таймере, не занимая поток.
+     */
+    void DoPartialWrite();
+    /**
+     * @brief Продолжение отправки по порциям.
+     * @param error Объект для хранения ошибки.
+     * @param bytes_transferred Сколько байт ушло.
+     */
+    void OnPartialWrite(boost::beast::error_code error, std::size_t bytes_transferred);
+    /**
+     * @brief Продолжение отправки по порциям после ожидания токенов.
+     * @param error Объект для хранения ошибки.
+     */
+    void OnPaceWait(boost::system::error_code error);
+    /**
+     * @brief Ждать ли токенов перед следующей порцией ответа из начала очереди.
+     * @param handler Что вызвать после ожидания.
+     * @return true, если ожидание началось.
+     */
+    template<class Handler>
+    bool Throttle(Handler&& handler)
+    {
+        const auto& share = shares[queueHead];
+        if(!share.Limited())
+        {
+            return false;
+        }
+        auto wait = share.Wait(std::chrono::steady_clock::now());
+        if(wait <= std::chrono::steady_clock::duration::zero())
+        {
+            return false;
+        }
+        throttled += wait;
+        shared->metrics.Add(Counter::ThrottleWaits);
+        paceTimer.expires_after(wait);
+        paceTimer.async_wait(std::forward<Handler>(handler));
+        return true;
+    }
     /**
      * @brief Метод для отключения клиента.
      */
@@ -211,13 +607,114 @@ private:
      */
     void OnShutdown(boost::beast::error_code error);
 private:
+    // Ограничение на тело обычного запроса (читается в память).
+    static constexpr std::uint64_t requestBodyLimit = 1024 * 1024;
+    // Сколько ответов на конвейерные запросы может ждать отправки.
+    static constexpr std::size_t pipelineDepth = 8;
+    // Ответы не больше этого склеиваются в одну запись (максимум TLS-записи).
+    static constexpr std::size_t coalesceLimit = 16 * 1024;
+
+    /**
+     * @brief bind_front_handler, чьи операции берут память из memory.
+     * @param memory readMemory или writeMemory - по цепочке, к которой относится операция.
+     */
+    template<class... Args>
+    auto Bind(HandlerMemory& memory, Args&&... args)
+    {
+        return MakeAllocatingHandler(memory, boost::beast::bind_front_handler(std::forward<Args>(args)...));
+    }
+
+    /**
+     * @brief Состояние отправки файла через sendfile.
+     */
+    struct SendFileState
+    {
+        explicit SendFileState(boost::beast::http::response<FileRangeBody, HttpFields>&& m)
+            : msg(std::move(m))
+            , sr(msg)
+        {
+        }
+
+        boost::beast::http::response<FileRangeBody, HttpFields> msg;
+        boost::beast::http::response_serializer<FileRangeBody, HttpFields> sr;
+        std::size_t part = 0;
+        bool headSent = false;
+        std::uint64_t sent = 0;
+        bool tailSent = false;
+        std::size_t bytes = 0;
+        // Крайний срок ожидания сокета; сдвигается, когда sendfile что-то отправил.
+        std::chrono::steady_clock::time_point deadline;
+        // Идет ожидание готовности сокета к записи.
+        bool waiting = false;
+        bool timedOut = false;
+    };
+
     boost::beast::ssl_stream<boost::beast::tcp_stream> stream;
     boost::beast::flat_buffer buff;
-    boost::beast::http::request<boost::beast::http::string_body> req;
-    std::shared_ptr<void> mg;
+    boost::beast::http::request<boost::beast::http::string_body, HttpFields> req;
+    // Сначала читаем только заголовок, тело - в зависимости от маршрута.
+    std::optional<boost::beast::http::request_parser<boost::beast::http::empty_body, RecyclingAllocator<char>>> headerParser;
+    std::optional<boost::beast::http::request_parser<boost::beast::http::string_body, RecyclingAllocator<char>>> stringParser;
+    std::optional<boost::beast::http::request_parser<boost::beast::http::file_body, RecyclingAllocator<char>>> uploadParser;
+    boost::beast::http::response<boost::beast::http::empty_body, HttpFields> continueRes;
+    std::string uploadTemp;
+    std::string uploadPath;
+    // Очередь ответов (кольцо): место под них переиспользуется запросами keep-alive.
+    std::array<Outgoing, pipelineDepth> responses;
+    std::size_t queueHead = 0;
+    std::size_t queueSize = 0;
+    // Сколько ответов из начала очереди уходит текущей записью.
+    std::size_t writeCount = 0;
+    // Склеенные маленькие ответы.
+    std::string writeBuffer;
+    bool reading = false;
+    bool writing = false;
+    // Следующих запросов не будет: клиент закрыл соединение, ошибка или ответ с Connection: close.
+    bool readStopped = false;
+    // Отключить клиента, когда очередь опустеет.
+    bool closeAfterWrites = false;
+    // Загрузка файла ждет, пока уйдут ответы на предыдущие запросы.
+    bool uploadPending = false;
+    // Корзины токенов для ответов из очереди (пустые - без ограничения скорости).
+    std::array<BandwidthShare, pipelineDepth> shares;
+    // Сериализатор ответа из начала очереди, который уходит по порциям (архив или файл с ограничением скорости).
+    std::variant<std::monostate,
+                 boost::beast::http::response_serializer<FileRangeBody, HttpFields>,
+                 boost::beast::http::response_serializer<TarBody, HttpFields>> partialWriter;
+    std::size_t partialBytes = 0;
+    // Ожидание токенов и сколько ждал текущий ответ.
+    boost::asio::steady_timer paceTimer;
+    std::chrono::steady_clock::duration throttled{};
+    boost::asio::ip::address client;
+    // Срок ожидания запроса, чтение которого началось во время записи.
+    boost::asio::steady_timer idleTimer;
+    bool idleExpired = false;
     Executable exec;
     std::weak_ptr<HttpsServer> host;
     std::string filePath;
+    // Исходящие данные шифрует ядро (kTLS TX включен после рукопожатия).
+    bool kernelTls = false;
+    std::optional<SendFileState> sendFileState;
+    // Срок ожидания сокета при sendfile: async_wait на сокете таймер tcp_stream не видит.
+    boost::asio::steady_timer sendFileTimer;
+
+    // Держим общие данные, чтобы метрики пережили сервер, если сессия завершается позже.
+    std::shared_ptr<ServerShared> shared;
+    // Освобождается раньше shared, в котором живет AdmissionControl.
+    AdmissionControl::Slot slot;
+    // Память под асинхронные операции сессии, переиспользуется между запросами.
+    // Своя у каждой цепочки операций: в цепочке следующая операция начинается
+    // только в обработчике предыдущей, то есть после освобождения ее памяти,
+    // поэтому блокировки не нужны и в --shared. Чтение (рукопожатие, запросы,
+    // загрузка файла) и запись (ответы, sendfile, ожидание токенов, shutdown)
+    // идут одновременно. Ожидания idleTimer и sendFileTimer отменяются и
+    // взводятся снова, пока отмененное еще не завершилось, - их память берет asio.
+    HandlerMemory readMemory;
+    HandlerMemory writeMemory;
+    std::chrono::steady_clock::time_point created;
+    // Начало текущего этапа (рукопожатие, чтение, shutdown).
+    std::chrono::steady_clock::time_point stageStart;
+    std::chrono::steady_clock::time_point writeStart;
 
 };
 
@@ -0,0 +1,200 @@
+#include "KernelTls.hpp"
+
+#include "../../common/logger.hpp"
+
+#if defined(__linux__) && __has_include(<linux/tls.h>)
+
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/obj_mac.h>
+
+#include <linux/tls.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <cstring>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+
+namespace
+{
+    /**
+     * @brief Выводит key_block TLS 1.2 (RFC 5246, 6.3) из master secret.
+     */
+    bool DeriveKeyBlock(SSL* ssl, const EVP_MD* md, unsigned char* out, std::size_t outLen)
+    {
+        unsigned char master[SSL_MAX_MASTER_KEY_LENGTH];
+        std::size_t masterLen = SSL_SESSION_get_master_key(SSL_get_session(ssl), master, sizeof(master));
+
+        unsigned char clientRandom[SSL3_RANDOM_SIZE];
+        unsigned char serverRandom[SSL3_RANDOM_SIZE];
+        if(masterLen == 0
+            || SSL_get_client_random(ssl, clientRandom, sizeof(clientRandom)) != sizeof(clientRandom)
+            || SSL_get_server_random(ssl, serverRandom, sizeof(serverRandom)) != sizeof(serverRandom))
+        {
+            return false;
+        }
+
+        static const unsigned char label[] = "key expansion";
+
+        EVP_PKEY_CTX* pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_TLS1_PRF, nullptr);
+        bool ok = pctx != nullptr
+            && EVP_PKEY_derive_init(pctx) > 0
+            && EVP_PKEY_CTX_set_tls1_prf_md(pctx, md) > 0
+            && EVP_PKEY_CTX_set1_tls1_prf_secret(pctx, master, static_cast<int>(masterLen)) > 0
+            && EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, label, sizeof(label) - 1) > 0
+            && EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, serverRandom, sizeof(serverRandom)) > 0
+            && EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, clientRandom, sizeof(clientRandom)) > 0
+            && EVP_PKEY_derive(pctx, out, &outLen) > 0;
+
+        EVP_PKEY_CTX_free(pctx);
+        OPENSSL_cleanse(master, sizeof(master));
+        return ok;
+    }
+
+    template<class CryptoInfo>
+    void FillCryptoInfo(CryptoInfo& info, unsigned short cipherType,
+                        const unsigned char* keyBlock, std::size_t keyLen)
+    {
+        std::memset(&info, 0, sizeof(info));
+        info.info.version = TLS_1_2_VERSION;
+        info.info.cipher_type = cipherType;
+
+        // key_block = client_key | server_key | client_iv(4) | server_iv(4)
+        std::memcpy(info.key, keyBlock + keyLen, keyLen);
+        std::memcpy(info.salt, keyBlock + 2 * keyLen + 4, sizeof(info.salt));
+
+        // Сервер в новой эпохе успел отправить ровно одну запись - Finished,
+        // поэтому следующая запись имеет номер 1. Явную часть nonce берем
+        // равной номеру записи, ядро дальше увеличивает ее само.
+        info.rec_seq[sizeof(info.rec_seq) - 1] = 1;
+        std::memcpy(info.iv, info.rec_seq, sizeof(info.iv));
+    }
+}
+
+const char* KernelTls::CipherList()
+{
+    return "ECDHE-RSA-AES128-GCM-SHA256:ECDHE-RSA-AES256-GCM-SHA384:"
+           "DHE-RSA-AES128-GCM-SHA256:DHE-RSA-AES256-GCM-SHA384:"
+           "AES128-GCM-SHA256:AES256-GCM-SHA384";
+}
+
+bool KernelTls::EnableTx(SSL* ssl, int fd)
+{
+    if(SSL_version(ssl) != TLS1_2_VERSION)
+    {
+        return false;
+    }
+
+    const SSL_CIPHER* cipher = SSL_get_current_cipher(ssl);
+    if(cipher == nullptr)
+    {
+        return false;
+    }
+
+    int nid = SSL_CIPHER_get_cipher_nid(cipher);
+    std::size_t keyLen = 0;
+    if(nid == NID_aes_128_gcm)
+    {
+        keyLen = TLS_CIPHER_AES_GCM_128_KEY_SIZE;
+    }
+    else if(nid == NID_aes_256_gcm)
+    {
+        keyLen = TLS_CIPHER_AES_GCM_256_KEY_SIZE;
+    }
+    else
+    {
+        LOG_ERROR("kTLS: unsupported cipher ", SSL_CIPHER_get_name(cipher));
+        return false;
+    }
+
+    unsigned char keyBlock[2 * TLS_CIPHER_AES_GCM_256_KEY_SIZE + 2 * TLS_CIPHER_AES_GCM_256_SALT_SIZE];
+    std::size_t keyBlockLen = 2 * keyLen + 2 * TLS_CIPHER_AES_GCM_128_SALT_SIZE;
+    if(!DeriveKeyBlock(ssl, SSL_CIPHER_get_handshake_digest(cipher), keyBlock, keyBlockLen))
+    {
+        LOG_ERROR("kTLS: can't derive key block");
+        return false;
+    }
+
+    if(::setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) != 0)
+    {
+        // Модуль tls не загружен или ядро слишком старое.
+        OPENSSL_cleanse(keyBlock, sizeof(keyBlock));
+        return false;
+    }
+
+    int rc = -1;
+    if(keyLen == TLS_CIPHER_AES_GCM_128_KEY_SIZE)
+    {
+        tls12_crypto_info_aes_gcm_128 info;
+        FillCryptoInfo(info, TLS_CIPHER_AES_GCM_128, keyBlock, keyLen);
+        rc = ::setsockopt(fd, SOL_TLS, TLS_TX, &info, sizeof(info));
+        OPENSSL_cleanse(&info, sizeof(info));
+    }
+    else
+    {
+        tls12_crypto_info_aes_gcm_256 info;
+        FillCryptoInfo(info, TLS_CIPHER_AES_GCM_256, keyBlock, keyLen);
+        rc = ::setsockopt(fd, SOL_TLS, TLS_TX, &info, sizeof(info));
+        OPENSSL_cleanse(&info, sizeof(info));
+    }
+    OPENSSL_cleanse(keyBlock, sizeof(keyBlock));
+
+    if(rc != 0)
+    {
+        LOG_ERROR("kTLS: setsockopt TLS_TX failed");
+        return false;
+    }
+
+    return true;
+}
+
+bool KernelTls::SendCloseNotify(int fd)
+{
+    unsigned char alert[2] = {1, 0}; // warning, close_notify
+    unsigned char recordType = 21;   // alert
+
+    char control[CMSG_SPACE(sizeof(recordType))];
+    std::memset(control, 0, sizeof(control));
+
+    iovec iov{alert, sizeof(alert)};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_TLS;
+    cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(recordType));
+    std::memcpy(CMSG_DATA(cmsg), &recordType, sizeof(recordType));
+
+    return ::sendmsg(fd, &msg, MSG_DONTWAIT) == static_cast<ssize_t>(sizeof(alert));
+}
+
+#else
+
+const char* KernelTls::CipherList()
+{
+    return "DEFAULT";
+}
+
+bool KernelTls::EnableTx(SSL*, int)
+{
+    return false;
+}
+
+bool KernelTls::SendCloseNotify(int)
+{
+    return false;
+}
+
+#endif
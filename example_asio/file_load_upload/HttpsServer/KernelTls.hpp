@@ -0,0 +1,40 @@
+#ifndef KERNEL_TLS_HPP
+#define KERNEL_TLS_HPP
+
+#include <openssl/ssl.h>
+
+/**
+ * @brief Перенос шифрования исходящих данных в ядро Linux (kTLS, TLS_TX).
+ * @details asio::ssl работает через BIO-пару в памяти, поэтому OpenSSL сам
+ * включить kTLS не может. После рукопожатия мы выводим ключи сервера из
+ * master secret и передаем их в сокет через setsockopt(SOL_TLS, TLS_TX).
+ * С этого момента все, что пишется в tcp-сокет напрямую (write, sendfile),
+ * уходит клиенту уже в виде TLS-записей. Чтение по-прежнему идет через OpenSSL.
+ *
+ * Поддерживается только TLS 1.2 с AES-GCM и без пересогласования: иначе
+ * OpenSSL может сам что-то зашифровать и сбить счетчик записей.
+ */
+class KernelTls
+{
+public:
+    /**
+     * @brief Список шифров, с которыми kTLS может работать.
+     */
+    static const char* CipherList();
+    /**
+     * @brief Включает TLS_TX на сокете после завершенного рукопожатия.
+     * @param ssl OpenSSL-объект сессии (stream.native_handle()).
+     * @param fd Дескриптор tcp-сокета.
+     * @return true, если ядро теперь шифрует исходящие данные.
+     * false - сокет не тронут, можно работать через OpenSSL как раньше.
+     */
+    static bool EnableTx(SSL* ssl, int fd);
+    /**
+     * @brief Отправляет close_notify через kTLS.
+     * @param fd Дескриптор tcp-сокета с включенным TLS_TX.
+     * @return true, если alert ушел в сокет.
+     */
+    static bool SendCloseNotify(int fd);
+};
+
+#endif//KERNEL_TLS_HPP
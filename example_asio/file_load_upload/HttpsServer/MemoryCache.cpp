@@ -0,0 +1,261 @@
+#include "MemoryCache.hpp"
+
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+
+namespace
+{
+    std::uint64_t Mix(std::uint64_t x)
+    {
+        // splitmix64
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+}
+
+std::size_t MemoryCache::KeyHash::operator()(const Key& key) const
+{
+    return static_cast<std::size_t>(Mix(static_cast<std::uint64_t>(key.inode) ^ Mix(static_cast<std::uint64_t>(key.device))));
+}
+
+MemoryCache::MemoryCache(std::size_t budget, std::size_t maxFileSize)
+    : budget(budget)
+    , maxFileSize(std::min(maxFileSize, budget))
+{
+    // Ширина sketch'а - с запасом на число файлов, которые могут поместиться
+    // в бюджет при среднем размере 64 КБ.
+    std::size_t expected = std::max<std::size_t>(budget / (64 * 1024), 1);
+    sketchWidth = 1024;
+    while(sketchWidth < expected * 4 && sketchWidth < (std::size_t(1) << 22))
+    {
+        sketchWidth <<= 1;
+    }
+    sketch.assign(sketchWidth * sketchRows, 0);
+    sampleLimit = sketchWidth * 10;
+}
+
+std::size_t MemoryCache::Slot(std::uint64_t hash, unsigned row) const
+{
+    return row * sketchWidth + (Mix(hash + row) & (sketchWidth - 1));
+}
+
+void MemoryCache::Record(std::uint64_t hash)
+{
+    for(unsigned row = 0; row < sketchRows; ++row)
+    {
+        auto& counter = sketch[Slot(hash, row)];
+        if(counter < sketchMax)
+        {
+            ++counter;
+        }
+    }
+
+    // Старение: раз в sampleLimit обращений делим все счетчики пополам,
+    // чтобы популярность в прошлом не держала файл в кеше вечно.
+    if(++samples >= sampleLimit)
+    {
+        for(auto& counter : sketch)
+        {
+            counter >>= 1;
+        }
+        samples /= 2;
+    }
+}
+
+unsigned MemoryCache::Estimate(std::uint64_t hash) const
+{
+    unsigned result = sketchMax;
+    for(unsigned row = 0; row < sketchRows; ++row)
+    {
+        result = std::min<unsigned>(result, sketch[Slot(hash, row)]);
+    }
+    return result;
+}
+
+std::shared_ptr<const MemoryBlob> MemoryCache::Load(const CachedFile& file) const
+{
+    auto blob = std::make_shared<MemoryBlob>();
+    blob->size = static_cast<std::size_t>(file.Size());
+    blob->device = file.Device();
+    blob->inode = file.Inode();
+    blob->modified = file.ModifiedTimeSpec();
+    blob->data.reset(new char[blob->size == 0 ? 1 : blob->size]);
+
+    std::size_t done = 0;
+    while(done < blob->size)
+    {
+        ssize_t n = ::pread(file.NativeHandle(), blob->data.get() + done, blob->size - done, static_cast<off_t>(done));
+        if(n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(n <= 0)
+        {
+            return nullptr;
+        }
+        done += static_cast<std::size_t>(n);
+    }
+
+    return blob;
+}
+
+void MemoryCache::Erase(std::list<Node>::iterator node)
+{
+    used -= node->blob->size;
+    index.erase(node->key);
+    lru.erase(node);
+}
+
+std::shared_ptr<const MemoryBlob> MemoryCache::Get(const CachedFile& file, bool admit)
+{
+    if(budget == 0 || file.Size() > maxFileSize)
+    {
+        return nullptr;
+    }
+
+    Key key{file.Device(), file.Inode()};
+    std::uint64_t hash = KeyHash{}(key);
+    std::size_t need = static_cast<std::size_t>(file.Size());
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Record(hash);
+
+        auto it = index.find(key);
+        if(it != index.end())
+        {
+            auto node = it->second;
+            const auto& blob = *node->blob;
+            if(blob.size == file.Size()
+                && blob.modified.tv_sec == file.ModifiedTimeSpec().tv_sec
+                && blob.modified.tv_nsec == file.ModifiedTimeSpec().tv_nsec)
+            {
+                ++hits;
+                lru.splice(lru.begin(), lru, node);
+                return node->blob;
+            }
+            Erase(node);
+        }
+
+        ++misses;
+
+        // Первое обращение отдаем с диска: читать в память стоит только повторно нужное.
+        unsigned frequency = Estimate(hash);
+        if(!admit || frequency < admitFrequency)
+        {
+            return nullptr;
+        }
+
+        if(used + need > budget)
+        {
+            // Кандидат должен быть популярнее каждого, кого вытесняет.
+            std::size_t freed = 0;
+            std::size_t victims = 0;
+            for(auto node = lru.rbegin(); node != lru.rend() && used - freed + need > budget; ++node)
+            {
+                if(Estimate(KeyHash{}(node->key)) >= frequency)
+                {
+                    ++rejections;
+                    return nullptr;
+                }
+                freed += node->blob->size;
+                ++victims;
+            }
+
+            // Место занято файлами, которые читают другие потоки.
+            if(used - freed + need > budget)
+            {
+                ++rejections;
+                return nullptr;
+            }
+
+            while(victims-- > 0)
+            {
+                Erase(std::prev(lru.end()));
+                ++evictions;
+            }
+        }
+
+        used += need;
+    }
+
+    auto blob = Load(file);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!blob || index.count(key) != 0)
+    {
+        // Не прочитали или другой поток успел раньше - отдаем свою копию, место возвращаем.
+        used -= need;
+        return blob;
+    }
+
+    lru.push_front(Node{key, blob});
+    index.emplace(key, lru.begin());
+
+    return blob;
+}
+
+void MemoryCache::Invalidate(dev_t device, ino_t inode)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(Key{device, inode});
+    if(it != index.end())
+    {
+        Erase(it->second);
+    }
+}
+
+void MemoryCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for(const auto& node : lru)
+    {
+        used -= node.blob->size;
+    }
+    index.clear();
+    lru.clear();
+}
+
+std::uint64_t MemoryCache::Hits() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return hits;
+}
+
+std::uint64_t MemoryCache::Misses() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return misses;
+}
+
+std::uint64_t MemoryCache::Evictions() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return evictions;
+}
+
+std::uint64_t MemoryCache::Rejections() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return rejections;
+}
+
+std::size_t MemoryCache::UsedBytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return used;
+}
+
+std::size_t MemoryCache::Budget() const
+{
+    return budget;
+}
+
+std::size_t MemoryCache::Count() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return lru.size();
+}
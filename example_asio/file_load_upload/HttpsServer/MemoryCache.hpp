@@ -0,0 +1,143 @@
+#ifndef MEMORY_CACHE_HPP
+#define MEMORY_CACHE_HPP
+
+#include <sys/types.h>
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "FileCache.hpp"
+
+/**
+ * @brief Содержимое файла, целиком скопированное в память.
+ * @details Вместе с данными хранится то, по чему blob сверяется с файлом:
+ * устройство, inode, размер и mtime.
+ */
+struct MemoryBlob
+{
+    std::unique_ptr<char[]> data;
+    std::size_t size = 0;
+    dev_t device = 0;
+    ino_t inode = 0;
+    timespec modified{};
+};
+
+/**
+ * @brief Ограниченный по памяти кеш горячих файлов с допуском по TinyLFU.
+ * @details Частота обращений оценивается count-min sketch'ем с 4-битными
+ * счетчиками, которые периодически делятся пополам. Новый файл попадает в кеш
+ * не раньше, чем оценка его частоты дойдет до admitFrequency (второе
+ * обращение), и только если для него хватает свободного бюджета или он
+ * популярнее всех файлов из хвоста LRU, которые придется ради него вытеснить.
+ * Так однократные обращения не читают файл целиком в потоке io и не выбивают
+ * из кеша постоянно нужные файлы - промах отдается с диска.
+ * Методы потокобезопасны; сам файл читается в память вне блокировки.
+ */
+class MemoryCache
+{
+public:
+    /**
+     * @brief Конструктор.
+     * @param budget Сколько байт можно занять под файлы (0 - кеш выключен).
+     * @param maxFileSize Файлы больше этого размера в кеш не попадают.
+     */
+    MemoryCache(std::size_t budget, std::size_t maxFileSize);
+    /**
+     * @brief Отмечает обращение к файлу и возвращает его содержимое из памяти.
+     * @param file Открытый и уже сверенный с диском файл.
+     * @param admit Можно ли при промахе прочитать файл в кеш (false для HEAD и
+     * запросов небольшой части файла - им хватит чтения с диска).
+     * @return Содержимое файла или nullptr, если файл отдается с диска.
+     */
+    std::shared_ptr<const MemoryBlob> Get(const CachedFile& file, bool admit = true);
+    /**
+     * @brief Убирает файл из кеша.
+     */
+    void Invalidate(dev_t device, ino_t inode);
+    /**
+     * @brief Убирает все файлы из кеша.
+     */
+    void Clear();
+
+    std::uint64_t Hits() const;
+    std::uint64_t Misses() const;
+    std::uint64_t Evictions() const;
+    std::uint64_t Rejections() const;
+    std::size_t UsedBytes() const;
+    std::size_t Budget() const;
+    std::size_t Count() const;
+private:
+    struct Key
+    {
+        dev_t device;
+        ino_t inode;
+
+        bool operator==(const Key& other) const
+        {
+            return device == other.device && inode == other.inode;
+        }
+    };
+
+    struct KeyHash
+    {
+        std::size_t operator()(const Key& key) const;
+    };
+
+    struct Node
+    {
+        Key key;
+        std::shared_ptr<const MemoryBlob> blob;
+    };
+
+    /**
+     * @brief Учитывает обращение в sketch.
+     */
+    void Record(std::uint64_t hash);
+    /**
+     * @brief Оценка частоты обращений.
+     */
+    unsigned Estimate(std::uint64_t hash) const;
+    /**
+     * @brief Индекс счетчика в строке row.
+     */
+    std::size_t Slot(std::uint64_t hash, unsigned row) const;
+    /**
+     * @brief Читает файл в память.
+     */
+    std::shared_ptr<const MemoryBlob> Load(const CachedFile& file) const;
+    /**
+     * @brief Удаляет запись из кеша.
+     */
+    void Erase(std::list<Node>::iterator node);
+
+    static constexpr unsigned sketchRows = 4;
+    static constexpr std::uint8_t sketchMax = 15;
+    // С какой оценки частоты файл допускается в кеш.
+    static constexpr unsigned admitFrequency = 2;
+
+    std::size_t budget;
+    std::size_t maxFileSize;
+    // Включая место, зарезервированное под файлы, которые сейчас читаются.
+    std::size_t used = 0;
+
+    mutable std::mutex mutex;
+
+    std::list<Node> lru;
+    std::unordered_map<Key, std::list<Node>::iterator, KeyHash> index;
+
+    std::vector<std::uint8_t> sketch;
+    std::size_t sketchWidth = 0;
+    std::size_t samples = 0;
+    std::size_t sampleLimit = 0;
+
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t evictions = 0;
+    std::uint64_t rejections = 0;
+};
+
+#endif//MEMORY_CACHE_HPP
@@ -0,0 +1,218 @@
+#include "Metrics.hpp"
+
+#include <cstdio>
+#include <utility>
+
+namespace
+{
+    std::atomic<std::uint64_t> nextMetricsId{1};
+
+    /**
+     * @brief Запись от единственного писателя: без lock-префикса.
+     */
+    template<class T>
+    void Bump(std::atomic<T>& value, T delta)
+    {
+        value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    const char* const stageNames[] = {
+        "accept", "handshake", "read", "handle", "write", "throttle", "shutdown", "session"
+    };
+
+    struct CounterInfo
+    {
+        const char* name;
+        const char* help;
+    };
+
+    const CounterInfo counterInfo[] = {
+        {"https_bytes_sent_total", "Response bytes written to clients."},
+        {"https_requests_total", "Responses sent."},
+        {"https_handshake_failures_total", "Failed TLS handshakes."},
+        {"https_resumed_handshakes_total", "TLS handshakes that resumed a session."},
+        {"https_timeouts_total", "Operations aborted by a timeout."},
+        {"https_accept_errors_total", "Errors returned by accept."},
+        {"https_read_errors_total", "Errors while reading requests."},
+        {"https_write_errors_total", "Errors while writing responses."},
+        {"https_handler_allocations_total", "Memory requests of session async operations."},
+        {"https_handler_heap_allocations_total", "Session async operation memory taken from the heap, not recycled."},
+        {"https_watch_events_total", "inotify events applied to the recordings index and file cache."},
+        {"https_watch_overflows_total", "inotify queue overflows that forced a rescan of recordings."},
+        {"https_throttle_waits_total", "Times a response waited for bandwidth tokens."},
+        {"https_admission_rejected_total", "Connections closed at accept because max sessions were open."},
+        {"https_accept_shed_total", "Queued connections closed through the reserve descriptor when out of descriptors."}
+    };
+
+    // Границы корзин для Prometheus, в секундах.
+    const double exportBounds[] = {
+        0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+        0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60
+    };
+}
+
+std::size_t LatencyHistogram::Index(std::uint64_t value)
+{
+    constexpr std::uint64_t limit = (std::uint64_t(1) << (maxExponent + 1)) - 1;
+    if(value > limit)
+    {
+        value = limit;
+    }
+    if(value < (std::uint64_t(1) << subBits))
+    {
+        return static_cast<std::size_t>(value);
+    }
+    unsigned exponent = 63 - static_cast<unsigned>(__builtin_clzll(value));
+    std::uint64_t sub = (value >> (exponent - subBits)) & ((std::uint64_t(1) << subBits) - 1);
+    return static_cast<std::size_t>(((exponent - subBits + 1) << subBits) + sub);
+}
+
+std::uint64_t LatencyHistogram::UpperBound(std::size_t index)
+{
+    if(index < (std::size_t(1) << subBits))
+    {
+        return index;
+    }
+    unsigned exponent = static_cast<unsigned>(index >> subBits) + subBits - 1;
+    std::uint64_t sub = index & ((std::size_t(1) << subBits) - 1);
+    std::uint64_t lower = ((std::uint64_t(1) << subBits) + sub) << (exponent - subBits);
+    return lower + (std::uint64_t(1) << (exponent - subBits)) - 1;
+}
+
+Metrics::Metrics()
+    : id(nextMetricsId.fetch_add(1))
+{
+
+}
+
+Metrics::Shard& Metrics::Local()
+{
+    // Обычно в процессе один экземпляр Metrics, так что поиск - одно сравнение.
+    thread_local std::vector<std::pair<std::uint64_t, Shard*>> local;
+    for(const auto& [owner, shard] : local)
+    {
+        if(owner == id)
+        {
+            return *shard;
+        }
+    }
+
+    auto shard = std::make_unique<Shard>();
+    Shard* raw = shard.get();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        shards.push_back(std::move(shard));
+    }
+    local.emplace_back(id, raw);
+    return *raw;
+}
+
+void Metrics::Record(Stage stage, std::chrono::steady_clock::duration duration)
+{
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    std::uint64_t value = micros < 0 ? 0 : static_cast<std::uint64_t>(micros);
+
+    Shard& shard = Local();
+    auto s = static_cast<std::size_t>(stage);
+    Bump<std::uint64_t>(shard.buckets[s][LatencyHistogram::Index(value)], 1);
+    Bump<std::uint64_t>(shard.sumMicros[s], value);
+}
+
+void Metrics::Add(Counter counter, std::uint64_t value)
+{
+    Bump<std::uint64_t>(Local().counters[static_cast<std::size_t>(counter)], value);
+}
+
+void Metrics::SessionOpened()
+{
+    Bump<std::int64_t>(Local().active, 1);
+}
+
+void Metrics::SessionClosed()
+{
+    Bump<std::int64_t>(Local().active, -1);
+}
+
+std::string Metrics::Render() const
+{
+    constexpr std::size_t stages = static_cast<std::size_t>(Stage::Count);
+    constexpr std::size_t counters = static_cast<std::size_t>(Counter::Count);
+
+    std::vector<std::array<std::uint64_t, LatencyHistogram::bucketCount>> buckets(stages);
+    std::array<std::uint64_t, stages> sums{};
+    std::array<std::uint64_t, counters> totals{};
+    std::int64_t active = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(const auto& shard : shards)
+        {
+            for(std::size_t s = 0; s < stages; ++s)
+            {
+                for(std::size_t b = 0; b < LatencyHistogram::bucketCount; ++b)
+                {
+                    buckets[s][b] += shard->buckets[s][b].load(std::memory_order_relaxed);
+                }
+                sums[s] += shard->sumMicros[s].load(std::memory_order_relaxed);
+            }
+            for(std::size_t c = 0; c < counters; ++c)
+            {
+                totals[c] += shard->counters[c].load(std::memory_order_relaxed);
+            }
+            active += shard->active.load(std::memory_order_relaxed);
+        }
+    }
+
+    std::string out;
+    out.reserve(16 * 1024);
+    char line[256];
+
+    out += "# HELP https_stage_duration_seconds Time spent in each stage of a session.\n";
+    out += "# TYPE https_stage_duration_seconds histogram\n";
+    for(std::size_t s = 0; s < stages; ++s)
+    {
+        std::uint64_t count = 0;
+        std::size_t b = 0;
+        for(double bound : exportBounds)
+        {
+            // Корзина учитывается, только если все ее значения не больше границы.
+            auto limit = static_cast<std::uint64_t>(bound * 1e6);
+            for(; b < LatencyHistogram::bucketCount && LatencyHistogram::UpperBound(b) <= limit; ++b)
+            {
+                count += buckets[s][b];
+            }
+            std::snprintf(line, sizeof(line), "https_stage_duration_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n",
+                stageNames[s], bound, static_cast<unsigned long long>(count));
+            out += line;
+        }
+        for(; b < LatencyHistogram::bucketCount; ++b)
+        {
+            count += buckets[s][b];
+        }
+        std::snprintf(line, sizeof(line),
+            "https_stage_duration_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n"
+            "https_stage_duration_seconds_sum{stage=\"%s\"} %.6f\n"
+            "https_stage_duration_seconds_count{stage=\"%s\"} %llu\n",
+            stageNames[s], static_cast<unsigned long long>(count),
+            stageNames[s], static_cast<double>(sums[s]) / 1e6,
+            stageNames[s], static_cast<unsigned long long>(count));
+        out += line;
+    }
+
+    for(std::size_t c = 0; c < counters; ++c)
+    {
+        std::snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+            counterInfo[c].name, counterInfo[c].help, counterInfo[c].name, counterInfo[c].name,
+            static_cast<unsigned long long>(totals[c]));
+        out += line;
+    }
+
+    std::snprintf(line, sizeof(line),
+        "# HELP https_active_sessions Sessions currently open.\n"
+        "# TYPE https_active_sessions gauge\n"
+        "https_active_sessions %lld\n",
+        static_cast<long long>(active));
+    out += line;
+
+    return out;
+}
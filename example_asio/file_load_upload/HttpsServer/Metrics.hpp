@@ -0,0 +1,130 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Этапы жизни сессии, для которых считается время.
+ */
+enum class Stage
+{
+    Accept,     // от accept до OnRun (ожидание в очереди io_context)
+    Handshake,  // TLS-рукопожатие
+    Read,       // от разобранного заголовка до прочитанного тела
+    Handle,     // HandleRequest: разбор запроса и подготовка ответа
+    Write,      // отправка ответа
+    Throttle,   // ожидание токенов при отправке ответа с ограничением скорости
+    Shutdown,   // TLS shutdown
+    Session,    // вся жизнь сессии
+    Count
+};
+
+/**
+ * @brief Счетчики событий.
+ */
+enum class Counter
+{
+    BytesSent,
+    Requests,
+    HandshakeFailures,
+    ResumedHandshakes,
+    Timeouts,
+    AcceptErrors,
+    ReadErrors,
+    WriteErrors,
+    HandlerAllocations,
+    HandlerHeapAllocations,
+    WatchEvents,
+    WatchOverflows,
+    ThrottleWaits,
+    AdmissionRejected,
+    AcceptShed,
+    Count
+};
+
+/**
+ * @brief Гистограмма в духе HDR: логарифмические группы по степеням двойки,
+ * каждая поделена на 8 линейных корзин (погрешность не больше 12.5%).
+ * @details Значения в микросекундах, от 0 до ~2^40 мкс.
+ */
+class LatencyHistogram
+{
+public:
+    static constexpr unsigned subBits = 3;
+    static constexpr unsigned maxExponent = 40;
+    static constexpr std::size_t bucketCount = (maxExponent - subBits + 2) << subBits;
+
+    /**
+     * @brief Номер корзины для значения.
+     */
+    static std::size_t Index(std::uint64_t value);
+    /**
+     * @brief Наибольшее значение, которое попадает в корзину.
+     */
+    static std::uint64_t UpperBound(std::size_t index);
+};
+
+/**
+ * @brief Метрики сервера: гистограммы этапов сессии и счетчики.
+ * @details Каждый поток пишет в свой блок счетчиков, поэтому запись - это
+ * load + store без lock-префикса, без блокировок и без выделения памяти
+ * (память под блок выделяется один раз, при первой записи из потока).
+ * Render суммирует блоки всех потоков; значения при этом могут быть
+ * чуть несогласованными между собой, что для мониторинга не важно.
+ */
+class Metrics
+{
+public:
+    Metrics();
+
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    /**
+     * @brief Учитывает длительность этапа.
+     */
+    void Record(Stage stage, std::chrono::steady_clock::duration duration);
+    /**
+     * @brief Увеличивает счетчик.
+     */
+    void Add(Counter counter, std::uint64_t value = 1);
+    /**
+     * @brief Учет открытых сессий (может вызываться из разных потоков для одной сессии).
+     */
+    void SessionOpened();
+    void SessionClosed();
+
+    /**
+     * @brief Все метрики в текстовом формате Prometheus (version 0.0.4).
+     */
+    std::string Render() const;
+private:
+    struct alignas(64) Shard
+    {
+        std::array<std::array<std::atomic<std::uint64_t>, LatencyHistogram::bucketCount>,
+            static_cast<std::size_t>(Stage::Count)> buckets{};
+        std::array<std::atomic<std::uint64_t>, static_cast<std::size_t>(Stage::Count)> sumMicros{};
+        std::array<std::atomic<std::uint64_t>, static_cast<std::size_t>(Counter::Count)> counters{};
+        std::atomic<std::int64_t> active{0};
+    };
+
+    /**
+     * @brief Блок счетчиков текущего потока.
+     */
+    Shard& Local();
+
+    // Отличает экземпляры Metrics, даже если новый создан по адресу старого.
+    std::uint64_t id;
+
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<Shard>> shards;
+};
+
+#endif//METRICS_HPP
@@ -0,0 +1,339 @@
+#include "RecordingIndex.hpp"
+
+#include <boost/json.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+
+#include "../../common/logger.hpp"
+
+bool RecordingIndex::ReadMeta(const std::filesystem::path& meta, Recording& recording)
+{
+    // a.wav.json -> a.wav
+    std::filesystem::path path = meta;
+    path.replace_extension();
+
+    std::error_code ec;
+    auto size = std::filesystem::file_size(path, ec);
+    if(ec || !std::filesystem::is_regular_file(path, ec))
+    {
+        return false;
+    }
+
+    std::ifstream file(meta, std::ios::binary);
+    std::stringstream text;
+    text << file.rdbuf();
+
+    boost::json::error_code error;
+    auto value = boost::json::parse(text.str(), error);
+    if(error || !value.is_object())
+    {
+        LOG_WARN("Bad recording metadata ", meta.string());
+        return false;
+    }
+    const auto& object = value.as_object();
+
+    auto created = object.if_contains("created");
+    if(!created || !created->is_string()
+        || !ParseTime(std::string_view(created->as_string().data(), created->as_string().size()), recording.created))
+    {
+        LOG_WARN("Bad or missing 'created' in ", meta.string());
+        return false;
+    }
+
+    for(std::size_t f = 0; f < fieldCount; ++f)
+    {
+        auto field = object.if_contains(FieldName(static_cast<Field>(f)));
+        if(!field)
+        {
+            continue;
+        }
+        // Номера (pin, agent_id) встречаются и числами, и строками.
+        if(field->is_string())
+        {
+            recording.fields[f] = field->as_string().c_str();
+        }
+        else if(field->is_int64() || field->is_uint64())
+        {
+            recording.fields[f] = boost::json::serialize(*field);
+        }
+    }
+
+    recording.path = path.string();
+    recording.size = size;
+    recording.metaModified = static_cast<std::int64_t>(
+        std::filesystem::last_write_time(meta, ec).time_since_epoch().count());
+    return true;
+}
+
+void RecordingIndex::Update(Recording recording, std::uint64_t generation)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = byPath.find(recording.path);
+    if(it == byPath.end())
+    {
+        it = byPath.emplace(recording.path, Entry{}).first;
+    }
+    else
+    {
+        Unlink(it->second);
+    }
+    it->second.recording = std::move(recording);
+    it->second.generation = generation;
+    Link(it->second);
+}
+
+bool RecordingIndex::Remove(const std::string& path)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = byPath.find(path);
+    if(it == byPath.end())
+    {
+        return false;
+    }
+    Unlink(it->second);
+    byPath.erase(it);
+    return true;
+}
+
+std::size_t RecordingIndex::RemoveUnder(const std::string& directory)
+{
+    std::string prefix = directory;
+    if(prefix.empty() || prefix.back() != '/')
+    {
+        prefix += '/';
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    std::size_t removed = 0;
+    auto it = byPath.lower_bound(prefix);
+    while(it != byPath.end() && it->first.compare(0, prefix.size(), prefix) == 0)
+    {
+        Unlink(it->second);
+        it = byPath.erase(it);
+        ++removed;
+    }
+    return removed;
+}
+
+bool RecordingIndex::Touch(const std::string& path, std::int64_t metaModified, std::uint64_t size,
+    std::uint64_t generation)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = byPath.find(path);
+    if(it == byPath.end()
+        || it->second.recording.metaModified != metaModified
+        || it->second.recording.size != size)
+    {
+        return false;
+    }
+    it->second.generation = generation;
+    return true;
+}
+
+std::size_t RecordingIndex::Sweep(std::uint64_t generation)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    std::size_t removed = 0;
+    for(auto it = byPath.begin(); it != byPath.end();)
+    {
+        if(it->second.generation >= generation)
+        {
+            ++it;
+            continue;
+        }
+        Unlink(it->second);
+        it = byPath.erase(it);
+        ++removed;
+    }
+    return removed;
+}
+
+void RecordingIndex::Link(const Entry& entry)
+{
+    Key key{entry.recording.created, &entry};
+    byTime.insert(key);
+    for(std::size_t f = 0; f < fieldCount; ++f)
+    {
+        postings[f][entry.recording.fields[f]].insert(key);
+    }
+}
+
+void RecordingIndex::Unlink(const Entry& entry)
+{
+    Key key{entry.recording.created, &entry};
+    byTime.erase(key);
+    for(std::size_t f = 0; f < fieldCount; ++f)
+    {
+        auto it = postings[f].find(entry.recording.fields[f]);
+        if(it == postings[f].end())
+        {
+            continue;
+        }
+        it->second.erase(key);
+        if(it->second.empty())
+        {
+            postings[f].erase(it);
+        }
+    }
+}
+
+std::vector<RecordingIndex::Recording> RecordingIndex::Find(const Query& query, bool& truncated) const
+{
+    truncated = false;
+    std::vector<Recording> found;
+    if(query.from > query.to)
+    {
+        return found;
+    }
+
+    std::shared_lock<std::shared_mutex> lock(mutex);
+
+    // Ведущее поле - с самыми короткими списками; по нему идем в диапазоне дат.
+    std::size_t lead = fieldCount;
+    std::size_t leadSize = byTime.size();
+    for(std::size_t f = 0; f < fieldCount; ++f)
+    {
+        if(query.values[f].empty())
+        {
+            continue;
+        }
+        std::size_t size = 0;
+        for(const auto& value : query.values[f])
+        {
+            auto it = postings[f].find(value);
+            size += it == postings[f].end() ? 0 : it->second.size();
+        }
+        if(size <= leadSize)
+        {
+            lead = f;
+            leadSize = size;
+        }
+    }
+
+    // false - набрали limit, дальше не ищем.
+    auto take = [&query, &found, &truncated, lead](const Key& key)
+        {
+            const auto& recording = key.second->recording;
+            for(std::size_t f = 0; f < fieldCount; ++f)
+            {
+                const auto& values = query.values[f];
+                if(f != lead && !values.empty()
+                    && std::find(values.begin(), values.end(), recording.fields[f]) == values.end())
+                {
+                    return true;
+                }
+            }
+            if(found.size() == query.limit)
+            {
+                truncated = true;
+                return false;
+            }
+            found.push_back(recording);
+            return true;
+        };
+
+    const Key low{query.from, nullptr};
+
+    if(lead == fieldCount)
+    {
+        for(auto it = byTime.lower_bound(low); it != byTime.end() && it->first <= query.to && take(*it); ++it)
+        {
+        }
+        return found;
+    }
+
+    // Списки разных значений не пересекаются - сливаем их по времени.
+    std::vector<std::pair<Postings::const_iterator, Postings::const_iterator>> ranges;
+    const auto& values = query.values[lead];
+    for(std::size_t v = 0; v < values.size(); ++v)
+    {
+        auto it = postings[lead].find(values[v]);
+        if(it != postings[lead].end() && std::find(values.begin(), values.begin() + v, values[v]) == values.begin() + v)
+        {
+            ranges.emplace_back(it->second.lower_bound(low), it->second.end());
+        }
+    }
+
+    for(;;)
+    {
+        decltype(ranges)::value_type* next = nullptr;
+        for(auto& range : ranges)
+        {
+            if(range.first != range.second && range.first->first <= query.to
+                && (!next || KeyLess{}(*range.first, *next->first)))
+            {
+                next = &range;
+            }
+        }
+        if(!next || !take(*next->first))
+        {
+            break;
+        }
+        ++next->first;
+    }
+    return found;
+}
+
+std::size_t RecordingIndex::Size() const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return byPath.size();
+}
+
+const char* RecordingIndex::FieldName(Field field)
+{
+    switch(field)
+    {
+    case Field::Login:     return "login";
+    case Field::Theme:     return "theme";
+    case Field::Pin:       return "pin";
+    case Field::ProjectId: return "project_id";
+    case Field::AgentId:   return "agent_id";
+    case Field::Count:     break;
+    }
+    return "";
+}
+
+bool RecordingIndex::ParseTime(std::string_view value, std::int64_t& time)
+{
+    // Дата без времени - начало суток.
+    std::string text(value);
+    std::tm tm{};
+    int consumed = 0;
+    if(std::sscanf(text.c_str(), "%4d-%2d-%2d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &consumed) != 3)
+    {
+        return false;
+    }
+    if(static_cast<std::size_t>(consumed) != text.size())
+    {
+        int rest = 0;
+        if(std::sscanf(text.c_str() + consumed, " %2d:%2d:%2d%n", &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &rest) != 3
+            || static_cast<std::size_t>(consumed + rest) != text.size())
+        {
+            return false;
+        }
+    }
+
+    if(tm.tm_mon < 1 || tm.tm_mon > 12 || tm.tm_mday < 1 || tm.tm_mday > 31
+        || tm.tm_hour < 0 || tm.tm_hour > 23 || tm.tm_min < 0 || tm.tm_min > 59 || tm.tm_sec < 0 || tm.tm_sec > 60)
+    {
+        return false;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    time = static_cast<std::int64_t>(::timegm(&tm));
+    return true;
+}
+
+std::string RecordingIndex::FormatTime(std::int64_t time)
+{
+    std::time_t t = static_cast<std::time_t>(time);
+    std::tm tm{};
+    ::gmtime_r(&t, &tm);
+    char buffer[32];
+    std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &tm);
+    return buffer;
+}
@@ -0,0 +1,155 @@
+#ifndef RECORDING_INDEX_HPP
+#define RECORDING_INDEX_HPP
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <map>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Индекс метаданных записей в памяти для поиска POST /v1/find.
+ * @details Метаданные записи лежат рядом с ней в файле <запись>.json:
+ * {"created": "2021-03-04 10:00:00", "login": "...", "theme": "...",
+ *  "pin": "...", "project_id": "...", "agent_id": "..."}.
+ * Записи упорядочены по created, поэтому диапазон дат - это отрезок
+ * упорядоченного множества. Для полей на равенство - хеш-таблицы
+ * значение -> записи (тоже по created). Запрос идет по самому избирательному
+ * полю, остальные условия проверяются у кандидатов. Индекс меняется по одной
+ * записи (RecordingWatcher применяет события inotify), поиск идет под
+ * разделяемой блокировкой.
+ */
+class RecordingIndex
+{
+public:
+    /**
+     * @brief Поля, по которым ищем на равенство.
+     */
+    enum class Field
+    {
+        Login,
+        Theme,
+        Pin,
+        ProjectId,
+        AgentId,
+        Count
+    };
+
+    static constexpr std::size_t fieldCount = static_cast<std::size_t>(Field::Count);
+
+    struct Recording
+    {
+        std::string path;
+        std::uint64_t size = 0;
+        // Секунды от эпохи, время из метаданных считается UTC.
+        std::int64_t created = 0;
+        std::array<std::string, fieldCount> fields;
+        // mtime файла метаданных: при пересканировании неизмененные не перечитываем.
+        std::int64_t metaModified = 0;
+    };
+
+    struct Query
+    {
+        std::int64_t from = std::numeric_limits<std::int64_t>::min();
+        std::int64_t to = std::numeric_limits<std::int64_t>::max();
+        // Допустимые значения поля; пустой список - поле не проверяется.
+        std::array<std::vector<std::string>, fieldCount> values;
+        std::size_t limit = std::numeric_limits<std::size_t>::max();
+    };
+
+    RecordingIndex() = default;
+
+    RecordingIndex(const RecordingIndex&) = delete;
+    RecordingIndex& operator=(const RecordingIndex&) = delete;
+
+    /**
+     * @brief Читает метаданные записи.
+     * @param meta Путь к <запись>.json.
+     * @return false, если записи нет или метаданные не разобрать.
+     */
+    static bool ReadMeta(const std::filesystem::path& meta, Recording& recording);
+
+    /**
+     * @brief Добавляет запись или заменяет запись с тем же путем.
+     * @param generation Поколение пересканирования (см. Sweep).
+     */
+    void Update(Recording recording, std::uint64_t generation);
+    /**
+     * @brief Убирает запись.
+     * @return false, если такой записи не было.
+     */
+    bool Remove(const std::string& path);
+    /**
+     * @brief Убирает все записи внутри директории.
+     * @return Сколько записей убрано.
+     */
+    std::size_t RemoveUnder(const std::string& directory);
+    /**
+     * @brief Отмечает запись поколением, если она не изменилась.
+     * @return false, если записи нет или ее метаданные/размер другие - ее надо перечитать.
+     */
+    bool Touch(const std::string& path, std::int64_t metaModified, std::uint64_t size, std::uint64_t generation);
+    /**
+     * @brief Убирает записи, не отмеченные поколением generation или новее.
+     * @return Сколько записей убрано.
+     */
+    std::size_t Sweep(std::uint64_t generation);
+
+    /**
+     * @brief Записи, подходящие под запрос, по возрастанию created.
+     * @param truncated true, если подходящих больше, чем query.limit.
+     */
+    std::vector<Recording> Find(const Query& query, bool& truncated) const;
+
+    std::size_t Size() const;
+
+    /**
+     * @brief Имя поля в JSON ("login", "project_id", ...).
+     */
+    static const char* FieldName(Field field);
+    /**
+     * @brief Разбирает время вида "2021-03-04 10:00:00".
+     * @return false, если формат не распознан.
+     */
+    static bool ParseTime(std::string_view value, std::int64_t& time);
+    static std::string FormatTime(std::int64_t time);
+private:
+    struct Entry
+    {
+        Recording recording;
+        std::uint64_t generation = 0;
+    };
+
+    // Время создания и запись (узлы std::map не перемещаются).
+    using Key = std::pair<std::int64_t, const Entry*>;
+
+    struct KeyLess
+    {
+        bool operator()(const Key& a, const Key& b) const
+        {
+            return a.first != b.first ? a.first < b.first : std::less<const Entry*>{}(a.second, b.second);
+        }
+    };
+
+    using Postings = std::set<Key, KeyLess>;
+
+    /**
+     * @brief Добавляет запись в упорядочение по времени и списки полей.
+     */
+    void Link(const Entry& entry);
+    void Unlink(const Entry& entry);
+
+    mutable std::shared_mutex mutex;
+    std::map<std::string, Entry> byPath;
+    Postings byTime;
+    std::array<std::unordered_map<std::string, Postings>, fieldCount> postings;
+};
+
+#endif//RECORDING_INDEX_HPP
@@ -0,0 +1,298 @@
+#include "RecordingWatcher.hpp"
+
+#include <boost/asio/post.hpp>
+#include <cerrno>
+#include <cstring>
+
+RecordingWatcher::RecordingWatcher(boost::asio::io_context& context, std::filesystem::path root,
+    std::shared_ptr<ServerShared> shared)
+    : descriptor(boost::asio::make_strand(context))
+    , root(std::move(root))
+    , shared(std::move(shared))
+{
+
+}
+
+void RecordingWatcher::Start()
+{
+    int fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(fd < 0)
+    {
+        LOG_WARN("inotify is not available: ", std::strerror(errno), ", recordings index will not be updated");
+    }
+    else
+    {
+        descriptor.assign(fd);
+    }
+
+    // Первое построение - целиком, до того как сервер начнет отвечать.
+    fullRescan = true;
+    pending.push_back(root);
+    while(RescanStep())
+    {
+    }
+
+    if(descriptor.is_open())
+    {
+        DoRead();
+    }
+}
+
+void RecordingWatcher::DoRead()
+{
+    descriptor.async_read_some(
+        boost::asio::buffer(buffer),
+        boost::beast::bind_front_handler(
+            &RecordingWatcher::OnRead,
+            this->shared_from_this()));
+}
+
+void RecordingWatcher::OnRead(boost::system::error_code error, std::size_t bytes)
+{
+    if(error)
+    {
+        if(error != boost::asio::error::operation_aborted)
+        {
+            LOG_ERROR("Error on inotify read: ", error.message());
+        }
+        return;
+    }
+
+    // Ядро отдает только целые события.
+    std::size_t offset = 0;
+    while(offset + sizeof(inotify_event) <= bytes)
+    {
+        const auto* event = reinterpret_cast<const inotify_event*>(buffer.data() + offset);
+        Handle(*event);
+        offset += sizeof(inotify_event) + event->len;
+    }
+
+    DoRead();
+}
+
+void RecordingWatcher::Handle(const inotify_event& event)
+{
+    auto& metrics = shared->metrics;
+    metrics.Add(Counter::WatchEvents);
+
+    if(event.mask & IN_Q_OVERFLOW)
+    {
+        LOG_WARN("inotify queue overflow, rescanning ", root.string());
+        metrics.Add(Counter::WatchOverflows);
+        // Какие файлы поменялись, неизвестно.
+        shared->fileCache.Clear();
+        return Rescan(root, true);
+    }
+
+    auto it = watches.find(event.wd);
+    if(it == watches.end())
+    {
+        return;
+    }
+    if(event.mask & IN_IGNORED)
+    {
+        watches.erase(it);
+        return;
+    }
+    // События самой директории (удаление, перенос) придут и от ее родителя.
+    if(event.len == 0)
+    {
+        return;
+    }
+
+    std::filesystem::path path = it->second / event.name;
+    auto& index = *shared->recordings;
+
+    if(event.mask & IN_ISDIR)
+    {
+        if(event.mask & (IN_CREATE | IN_MOVED_TO))
+        {
+            Rescan(path, false);
+        }
+        else if(event.mask & (IN_DELETE | IN_MOVED_FROM))
+        {
+            Unwatch(path);
+            index.RemoveUnder(path.string());
+            shared->fileCache.Clear();
+        }
+        return;
+    }
+
+    bool removed = event.mask & (IN_DELETE | IN_MOVED_FROM);
+    bool written = event.mask & (IN_CLOSE_WRITE | IN_MOVED_TO);
+
+    if(path.extension() == ".json")
+    {
+        if(removed)
+        {
+            index.Remove(std::filesystem::path(path).replace_extension().string());
+        }
+        else if(written)
+        {
+            Reindex(path);
+        }
+        return;
+    }
+
+    // Сессии откроют файл заново и не отдадут старое содержимое.
+    shared->fileCache.Invalidate(path.string());
+
+    if(removed)
+    {
+        index.Remove(path.string());
+    }
+    else if(written)
+    {
+        // Запись появилась или поменялся ее размер.
+        std::filesystem::path meta = path;
+        meta += ".json";
+        std::error_code ec;
+        if(std::filesystem::exists(meta, ec))
+        {
+            Reindex(meta);
+        }
+    }
+}
+
+void RecordingWatcher::Watch(const std::filesystem::path& directory)
+{
+    if(!descriptor.is_open())
+    {
+        return;
+    }
+
+    int wd = ::inotify_add_watch(descriptor.native_handle(), directory.c_str(), watchMask);
+    if(wd < 0)
+    {
+        // ENOSPC - кончился fs.inotify.max_user_watches.
+        LOG_WARN("Can't watch ", directory.string(), ": ", std::strerror(errno));
+        return;
+    }
+    watches[wd] = directory;
+}
+
+void RecordingWatcher::Unwatch(const std::filesystem::path& directory)
+{
+    std::string prefix = directory.string() + "/";
+    for(auto it = watches.begin(); it != watches.end();)
+    {
+        const std::string path = it->second.string();
+        if(path == directory.string() || path.compare(0, prefix.size(), prefix) == 0)
+        {
+            ::inotify_rm_watch(descriptor.native_handle(), it->first);
+            it = watches.erase(it);
+            continue;
+        }
+        ++it;
+    }
+}
+
+void RecordingWatcher::Reindex(const std::filesystem::path& meta)
+{
+    RecordingIndex::Recording recording;
+    if(RecordingIndex::ReadMeta(meta, recording))
+    {
+        shared->recordings->Update(std::move(recording), generation);
+        return;
+    }
+    shared->recordings->Remove(std::filesystem::path(meta).replace_extension().string());
+}
+
+void RecordingWatcher::Rescan(const std::filesystem::path& directory, bool full)
+{
+    if(full)
+    {
+        // Начатый обход уже ничего не значит - начинаем с корня.
+        pending.clear();
+        current = std::filesystem::directory_iterator();
+        fullRescan = true;
+        ++generation;
+    }
+    pending.push_back(directory);
+
+    if(!rescanning)
+    {
+        rescanning = true;
+        DoRescan();
+    }
+}
+
+void RecordingWatcher::DoRescan()
+{
+    boost::asio::post(
+        descriptor.get_executor(),
+        [self = this->shared_from_this()]
+        {
+            if(self->RescanStep())
+            {
+                return self->DoRescan();
+            }
+            self->rescanning = false;
+        });
+}
+
+bool RecordingWatcher::RescanStep()
+{
+    std::error_code ec;
+    std::size_t visited = 0;
+    while(visited < rescanBatch)
+    {
+        if(current == std::filesystem::directory_iterator())
+        {
+            if(pending.empty())
+            {
+                break;
+            }
+            auto directory = std::move(pending.front());
+            pending.pop_front();
+
+            Watch(directory);
+            current = std::filesystem::directory_iterator(directory,
+                std::filesystem::directory_options::skip_permission_denied, ec);
+            if(ec)
+            {
+                LOG_WARN("Can't scan ", directory.string(), ": ", ec.message());
+                current = std::filesystem::directory_iterator();
+            }
+            continue;
+        }
+
+        const auto& entry = *current;
+        ++visited;
+        if(entry.is_directory(ec) && !entry.is_symlink(ec))
+        {
+            pending.push_back(entry.path());
+        }
+        else if(entry.path().extension() == ".json" && entry.is_regular_file(ec))
+        {
+            std::filesystem::path path = entry.path();
+            path.replace_extension();
+            auto size = std::filesystem::file_size(path, ec);
+            auto modified = entry.last_write_time(ec).time_since_epoch().count();
+            if(ec || !shared->recordings->Touch(path.string(), static_cast<std::int64_t>(modified), size, generation))
+            {
+                Reindex(entry.path());
+            }
+        }
+
+        current.increment(ec);
+        if(ec)
+        {
+            current = std::filesystem::directory_iterator();
+        }
+    }
+
+    if(current != std::filesystem::directory_iterator() || !pending.empty())
+    {
+        return true;
+    }
+
+    if(fullRescan)
+    {
+        fullRescan = false;
+        std::size_t removed = shared->recordings->Sweep(generation);
+        LOG_INFO("recordings indexed: ", shared->recordings->Size(), ", removed: ", removed,
+            ", watched directories: ", watches.size());
+    }
+    return false;
+}
@@ -0,0 +1,108 @@
+#ifndef RECORDING_WATCHER_HPP
+#define RECORDING_WATCHER_HPP
+
+#include <sys/inotify.h>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/strand.hpp>
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <unordered_map>
+
+#include "HttpsServer.hpp"
+
+/**
+ * @brief Поддерживает индекс записей и кеш открытых файлов в актуальном
+ * состоянии по событиям inotify, без периодических полных обходов.
+ * @details inotify не рекурсивен, поэтому наблюдение ставится на каждую
+ * поддиректорию recordingsDirectory. События читаются через
+ * posix::stream_descriptor на strand'е io_context и применяются по одному
+ * файлу: новый/измененный <запись>.json перечитывается, удаленный убирается
+ * из индекса, у измененных и удаленных файлов сбрасывается запись в FileCache.
+ * Новая или перенесенная в дерево директория обходится отдельно.
+ *
+ * При переполнении очереди ядра (IN_Q_OVERFLOW) неизвестно, что поменялось:
+ * кеш файлов очищается, а дерево обходится заново порциями по rescanBatch
+ * записей, между которыми io_context обслуживает клиентов. Неизмененные
+ * метаданные (mtime и размер записи те же) не перечитываются, а записи,
+ * которых обход не нашел, в конце удаляются.
+ */
+class RecordingWatcher : public std::enable_shared_from_this<RecordingWatcher>
+{
+public:
+    /**
+     * @brief Конструктор.
+     * @param context io_context, в котором обрабатываются события.
+     * @param root Директория с записями.
+     * @param shared Индекс записей и кеши сервера.
+     */
+    RecordingWatcher(boost::asio::io_context& context, std::filesystem::path root,
+        std::shared_ptr<ServerShared> shared);
+
+    RecordingWatcher(const RecordingWatcher&) = delete;
+    RecordingWatcher& operator=(const RecordingWatcher&) = delete;
+
+    /**
+     * @brief Строит индекс полным обходом (синхронно) и начинает следить за изменениями.
+     * @details Без inotify индекс строится, но не обновляется.
+     */
+    void Start();
+private:
+    /**
+     * @brief Читает очередную пачку событий.
+     */
+    void DoRead();
+    void OnRead(boost::system::error_code error, std::size_t bytes);
+    void Handle(const inotify_event& event);
+    /**
+     * @brief Ставит наблюдение на директорию (не рекурсивно).
+     */
+    void Watch(const std::filesystem::path& directory);
+    /**
+     * @brief Снимает наблюдение с директории и ее поддиректорий.
+     */
+    void Unwatch(const std::filesystem::path& directory);
+    /**
+     * @brief Перечитывает метаданные записи и обновляет индекс.
+     * @param meta Путь к <запись>.json.
+     */
+    void Reindex(const std::filesystem::path& meta);
+    /**
+     * @brief Добавляет директорию в очередь обхода.
+     * @param full Обход всего дерева: в конце удаляются записи, которых он не нашел.
+     */
+    void Rescan(const std::filesystem::path& directory, bool full);
+    /**
+     * @brief Обходит не больше rescanBatch записей.
+     * @return false, если обход закончен.
+     */
+    bool RescanStep();
+    /**
+     * @brief Запускает следующую порцию обхода через post.
+     */
+    void DoRescan();
+
+    static constexpr std::size_t rescanBatch = 1024;
+    static constexpr std::uint32_t watchMask = IN_CREATE | IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_DELETE
+        | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+
+    boost::asio::posix::stream_descriptor descriptor;
+    std::filesystem::path root;
+    std::shared_ptr<ServerShared> shared;
+
+    alignas(inotify_event) std::array<char, 64 * 1024> buffer;
+    std::unordered_map<int, std::filesystem::path> watches;
+
+    // Состояние обхода.
+    std::deque<std::filesystem::path> pending;
+    std::filesystem::directory_iterator current;
+    bool rescanning = false;
+    bool fullRescan = false;
+    // Записи, отмеченные меньшим поколением, полный обход не нашел.
+    std::uint64_t generation = 1;
+};
+
+#endif//RECORDING_WATCHER_HPP
@@ -0,0 +1,97 @@
+#include "RecyclingAllocator.hpp"
+
+#include <array>
+#include <new>
+
+namespace
+{
+
+/**
+ * @brief Списки свободных блоков одного потока.
+ */
+struct FreeLists
+{
+    struct Node
+    {
+        Node* next;
+    };
+
+    // Размеры 32, 64, ..., 4096.
+    static constexpr std::size_t classes = 8;
+
+    ~FreeLists();
+
+    std::array<Node*, classes> heads{};
+    std::array<std::size_t, classes> counts{};
+};
+
+// Блоки могут освобождаться и при разрушении других thread_local объектов
+// потока, уже после списков - тогда они уходят прямо в кучу.
+thread_local bool listsDestroyed = false;
+thread_local FreeLists lists;
+
+FreeLists::~FreeLists()
+{
+    listsDestroyed = true;
+    for(Node* head : heads)
+    {
+        while(head)
+        {
+            Node* next = head->next;
+            ::operator delete(head);
+            head = next;
+        }
+    }
+}
+
+/**
+ * @brief Номер списка для блока size байт (size > 0 и не больше 4096).
+ */
+std::size_t SizeClass(std::size_t size)
+{
+    std::size_t index = 0;
+    for(std::size_t capacity = 32; capacity < size; capacity *= 2)
+    {
+        ++index;
+    }
+    return index;
+}
+
+}
+
+void* RecyclingPool::Allocate(std::size_t size)
+{
+    if(size > maxBlock || listsDestroyed)
+    {
+        return ::operator new(size);
+    }
+
+    std::size_t index = SizeClass(size);
+    if(FreeLists::Node* node = lists.heads[index])
+    {
+        lists.heads[index] = node->next;
+        --lists.counts[index];
+        return node;
+    }
+    return ::operator new(minBlock << index);
+}
+
+void RecyclingPool::Deallocate(void* pointer, std::size_t size)
+{
+    if(size > maxBlock || listsDestroyed)
+    {
+        ::operator delete(pointer);
+        return;
+    }
+
+    std::size_t index = SizeClass(size);
+    if(lists.counts[index] >= maxFree)
+    {
+        ::operator delete(pointer);
+        return;
+    }
+    auto* node = static_cast<FreeLists::Node*>(pointer);
+    node->next = lists.heads[index];
+    lists.heads[index] = node;
+    ++lists.counts[index];
+}
@@ -0,0 +1,78 @@
+#ifndef RECYCLING_ALLOCATOR_HPP
+#define RECYCLING_ALLOCATOR_HPP
+
+#include <boost/beast/http/fields.hpp>
+#include <cstddef>
+#include <type_traits>
+
+/**
+ * @brief Запас блоков потока для мелких объектов запроса и ответа.
+ * @details Поля заголовков и target выделяются на каждый запрос и живут
+ * до отправки ответа. Освобожденный блок остается в списке своего размера
+ * (степень двойки от minBlock до maxBlock) в потоке, который его освободил,
+ * и достается следующему запросу этого потока без malloc. Блоков в списке
+ * не больше maxFree, большие блоки берутся прямо из кучи. Блокировок нет:
+ * у каждого потока свои списки, а блок, выделенный в одном потоке и
+ * освобожденный в другом (режим --shared), просто переходит в запас второго.
+ */
+class RecyclingPool
+{
+public:
+    static void* Allocate(std::size_t size);
+    static void Deallocate(void* pointer, std::size_t size);
+private:
+    static constexpr std::size_t minBlock = 32;
+    static constexpr std::size_t maxBlock = 4096;
+    static constexpr std::size_t maxFree = 64;
+};
+
+/**
+ * @brief Аллокатор без состояния поверх RecyclingPool.
+ * @details Все экземпляры равны, поэтому перемещение сообщений beast между
+ * сессиями и потоками не копирует поля.
+ */
+template<class T>
+class RecyclingAllocator
+{
+public:
+    using value_type = T;
+    using is_always_equal = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+
+    RecyclingAllocator() noexcept = default;
+
+    template<class U>
+    RecyclingAllocator(const RecyclingAllocator<U>&) noexcept
+    {
+
+    }
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(RecyclingPool::Allocate(sizeof(T) * n));
+    }
+
+    void deallocate(T* pointer, std::size_t n) noexcept
+    {
+        RecyclingPool::Deallocate(pointer, sizeof(T) * n);
+    }
+
+    template<class U>
+    bool operator==(const RecyclingAllocator<U>&) const noexcept
+    {
+        return true;
+    }
+
+    template<class U>
+    bool operator!=(const RecyclingAllocator<U>&) const noexcept
+    {
+        return false;
+    }
+};
+
+/**
+ * @brief Поля заголовков запросов и ответов сервера.
+ */
+using HttpFields = boost::beast::http::basic_fields<RecyclingAllocator<char>>;
+
+#endif//RECYCLING_ALLOCATOR_HPP
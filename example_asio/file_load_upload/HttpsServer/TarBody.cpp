@@ -0,0 +1,254 @@
+#include "TarBody.hpp"
+
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+
+#include "../../common/logger.hpp"
+
+namespace
+{
+
+constexpr std::size_t blockSize = 512;
+// Больше не помещается в 11 восьмеричных цифр поля size - размер уходит в pax.
+constexpr std::uint64_t maxOctalSize = 077777777777ULL;
+
+void PutOctal(char* field, std::size_t width, std::uint64_t value)
+{
+    // width - 1 цифр и завершающий ноль.
+    std::snprintf(field, width, "%0*llo", static_cast<int>(width - 1), static_cast<unsigned long long>(value));
+}
+
+/**
+ * @brief Заполняет заголовок ustar.
+ * @param block Блок из blockSize байт.
+ */
+void PutHeader(char* block, std::string_view name, std::string_view prefix, std::uint64_t size,
+    std::int64_t mtime, char type)
+{
+    std::memset(block, 0, blockSize);
+    std::memcpy(block, name.data(), std::min<std::size_t>(name.size(), 100));
+    PutOctal(block + 100, 8, 0644);
+    PutOctal(block + 108, 8, 0);
+    PutOctal(block + 116, 8, 0);
+    PutOctal(block + 124, 12, size);
+    PutOctal(block + 136, 12, static_cast<std::uint64_t>(std::max<std::int64_t>(mtime, 0)));
+    block[156] = type;
+    std::memcpy(block + 257, "ustar", 6);
+    std::memcpy(block + 263, "00", 2);
+    std::memcpy(block + 345, prefix.data(), std::min<std::size_t>(prefix.size(), 155));
+
+    // Контрольная сумма считается с пробелами на ее месте.
+    std::memset(block + 148, ' ', 8);
+    unsigned sum = 0;
+    for(std::size_t i = 0; i < blockSize; ++i)
+    {
+        sum += static_cast<unsigned char>(block[i]);
+    }
+    std::snprintf(block + 148, 8, "%06o", sum);
+}
+
+/**
+ * @brief Запись расширенного заголовка pax: "<длина> <ключ>=<значение>\n".
+ */
+std::string PaxRecord(std::string_view key, std::string_view value)
+{
+    // Длина записи включает и число, которым она записана.
+    std::size_t length = key.size() + value.size() + 3;
+    std::size_t digits = std::to_string(length).size();
+    while(std::to_string(length + digits).size() != digits)
+    {
+        ++digits;
+    }
+    std::string record = std::to_string(length + digits);
+    record += ' ';
+    record += key;
+    record += '=';
+    record += value;
+    record += '\n';
+    return record;
+}
+
+/**
+ * @brief Заголовок файла в архиве: ustar и, если нужно, pax перед ним.
+ * @details Имя длиннее 100 символов делится на prefix/name по '/', а если
+ * не делится - уходит целиком в pax ("path"), как и размер больше 8 ГБ.
+ */
+std::string MemberHeader(const std::string& name, std::uint64_t size, std::int64_t mtime)
+{
+    std::string_view shortName = name;
+    std::string_view prefix;
+    std::string pax;
+
+    if(name.size() > 100)
+    {
+        auto slash = name.find('/', name.size() - 101);
+        if(slash != std::string::npos && slash > 0 && slash <= 155 && slash + 1 < name.size())
+        {
+            prefix = std::string_view(name).substr(0, slash);
+            shortName = std::string_view(name).substr(slash + 1);
+        }
+        else
+        {
+            pax += PaxRecord("path", name);
+            shortName = std::string_view(name).substr(name.size() - 100);
+        }
+    }
+    if(size > maxOctalSize)
+    {
+        pax += PaxRecord("size", std::to_string(size));
+    }
+
+    std::string header;
+    if(!pax.empty())
+    {
+        header.resize(blockSize + (pax.size() + blockSize - 1) / blockSize * blockSize);
+        PutHeader(header.data(), "././@PaxHeader", {}, pax.size(), mtime, 'x');
+        std::memcpy(header.data() + blockSize, pax.data(), pax.size());
+    }
+    std::size_t at = header.size();
+    header.resize(at + blockSize);
+    PutHeader(header.data() + at, shortName, prefix, size > maxOctalSize ? 0 : size, mtime, '0');
+    return header;
+}
+
+}
+
+void TarBody::value_type::Add(std::string path, std::string name)
+{
+    members.push_back(Member{std::move(path), std::move(name)});
+}
+
+const std::vector<TarBody::Member>& TarBody::value_type::Members() const
+{
+    return members;
+}
+
+void TarBody::writer::init(boost::beast::error_code& ec)
+{
+    buf = std::make_unique<char[]>(bufferSize);
+    ec = {};
+}
+
+bool TarBody::writer::StartMember()
+{
+    const auto& m = body.members[member];
+    if(!file)
+    {
+        boost::beast::error_code ec;
+        file = CachedFile::Open(m.path, ec);
+        if(ec || !file)
+        {
+            // Заголовок ответа уже ушел - пропускаем файл, а не рвем архив.
+            LOG_WARN("Skip ", m.path, " in archive: ", ec.message());
+            file.reset();
+            ++member;
+            return true;
+        }
+        size = file->Size();
+        sent = 0;
+        shrunk = false;
+    }
+
+    std::string header = MemberHeader(m.name, size, static_cast<std::int64_t>(file->ModifiedTime()));
+    if(header.size() > bufferSize)
+    {
+        LOG_WARN("Skip ", m.path, " in archive: name is too long");
+        file.reset();
+        ++member;
+        return true;
+    }
+    if(bufferSize - fill < header.size())
+    {
+        return false;
+    }
+    std::memcpy(buf.get() + fill, header.data(), header.size());
+    fill += header.size();
+    headerSent = true;
+    return true;
+}
+
+boost::optional<std::pair<TarBody::writer::const_buffers_type, bool>>
+    TarBody::writer::get(boost::beast::error_code& ec)
+{
+    ec = {};
+    fill = 0;
+
+    while(fill < bufferSize)
+    {
+        if(file && headerSent)
+        {
+            if(sent < size)
+            {
+                std::size_t amount = static_cast<std::size_t>(std::min<std::uint64_t>(size - sent, bufferSize - fill));
+                if(shrunk)
+                {
+                    std::memset(buf.get() + fill, 0, amount);
+                    fill += amount;
+                    sent += amount;
+                    continue;
+                }
+
+                ssize_t nread = ::pread(file->NativeHandle(), buf.get() + fill, amount, static_cast<off_t>(sent));
+                if(nread < 0)
+                {
+                    if(errno == EINTR)
+                    {
+                        continue;
+                    }
+                    ec = boost::beast::error_code(errno, boost::system::generic_category());
+                    return boost::none;
+                }
+                if(nread == 0)
+                {
+                    LOG_WARN("File ", body.members[member].path, " was truncated while archiving");
+                    shrunk = true;
+                    continue;
+                }
+                fill += static_cast<std::size_t>(nread);
+                sent += static_cast<std::uint64_t>(nread);
+                continue;
+            }
+
+            // Данные файла дополняются нулями до целого блока.
+            std::size_t padding = static_cast<std::size_t>((blockSize - size % blockSize) % blockSize);
+            if(bufferSize - fill < padding)
+            {
+                break;
+            }
+            std::memset(buf.get() + fill, 0, padding);
+            fill += padding;
+            file.reset();
+            headerSent = false;
+            ++member;
+            continue;
+        }
+
+        if(member < body.members.size())
+        {
+            if(!StartMember())
+            {
+                break;
+            }
+            continue;
+        }
+
+        // Конец архива - два нулевых блока.
+        if(!finished && bufferSize - fill >= 2 * blockSize)
+        {
+            std::memset(buf.get() + fill, 0, 2 * blockSize);
+            fill += 2 * blockSize;
+            finished = true;
+        }
+        break;
+    }
+
+    if(fill == 0)
+    {
+        return boost::none;
+    }
+    return {{const_buffers_type{buf.get(), fill}, !finished}};
+}
@@ -0,0 +1,92 @@
+#ifndef TAR_BODY_HPP
+#define TAR_BODY_HPP
+
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/optional.hpp>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "FileCache.hpp"
+
+/**
+ * @brief Тело ответа - tar-архив (POSIX ustar + pax), собираемый на лету.
+ * @details Файлы открываются по одному, когда до них доходит очередь,
+ * и читаются через pread в буфер writer'а, поэтому память и число открытых
+ * дескрипторов не зависят от числа файлов. Размер архива заранее не известен,
+ * ответ уходит с Transfer-Encoding: chunked. Файл, который не удалось открыть,
+ * пропускается; если файл укоротили во время отдачи, его хвост добивается
+ * нулями (заголовок с размером уже ушел).
+ */
+struct TarBody
+{
+    /**
+     * @brief Файл архива.
+     */
+    struct Member
+    {
+        // Путь на диске.
+        std::string path;
+        // Имя в архиве.
+        std::string name;
+    };
+
+    class value_type
+    {
+        friend struct TarBody;
+    public:
+        /**
+         * @brief Добавляет файл в архив.
+         * @param path Путь к файлу.
+         * @param name Имя файла в архиве.
+         */
+        void Add(std::string path, std::string name);
+        const std::vector<Member>& Members() const;
+    private:
+        std::vector<Member> members;
+    };
+
+    class writer
+    {
+    public:
+        using const_buffers_type = boost::asio::const_buffer;
+
+        template<bool isRequest, class Fields>
+        writer(boost::beast::http::header<isRequest, Fields>& h, value_type& b)
+            : body(b)
+        {
+            boost::ignore_unused(h);
+        }
+
+        void init(boost::beast::error_code& ec);
+
+        boost::optional<std::pair<const_buffers_type, bool>>
+            get(boost::beast::error_code& ec);
+    private:
+        /**
+         * @brief Открывает очередной файл и кладет в буфер его заголовок.
+         * @return false, если заголовок не поместился - сначала отправить буфер.
+         */
+        bool StartMember();
+
+        static constexpr std::size_t bufferSize = 64 * 1024;
+
+        value_type& body;
+        std::size_t member = 0;
+        std::shared_ptr<CachedFile> file;
+        std::uint64_t size = 0;
+        std::uint64_t sent = 0;
+        bool headerSent = false;
+        // Файл стал короче заголовка - остаток добиваем нулями.
+        bool shrunk = false;
+        bool finished = false;
+        // В куче: сериализатор архива живет в сессии все время отдачи.
+        std::unique_ptr<char[]> buf;
+        std::size_t fill = 0;
+    };
+};
+
+#endif//TAR_BODY_HPP
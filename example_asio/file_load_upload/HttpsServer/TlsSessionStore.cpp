@@ -0,0 +1,293 @@
+#include "TlsSessionStore.hpp"
+
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <cstring>
+
+TlsSessionStore::TlsSessionStore(std::size_t capacity, std::chrono::seconds lifetime,
+                                 std::chrono::seconds ticketKeyLifetime)
+    : capacity(capacity == 0 ? 1 : capacity)
+    , lifetime(lifetime)
+    , ticketKeyLifetime(ticketKeyLifetime)
+{
+
+}
+
+int TlsSessionStore::ExDataIndex()
+{
+    static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    return index;
+}
+
+TlsSessionStore* TlsSessionStore::From(SSL_CTX* ctx)
+{
+    return static_cast<TlsSessionStore*>(SSL_CTX_get_ex_data(ctx, ExDataIndex()));
+}
+
+bool TlsSessionStore::Attach(SSL_CTX* ctx, bool tickets)
+{
+    if(ExDataIndex() < 0 || SSL_CTX_set_ex_data(ctx, ExDataIndex(), this) != 1)
+    {
+        return false;
+    }
+
+    // Клиенты привязывают сессию к этому контексту - у всех шардов он одинаковый.
+    static const unsigned char sessionContext[] = "HttpsServer";
+    if(SSL_CTX_set_session_id_context(ctx, sessionContext, sizeof(sessionContext) - 1) != 1)
+    {
+        return false;
+    }
+
+    SSL_CTX_set_timeout(ctx, static_cast<long>(lifetime.count()));
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+    SSL_CTX_sess_set_new_cb(ctx, &TlsSessionStore::NewSession);
+    SSL_CTX_sess_set_get_cb(ctx, &TlsSessionStore::GetSession);
+    SSL_CTX_sess_set_remove_cb(ctx, &TlsSessionStore::RemoveSession);
+
+    if(!tickets)
+    {
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+        return true;
+    }
+
+    SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(ticketKeys.empty() && !Rotate())
+        {
+            return false;
+        }
+    }
+    return SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, &TlsSessionStore::TicketKeyCallback) == 1;
+}
+
+std::uint64_t TlsSessionStore::Hits() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return hits;
+}
+
+std::uint64_t TlsSessionStore::Misses() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return misses;
+}
+
+std::uint64_t TlsSessionStore::TicketKeyRotations() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return rotations;
+}
+
+std::size_t TlsSessionStore::Count() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return lru.size();
+}
+
+int TlsSessionStore::NewSession(SSL* ssl, SSL_SESSION* session)
+{
+    if(auto store = From(SSL_get_SSL_CTX(ssl)))
+    {
+        store->Store(session);
+    }
+    // Ссылку на session не оставляем себе.
+    return 0;
+}
+
+SSL_SESSION* TlsSessionStore::GetSession(SSL* ssl, const unsigned char* id, int length, int* copy)
+{
+    // Отдаем свежий объект, OpenSSL заберет его себе без лишнего увеличения счетчика ссылок.
+    *copy = 0;
+    auto store = From(SSL_get_SSL_CTX(ssl));
+    return store ? store->Load(id, length) : nullptr;
+}
+
+void TlsSessionStore::RemoveSession(SSL_CTX* ctx, SSL_SESSION* session)
+{
+    if(auto store = From(ctx))
+    {
+        store->Remove(session);
+    }
+}
+
+void TlsSessionStore::Store(SSL_SESSION* session)
+{
+    unsigned int idLength = 0;
+    const unsigned char* id = SSL_SESSION_get_id(session, &idLength);
+    if(idLength == 0)
+    {
+        return;
+    }
+
+    int derLength = i2d_SSL_SESSION(session, nullptr);
+    if(derLength <= 0)
+    {
+        return;
+    }
+    std::string der(static_cast<std::size_t>(derLength), '\0');
+    auto out = reinterpret_cast<unsigned char*>(der.data());
+    if(i2d_SSL_SESSION(session, &out) != derLength)
+    {
+        return;
+    }
+
+    std::string key(reinterpret_cast<const char*>(id), idLength);
+    auto expires = std::chrono::steady_clock::now() + lifetime;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(key);
+    if(it != index.end())
+    {
+        it->second->der = std::move(der);
+        it->second->expires = expires;
+        lru.splice(lru.begin(), lru, it->second);
+        return;
+    }
+
+    while(lru.size() >= capacity)
+    {
+        index.erase(lru.back().id);
+        lru.pop_back();
+    }
+    lru.push_front(Entry{key, std::move(der), expires});
+    index.emplace(std::move(key), lru.begin());
+}
+
+SSL_SESSION* TlsSessionStore::Load(const unsigned char* id, int length)
+{
+    std::string der;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(std::string(reinterpret_cast<const char*>(id), static_cast<std::size_t>(length)));
+        if(it == index.end())
+        {
+            ++misses;
+            return nullptr;
+        }
+        if(it->second->expires <= std::chrono::steady_clock::now())
+        {
+            lru.erase(it->second);
+            index.erase(it);
+            ++misses;
+            return nullptr;
+        }
+        lru.splice(lru.begin(), lru, it->second);
+        der = it->second->der;
+        ++hits;
+    }
+
+    auto in = reinterpret_cast<const unsigned char*>(der.data());
+    return d2i_SSL_SESSION(nullptr, &in, static_cast<long>(der.size()));
+}
+
+void TlsSessionStore::Remove(SSL_SESSION* session)
+{
+    unsigned int idLength = 0;
+    const unsigned char* id = SSL_SESSION_get_id(session, &idLength);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(std::string(reinterpret_cast<const char*>(id), idLength));
+    if(it != index.end())
+    {
+        lru.erase(it->second);
+        index.erase(it);
+    }
+}
+
+bool TlsSessionStore::Rotate()
+{
+    TicketKey key;
+    if(RAND_bytes(key.name.data(), static_cast<int>(key.name.size())) != 1
+        || RAND_priv_bytes(key.aesKey.data(), static_cast<int>(key.aesKey.size())) != 1
+        || RAND_priv_bytes(key.hmacKey.data(), static_cast<int>(key.hmacKey.size())) != 1)
+    {
+        return false;
+    }
+    key.created = std::chrono::steady_clock::now();
+
+    ticketKeys.push_front(key);
+    while(ticketKeys.size() > previousTicketKeys + 1)
+    {
+        OPENSSL_cleanse(&ticketKeys.back(), sizeof(TicketKey));
+        ticketKeys.pop_back();
+    }
+    ++rotations;
+    return true;
+}
+
+int TlsSessionStore::TicketKeyCallback(SSL* ssl, unsigned char* name, unsigned char* iv,
+    EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac, int enc)
+{
+    auto store = From(SSL_get_SSL_CTX(ssl));
+    if(!store)
+    {
+        return -1;
+    }
+
+    TicketKey key;
+    bool current = true;
+    {
+        std::lock_guard<std::mutex> lock(store->mutex);
+        if(store->ticketKeys.empty()
+            || std::chrono::steady_clock::now() - store->ticketKeys.front().created >= store->ticketKeyLifetime)
+        {
+            store->Rotate();
+        }
+        if(store->ticketKeys.empty())
+        {
+            return -1;
+        }
+
+        if(enc)
+        {
+            key = store->ticketKeys.front();
+        }
+        else
+        {
+            auto it = store->ticketKeys.begin();
+            for(; it != store->ticketKeys.end(); ++it)
+            {
+                if(std::memcmp(it->name.data(), name, it->name.size()) == 0)
+                {
+                    break;
+                }
+            }
+            if(it == store->ticketKeys.end())
+            {
+                // Ключ уже выброшен - полное рукопожатие и новый билет.
+                return 0;
+            }
+            current = it == store->ticketKeys.begin();
+            key = *it;
+        }
+    }
+
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmacKey.data(), key.hmacKey.size()),
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, const_cast<char*>("SHA256"), 0),
+        OSSL_PARAM_construct_end()
+    };
+
+    int result = -1;
+    if(enc)
+    {
+        std::memcpy(name, key.name.data(), key.name.size());
+        if(RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) == 1
+            && EVP_EncryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key.aesKey.data(), iv) == 1
+            && EVP_MAC_CTX_set_params(mac, params) == 1)
+        {
+            result = 1;
+        }
+    }
+    else if(EVP_DecryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key.aesKey.data(), iv) == 1
+        && EVP_MAC_CTX_set_params(mac, params) == 1)
+    {
+        // 2 - билет принят, но клиенту выдается новый под текущим ключом.
+        result = current ? 1 : 2;
+    }
+
+    OPENSSL_cleanse(&key, sizeof(key));
+    return result;
+}
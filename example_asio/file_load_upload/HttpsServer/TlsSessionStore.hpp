@@ -0,0 +1,105 @@
+#ifndef TLS_SESSION_STORE_HPP
+#define TLS_SESSION_STORE_HPP
+
+#include <openssl/ssl.h>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * @brief Общее для всех шардов хранилище TLS-сессий: кеш по session ID и ключи билетов.
+ * @details У каждого шарда свой SSL_CTX, а встроенный кеш OpenSSL и ключи
+ * билетов (RFC 5077) живут внутри SSL_CTX. Без общего хранилища клиент,
+ * попавший после переподключения на другой шард, проходил бы полное
+ * рукопожатие. Здесь сессии хранятся в сериализованном виде (DER) в LRU
+ * с ограниченным размером, а ключи билетов периодически меняются: билет,
+ * зашифрованный предыдущим ключом, еще принимается, но клиент получает новый.
+ */
+class TlsSessionStore
+{
+public:
+    /**
+     * @brief Конструктор.
+     * @param capacity Сколько сессий помнить.
+     * @param lifetime Время жизни сессии (и билета).
+     * @param ticketKeyLifetime Как часто менять ключ билетов.
+     */
+    TlsSessionStore(std::size_t capacity, std::chrono::seconds lifetime, std::chrono::seconds ticketKeyLifetime);
+
+    TlsSessionStore(const TlsSessionStore&) = delete;
+    TlsSessionStore& operator=(const TlsSessionStore&) = delete;
+
+    /**
+     * @brief Подключает хранилище к серверному контексту.
+     * @param ctx Контекст шарда. Хранилище должно пережить его.
+     * @param tickets Выдавать билеты; если false - только кеш по session ID.
+     * @return false, если OpenSSL отказался принять настройки.
+     */
+    bool Attach(SSL_CTX* ctx, bool tickets);
+
+    // Сессия найдена в кеше по session ID.
+    std::uint64_t Hits() const;
+    std::uint64_t Misses() const;
+    // Сколько раз менялся ключ билетов.
+    std::uint64_t TicketKeyRotations() const;
+    std::size_t Count() const;
+private:
+    struct TicketKey
+    {
+        std::array<unsigned char, 16> name;
+        std::array<unsigned char, 32> aesKey;
+        std::array<unsigned char, 32> hmacKey;
+        std::chrono::steady_clock::time_point created;
+    };
+
+    struct Entry
+    {
+        std::string id;
+        std::string der;
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    static int NewSession(SSL* ssl, SSL_SESSION* session);
+    static SSL_SESSION* GetSession(SSL* ssl, const unsigned char* id, int length, int* copy);
+    static void RemoveSession(SSL_CTX* ctx, SSL_SESSION* session);
+    static int TicketKeyCallback(SSL* ssl, unsigned char* name, unsigned char* iv,
+        EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac, int enc);
+
+    /**
+     * @brief Хранилище, подключенное к контексту.
+     */
+    static TlsSessionStore* From(SSL_CTX* ctx);
+    static int ExDataIndex();
+
+    void Store(SSL_SESSION* session);
+    SSL_SESSION* Load(const unsigned char* id, int length);
+    void Remove(SSL_SESSION* session);
+
+    /**
+     * @brief Новый случайный ключ билетов. Вызывается под mutex.
+     */
+    bool Rotate();
+
+    // Текущий ключ и столько предыдущих еще принимаются.
+    static constexpr std::size_t previousTicketKeys = 2;
+
+    std::size_t capacity;
+    std::chrono::seconds lifetime;
+    std::chrono::seconds ticketKeyLifetime;
+
+    mutable std::mutex mutex;
+    std::list<Entry> lru;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    // front - текущий ключ.
+    std::deque<TicketKey> ticketKeys;
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t rotations = 0;
+};
+
+#endif//TLS_SESSION_STORE_HPP
@@ -15,7 +15,36 @@
 #include <thread>
 #include <vector>
 
+#include <pthread.h>
+#include <sched.h>
+
 #include "./HttpsServer.hpp"
+#include "./RecordingWatcher.hpp"
+
+/**
+ * @brief Как раскладывать сервер по потокам.
+ */
+enum class ThreadMode
+{
+    Single,     // один io_context, один поток
+    Shared,     // один io_context, который крутят несколько потоков
+    Sharded     // по io_context, acceptor'у (SO_REUSEPORT) и HttpsServer на ядро
+};
+
+/**
+ * @brief Привязывает текущий поток к ядру.
+ * @param cpu Номер ядра.
+ */
+static void PinThread(unsigned cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % CPU_SETSIZE, &set);
+    if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+    {
+        LOG_WARN("Can't pin thread to cpu ", cpu);
+    }
+}
 
 int main(int argc, char* argv[]) 
 {
@@ -25,10 +54,192 @@ int main(int argc, char* argv[])
     config.currentServerKey = "./server01.key";
     config.diffieHellman = "./dh2048.pem";
 
+    ThreadMode mode = ThreadMode::Single;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    bool pin = true;
+    std::string logFile;
+    auto logFormat = Logger::Format::Text;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(arg == "--ktls")
+        {
+            config.kernelTls = true;
+        }
+        else if(arg == "--etag-hash")
+        {
+            config.etagContentHash = true;
+        }
+        else if(arg == "--no-tickets")
+        {
+            config.tlsSessionTickets = false;
+        }
+        else if(arg == "--coroutines")
+        {
+            config.coroutineSessions = true;
+        }
+        else if(arg == "--recordings" && i + 1 < argc)
+        {
+            config.recordingsDirectory = argv[++i];
+        }
+        else if(arg == "--bandwidth" && i + 1 < argc)
+        {
+            config.bandwidthLimit = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if(arg == "--rate-limit" && i + 1 < argc)
+        {
+            // PREFIX=CLIENT[/ROUTE], байт/с: "/v1/download=2000000/50000000".
+            std::string spec = argv[++i];
+            auto eq = spec.find('=');
+            if(eq == std::string::npos || eq == 0)
+            {
+                std::cout << "--rate-limit expects PREFIX=CLIENT[/ROUTE]" << std::endl;
+                return 1;
+            }
+            BandwidthRule rule;
+            rule.prefix = spec.substr(0, eq);
+            char* end = nullptr;
+            rule.clientRate = std::strtoull(spec.c_str() + eq + 1, &end, 10);
+            if(*end == '/')
+            {
+                rule.routeRate = std::strtoull(end + 1, nullptr, 10);
+            }
+            config.bandwidthRules.push_back(std::move(rule));
+        }
+        else if(arg == "--max-sessions" && i + 1 < argc)
+        {
+            config.maxSessions = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if(arg == "--shared")
+        {
+            mode = ThreadMode::Shared;
+        }
+        else if(arg == "--sharded")
+        {
+            mode = ThreadMode::Sharded;
+        }
+        else if(arg == "--threads" && i + 1 < argc)
+        {
+            threads = std::max(1, std::atoi(argv[++i]));
+        }
+        else if(arg == "--no-pin")
+        {
+            pin = false;
+        }
+        else if(arg == "--log-file" && i + 1 < argc)
+        {
+            logFile = argv[++i];
+        }
+        else if(arg == "--log-binary")
+        {
+            logFormat = Logger::Format::Binary;
+        }
+        else if(arg == "--log-level" && i + 1 < argc)
+        {
+            Logger::Instance().SetLevel(static_cast<LogLevel>(std::clamp(std::atoi(argv[++i]), 0, 5)));
+        }
+        else
+        {
+            std::cout << "usage: HttpsServer [--ktls] [--etag-hash] [--no-tickets] [--coroutines] [--recordings DIR]"
+                         " [--bandwidth BYTES] [--rate-limit PREFIX=CLIENT[/ROUTE]]... [--max-sessions N] [--shared | --sharded] [--threads N] [--no-pin]"
+                         " [--log-file PATH] [--log-binary] [--log-level 0-5]" << std::endl;
+            return 1;
+        }
+    }
+
+    if(!logFile.empty() && !Logger::Instance().Open(logFile, logFormat))
+    {
+        LOG_ERROR("Can't open log file ", logFile);
+    }
+
+    auto shared = std::make_shared<ServerShared>(config);
+
+    // Индекс записей строится до приема подключений, дальше обновляется по inotify.
+    auto watchRecordings = [&config, &shared](boost::asio::io_context& context)
+    {
+        if(!config.recordingsDirectory.empty())
+        {
+            std::make_shared<RecordingWatcher>(context, config.recordingsDirectory, shared)->Start();
+        }
+    };
+
+    if(mode == ThreadMode::Single)
+    {
+        boost::asio::io_context context{1};
+        watchRecordings(context);
+        std::make_shared<HttpsServer>( config, "0.0.0.0", context, shared)->Run();
+        context.run();
+        return 0;
+    }
+
+    if(mode == ThreadMode::Shared)
+    {
+        // Для сравнения с шардами: один acceptor, сессии раскиданы по strand'ам.
+        boost::asio::io_context context{static_cast<int>(threads)};
+        watchRecordings(context);
+        std::make_shared<HttpsServer>( config, "0.0.0.0", context, shared)->Run();
+
+        std::vector<std::thread> pool;
+        for(unsigned i = 1; i < threads; ++i)
+        {
+            pool.emplace_back([&context, i, pin]
+            {
+                if(pin)
+                {
+                    PinThread(i);
+                }
+                context.run();
+            });
+        }
+        if(pin)
+        {
+            PinThread(0);
+        }
+        context.run();
+
+        for(auto& t : pool)
+        {
+            t.join();
+        }
+        return 0;
+    }
+
+    // Sharded: у каждого ядра свой io_context с одним потоком, свой acceptor
+    // и свой HttpsServer; подключения между потоками не передаются.
+    config.reusePort = true;
+
+    std::vector<std::unique_ptr<boost::asio::io_context>> contexts;
+    for(unsigned i = 0; i < threads; ++i)
+    {
+        contexts.push_back(std::make_unique<boost::asio::io_context>(1));
+        std::make_shared<HttpsServer>( config, "0.0.0.0", *contexts.back(), shared)->Run();
+    }
+    // События записей обрабатывает первое ядро.
+    watchRecordings(*contexts[0]);
+
+    std::vector<std::thread> pool;
+    for(unsigned i = 1; i < threads; ++i)
+    {
+        pool.emplace_back([&contexts, i, pin]
+        {
+            if(pin)
+            {
+                PinThread(i);
+            }
+            contexts[i]->run();
+        });
+    }
+    if(pin)
+    {
+        PinThread(0);
+    }
+    contexts[0]->run();
 
-    boost::asio::io_context context{1};
-    std::make_shared<HttpsServer>( config, "0.0.0.0", context)->Run();
-    context.run();
+    for(auto& t : pool)
+    {
+        t.join();
+    }
 
     return 0;
 }
\ No newline at end of file
@@ -5,12 +5,12 @@ HttpsClient::HttpsClient(boost::asio::io_context& context, Config& config)
     , ssl_context(boost::asio::ssl::context::tlsv12_client)
     , resolver(context)
 {
-    std::cout << "start HttpsClient constructor" << std::endl;
+    LOG_DEBUG("start HttpsClient constructor");
     boost::system::error_code error;
     ssl_context.set_verify_mode(boost::asio::ssl::verify_peer, error);
     if (error.failed())
     {
-        std::cout << "error set_verify_mode" << std::endl;
+        LOG_ERROR("error set_verify_mode");
         exit(23);
     }
 
@@ -18,14 +18,14 @@ HttpsClient::HttpsClient(boost::asio::io_context& context, Config& config)
     ssl_context.load_verify_file(config.rootCACertificate, error);
     if (error.failed())
     {
-        std::cout << "error load_verify_file root CA cert" << std::endl;
+        LOG_ERROR("error load_verify_file root CA cert");
         exit(43);
     }
 
     results = resolver.resolve(config.serverHost, config.serverPort, error);
     if (error.failed())
     {
-        std::cout << "error resolving host - check net or vpn" << std::endl;
+        LOG_ERROR("error resolving host - check net or vpn");
         exit(53);
     }
 }
@@ -50,13 +50,16 @@ std::string HttpsClient::PostRequest(const std::string& task, const std::string&
         return error.message();
     }
 
+    session.Apply(stream.native_handle());
     stream.handshake(boost::asio::ssl::stream_base::client, error);
     if (error.failed())
     {
         bad = true;
+        session.Reset();
         boost::beast::get_lowest_layer(stream).close();
         return error.message();
     }
+    session.Save(stream.native_handle());
 
     boost::beast::http::request<boost::beast::http::string_body> req(boost::beast::http::verb::post, target, 11);
     req.set(boost::beast::http::field::host, "some_host");
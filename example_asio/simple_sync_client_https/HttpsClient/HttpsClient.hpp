@@ -18,6 +18,9 @@
 #include <fstream>
 #include <filesystem>
 
+#include "../../common/logger.hpp"
+#include "../../common/tls_client_session.hpp"
+
 
 struct Config {
     std::string rootCACertificate;
@@ -49,6 +52,8 @@ private:
     boost::asio::ip::tcp::resolver resolver;
     //Точка подключения к серверу
     boost::asio::ip::basic_resolver_results<boost::asio::ip::tcp> results;
+    //TLS-сессия прошлого подключения, чтобы не делать полное рукопожатие
+    TlsClientSession session;
 };
 
 #endif//SOURCE_HTTPS_CLIENT
\ No newline at end of file
@@ -40,7 +40,7 @@ int main() {
   // std::string target = "/v1/load";
 
   // show json
-  std::cout << "i send ->" << boost::json::serialize(message) << std::endl;
+  LOG_DEBUG("i send ->", boost::json::serialize(message));
 
   // Create client to require data from ScreenRecorder API
   HttpsClient client(ioContext, config);